@@ -22,13 +22,28 @@
 #include <QuartzCore/QuartzCore.hpp>
 #include <QuartzCore/CAMetalDrawable.hpp>
 #include <simd/simd.h>
+#include "FruCoRe_TextureCache.h"
+#include "FruCoRe_DiskCache.h"
+#include "FruCoRe_AtlasPacker.h"
+#include "FruCoRe_TextureMap.h"
+#include "FruCoRe_Telemetry.h"
+#include "FruCoRe_PolygonFans.h"
+#include "FruCoRe_VertexPacking.h"
+#include "FruCoRe_VertexEmission.h"
+#include "FruCoRe_TilePacking.h"
+#include "FruCoRe_DrawList.h"
+#include "FruCoRe_DrawBatching.h"
+#include "FruCoRe_SurfaceLookup.h"
 
-#define DRAWTILE_INSTANCEDATA_SIZE 128
-#define DRAWTILE_VERTEXBUFFER_SIZE (DRAWTILE_INSTANCEDATA_SIZE * 6) // We always have 6 vertices per instance
+#define DRAWTILE_INSTANCEDATA_SIZE 2048
 #define DRAWCOMPLEX_INSTANCEDATA_SIZE 128
 #define DRAWCOMPLEX_VERTEXBUFFER_SIZE (DRAWCOMPLEX_INSTANCEDATA_SIZE * 128)
+#define DRAWCOMPLEX_INDEXBUFFER_SIZE (DRAWCOMPLEX_VERTEXBUFFER_SIZE * 3) // A fan never has more than 3 indices per vertex
+#define WORLDGEOMETRY_BUFFER_SIZE (1024 * 1024) // In vertices. We start over when it's full
 #define DRAWGOURAUD_INSTANCEDATA_SIZE 128
 #define DRAWGOURAUD_VERTEXBUFFER_SIZE (DRAWGOURAUD_INSTANCEDATA_SIZE * 128)
+#define DRAWGOURAUD_INDEXBUFFER_SIZE (DRAWGOURAUD_VERTEXBUFFER_SIZE * 3)
+static_assert(DRAWCOMPLEX_VERTEXBUFFER_SIZE <= FAN_MAX_VERTICES && DRAWGOURAUD_VERTEXBUFFER_SIZE <= FAN_MAX_VERTICES, "Fan indices are 16-bit");
 #define DRAWSIMPLE_INSTANCEDATA_SIZE 128
 #define DRAWSIMPLE_VERTEXBUFFER_SIZE (DRAWSIMPLE_INSTANCEDATA_SIZE * 6) // We always have 6 vertices per instance
 #define MAX_IN_FLIGHT_FRAMES 10
@@ -61,10 +76,24 @@ class UFruCoReRenderDevice : public URenderDevice
     UBOOL OneXBlending;
 	UBOOL ActorXBlending;
 	UBOOL UseGammaCorrection;
+	UBOOL UsePalettedTextures;
     INT NumAASamples;
     FLOAT LODBias;
     FLOAT GammaOffset;
 	BYTE FramebufferBpc;
+	INT TextureMemoryBudget; // In MB. 0 = unlimited
+	UBOOL AsyncTextureUploads;
+	UBOOL UseDiskCache;
+	INT DiskCacheSize; // In MB
+	UBOOL CompressTextures;
+	UBOOL PackLightMaps;
+	UBOOL GenerateMips;
+	INT UploadBudget; // In KB per frame. 0 = unlimited
+	UBOOL StreamTextures;
+	UBOOL DeduplicateTextures;
+	UBOOL CacheWorldGeometry;
+	UBOOL SortOpaqueDraws;
+	UBOOL BatchDrawCalls;
     
     //
     // A BufferObject describes a GPU-mapped buffer object
@@ -307,13 +336,102 @@ class UFruCoReRenderDevice : public URenderDevice
     };
     
     //
-    // Helper class for drawPrimitives(type:vertexStart:vertexCount:instanceCount:baseInstance:) batching
+    // A StagingArena is a CPU-side scratch buffer we convert texture data into
+    // before handing it to Metal. It only ever grows (geometrically) so that
+    // in steady state, texture conversions do not hit the heap at all.
+    //
+    // Conversions that need an intermediate copy of the texture (e.g., P8 to
+    // BC1 expands to RGBA8 first) write their output into the buffer the
+    // caller got from Reserve, so they keep the copy in a second buffer.
+    //
+    class StagingArena
+    {
+    public:
+        StagingArena() = default;
+        ~StagingArena()
+        {
+            Free();
+        }
+
+        // Returns a buffer of at least @Bytes bytes. The contents of the buffer are undefined.
+        // The returned pointer is only valid until the next Reserve call
+        BYTE* Reserve(size_t Bytes)
+        {
+            return Grow(Data, Capacity, Bytes);
+        }
+
+        // Same as Reserve, but returns the second buffer. The returned
+        // pointer is only valid until the next ReserveScratch call
+        BYTE* ReserveScratch(size_t Bytes)
+        {
+            return Grow(ScratchData, ScratchCapacity, Bytes);
+        }
+
+        void Free()
+        {
+            delete[] Data;
+            delete[] ScratchData;
+            Data = ScratchData = nullptr;
+            Capacity = ScratchCapacity = 0;
+        }
+
+        // Called at the start of every frame
+        void ResetFrameStats()
+        {
+            NumFrameAllocations = 0;
+        }
+
+        size_t GetTotalCapacity() const
+        {
+            return Capacity + ScratchCapacity;
+        }
+
+        BYTE*   Data{};
+        size_t  Capacity{};             // Size of Data (in bytes)
+        BYTE*   ScratchData{};
+        size_t  ScratchCapacity{};
+        INT     NumAllocations{};       // Total number of heap allocations since startup
+        INT     NumFrameAllocations{};  // Number of heap allocations in the current frame
+
+    private:
+        BYTE* Grow(BYTE*& Buffer, size_t& BufferCapacity, size_t Bytes)
+        {
+            if (Bytes > BufferCapacity)
+            {
+                size_t NewCapacity = Max<size_t>(BufferCapacity * 2, 256 * 1024);
+                while (NewCapacity < Bytes)
+                    NewCapacity *= 2;
+                
+                delete[] Buffer;
+                Buffer = new BYTE[NewCapacity];
+                BufferCapacity = NewCapacity;
+                
+                NumAllocations++;
+                NumFrameAllocations++;
+            }
+            return Buffer;
+        }
+    };
+
+    //
+    // Helper class for drawPrimitives(type:vertexStart:vertexCount:instanceCount:baseInstance:) and
+    // drawIndexedPrimitives(type:indexCount:indexType:indexBuffer:indexBufferOffset:instanceCount:baseVertex:baseInstance:) batching
     // TODO: We could probably use some sort of buffer to store DrawPrimitivesIndirectArguments directly on the GPU
     // TODO: This would allow us to draw using only one draw call
     //
     class MultiDrawIndirectBuffer
     {
     public:
+        struct DrawCommand
+        {
+            uint32_t vertexCount;
+            uint32_t instanceCount;
+            uint32_t vertexStart;
+            uint32_t baseInstance;
+            uint32_t indexCount;            // 0 for non-indexed draws
+            uint32_t indexStart;
+        };
+        
         MultiDrawIndirectBuffer()
         {
             CommandBuffer.AddZeroed(1024);
@@ -330,14 +448,77 @@ class UFruCoReRenderDevice : public URenderDevice
                 CommandBuffer.Add(1024);
             
             CommandBuffer(TotalCommands).vertexStart = TotalVertices;
-            CommandBuffer(TotalCommands).baseInstance = TotalCommands;
+            CommandBuffer(TotalCommands).baseInstance = TotalInstances;
             CommandBuffer(TotalCommands).instanceCount = 1;
+            CommandBuffer(TotalCommands).indexStart = TotalIndices;
         }
 
-        void EndDrawCall(INT Vertices)
+        // If @Indices is non-zero, this is an indexed draw of @Indices indices
+        // that reference the @Vertices vertices we've just written. If @Merge
+        // is true, the vertices carry their instance index, so we can append
+        // the draw to the previous one if it's adjacent in the buffers
+        void EndDrawCall(INT Vertices, INT Indices=0, bool Merge=false)
         {
             TotalVertices += Vertices;
-            CommandBuffer(TotalCommands++).vertexCount = Vertices;
+            TotalIndices += Indices;
+            TotalInstances++;
+            CommandBuffer(TotalCommands).indexCount = Indices;
+            CommandBuffer(TotalCommands).vertexCount = Vertices;
+            
+            if (Merge && HasUnqueuedCommands() && MergeDrawCommands(CommandBuffer(TotalCommands - 1), CommandBuffer(TotalCommands)))
+            {
+                FrameMergedCommands++;
+                return;
+            }
+            TotalCommands++;
+        }
+        
+        //
+        // Adds a non-indexed draw call of the @Vertices vertices at @VertexStart
+        // in a buffer other than the ring buffer we're filling (e.g., a
+        // persistent buffer). It therefore doesn't advance TotalVertices.
+        // If @SameInstance is true, the draw uses the instance data of the
+        // previous AddDrawCall, and we append it to that draw if it's adjacent
+        //
+        void AddDrawCall(INT VertexStart, INT Vertices, bool SameInstance=false)
+        {
+            if (TotalCommands == CommandBuffer.Num())
+                CommandBuffer.Add(1024);
+            
+            CommandBuffer(TotalCommands).vertexStart = VertexStart;
+            CommandBuffer(TotalCommands).baseInstance = SameInstance ? TotalInstances - 1 : TotalInstances++;
+            CommandBuffer(TotalCommands).instanceCount = 1;
+            CommandBuffer(TotalCommands).indexStart = 0;
+            CommandBuffer(TotalCommands).indexCount = 0;
+            CommandBuffer(TotalCommands).vertexCount = Vertices;
+            
+            if (SameInstance && HasUnqueuedCommands() && MergeDrawCommands(CommandBuffer(TotalCommands - 1), CommandBuffer(TotalCommands)))
+            {
+                FrameMergedCommands++;
+                return;
+            }
+            TotalCommands++;
+        }
+        
+        //
+        // Adds one instance of a primitive whose @Vertices vertices the vertex
+        // shader generates from vertex_id. Consecutive instances are drawn with
+        // one instanced draw call, up until the next Draw. We flush whenever the
+        // render state changes, so all instances of a call share the same state.
+        // Returns true if the instance started a new draw call.
+        //
+        // Don't mix this with StartDrawCall/EndDrawCall in the same buffer.
+        //
+        bool AddGeneratedInstance(INT Vertices)
+        {
+            if (TotalCommands == CommandBuffer.Num())
+                CommandBuffer.Add(1024);
+            
+            DrawCommand* Prev = HasUnqueuedCommands() ? &CommandBuffer(TotalCommands - 1) : nullptr;
+            if (::AddGeneratedInstance(Prev, CommandBuffer(TotalCommands), TotalInstances++, Vertices))
+                return false;
+            TotalCommands++;
+            return true;
         }
         
         bool HasUnqueuedCommands()
@@ -347,28 +528,64 @@ class UFruCoReRenderDevice : public URenderDevice
 
         void Reset()
         {
-            EnqueuedCommands = TotalCommands = TotalVertices = 0;
+            EnqueuedCommands = TotalCommands = TotalVertices = TotalIndices = TotalInstances = 0;
         }
 
-        void Draw(MTL::PrimitiveType Type, MTL::RenderCommandEncoder* Encoder)
+        // @IndexBuffer holds 16-bit indices into the vertex buffer. It's only needed if we've buffered indexed draws.
+        // Returns the number of native draw calls we've encoded
+        INT Draw(MTL::PrimitiveType Type, MTL::RenderCommandEncoder* Encoder, MTL::Buffer* IndexBuffer=nullptr)
         {
+            const INT Num = TotalCommands - EnqueuedCommands;
             for (INT i = EnqueuedCommands; i < TotalCommands; ++i)
+                EncodeCommand(Type, Encoder, IndexBuffer, CommandBuffer(i));
+            EnqueuedCommands = TotalCommands;
+            return Num;
+        }
+        
+        // Copies the unqueued commands to @Out instead of encoding them, so
+        // we can encode them later (see SortOpaqueDraws). Returns the number
+        // of commands we copied
+        INT Defer(std::vector<DrawCommand>& Out)
+        {
+            const INT Num = TotalCommands - EnqueuedCommands;
+            Out.insert(Out.end(), &CommandBuffer(EnqueuedCommands), &CommandBuffer(EnqueuedCommands) + Num);
+            EnqueuedCommands = TotalCommands;
+            return Num;
+        }
+        
+        static void EncodeCommand(MTL::PrimitiveType Type, MTL::RenderCommandEncoder* Encoder, MTL::Buffer* IndexBuffer, const DrawCommand& Command)
+        {
+            if (Command.indexCount)
             {
-                Encoder->drawPrimitives(
+                Encoder->drawIndexedPrimitives(
                     Type,
-                    CommandBuffer(i).vertexStart,
-                    CommandBuffer(i).vertexCount,
-                    CommandBuffer(i).instanceCount,
-                    CommandBuffer(i).baseInstance
+                    Command.indexCount,
+                    MTL::IndexTypeUInt16,
+                    IndexBuffer,
+                    Command.indexStart * sizeof(uint16_t),
+                    Command.instanceCount,
+                    0,
+                    Command.baseInstance
                 );
+                return;
             }
-            EnqueuedCommands = TotalCommands;
+            
+            Encoder->drawPrimitives(
+                Type,
+                Command.vertexStart,
+                Command.vertexCount,
+                Command.instanceCount,
+                Command.baseInstance
+            );
         }
 
-        TArray<MTL::DrawPrimitivesIndirectArguments> CommandBuffer;
+        TArray<DrawCommand> CommandBuffer;
         INT TotalVertices{};
+        INT TotalIndices{};
+        INT TotalInstances{};
         INT TotalCommands{};
         INT EnqueuedCommands{};
+        INT FrameMergedCommands{};      // Draws EndDrawCall appended to the previous one in this frame
     };
     
     //
@@ -430,6 +647,7 @@ class UFruCoReRenderDevice : public URenderDevice
         ADD_OPTION(OPT_MSAAx4);
         ADD_OPTION(OPT_MSAAx8);
 		ADD_OPTION(OPT_NoSmooth);
+        ADD_OPTION(OPT_PalettedTexture);
         if (Result.Len() == 0)
             Result = TEXT("OPT_None");
         return Result;
@@ -451,6 +669,38 @@ class UFruCoReRenderDevice : public URenderDevice
         }
     };
 
+    //
+    // A batch of opaque draw commands we've recorded for sorted submission
+    // (see SortOpaqueDraws), along with the state we would have drawn them
+    // with. Records hold raw Metal pointers. They're safe to use until the
+    // end of the frame, because we never release buffers or textures the
+    // current command buffer may still need.
+    //
+    struct DeferredBinding
+    {
+        MTL::Buffer*                    Buffer;
+        INT                             VertexIndex;
+        INT                             FragmentIndex;
+    };
+    
+    struct DeferredDraw
+    {
+        INT                             Program;
+        const MTL::RenderPipelineState* PipelineState;
+        DepthMode                       Depth;
+        MTL::Texture*                   Textures[IDX_DiffusePalette + 1];
+        DeferredBinding                 Bindings[4];
+        INT                             NumBindings;
+        MTL::Buffer*                    IndexBuffer;
+        INT                             FirstCommand;   // In DeferredCommands
+        INT                             NumCommands;
+        
+        template<typename T> void AddBinding(BufferObject<T>& Buffer)
+        {
+            Bindings[NumBindings++] = { Buffer.Buffers(Buffer.ActiveBuffer), Buffer.VertexBindingIndex, Buffer.FragmentBindingIndex };
+        }
+    };
+
     // Common interface for all shaders
     class ShaderProgram
     {
@@ -502,33 +752,34 @@ class UFruCoReRenderDevice : public URenderDevice
         const char*                     FragmentFunctionName;
     };
     
+    //
+    // Common implementation for programs that read nothing but instance data.
+    // Their vertex shaders generate the vertices from vertex_id
+    //
     template
     <
-        typename V,
         typename I,
-        auto VertexBufferSize,
-        auto VertexBufferBindingIndex,
         auto InstanceDataBufferSize,
         auto InstanceDataBufferBindingIndex
     >
-    class ShaderProgramImpl : public ShaderProgram
+    class InstancedShaderProgramImpl : public ShaderProgram
     {
     public:
         // Persistent state
         MTL::Library*                   Library{};
         
         // Buffered render data
-        BufferObject<V>                 VertexBuffer;
         BufferObject<I>                 InstanceDataBuffer;
+        BufferObject<uint16_t>          IndexBuffer;        // Only initialized by programs that draw indexed polygon fans
         MultiDrawIndirectBuffer         DrawBuffer;
         
         // Previously selected state
         ShaderSpecializationKey         CachedStateKey{};
         MTL::RenderPipelineState*       CachedState{};
         
-        ShaderProgramImpl() = default;
+        InstancedShaderProgramImpl() = default;
         
-        virtual ~ShaderProgramImpl()
+        virtual ~InstancedShaderProgramImpl()
         {
             for (TMap<ShaderSpecializationKey, MTL::RenderPipelineState*>::TIterator It(PipelineStates); It; ++It)
             {
@@ -538,7 +789,6 @@ class UFruCoReRenderDevice : public URenderDevice
         
         virtual void InitializeBuffers()
         {
-            VertexBuffer.Initialize(VertexBufferSize, RenDev->Device, VertexBufferBindingIndex);
             InstanceDataBuffer.Initialize(InstanceDataBufferSize, RenDev->Device, InstanceDataBufferBindingIndex);
         }
 
@@ -595,7 +845,6 @@ class UFruCoReRenderDevice : public URenderDevice
         // Binds this shader's buffer to the active commandencoder
         virtual void ActivateShader()
         {
-            VertexBuffer.BindBuffer(RenDev->CommandEncoder);
             InstanceDataBuffer.BindBuffer(RenDev->CommandEncoder);
         }
 
@@ -611,13 +860,15 @@ class UFruCoReRenderDevice : public URenderDevice
         {
             // Make the GPU driver signal our buffer semaphores when it's done with the current command buffer
             // This way, we know the full buffer is ready to reuse
-            VertexBuffer.Signal(RenDev->CommandBuffer);
             InstanceDataBuffer.Signal(RenDev->CommandBuffer);
+            if (IndexBuffer.BufferCount())
+                IndexBuffer.Signal(RenDev->CommandBuffer);
             
             Flush();
             
-            VertexBuffer.Rotate(RenDev->Device, RenDev->CommandEncoder);
             InstanceDataBuffer.Rotate(RenDev->Device, RenDev->CommandEncoder);
+            if (IndexBuffer.BufferCount())
+                IndexBuffer.Rotate(RenDev->Device);
             DrawBuffer.Reset();
         }
 
@@ -627,10 +878,78 @@ class UFruCoReRenderDevice : public URenderDevice
             if (!DrawBuffer.HasUnqueuedCommands())
                 return;
             
-            VertexBuffer.BufferData();
             InstanceDataBuffer.BufferData();
-                
-            DrawBuffer.Draw(MTL::PrimitiveTypeTriangle, RenDev->CommandEncoder);
+            if (IndexBuffer.BufferCount())
+                IndexBuffer.BufferData();
+            
+            auto Indices = IndexBuffer.BufferCount() ? IndexBuffer.Buffers(IndexBuffer.ActiveBuffer) : nullptr;
+            if (RenDev->DeferringDraws)
+            {
+                auto& Draw = RenDev->DeferDraw();
+                Draw.IndexBuffer = Indices;
+                CaptureBindings(Draw);
+                Draw.NumCommands = DrawBuffer.Defer(RenDev->DeferredCommands);
+                return;
+            }
+            
+            RenDev->FrameNativeDraws += DrawBuffer.Draw(MTL::PrimitiveTypeTriangle, RenDev->CommandEncoder, Indices);
+        }
+        
+        // Records the buffers our deferred draws read, so we can bind them
+        // again when we submit the draws
+        virtual void CaptureBindings(DeferredDraw& Draw)
+        {
+            Draw.AddBinding(InstanceDataBuffer);
+        }
+    };
+    
+    // Common implementation for programs that buffer vertices as well as instance data
+    template
+    <
+        typename V,
+        typename I,
+        auto VertexBufferSize,
+        auto VertexBufferBindingIndex,
+        auto InstanceDataBufferSize,
+        auto InstanceDataBufferBindingIndex
+    >
+    class ShaderProgramImpl : public InstancedShaderProgramImpl<I, InstanceDataBufferSize, InstanceDataBufferBindingIndex>
+    {
+    public:
+        typedef InstancedShaderProgramImpl<I, InstanceDataBufferSize, InstanceDataBufferBindingIndex> InstancedImpl;
+        
+        BufferObject<V>                 VertexBuffer;
+        
+        virtual void InitializeBuffers()
+        {
+            VertexBuffer.Initialize(VertexBufferSize, this->RenDev->Device, VertexBufferBindingIndex);
+            InstancedImpl::InitializeBuffers();
+        }
+        
+        virtual void ActivateShader()
+        {
+            VertexBuffer.BindBuffer(this->RenDev->CommandEncoder);
+            InstancedImpl::ActivateShader();
+        }
+        
+        virtual void RotateBuffers()
+        {
+            VertexBuffer.Signal(this->RenDev->CommandBuffer);
+            InstancedImpl::RotateBuffers();
+            VertexBuffer.Rotate(this->RenDev->Device, this->RenDev->CommandEncoder);
+        }
+        
+        virtual void Flush()
+        {
+            if (this->DrawBuffer.HasUnqueuedCommands())
+                VertexBuffer.BufferData();
+            InstancedImpl::Flush();
+        }
+        
+        virtual void CaptureBindings(DeferredDraw& Draw)
+        {
+            Draw.AddBinding(VertexBuffer);
+            InstancedImpl::CaptureBindings(Draw);
         }
     };
 
@@ -656,9 +975,84 @@ class UFruCoReRenderDevice : public URenderDevice
             this->FragmentFunctionName = _FragmentFunctionName;
         }
         
+        virtual ~DrawComplexProgram()
+        {
+            FlushWorldGeometry();
+        }
+        
         virtual void BuildCommonPipelineStates();
+        virtual void InitializeBuffers()
+        {
+            ShaderProgramImpl::InitializeBuffers();
+            IndexBuffer.Initialize(DRAWCOMPLEX_INDEXBUFFER_SIZE, RenDev->Device);
+        }
+        virtual void ActivateShader()
+        {
+            ShaderProgramImpl::ActivateShader();
+            if (WorldGeometryBuffer)
+                RenDev->CommandEncoder->setVertexBuffer(WorldGeometryBuffer, 0, IDX_DrawComplexWorldVertexData);
+        }
+        virtual void CaptureBindings(DeferredDraw& Draw)
+        {
+            ShaderProgramImpl::CaptureBindings(Draw);
+            if (WorldGeometryBuffer)
+                Draw.Bindings[Draw.NumBindings++] = { WorldGeometryBuffer, IDX_DrawComplexWorldVertexData, -1 };
+        }
+        
+        //
+        // World-space geometry cache (CacheWorldGeometry). We find the
+        // surface a facet may belong to by its texture mapping (see
+        // FruCoRe_SurfaceLookup.h). The first time we see a surface, we
+        // store each of its BSP nodes as an unfanned triangle list in a
+        // persistent buffer that we never overwrite. When it's full, we drop
+        // the cached geometry and start over.
+        //
+        // We only draw a cached node in place of a facet polygon if the
+        // polygon is that node clipped to the view frustum (see
+        // IsClippedNode), so we draw exactly the nodes the engine submitted.
+        // If any polygon of the facet doesn't match, we emit the facet as
+        // usual. We only use the cache for opaque surfaces in the top-level
+        // scene node, since the cached copy of a node isn't clipped.
+        //
+        struct CachedSurface
+        {
+            INT             FirstVertex;        // In WorldGeometryBuffer. -1 if the surface is not cached yet
+            INT             NumVertices;        // 0 if the surface can't be cached
+            INT             FirstNode;          // In CachedNodes, once the surface is cached
+            INT             NumNodes;
+        };
+        struct CachedNode
+        {
+            INT             FirstVertex;        // In WorldGeometryBuffer
+            INT             NumVertices;
+            INT             FirstPoint;         // In NodePoints
+            INT             NumPoints;
+            INT             LastDrawnFrame;
+            FBox            Bounds;
+        };
+        TArray<CachedSurface> CachedSurfaces;  // Indexed by iSurf
+        TArray<CachedNode>  CachedNodes;
+        TArray<FLOAT>       NodePoints;         // World-space outlines of the cached nodes, 3 floats per point
+        TArray<FLOAT>       FacetPoints;        // Scratch space for IsClippedNode
+        TArray<INT>         FacetNodes;         // The cached node of every polygon of the facet we're drawing
+        FSurfaceLookup      SurfaceLookup;
+        ULevel*             WorldGeometryLevel{};
+        MTL::Buffer*        WorldGeometryBuffer{};
+        INT                 NumWorldGeometryVertices{};
+        INT                 NumCachedSurfaces{};
+        INT                 NumWorldGeometryResets{};
+        INT                 FrameCachedFacetDraws{};
+        INT                 FrameEmittedFacetDraws{};
+        
+        UBOOL FindCachedNodes(FSceneNode* Frame, FSurfaceInfo& Surface, FSurfaceFacet& Facet, FLOAT& OutMinZ);
+        INT FindClippedNode(FSceneNode* Frame, const CachedSurface& Entry, FSavedPoly* Poly, FLOAT& OutMinZ);
+        void BuildSurfaceLookup(ULevel* Level);
+        void CacheSurface(UModel* Model, INT iSurf, CachedSurface& Entry);
+        void ResetWorldGeometry();
+        void FlushWorldGeometry();
     };
     
+    struct CachedTexture;
     class DrawGouraudProgram : public ShaderProgramImpl<GouraudVertex, GouraudInstanceData, DRAWGOURAUD_VERTEXBUFFER_SIZE, IDX_DrawGouraudVertexData, DRAWGOURAUD_INSTANCEDATA_SIZE, IDX_DrawGouraudInstanceData>
     {
     public:
@@ -670,19 +1064,90 @@ class UFruCoReRenderDevice : public URenderDevice
             this->FragmentFunctionName = _FragmentFunctionName;
         }
         void PrepareDrawCall(FSceneNode* Frame, FTextureInfo& Info, DWORD PolyFlags);
-        void FinishDrawCall(FTextureInfo& Info);
-        void BufferVert(GouraudVertex* Vert, FTransTexture* P);
+        
+        // Buffers @Count vertices at the current position of the vertex buffer.
+        // @GetPoint(i) returns a reference to the i-th FTransTexture
+        template<typename G> void BufferVerts(uint32_t Count, G&& GetPoint)
+        {
+            // The shader only reads the fog stream if we specialized it for fog
+            EmitGouraudVertices(VertexBuffer.GetCurrentElementPtr(),
+                                (LastShaderOptions & OPT_RenderFog) ? FogBuffer.GetCurrentElementPtr() : nullptr,
+                                Count, InstanceDataBuffer.Index, GetPoint);
+        }
+        
         void PushClipPlane(const FPlane& ClipPlane);
         void PopClipPlane();
         
         virtual void BuildCommonPipelineStates();
+        virtual void InitializeBuffers()
+        {
+            ShaderProgramImpl::InitializeBuffers();
+            IndexBuffer.Initialize(DRAWGOURAUD_INDEXBUFFER_SIZE, RenDev->Device);
+            FogBuffer.Initialize(DRAWGOURAUD_VERTEXBUFFER_SIZE, RenDev->Device, IDX_DrawGouraudFogData);
+        }
+        virtual void ActivateShader()
+        {
+            ShaderProgramImpl::ActivateShader();
+            FogBuffer.BindBuffer(RenDev->CommandEncoder);
+        }
+        virtual void RotateBuffers()
+        {
+            FogBuffer.Signal(RenDev->CommandBuffer);
+            ShaderProgramImpl::RotateBuffers();
+            FogBuffer.Rotate(RenDev->Device, RenDev->CommandEncoder);
+        }
+        virtual void Flush()
+        {
+            if (DrawBuffer.HasUnqueuedCommands())
+                FogBuffer.BufferData();
+            ShaderProgramImpl::Flush();
+        }
+        virtual void CaptureBindings(DeferredDraw& Draw)
+        {
+            ShaderProgramImpl::CaptureBindings(Draw);
+            Draw.AddBinding(FogBuffer);
+        }
+        
+        // Advances the vertex buffer and the fog stream together
+        void AdvanceVertices(uint32_t Count)
+        {
+            VertexBuffer.Advance(Count);
+            FogBuffer.Advance(Count);
+        }
+        
+        // Bytes we buffer per vertex, and what we used to buffer with float4 attributes
+        QWORD GetVertexBytes() const { return sizeof(GouraudVertex) + ((LastShaderOptions & OPT_RenderFog) ? sizeof(PackedHalf4) : 0); }
+        static constexpr QWORD UnpackedVertexBytes = 5 * sizeof(simd::float4);
         
         DWORD LastShaderOptions{};
-        FTextureInfo DetailTextureInfo{};
-        FTextureInfo MacroTextureInfo{};
+        
+        // Per-vertex fog colors. This stream runs in lockstep with VertexBuffer
+        // (i.e., FogBuffer.Index always equals VertexBuffer.Index), but we only
+        // fill it for polys that need fog
+        BufferObject<PackedHalf4> FogBuffer;
+        
+        // Meshes can draw thousands of polys with the same detail or macro
+        // texture, so we lock those once per frame and keep them locked
+        // until UFruCoReRenderDevice::Unlock
+        struct LockedTexture
+        {
+            UTexture*       Texture;
+#if ENGINE_VERSION!=227
+            FTime           Time;
+#endif
+            FTextureInfo    Info;
+            QWORD           CacheID;        // Info.CacheID before SetTexture tagged it
+            DWORD           PolyFlags;      // PolyFlags we last bound Info with
+            CachedTexture*  Bound;          // Cache entry we last bound for Info. Only valid while NumTextureFlushes equals FlushCount
+            INT             FlushCount;
+        };
+        TArray<LockedTexture*> LockedTextures;
+        LockedTexture* LockTexture(FSceneNode* Frame, UTexture* Texture);
+        void BindLockedTexture(INT TexNum, LockedTexture* Locked, DWORD PolyFlags);
+        void UnlockTextures();
     };
     
-    class DrawTileProgram : public ShaderProgramImpl<TileVertex, TileInstanceData, DRAWTILE_VERTEXBUFFER_SIZE, IDX_DrawTileVertexData, DRAWTILE_INSTANCEDATA_SIZE, IDX_DrawTileInstanceData>
+    class DrawTileProgram : public InstancedShaderProgramImpl<TileInstanceData, DRAWTILE_INSTANCEDATA_SIZE, IDX_DrawTileInstanceData>
     {
     public:
         DrawTileProgram(UFruCoReRenderDevice* _RenDev, const TCHAR* _ShaderName, const char* _VertexFunctionName, const char* _FragmentFunctionName)
@@ -763,13 +1228,33 @@ class UFruCoReRenderDevice : public URenderDevice
     static BlendMode GetBlendMode(DWORD PolyFlags);
     void SetDepthMode(DepthMode Mode);
     void SetTexture(INT TexNum, FTextureInfo& Info, DWORD PolyFlags, FLOAT PanBias);
+    DWORD GetTextureShaderOptions(INT TexNum);
     void SetProjection(FSceneNode* Frame, UBOOL bNearZ);
+    UBOOL SetFrameUniforms(FSceneNode* Frame);
     void CreateRenderTargets();
     void CreateMultisampleRenderTargets();
     void RegisterTextureFormats();
     void CreateCommandEncoder(MTL::CommandBuffer* Buffer, bool ClearDepthBuffer=true, bool ClearColorBuffer=true);
     MTL::Library* GetShaderLibrary();
     void SetPipelineState(const MTL::RenderPipelineState* State);
+    
+    //
+    // Sorted submission of opaque draws (SortOpaqueDraws). While we're
+    // deferring, the programs record their batches in DrawList rather than
+    // encoding them. FlushDrawList sorts and encodes everything we've
+    // recorded. We flush it before any draw that has to stay in engine
+    // order (e.g., translucent polys, tiles, lines), and before anything
+    // that ends the command encoder or changes the uniforms
+    //
+    static UBOOL IsDeferrableDraw(DWORD PolyFlags);
+    void SetDrawDeferral(UBOOL Defer);
+    DeferredDraw& DeferDraw();
+    void FlushDrawList();
+    TDeferredDrawList<DeferredDraw> DrawList;
+    std::vector<MultiDrawIndirectBuffer::DrawCommand> DeferredCommands; // Keeps its memory between flushes
+    UBOOL                           DeferringDraws;
+    INT                             FrameDeferredBatches;   // Batches we recorded in the draw list
+    INT                             FrameFlushesAvoided;    // Recorded batches that didn't need a state change when we submitted them
     void SetMSAAOptions();
     MTL::RenderPipelineState* BuildPostprocessPipelineState(const char* VertexFunctionName, const char* FragmentFunctionName, const char* StateName);
 
@@ -779,6 +1264,11 @@ class UFruCoReRenderDevice : public URenderDevice
 	CA::MetalLayer*                 Layer;
 	MTL::Device*                    Device;
     BufferObject<GlobalUniforms>    GlobalUniformsBuffer;
+    
+    // Set once per frame, for the top-level scene node (see SetFrameUniforms)
+    FrameUniforms                   FrameUniformsData;
+    FCoords                         FrameUniformsCoords;
+    INT                             FrameUniformsNumber;    // Frame we last set FrameUniformsData for
     MTL::CommandQueue*              CommandQueue;
     MTL::DepthStencilState*         DepthStencilStates[DEPTH_Max];
     DepthMode                       CurrentDepthMode;
@@ -822,32 +1312,205 @@ class UFruCoReRenderDevice : public URenderDevice
     MTL::RenderPipelineState*       GammaCorrectPipelineState;
     
     // Texture state
-    typedef BYTE* (*ConversionFunc)(FTextureInfo&, DWORD, INT);
+    // Converts mip @MipLevel of the given texture into @Dest. @Dest is supplied by the caller and must be large enough to hold the converted mip.
+    // Intermediate copies go in the scratch buffer of the caller's @Staging arena
+    typedef void (*ConversionFunc)(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, StagingArena& Staging);
     struct TextureFormat
     {
         MTL::PixelFormat    MetalFormat;
-        INT                 BlockSize;
+        INT                 BlockWidth;         // 1 for uncompressed formats, 4 for block-compressed formats
+        INT                 BytesPerBlock;
         ConversionFunc      ConversionFunction;
+        
+        INT GetBytesPerRow(INT USize) const
+        {
+            return ((USize + BlockWidth - 1) / BlockWidth) * BytesPerBlock;
+        }
     };
+    struct TextureJob;
+    struct AtlasPage;
+    struct SharedTexture;
     struct CachedTexture
     {
         QWORD               CacheID;
+        BYTE                Format;             // ETextureFormat of the source texture
         MTL::Texture*       Texture;
+        MTL::Texture*       Palette;            // Only set for paletted textures. In that case, Texture holds the palette indices
         INT                 RealTimeChangeCount;
+        QWORD               DataHash;           // Realtime textures only. Hashes of the source texels and palette we last uploaded
+        QWORD               PaletteHash;
+        INT                 LastUsedFrame;      // Frame number of the last frame in which this texture was bound
+        QWORD               SizeBytes;          // Amount of GPU memory used by Texture and Palette. 0 for entries that use another entry's SharedTexture
+        BYTE*               Shadow;             // Realtime P8 textures only. Copy of the indices and palette we last uploaded
+        TextureJob*         PendingJob;         // Set while a worker is still preparing the full-resolution texture, or while we're still uploading its larger mips. Texture is a low-res placeholder or view in that case
+        AtlasPage*          Page;               // Set if Texture is a shared atlas page. The page owns the Metal texture in that case
+        TextureJob*         Stream;             // Set if we only keep some of the texture's mips resident (see StreamTextures)
+        QWORD               ContentKey;         // Hash of the source data, palette, and format. 0 if we don't deduplicate this texture
+        SharedTexture*      Shared;             // Set if other entries with the same ContentKey may use Texture and Palette too
+        INT                 AtlasX;             // Position of the texture within its atlas page
+        INT                 AtlasY;
         FLOAT               UMult;
         FLOAT               VMult;
         FLOAT               UPan;
         FLOAT               VPan;
     };
     TMap<INT, TextureFormat>        TextureFormats;
-    //
-    // Cache ID wrapper to ensure proper TMap hashing behaviour
-    //
-    struct FCacheID : public TDataWrapper<QWORD>
+    TMap<INT, TextureFormat>        CompressedTextureFormats;       // Used instead of TextureFormats if CompressTextures is set
+    TMap<INT, TextureFormat>        AlphaCompressedTextureFormats;  // Same, but for textures with alpha
+    UBOOL                           bCanCompressTextures;
+    const TextureFormat* FindTextureFormat(FTextureInfo& Info, DWORD PolyFlags);
+    TTextureCacheMap<CachedTexture*>   BindMap;
+    StagingArena                    TextureStaging;
+    QWORD                           TextureMemoryUsed;
+    INT                             NumEvictedTextures;
+    void EvictTextures();
+    void ReleaseCachedTexture(CachedTexture* Texture);
+    CachedTexture* AddCachedTexture(QWORD CacheID, BYTE Format, MTL::Texture* MetalTexture, MTL::Texture* MetalPalette, QWORD SizeBytes);
+    
+    // Dirty region uploads for realtime P8 textures
+    INT                             NumPartialRealtimeUploads;
+    INT                             NumFullRealtimeUploads;
+    INT                             NumPaletteRealtimeUploads;      // Paletted textures whose indices didn't change
+    INT                             NumSkippedRealtimeUploads;      // Changes that didn't change the source data at all
+    UBOOL UploadDirtyRegions(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags);
+    
+    // Lightmap and fogmap atlas. Small lightmaps and fogmaps share large
+    // pages, so consecutive BSP surfaces usually keep the same textures bound
+    struct AtlasPage
+    {
+        MTL::Texture*       Texture;
+        FSkylinePacker      Packer;
+        TArray<QWORD>       CacheIDs;           // Cache entries we've packed into this page
+        INT                 LastUsedFrame;
+    };
+    TArray<AtlasPage*>              AtlasPages;
+    INT                             NumAtlasResets;
+    UBOOL UploadToAtlas(CachedTexture*& Texture, INT TexNum, FTextureInfo& Info, DWORD PolyFlags);
+    AtlasPage* AllocateAtlasRegion(INT USize, INT VSize, INT& OutX, INT& OutY);
+    void ResetAtlasPage(AtlasPage* Page);
+    void ReleaseAtlasPages();
+    
+    // Background texture preparation. A TextureJob converts and uploads the
+    // full mip chain of a texture on a worker thread while the render thread
+    // draws with a placeholder built from the texture's smallest mips
+    struct TextureJob
+    {
+        CachedTexture*      Texture;            // Cache entry that receives MetalTexture once the job is done
+        MTL::Texture*       MetalTexture;       // The GPU never sees this texture until the render thread swaps it in
+        FTextureInfo        Info;               // Copy of the engine's texture info. Info.Mips and Info.Palette point to the copies below
+        FColor              Palette[256];
+        TArray<FMipmapBase> SourceMips;         // Copies of the engine's mip descriptors. Their DataPtrs point into SourceData, or are null for mips we didn't copy
+        TArray<BYTE>        SourceData;         // Copy of the source texels of the mips we may still have to convert. The engine only guarantees that its own copy stays valid while SetTexture runs
+        INT                 RealTimeChangeCount;
+        DWORD               PolyFlags;
+        TextureFormat       Format;
+        QWORD               SizeBytes;
+        DOUBLE              QueueTime;
+        UBOOL               bDeduplicate;       // Async jobs only. If set, the worker computes ContentKey
+        QWORD               ContentKey;
+        volatile INT        Done;
+        INT                 ResidentMip;        // Deferred uploads and streamed textures only. Largest mip we've uploaded so far
+        INT                 InitialMip;         // Streamed textures only. We never drop below this mip
+        INT                 WantedMip;          // Streamed textures only. Largest mip a draw asked for in LastWantedFrame
+        INT                 LastWantedFrame;
+        INT                 LastTopMipUseFrame; // Streamed textures only. Last frame in which a draw needed mip ResidentMip
+    };
+    struct RetiredTexture
+    {
+        MTL::Texture*       Texture;
+        INT                 LastUsedFrame;      // We can release Texture once the GPU has finished this frame
+    };
+    dispatch_group_t                TextureJobGroup;
+    TArray<TextureJob*>             PendingTextureJobs;
+    TArray<RetiredTexture>          RetiredTextures;
+    INT                             NumAsyncTextures;       // Number of textures made resident through the worker pool
+    DOUBLE                          TotalTimeToResident;    // In seconds
+    DOUBLE                          MaxTimeToResident;      // In seconds
+    TextureJob* CreateTextureJob(FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT NumCopiedMips);
+    void QueueTextureJob(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, UBOOL bDeduplicate);
+    void FinishTextureJobs(UBOOL Wait);
+    void ReleaseRetiredTextures(UBOOL All);
+    
+    // Per-frame upload budget. Textures that don't fit get their small mips
+    // uploaded first and their larger mips over the next frames
+    QWORD                           FrameUploadBytes;
+    TArray<TextureJob*>             DeferredUploads;
+    INT GetBudgetedResidentMip(FTextureInfo& Info, const TextureFormat* Format);
+    void DeferMipUploads(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT ResidentMip);
+    void UploadDeferredMips();
+    void DiscardDeferredUploads();
+    
+    // Mip streaming. Streamed textures start out with their small mips only.
+    // Draws request larger mips based on their on-screen texel density, and
+    // we drop the largest mips again once they're unused for a while
+    TArray<TextureJob*>             StreamedTextures;
+    INT                             NumStreamedIn;
+    INT                             NumStreamedOut;
+    INT GetInitialStreamingMip(FTextureInfo& Info, const TextureFormat* Format);
+    void StartStreaming(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT ResidentMip);
+    void RequestStreamedMip(INT TexNum, FLOAT TexelsPerPixel);
+    void SetStreamedMip(TextureJob* Stream, INT MipLevel);
+    void StreamTextureMips();
+    
+    // Content-hash deduplication. Mod packages often import the same texture
+    // data under different names. Their cache entries share one Metal
+    // texture. Every entry holds its own reference to it, and its own
+    // pan and scale values
+    struct SharedTexture
     {
-        FCacheID( QWORD InValue ) : TDataWrapper(InValue) {}
+        MTL::Texture*       Texture;
+        MTL::Texture*       Palette;
+        QWORD               SizeBytes;          // Counted in TextureMemoryUsed once, no matter how many entries use it
+        INT                 LastUsedFrame;      // Most recent LastUsedFrame of all entries that use this texture
+        INT                 NumUsers;
     };
-    TMap<FCacheID, CachedTexture*>     BindMap;
+    TTextureCacheMap<SharedTexture*>   SharedTextures;
+    INT                             NumSharedTextures;  // Entries that reused another entry's texture
+    QWORD                           SharedBytes;        // GPU memory those entries would have needed otherwise
+    UBOOL CanDeduplicate(INT TexNum, FTextureInfo& Info);
+    QWORD GetContentKey(INT TexNum, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, UBOOL bPaletted);
+    CachedTexture* AddSharedCachedTexture(QWORD CacheID, BYTE Format, QWORD ContentKey);
+    void UseSharedTexture(CachedTexture* Texture, SharedTexture* Shared, QWORD ContentKey);
+    void ShareCachedTexture(CachedTexture* Texture);
+    
+    // Texture subsystem telemetry (see FRUCORE TEXSTATS)
+    static FTimeHistogram           ConversionTimes;    // Includes conversions on worker threads
+    INT                             FrameUploads;
+    QWORD                           TotalUploads;
+    QWORD                           TotalUploadBytes;
+    QWORD                           NumTextureCacheHits;
+    QWORD                           NumTextureCacheMisses;
+    INT                             NumTextureFlushes;
+    INT                             FrameTextureLocks;      // Detail and macro texture Lock calls in DrawGouraudProgram
+    INT                             FrameLockCacheHits;     // Locks we skipped because the texture was already locked this frame
+    QWORD                           FrameVertexBytes;       // Vertex data we buffered for the Complex and Gouraud programs
+    QWORD                           FrameUnpackedVertexBytes; // The same vertices in the old all-float4 layouts
+    void CountVertices(QWORD Count, QWORD Bytes, QWORD UnpackedBytes)
+    {
+        FrameVertexBytes += Count * Bytes;
+        FrameUnpackedVertexBytes += Count * UnpackedBytes;
+    }
+    INT                             FrameTiles;
+    INT                             FrameTileDraws;         // Instanced draws the tiles were batched into
+    INT                             FrameNativeDraws;       // Draw calls we encoded. Merged draws count once (see BatchDrawCalls)
+    void CountUpload(QWORD Bytes)
+    {
+        FrameUploads++;
+        FrameUploadBytes += Bytes;
+        TotalUploads++;
+        TotalUploadBytes += Bytes;
+    }
+    void PrintTextureStats(FOutputDevice& Ar, const TCHAR* CSVFilename);
+    
+    // Persistent cache of converted textures
+    FTextureDiskCache               TextureDiskCache;
+    FTextureDiskCache* GetDiskCache() { return UseDiskCache ? &TextureDiskCache : nullptr; }
+    FString GetDiskCachePath();
+    
+    // Level-load precaching. PrecacheTexture fills the queue, Lock flushes it
+    TArray<TextureJob*>             PrecacheQueue;
+    void FlushPrecacheQueue();
+    void DiscardPrecacheQueue();
     
     // Per-frame state
     const MTL::RenderPipelineState* ActivePipelineState{};
@@ -856,6 +1519,7 @@ class UFruCoReRenderDevice : public URenderDevice
     MTL::RenderCommandEncoder*      CommandEncoder;
     CA::MetalDrawable*              Drawable;
     CachedTexture*                  BoundTextures[8];
+    MTL::Texture*                   BoundMetalTextures[8];         // Several cache entries can share one Metal texture
     
     // Cached projection state. If any of these change, we need to recalculate our projection matrices
     FLOAT                           StoredFovAngle;
@@ -892,6 +1556,8 @@ class UFruCoReRenderDevice : public URenderDevice
 	// Suspension support
 	//
 	INT                             NumInFlightFrames;
+	INT                             FrameNumber;            // Number of the frame we're currently rendering
+	volatile INT                    CompletedFrameNumber;   // Number of the last frame the GPU has fully executed
 	BOOL                            RendererSuspended;
 	
 
@@ -901,11 +1567,5 @@ class UFruCoReRenderDevice : public URenderDevice
 	static void PrintNSError(const TCHAR* Prefix, const NS::Error* Error);
 };
     
-static inline DWORD GetTypeHash( const UFruCoReRenderDevice::FCacheID& A)
-{
-    QWORD Value = A.GetValue();
-    return ((DWORD)(Value>>8))^((DWORD)(Value>>16));
-}
-
 #define AUTO_INITIALIZE_REGISTRANTS_FRUCORE \
 	UFruCoReRenderDevice::StaticClass();
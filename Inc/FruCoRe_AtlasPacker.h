@@ -0,0 +1,73 @@
+/*=============================================================================
+    FruCoRe_AtlasPacker.h: Rectangle packer for lightmap and fogmap atlases.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//
+// Skyline bottom-left packer. We track the top edge of the packed area as a
+// list of horizontal segments and place every new rectangle on the segment
+// where its top edge ends up lowest. The packer cannot free individual
+// rectangles. Instead, the owner resets the entire page when it is full.
+//
+// Every rectangle gets @Padding texels of border on each side. The caller
+// fills that border by replicating the edge texels (see PadImage), so
+// bilinear filtering near the edge of one lightmap never picks up texels
+// from its neighbours.
+//
+class FSkylinePacker
+{
+public:
+    void Init(uint32_t InWidth, uint32_t InHeight, uint32_t InPadding);
+    void Reset();
+
+    // Finds room for a @Width x @Height rectangle (excluding padding). On
+    // success, @OutX and @OutY receive the position of the rectangle itself,
+    // i.e., the padding starts at (@OutX - Padding, @OutY - Padding)
+    bool Pack(uint32_t Width, uint32_t Height, uint32_t& OutX, uint32_t& OutY);
+
+    uint32_t GetWidth() const { return Width; }
+    uint32_t GetHeight() const { return Height; }
+    uint32_t GetPadding() const { return Padding; }
+    uint32_t GetNumRects() const { return NumRects; }
+
+    // Texels covered by packed rectangles, including their padding
+    uint64_t GetUsedArea() const { return UsedArea; }
+
+    // Fraction of the page covered by packed rectangles, including padding
+    float GetOccupancy() const;
+
+private:
+    struct FSegment
+    {
+        uint32_t X;
+        uint32_t Y;
+        uint32_t Width;
+    };
+
+    // Finds the lowest Y at which the rectangle fits if we place its left
+    // edge at the start of segment @Index. Returns false if it doesn't fit
+    bool FitsAt(size_t Index, uint32_t RectWidth, uint32_t RectHeight, uint32_t& OutY) const;
+
+    std::vector<FSegment>   Skyline;
+    uint32_t                Width{};
+    uint32_t                Height{};
+    uint32_t                Padding{};
+    uint32_t                NumRects{};
+    uint64_t                UsedArea{};
+};
+
+//
+// Copies a @USize x @VSize image of 32-bit texels into the center of a
+// (@USize + 2 * @Padding) x (@VSize + 2 * @Padding) image and fills the
+// border by replicating the edge texels.
+//
+void PadImage(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t Padding, uint32_t* Dst);
@@ -0,0 +1,121 @@
+/*=============================================================================
+    FruCoRe_DiskCache.h: Persistent cache of converted textures.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    The cache is a single memory-mapped file and only needs POSIX.
+
+    File layout (all fields little-endian, native alignment):
+      FDiskCacheHeader
+      FDiskCacheEntry[NumEntries]   - sorted by Key
+      Entry data                    - each entry starts at a 16-byte boundary
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DISKCACHE_MAGIC   0x43545246u // 'FRTC'
+#define DISKCACHE_VERSION 1
+
+struct FDiskCacheHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t NumEntries;
+    uint64_t FileSize;
+    uint64_t TableChecksum;         // HashBytes64 of the entry table
+};
+
+struct FDiskCacheEntry
+{
+    uint64_t Key;
+    uint64_t Offset;                // From the start of the file
+    uint64_t Size;
+    uint64_t Checksum;              // HashBytes64 of the entry data
+};
+
+class FTextureDiskCache
+{
+public:
+    struct FStats
+    {
+        uint64_t NumMappedEntries;
+        uint64_t MappedBytes;
+        uint64_t NumPendingEntries;   // Entries we'll add to the file when we save it
+        uint64_t PendingBytes;
+        uint64_t NumHits;
+        uint64_t NumMisses;
+        uint64_t NumCorruptEntries;   // Entries we rejected because their checksum did not match
+    };
+
+    FTextureDiskCache() = default;
+    ~FTextureDiskCache();
+
+    // Maps the cache file at @Path. If the file does not exist or is not a
+    // valid cache file, we start with an empty cache. The cache never grows
+    // beyond @MaxBytes of entry data
+    void Open(const char* InPath, uint64_t InMaxBytes);
+
+    // Writes all entries we've used or added since Open to the cache file,
+    // followed by the unused entries that still fit within the size limit.
+    // Returns false if the file could not be written.
+    bool Save();
+
+    void Close();
+
+    // Returns a pointer to the data of the entry with the given key, or nullptr
+    // if the cache has no valid entry of @Size bytes for that key. The pointer
+    // stays valid until Close(). Safe to call from any thread
+    const uint8_t* Find(uint64_t Key, uint64_t Size);
+
+    // Stores a copy of @Data. Safe to call from any thread
+    void Add(uint64_t Key, const void* Data, uint64_t Size);
+
+    // Checks the data of every entry we haven't used yet, so Save drops the
+    // corrupt ones. Returns the number of corrupt entries in the file
+    uint64_t Verify();
+
+    FStats GetStats();
+
+    // Validates the cache file at @Path and prints a summary and (if @Verbose)
+    // every entry to @Print. Returns false if the file is not a valid cache
+    static bool Inspect(const char* Path, bool Verbose, void (*Print)(const char* Line, void* User), void* User);
+
+private:
+    enum EEntryState : uint8_t
+    {
+        ENTRY_Unverified,
+        ENTRY_Valid,
+        ENTRY_Corrupt,
+    };
+
+    void Unmap();
+
+    std::mutex                  Lock;
+    std::string                 Path;
+    uint64_t                    MaxBytes{};
+
+    // Memory-mapped cache file
+    const uint8_t*              Mapped{};
+    uint64_t                    MappedSize{};
+    const FDiskCacheEntry*      Entries{};
+    uint64_t                    NumEntries{};
+    std::vector<uint8_t>        EntryStates;
+    std::vector<uint8_t>        EntryUsed;
+
+    // New entries
+    std::unordered_map<uint64_t, std::vector<uint8_t>> Pending;
+    uint64_t                    PendingBytes{};
+
+    uint64_t                    NumHits{};
+    uint64_t                    NumMisses{};
+    uint64_t                    NumCorruptEntries{};
+};
@@ -0,0 +1,59 @@
+/*=============================================================================
+    FruCoRe_DrawBatching.h: Merging of consecutive draw commands.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+
+//
+// The complex and gouraud vertices carry the index of their instance data,
+// so the vertex shader doesn't need the instance ID to find it. That means
+// consecutive draws that share the same render state can go out as one
+// native draw call, even if each of them has its own instance data.
+//
+// Tries to append draw command @Next to @Prev. C must have the fields of
+// MultiDrawIndirectBuffer::DrawCommand. Indexed draws merge if their
+// indices are adjacent in the index buffer. Non-indexed draws merge if
+// their vertices are adjacent in the vertex buffer. We never merge draws
+// that use more than one instance, since those do rely on the instance ID.
+// Empty draws merge with anything. Returns true if @Next is now part of
+// @Prev, in which case the caller should drop @Next.
+//
+template<typename C> bool MergeDrawCommands(C& Prev, const C& Next)
+{
+    if (Next.vertexCount == 0 && Next.indexCount == 0)
+        return true;
+
+    if (Prev.vertexCount == 0 && Prev.indexCount == 0)
+    {
+        Prev = Next;
+        return true;
+    }
+
+    if (Prev.instanceCount != 1 || Next.instanceCount != 1)
+        return false;
+
+    if (Prev.indexCount && Next.indexCount)
+    {
+        if (Prev.indexStart + Prev.indexCount != Next.indexStart)
+            return false;
+        Prev.indexCount += Next.indexCount;
+        Prev.vertexCount += Next.vertexCount;
+        return true;
+    }
+
+    if (!Prev.indexCount && !Next.indexCount)
+    {
+        if (Prev.vertexStart + Prev.vertexCount != Next.vertexStart)
+            return false;
+        Prev.vertexCount += Next.vertexCount;
+        return true;
+    }
+
+    return false;
+}
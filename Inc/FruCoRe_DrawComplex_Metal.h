@@ -1,8 +1,17 @@
+// 16 bytes. The shader reconstructs w. Instance is the index of the vertex's
+// instance data, so we can draw several surfaces with one draw call (see
+// FruCoRe_DrawBatching.h)
 typedef struct
 {
-    simd::float4 Point;
+    PackedFloat3 Point;
+    uint32_t     Instance;
 } ComplexVertex;
 
+// Draws of cached world-space facets (see CacheWorldGeometry) start at this
+// vertex ID. Their vertices are shared between frames, so they can't carry an
+// instance index. The shader uses the instance ID for those instead
+#define COMPLEX_WORLD_VERTEX_BASE (1 << 24)
+
 // Data for one draw call
 typedef struct
 {
@@ -1,10 +1,12 @@
+// 32 bytes. Fog colors live in a separate stream (IDX_DrawGouraudFogData) that
+// we only fill for PF_RenderFog polys. Light is a half because actor lighting
+// can exceed 1, and UV stays a float because mesh UVs are in texels
 typedef struct
 {
-    simd::float4 Point;
-    simd::float4 Normal;
-    simd::float4 UV;
-    simd::float4 LightColor;
-    simd::float4 FogColor;
+    simd::float2 UV;
+    PackedFloat3 Point;
+    uint32_t     Instance;      // Index of this vertex's instance data. Fills what used to be padding
+    PackedHalf4  LightColor;
 } GouraudVertex;
 
 // Data for one draw call
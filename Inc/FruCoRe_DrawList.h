@@ -0,0 +1,134 @@
+/*=============================================================================
+    FruCoRe_DrawList.h: Sort keys and storage for deferred opaque draws.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+//
+// Layout of the 64-bit sort key, from the most significant bit down. We sort
+// by the state that is most expensive to change first. The pipeline state and
+// textures are hashed pointers, so two different states can end up with the
+// same key. That only costs us some batching. The caller still compares the
+// actual state before it changes anything.
+//
+//   63..61     shader program
+//   60..47     pipeline state
+//   46..45     depth mode
+//   44..30     diffuse texture
+//   29..18     lightmap
+//   17..12     fogmap
+//   11..6      detail texture
+//    5..0      macro texture
+//
+#define DRAWKEY_PROGRAM_BITS    3
+#define DRAWKEY_PIPELINE_BITS   14
+#define DRAWKEY_DEPTH_BITS      2
+#define DRAWKEY_DIFFUSE_BITS    15
+#define DRAWKEY_LIGHTMAP_BITS   12
+#define DRAWKEY_FOGMAP_BITS     6
+#define DRAWKEY_DETAIL_BITS     6
+#define DRAWKEY_MACRO_BITS      6
+
+// Number of textures MakeDrawSortKey reads, in texture index order
+#define DRAWKEY_NUM_TEXTURES    5
+
+//
+// Hashes @Ptr down to @Bits bits. Null pointers always hash to 0, so draws
+// that don't use a texture sort before the ones that do
+//
+inline uint64_t HashDrawKeyPointer(const void* Ptr, uint32_t Bits)
+{
+    if (!Ptr)
+        return 0;
+
+    // Fibonacci hashing. The top bits of the product depend on all bits
+    // of the pointer, including the low ones that differ between objects
+    // allocated back to back
+    const uint64_t Hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(Ptr)) * 0x9E3779B97F4A7C15ull;
+    const uint64_t Result = Hash >> (64 - Bits);
+    return Result ? Result : 1;
+}
+
+//
+// Builds the sort key for a draw with shader program @Program, pipeline state
+// @PipelineState, and depth mode @DepthMode. @Textures holds the
+// DRAWKEY_NUM_TEXTURES textures the draw has bound (diffuse, lightmap, fogmap,
+// detail, macro). Unused slots may be null.
+//
+inline uint64_t MakeDrawSortKey(uint32_t Program, const void* PipelineState, uint32_t DepthMode, const void* const* Textures)
+{
+    uint64_t Key = Program & ((1u << DRAWKEY_PROGRAM_BITS) - 1);
+    Key = (Key << DRAWKEY_PIPELINE_BITS) | HashDrawKeyPointer(PipelineState, DRAWKEY_PIPELINE_BITS);
+    Key = (Key << DRAWKEY_DEPTH_BITS)    | (DepthMode & ((1u << DRAWKEY_DEPTH_BITS) - 1));
+    Key = (Key << DRAWKEY_DIFFUSE_BITS)  | HashDrawKeyPointer(Textures[0], DRAWKEY_DIFFUSE_BITS);
+    Key = (Key << DRAWKEY_LIGHTMAP_BITS) | HashDrawKeyPointer(Textures[1], DRAWKEY_LIGHTMAP_BITS);
+    Key = (Key << DRAWKEY_FOGMAP_BITS)   | HashDrawKeyPointer(Textures[2], DRAWKEY_FOGMAP_BITS);
+    Key = (Key << DRAWKEY_DETAIL_BITS)   | HashDrawKeyPointer(Textures[3], DRAWKEY_DETAIL_BITS);
+    Key = (Key << DRAWKEY_MACRO_BITS)    | HashDrawKeyPointer(Textures[4], DRAWKEY_MACRO_BITS);
+    return Key;
+}
+
+//
+// List of deferred draws of type T. Sort orders the draws by key, but keeps
+// draws with equal keys in the order we recorded them, so coplanar draws with
+// the same state still come out in engine order. We sort a compact array of
+// keys and indices rather than the draws themselves.
+//
+// The list keeps its memory when we reset it, so in steady state, recording
+// a frame's draws does not hit the heap.
+//
+template<typename T> class TDeferredDrawList
+{
+public:
+    // Appends a draw with sort key @Key and returns it so the caller can fill it in
+    T& Add(uint64_t Key)
+    {
+        Order.push_back({ Key, static_cast<uint32_t>(Draws.size()) });
+        Draws.emplace_back();
+        bSorted = false;
+        return Draws.back();
+    }
+
+    void Sort()
+    {
+        if (!bSorted)
+            std::sort(Order.begin(), Order.end(), [](const FEntry& A, const FEntry& B)
+            {
+                return A.Key < B.Key || (A.Key == B.Key && A.Index < B.Index);
+            });
+        bSorted = true;
+    }
+
+    void Reset()
+    {
+        Draws.clear();
+        Order.clear();
+        bSorted = true;
+    }
+
+    size_t Num() const { return Draws.size(); }
+
+    // Returns the @i-th draw in sorted order. Only valid after Sort
+    const T& operator[](size_t i) const { return Draws[Order[i].Index]; }
+    uint64_t GetKey(size_t i) const { return Order[i].Key; }
+
+private:
+    struct FEntry
+    {
+        uint64_t Key;
+        uint32_t Index;
+    };
+
+    std::vector<T>      Draws;
+    std::vector<FEntry> Order;
+    bool                bSorted{true};
+};
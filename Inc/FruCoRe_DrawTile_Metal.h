@@ -1,16 +1,9 @@
+// Data for one tile. The shader generates the quad from vertex_id, so
+// tiles don't have any vertex data (see FruCoRe_TilePacking.h)
 typedef struct
 {
-    simd::float4 Point;
-    simd::float4 UV;
-} TileVertex;
-
-// Data for one draw call
-typedef struct
-{
-    simd::float4 DrawColor;
-    simd::float4 HitColor;
-    float UMult;
-    float VMult;
-    float UPan;
-    float VPan;
+    simd::float4 Rect;          // X, Y, XL, YL in screen space
+    simd::float4 UVRect;        // U, V, UL, VL in normalized texture coordinates
+    float        Z;             // Depth in camera space
+    PackedHalf4  DrawColor;
 } TileInstanceData;
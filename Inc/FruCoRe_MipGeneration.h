@@ -0,0 +1,49 @@
+/*=============================================================================
+    FruCoRe_MipGeneration.h: Mip chain generation for single-mip textures.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    All images are arrays of 32-bit texels with the red channel in the first
+    byte and the alpha channel in the last byte (i.e., RGBA8Unorm).
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Alpha threshold of the masked rendering alpha test (Color.a < 0.5 is discarded)
+#define MIPGEN_MASK_THRESHOLD 128
+
+// Number of levels in a full mip chain that starts at @USize x @VSize
+uint32_t GetFullMipCount(uint32_t USize, uint32_t VSize);
+
+//
+// Downsamples a @USize x @VSize image into a max(1, @USize/2) x
+// max(1, @VSize/2) image with a 2x2 box filter.
+//
+// The color channels hold sRGB-encoded values, so we average them in linear
+// space. We also weight them by alpha, so fully transparent texels (e.g.,
+// the masked-out texels of a P8 texture) don't darken the edges of the
+// opaque areas. Alpha itself is averaged as is.
+//
+// DownsampleMip filters four output texels at a time with SSE2 or NEON where
+// available. DownsampleMipScalar is the reference implementation.
+//
+void DownsampleMip(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst);
+void DownsampleMipScalar(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst);
+
+// Fraction of the @Count texels whose alpha is at least @Threshold
+float ComputeAlphaCoverage(const uint32_t* Texels, size_t Count, uint8_t Threshold);
+
+//
+// Box-filtered alpha gets smoother with every mip, so alpha-tested textures
+// (fences, foliage) lose more and more texels to the alpha test in the
+// smaller mips. This function scales the alpha channel of @Texels so the
+// fraction of texels that pass the alpha test at @Threshold matches
+// @TargetCoverage (usually the coverage of the top mip) as closely as
+// possible.
+//
+void ScaleAlphaToCoverage(uint32_t* Texels, size_t Count, float TargetCoverage, uint8_t Threshold);
@@ -0,0 +1,63 @@
+/*=============================================================================
+    FruCoRe_PolygonFans.h: Fan index emission for convex polygons.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// The engine hands us convex polygons as a list of points. We used to
+// "unfan" them by writing vertex 0 again for every triangle, which turns
+// an N-gon into 3 * (N - 2) full vertices. Instead, we now write every
+// point once and triangulate the polygon with 16-bit fan indices.
+//
+// The indices are absolute positions in the vertex buffer, so the vertex
+// buffers of the indexed programs must not hold more than 65536 vertices.
+//
+#define FAN_MAX_VERTICES 65536
+
+// Number of indices we need to triangulate a polygon with @NumPts points
+inline uint32_t GetFanIndexCount(uint32_t NumPts)
+{
+    return NumPts >= 3 ? 3 * (NumPts - 2) : 0;
+}
+
+// Bytes we write for a polygon if we unfan it into a plain triangle list
+inline size_t GetUnfannedBytes(uint32_t NumPts, size_t VertexSize)
+{
+    return GetFanIndexCount(NumPts) * VertexSize;
+}
+
+// Bytes we write for a polygon if we write each point once, plus the fan indices
+inline size_t GetIndexedFanBytes(uint32_t NumPts, size_t VertexSize)
+{
+    return NumPts * VertexSize + GetFanIndexCount(NumPts) * sizeof(uint16_t);
+}
+
+// For triangles, the indices cost more than the vertices they save
+inline bool ShouldIndexFan(uint32_t NumPts, size_t VertexSize)
+{
+    return GetIndexedFanBytes(NumPts, VertexSize) < GetUnfannedBytes(NumPts, VertexSize);
+}
+
+//
+// Writes the indices of the triangles (0, 1, 2), (0, 2, 3), ... of a
+// polygon whose first point is at @FirstVertex in the vertex buffer.
+// Returns a pointer past the last index we wrote.
+//
+inline uint16_t* EmitFanIndices(uint16_t* Out, uint32_t FirstVertex, uint32_t NumPts)
+{
+    for (uint32_t i = 1; i + 1 < NumPts; ++i)
+    {
+        *Out++ = static_cast<uint16_t>(FirstVertex);
+        *Out++ = static_cast<uint16_t>(FirstVertex + i);
+        *Out++ = static_cast<uint16_t>(FirstVertex + i + 1);
+    }
+    return Out;
+}
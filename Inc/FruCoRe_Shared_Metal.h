@@ -14,7 +14,8 @@ enum ShaderOptions
     OPT_MSAAx4          = 0x0400,
     OPT_MSAAx8          = 0x0800,
 	OPT_NoSmooth        = 0x1000,
-    OPT_Max             = 0x1000
+    OPT_PalettedTexture = 0x2000,  // diffuse texture is an R8 index texture + a 256x1 palette texture
+    OPT_Max             = 0x2000
 };
 
 // Metal vertex shaders all share the same argument table.
@@ -24,7 +25,7 @@ enum BufferIndices
 {
     IDX_Uniforms,                       // 0
     IDX_DrawTileInstanceData,           // 1
-    IDX_DrawTileVertexData,             // 2
+    IDX_DrawTileVertexData,             // 2 (unused, tiles have no vertex data)
     IDX_DrawGouraudInstanceData,        // 3
     IDX_DrawGouraudVertexData,          // 4
     IDX_DrawComplexInstanceData,        // 5
@@ -32,16 +33,33 @@ enum BufferIndices
     IDX_DrawSimpleTriangleInstanceData, // 7
     IDX_DrawSimpleTriangleVertexData,   // 8
     IDX_DrawSimpleLineInstanceData,     // 9
-    IDX_DrawSimpleLineVertexData        // 10
+    IDX_DrawSimpleLineVertexData,       // 10
+    IDX_DrawGouraudFogData,             // 11
+    IDX_DrawComplexWorldVertexData,     // 12
+    IDX_FrameUniforms                   // 13
 };
 
+//
+// Compact vertex attributes. The CPU side has no packed_float3 or half4, so we
+// declare structs with the same size and alignment instead. The halves are
+// converted with FloatToHalf (see FruCoRe_VertexPacking.h)
+//
+#if __METAL_VERSION__
+typedef packed_float3 PackedFloat3;
+typedef half4 PackedHalf4;
+#else
+typedef struct { float X, Y, Z; } PackedFloat3;
+typedef struct alignas(8) { uint16_t Bits[4]; } PackedHalf4;
+#endif
+
 enum TextureIndices
 {
     IDX_DiffuseTexture,
     IDX_LightMap,
     IDX_FogMap,
     IDX_DetailTexture,
-    IDX_MacroTexture
+    IDX_MacroTexture,
+    IDX_DiffusePalette
 };
 
 //
@@ -72,6 +90,16 @@ struct GlobalUniforms
     uint32_t DetailMax;
 };
 
+// Uniforms we only set once per frame. These are passed with setVertexBytes,
+// so updating them doesn't rotate the global uniforms buffer
+struct FrameUniforms
+{
+    // World coordinates => camera coordinates of the top-level scene node.
+    // Only used for the BSP surfaces we've cached in world space (see
+    // CacheWorldGeometry)
+    simd::float4x4 ViewMatrix;
+};
+
 #if __METAL_VERSION__
 
 //
@@ -86,6 +114,7 @@ constant bool IsMasked          [[ function_constant(OPT_Masked)        ]];
 constant bool IsAlphaBlended    [[ function_constant(OPT_AlphaBlended)  ]];
 constant bool ShouldRenderFog   [[ function_constant(OPT_RenderFog)     ]];
 constant bool NoSmooth          [[ function_constant(OPT_NoSmooth)      ]];
+constant bool IsPaletted        [[ function_constant(OPT_PalettedTexture) ]];
 
 constant float2 FullscreenQuad[] =
 {
@@ -126,6 +155,63 @@ inline float4 ApplyPolyFlags(float4 Color, float4 LightColor)
     return Color;
 }
 
+//
+// Paletted texture support. The index texture is an R8Unorm texture and the
+// palette is a 256x1 RGBA8Unorm texture. We filter manually so we get the same
+// results as we would get by sampling the expanded RGBA8 texture with the
+// samplers of the draw shaders: bilinear within the mip and linear between
+// mips, or nearest within the mip and nearest mip. @Clamp selects
+// clamp-to-edge addressing instead of repeat (for NoSmooth tiles).
+//
+// When rendering masked polygons, palette index 0 is fully transparent. This
+// matches what P8ToRGBA8 does for PF_Masked textures.
+//
+inline float4 PalettedTexel(texture2d<float, access::sample> Indices, texture2d<float, access::sample> Palette, int2 Coords, uint Level, int2 Size, bool Clamp)
+{
+    Coords = Clamp ? clamp(Coords, int2(0), Size - 1) : ((Coords % Size) + Size) % Size;
+    const uint Index = uint(Indices.read(uint2(Coords), Level).r * 255.0 + 0.5);
+    if (IsMasked && Index == 0)
+        return float4(0.0);
+    return Palette.read(uint2(Index, 0));
+}
+
+inline float4 SamplePalettedLevel(texture2d<float, access::sample> Indices, texture2d<float, access::sample> Palette, float2 UV, uint Level, bool Bilinear, bool Clamp)
+{
+    const int2 Size = int2(max(Indices.get_width(Level), 1u), max(Indices.get_height(Level), 1u));
+    const float2 TexelPos = UV * float2(Size);
+    
+    if (!Bilinear)
+        return PalettedTexel(Indices, Palette, int2(floor(TexelPos)), Level, Size, Clamp);
+    
+    const float2 Pos = TexelPos - 0.5;
+    const int2 P0 = int2(floor(Pos));
+    const float2 F = Pos - floor(Pos);
+    const float4 T00 = PalettedTexel(Indices, Palette, P0            , Level, Size, Clamp);
+    const float4 T10 = PalettedTexel(Indices, Palette, P0 + int2(1, 0), Level, Size, Clamp);
+    const float4 T01 = PalettedTexel(Indices, Palette, P0 + int2(0, 1), Level, Size, Clamp);
+    const float4 T11 = PalettedTexel(Indices, Palette, P0 + int2(1, 1), Level, Size, Clamp);
+    return mix(mix(T00, T10, F.x), mix(T01, T11, F.x), F.y);
+}
+
+inline float4 SamplePaletted(texture2d<float, access::sample> Indices, texture2d<float, access::sample> Palette, float2 UV, float LODBias, bool Bilinear, bool Clamp)
+{
+    const float2 BaseSize = float2(Indices.get_width(), Indices.get_height());
+    const float2 dX = dfdx(UV * BaseSize);
+    const float2 dY = dfdy(UV * BaseSize);
+    const float MaxLevel = float(Indices.get_num_mip_levels() - 1);
+    const float Lod = clamp(0.5 * log2(max(max(dot(dX, dX), dot(dY, dY)), 1e-8)) + LODBias, 0.0, MaxLevel);
+    
+    if (!Bilinear)
+        return SamplePalettedLevel(Indices, Palette, UV, uint(round(Lod)), false, Clamp);
+    
+    const uint Level = uint(floor(Lod));
+    const float Blend = Lod - float(Level);
+    const float4 Color = SamplePalettedLevel(Indices, Palette, UV, Level, true, Clamp);
+    if (Blend == 0.0)
+        return Color;
+    return mix(Color, SamplePalettedLevel(Indices, Palette, UV, Level + 1, true, Clamp), Blend);
+}
+
 inline float3 rgb2hsv(float3 c)
 {
   float4 K = float4(0.0, -1.0 / 3.0, 2.0 / 3.0, -1.0); // some nice stuff from http://lolengine.net/blog/2013/07/27/rgb-to-hsv-in-glsl
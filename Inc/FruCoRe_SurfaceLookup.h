@@ -0,0 +1,203 @@
+/*=============================================================================
+    FruCoRe_SurfaceLookup.h: Maps BSP facets back to the surfaces they belong to.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "FruCoRe_TextureMap.h"
+
+//
+// DrawComplexSurface gets clipped camera-space polys and no surface index,
+// but it does get the facet's texture mapping. Transformed back to world
+// space, the mapping's origin and axes are the surface's base point and
+// texture vectors (FBspSurf::pBase, vTextureU and vTextureV). That narrows
+// the facet down to one level surface, but brushes outside the level's BSP
+// can share a mapping, so we still check the facet's polygons against the
+// surface's nodes (see IsClippedNode) before we trust the match.
+//
+struct FSurfaceMapping
+{
+    float Origin[3];
+    float XAxis[3];
+    float YAxis[3];
+};
+
+//
+// Base points are nearly always on the editor grid, so we bucket surfaces by
+// their base point rounded to whole units. Each bucket is a run in a sorted
+// array, and a hash table maps the bucket's key to its run. Within a run, we
+// compare the exact mappings with a tolerance that absorbs the round trip
+// through camera space. Lookups fail if no surface matches, or if several do
+// (e.g., two brushes with the same texture alignment on the same plane).
+//
+class FSurfaceLookup
+{
+public:
+    void Reset()
+    {
+        Entries.clear();
+        Buckets.Empty();
+    }
+
+    // Adds surface @Surf. Call Build once all surfaces are in
+    void Add(int32_t Surf, const FSurfaceMapping& Mapping)
+    {
+        Entries.push_back(FEntry{ GetKey(Mapping.Origin), Surf, Mapping });
+    }
+
+    void Build()
+    {
+        std::sort(Entries.begin(), Entries.end(), [](const FEntry& A, const FEntry& B) { return A.Key < B.Key; });
+        Buckets.Empty();
+        for (size_t i = 0; i < Entries.size(); ++i)
+            if (i == 0 || Entries[i].Key != Entries[i - 1].Key)
+                Buckets.Set(Entries[i].Key, &Entries[i]);
+    }
+
+    // Returns the surface whose mapping matches @Mapping, or -1
+    int32_t Find(const FSurfaceMapping& Mapping)
+    {
+        const uint64_t Key = GetKey(Mapping.Origin);
+        const FEntry* It = Buckets.FindRef(Key);
+        if (!It)
+            return -1;
+
+        int32_t Result = -1;
+        for (const FEntry* End = Entries.data() + Entries.size(); It != End && It->Key == Key; ++It)
+        {
+            if (!Matches(It->Mapping, Mapping))
+                continue;
+            if (Result != -1)
+                return -1;
+            Result = It->Surf;
+        }
+        return Result;
+    }
+
+    size_t Num() const
+    {
+        return Entries.size();
+    }
+
+private:
+    struct FEntry
+    {
+        uint64_t        Key;
+        int32_t         Surf;
+        FSurfaceMapping Mapping;
+    };
+
+    // 21 bits per axis covers the +/-1M unit range, well past the edge of any map
+    static uint64_t GetKey(const float* Origin)
+    {
+        uint64_t Key = 0;
+        for (int i = 0; i < 3; ++i)
+            Key = (Key << 21) | (static_cast<uint64_t>(static_cast<int64_t>(floorf(Origin[i] + 0.5f))) & 0x1FFFFF);
+        return Key;
+    }
+
+    static bool Matches(const FSurfaceMapping& A, const FSurfaceMapping& B)
+    {
+        return IsNear(A.Origin, B.Origin, 1.f / 16.f) &&
+               IsNear(A.XAxis, B.XAxis, GetLength(A.XAxis) / 1024.f) &&
+               IsNear(A.YAxis, B.YAxis, GetLength(A.YAxis) / 1024.f);
+    }
+
+    static bool IsNear(const float* A, const float* B, float Tolerance)
+    {
+        return fabsf(A[0] - B[0]) <= Tolerance && fabsf(A[1] - B[1]) <= Tolerance && fabsf(A[2] - B[2]) <= Tolerance;
+    }
+
+    static float GetLength(const float* V)
+    {
+        return sqrtf(V[0] * V[0] + V[1] * V[1] + V[2] * V[2]);
+    }
+
+    std::vector<FEntry> Entries;
+    TTextureCacheMap<const FEntry*> Buckets;   // First entry of every key
+};
+
+//
+// The engine draws a BSP node by clipping its polygon to the view frustum.
+// A matching texture mapping only tells us which surface a facet polygon
+// may belong to, so before we draw a cached node in its place, we check
+// that the polygon really is that node after clipping: all of its points
+// are on the node's plane and inside its outline, and every point that
+// isn't one of the node's vertices is on a side plane of the frustum.
+// Polygons of other brushes (e.g., movers) that happen to share a level
+// surface's texture mapping fail this unless they have the exact same shape.
+//
+// @NodePoints holds the node's @NumNodePoints world-space vertices in
+// winding order, and @Points the polygon's @NumPoints world-space points.
+// @OnFrustumEdge(i) returns true if point i is on a side plane of the
+// frustum. @Tolerance absorbs the round trip through camera space.
+//
+template<typename F> bool IsClippedNode(const float* NodePoints, uint32_t NumNodePoints, const float* Points, uint32_t NumPoints, float Tolerance, F&& OnFrustumEdge)
+{
+    if (NumNodePoints < 3 || NumPoints < 3)
+        return false;
+
+    // Newell's method gives us a normal that agrees with the winding
+    float Normal[3] = {};
+    for (uint32_t i = 0; i < NumNodePoints; ++i)
+    {
+        const float* A = &NodePoints[i * 3];
+        const float* B = &NodePoints[((i + 1) % NumNodePoints) * 3];
+        Normal[0] += (A[1] - B[1]) * (A[2] + B[2]);
+        Normal[1] += (A[2] - B[2]) * (A[0] + B[0]);
+        Normal[2] += (A[0] - B[0]) * (A[1] + B[1]);
+    }
+    const float Length = sqrtf(Normal[0] * Normal[0] + Normal[1] * Normal[1] + Normal[2] * Normal[2]);
+    if (Length <= 0.f)
+        return false;
+    for (int c = 0; c < 3; ++c)
+        Normal[c] /= Length;
+    const float PlaneW = Normal[0] * NodePoints[0] + Normal[1] * NodePoints[1] + Normal[2] * NodePoints[2];
+
+    bool bClipped = false;
+    for (uint32_t i = 0; i < NumPoints; ++i)
+    {
+        const float* P = &Points[i * 3];
+        if (fabsf(Normal[0] * P[0] + Normal[1] * P[1] + Normal[2] * P[2] - PlaneW) > Tolerance)
+            return false;
+
+        bool bVertex = false;
+        for (uint32_t j = 0; j < NumNodePoints; ++j)
+        {
+            const float* A = &NodePoints[j * 3];
+            const float* B = &NodePoints[((j + 1) % NumNodePoints) * 3];
+            const float Edge[3] = { B[0] - A[0], B[1] - A[1], B[2] - A[2] };
+            const float ToP[3] = { P[0] - A[0], P[1] - A[1], P[2] - A[2] };
+
+            // Distance from the edge, positive on the inside
+            const float Inside =
+                (Normal[0] * (Edge[1] * ToP[2] - Edge[2] * ToP[1]) +
+                 Normal[1] * (Edge[2] * ToP[0] - Edge[0] * ToP[2]) +
+                 Normal[2] * (Edge[0] * ToP[1] - Edge[1] * ToP[0])) /
+                fmaxf(sqrtf(Edge[0] * Edge[0] + Edge[1] * Edge[1] + Edge[2] * Edge[2]), 1e-6f);
+            if (Inside < -Tolerance)
+                return false;
+
+            bVertex = bVertex || (fabsf(ToP[0]) <= Tolerance && fabsf(ToP[1]) <= Tolerance && fabsf(ToP[2]) <= Tolerance);
+        }
+
+        if (!bVertex)
+        {
+            if (!OnFrustumEdge(i))
+                return false;
+            bClipped = true;
+        }
+    }
+
+    // An unclipped polygon must have all of the node's vertices
+    return bClipped || NumPoints == NumNodePoints;
+}
@@ -0,0 +1,70 @@
+/*=============================================================================
+    FruCoRe_Telemetry.h: Counters for the texture subsystem.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TIME_HISTOGRAM_BUCKETS 20
+
+//
+// Histogram of durations with power-of-two microsecond buckets. Bucket 0
+// counts durations below 1us, bucket i counts durations in [2^(i-1), 2^i) us,
+// and the last bucket counts everything longer than that.
+//
+// Add is safe to call from any thread. The readers may see a slightly
+// inconsistent snapshot while other threads are adding samples.
+//
+struct FTimeHistogram
+{
+    uint64_t Buckets[TIME_HISTOGRAM_BUCKETS];
+    uint64_t NumSamples;
+    uint64_t TotalMicroseconds;
+
+    void Reset()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void Add(double Seconds)
+    {
+        const uint64_t Microseconds = Seconds > 0.0 ? static_cast<uint64_t>(Seconds * 1000000.0) : 0;
+        int Bucket = 0;
+        while (Bucket < TIME_HISTOGRAM_BUCKETS - 1 && Microseconds >= GetBucketLimit(Bucket))
+            Bucket++;
+
+        __sync_fetch_and_add(&Buckets[Bucket], 1);
+        __sync_fetch_and_add(&NumSamples, 1);
+        __sync_fetch_and_add(&TotalMicroseconds, Microseconds);
+    }
+
+    // Exclusive upper bound of @Bucket, in microseconds. The last bucket has no upper bound
+    static uint64_t GetBucketLimit(int Bucket)
+    {
+        return Bucket < TIME_HISTOGRAM_BUCKETS - 1 ? (1ull << Bucket) : UINT64_MAX;
+    }
+
+    // Upper bound of the bucket that contains the @Fraction percentile
+    uint64_t GetPercentile(double Fraction) const
+    {
+        if (NumSamples == 0)
+            return 0;
+
+        const uint64_t Target = static_cast<uint64_t>(Fraction * NumSamples);
+        uint64_t Seen = 0;
+        for (int Bucket = 0; Bucket < TIME_HISTOGRAM_BUCKETS - 1; ++Bucket)
+        {
+            Seen += Buckets[Bucket];
+            if (Seen > Target)
+                return GetBucketLimit(Bucket);
+        }
+        return GetBucketLimit(TIME_HISTOGRAM_BUCKETS - 2) * 2;
+    }
+};
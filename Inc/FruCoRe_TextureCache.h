@@ -0,0 +1,118 @@
+/*=============================================================================
+    FruCoRe_TextureCache.h: Texture cache bookkeeping helpers.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    The renderer instantiates these helpers with its own CachedTexture
+    type, but they work with any type that has the members listed below.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+//
+// Fast, non-cryptographic 64-bit hash of @Size bytes at @Data. Hashes can be
+// chained by passing the previous hash as the @Seed of the next call.
+//
+inline uint64_t HashBytes64(const void* Data, size_t Size, uint64_t Seed = 0)
+{
+    const uint64_t C1 = 0x87C37B91114253D5ull;
+    const uint64_t C2 = 0x4CF5AD432745937Full;
+    const uint8_t* Ptr = static_cast<const uint8_t*>(Data);
+    uint64_t Hash = Seed ^ (Size * 0x9E3779B97F4A7C15ull);
+
+    for (; Size >= 8; Size -= 8, Ptr += 8)
+    {
+        uint64_t Word;
+        memcpy(&Word, Ptr, 8);
+        Word *= C1;
+        Word = (Word << 31) | (Word >> 33);
+        Word *= C2;
+        Hash ^= Word;
+        Hash = ((Hash << 27) | (Hash >> 37)) * 5 + 0x52DCE729;
+    }
+
+    uint64_t Tail = 0;
+    memcpy(&Tail, Ptr, Size);
+    Hash ^= Tail * C2;
+
+    // MurmurHash3 finalizer
+    Hash ^= Hash >> 33;
+    Hash *= 0xFF51AFD7ED558CCDull;
+    Hash ^= Hash >> 33;
+    Hash *= 0xC4CEB9FE1A85EC53ull;
+    Hash ^= Hash >> 33;
+    return Hash;
+}
+
+//
+// Size in bytes of a single USize x VSize mip. Uncompressed formats have a
+// BlockWidth of 1. Block-compressed formats have a BlockWidth of 4 and
+// always occupy at least one full block per mip.
+//
+inline uint64_t GetMipSizeBytes(uint32_t USize, uint32_t VSize, uint32_t BlockWidth, uint32_t BytesPerBlock)
+{
+    const uint64_t BlocksX = (USize + BlockWidth - 1) / BlockWidth;
+    const uint64_t BlocksY = (VSize + BlockWidth - 1) / BlockWidth;
+    return BlocksX * BlocksY * BytesPerBlock;
+}
+
+// Size in bytes of a full mip chain that starts at USize x VSize
+inline uint64_t GetMipChainSizeBytes(uint32_t USize, uint32_t VSize, uint32_t NumMips, uint32_t BlockWidth, uint32_t BytesPerBlock)
+{
+    uint64_t Result = 0;
+    for (uint32_t i = 0; i < NumMips; ++i)
+    {
+        Result += GetMipSizeBytes(USize, VSize, BlockWidth, BytesPerBlock);
+        USize = USize > 1 ? USize / 2 : 1;
+        VSize = VSize > 1 ? VSize / 2 : 1;
+    }
+    return Result;
+}
+
+//
+// Least-recently-used eviction policy for a memory-budgeted texture cache.
+//
+// T must have the following members:
+//  int32_t  LastUsedFrame - Number of the last frame in which the texture was bound
+//  uint64_t SizeBytes     - Amount of GPU memory the texture occupies
+//
+// Given the @NumEntries cached textures in @Entries, this function selects the
+// least recently used textures that need to be evicted to bring @UsedBytes
+// down to @BudgetBytes. Textures that were used after @CompletedFrame (i.e.,
+// textures that may still be referenced by an in-flight command buffer) are
+// never selected.
+//
+// The selected textures are written to @OutEvict, which must have room for
+// @NumEntries pointers. @Entries is reordered. Returns the number of textures
+// that should be evicted.
+//
+template<typename T> size_t SelectTexturesToEvict(T** Entries, size_t NumEntries, uint64_t UsedBytes, uint64_t BudgetBytes, int32_t CompletedFrame, T** OutEvict)
+{
+    if (UsedBytes <= BudgetBytes)
+        return 0;
+
+    // Only consider textures the GPU is no longer using, oldest first
+    T** End = std::partition(Entries, Entries + NumEntries, [CompletedFrame](const T* Entry)
+    {
+        return Entry->LastUsedFrame <= CompletedFrame;
+    });
+    std::sort(Entries, End, [](const T* A, const T* B)
+    {
+        return A->LastUsedFrame < B->LastUsedFrame;
+    });
+
+    size_t NumEvicted = 0;
+    for (T** It = Entries; It != End && UsedBytes > BudgetBytes; ++It)
+    {
+        OutEvict[NumEvicted++] = *It;
+        UsedBytes -= std::min<uint64_t>(UsedBytes, (*It)->SizeBytes);
+    }
+    return NumEvicted;
+}
@@ -0,0 +1,54 @@
+/*=============================================================================
+    FruCoRe_TextureCompression.h: CPU-side BC1/BC3 block encoder.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    All images are arrays of 32-bit texels with the red channel in the first
+    byte and the alpha channel in the last byte (i.e., RGBA8Unorm).
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BC1_BLOCK_BYTES 8
+#define BC3_BLOCK_BYTES 16
+
+//
+// Single-block encoders and decoders. @Texels holds a 4x4 block in row-major
+// order.
+//
+// The encoders do a range fit: they inset the bounding box of the block's
+// colors (and alpha values) and use its corners as the endpoints. Each texel
+// then gets the index of the nearest palette entry. The BC3 encoder ignores
+// the color of fully transparent texels, so masked-out texels don't drag the
+// color endpoints towards black.
+//
+void EncodeBC1Block(const uint32_t Texels[16], uint8_t Out[BC1_BLOCK_BYTES]);
+void EncodeBC3Block(const uint32_t Texels[16], uint8_t Out[BC3_BLOCK_BYTES]);
+void DecodeBC1Block(const uint8_t In[BC1_BLOCK_BYTES], uint32_t Texels[16]);
+void DecodeBC3Block(const uint8_t In[BC3_BLOCK_BYTES], uint32_t Texels[16]);
+
+//
+// Encodes block rows [@FirstBlockRow, @FirstBlockRow + @NumBlockRows) of a
+// @USize x @VSize image. Images whose dimensions are not a multiple of 4 are
+// padded by replicating the edge texels. @Dst points to the start of the
+// encoded image (not to the first block row we encode), so several threads
+// can encode disjoint block rows of the same image.
+//
+void EncodeBC1Rows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t FirstBlockRow, uint32_t NumBlockRows, uint8_t* Dst);
+void EncodeBC3Rows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t FirstBlockRow, uint32_t NumBlockRows, uint8_t* Dst);
+
+// Decodes an entire image. Used to measure the encoder's quality
+void DecodeBC1Image(const uint8_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst);
+void DecodeBC3Image(const uint8_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst);
+
+// Returns true if any of the @Count texels is not fully opaque
+bool HasTranslucentTexels(const uint32_t* Texels, size_t Count);
+
+// Peak signal-to-noise ratio (in dB) between two images, over the RGB
+// channels and, optionally, the alpha channel. Returns 999 for identical images
+double ComputePSNR(const uint32_t* A, const uint32_t* B, size_t Count, bool IncludeAlpha);
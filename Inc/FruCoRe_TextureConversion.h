@@ -0,0 +1,79 @@
+/*=============================================================================
+    FruCoRe_TextureConversion.h: CPU-side texture conversion kernels.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    This header (and the matching source file) intentionally has no Metal or
+    Unreal dependencies so the kernels can be built and benchmarked on any
+    platform.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Palette expansion kernels. All kernels produce the exact same output as:
+//
+//   for (size_t i = 0; i < Count; ++i)
+//       Dst[i] = Palette[Src[i]];
+//
+// Palette must point to 256 entries. Src and Dst may be unaligned.
+//
+typedef void (*ExpandP8Func)(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count);
+
+enum EExpandP8Kernel
+{
+    EXPANDP8_Scalar,
+    EXPANDP8_SSE2,
+    EXPANDP8_AVX2,
+    EXPANDP8_NEON,
+    EXPANDP8_Max
+};
+
+void ExpandP8Scalar(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count);
+
+// Returns the requested kernel, or nullptr if this kernel was not compiled in
+// or is not supported by the CPU we're running on
+ExpandP8Func GetExpandP8Kernel(EExpandP8Kernel Kernel);
+const char* GetExpandP8KernelName(EExpandP8Kernel Kernel);
+
+// Returns the fastest kernel supported by this CPU. The result is cached after the first call.
+EExpandP8Kernel GetBestExpandP8Kernel();
+
+// Expands @Count palette indices using the fastest kernel supported by this CPU
+void ExpandP8(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count);
+
+//
+// Dirty region tracking for realtime P8 textures
+//
+struct FDirtyRect
+{
+    uint32_t X, Y, Width, Height;
+};
+
+//
+// Compares the @USize x @VSize indices in @Src against @Shadow and copies all
+// changed texels into @Shadow. Consecutive changed rows are merged into a
+// single rectangle that spans the changed columns of all of these rows.
+// If there are more than @MaxRects such rectangles, the remaining rows are
+// merged into the last rectangle. Returns the number of rectangles written to
+// @OutRects. @OutDirtyTexels receives the total area of these rectangles.
+//
+size_t DiffP8Rows(const uint8_t* Src, uint8_t* Shadow, uint32_t USize, uint32_t VSize, FDirtyRect* OutRects, size_t MaxRects, uint64_t* OutDirtyTexels);
+
+// Expands the texels within @Rect of a P8 image with @SrcPitch bytes per row.
+// The output is tightly packed (i.e., it has Rect.Width texels per row)
+void ExpandP8Rect(const uint32_t* Palette, const uint8_t* Src, uint32_t SrcPitch, const FDirtyRect& Rect, uint32_t* Dst);
+
+//
+// CPU reference implementation of SamplePalettedLevel in
+// FruCoRe_Shared_Metal.h (bilinear or nearest filtering, repeat or
+// clamp-to-edge addressing). When @Masked is true, palette index 0 is fully
+// transparent, just like in P8ToRGBA8. @Out receives the filtered color as
+// normalized floats, in the byte order of the palette entries.
+//
+void SamplePalettedReference(const uint8_t* Indices, int USize, int VSize, const uint32_t* Palette, bool Masked, bool Bilinear, bool Clamp, float U, float V, float Out[4]);
@@ -0,0 +1,211 @@
+/*=============================================================================
+    FruCoRe_TextureMap.h: Hash table that maps cache IDs to cached textures.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+//
+// Open-addressing hash table with Robin Hood probing, keyed by 64-bit cache
+// IDs. Keys and values are stored inline in a single flat array, so a lookup
+// usually touches one cache line. Removal uses backward shifting, so the
+// table never accumulates tombstones.
+//
+// Cache IDs encode the texture index in their low bits and the texture type
+// in their high bits, so we mix all 64 bits before we pick a slot.
+//
+// The table also remembers the last key it found. Consecutive lookups of the
+// same texture (e.g., a mesh that uses one skin for all of its polys) skip
+// the probe entirely.
+//
+// V must be a pointer type. Find returns nullptr for missing keys.
+//
+template<typename V> class TTextureCacheMap
+{
+public:
+    TTextureCacheMap() = default;
+    ~TTextureCacheMap()
+    {
+        free(Slots);
+    }
+
+    TTextureCacheMap(const TTextureCacheMap&) = delete;
+    TTextureCacheMap& operator=(const TTextureCacheMap&) = delete;
+
+    V FindRef(uint64_t Key)
+    {
+        if (LastValue && LastKey == Key)
+            return LastValue;
+
+        if (!Slots)
+            return nullptr;
+
+        uint32_t Index = static_cast<uint32_t>(Mix(Key)) & Mask;
+        for (uint32_t Distance = 1; Distance <= Slots[Index].Distance; ++Distance)
+        {
+            if (Slots[Index].Key == Key)
+            {
+                LastKey = Key;
+                LastValue = Slots[Index].Value;
+                return LastValue;
+            }
+            Index = (Index + 1) & Mask;
+        }
+        return nullptr;
+    }
+
+    // Adds or replaces the value for @Key
+    void Set(uint64_t Key, V Value)
+    {
+        if ((NumEntries + 1) * 8 > (Mask + 1) * 7 || !Slots)
+            Grow();
+
+        if (LastKey == Key)
+            LastValue = nullptr;
+
+        FSlot Pending{Key, Value, 1};
+        uint32_t Index = static_cast<uint32_t>(Mix(Key)) & Mask;
+        for (;;)
+        {
+            FSlot& Slot = Slots[Index];
+            if (Slot.Distance == 0)
+            {
+                Slot = Pending;
+                NumEntries++;
+                return;
+            }
+            if (Slot.Key == Pending.Key)
+            {
+                Slot.Value = Pending.Value;
+                return;
+            }
+
+            // Robin Hood: the entry that is further from its home slot keeps this one
+            if (Slot.Distance < Pending.Distance)
+            {
+                FSlot Displaced = Slot;
+                Slot = Pending;
+                Pending = Displaced;
+            }
+            Pending.Distance++;
+            Index = (Index + 1) & Mask;
+        }
+    }
+
+    void Remove(uint64_t Key)
+    {
+        if (!Slots)
+            return;
+
+        if (LastKey == Key)
+            LastValue = nullptr;
+
+        uint32_t Index = static_cast<uint32_t>(Mix(Key)) & Mask;
+        for (uint32_t Distance = 1; Distance <= Slots[Index].Distance; ++Distance)
+        {
+            if (Slots[Index].Key == Key)
+            {
+                // Shift the following entries back until we find one that is
+                // already in its home slot
+                uint32_t Next = (Index + 1) & Mask;
+                while (Slots[Next].Distance > 1)
+                {
+                    Slots[Index] = Slots[Next];
+                    Slots[Index].Distance--;
+                    Index = Next;
+                    Next = (Next + 1) & Mask;
+                }
+                Slots[Index] = FSlot{};
+                NumEntries--;
+                return;
+            }
+            Index = (Index + 1) & Mask;
+        }
+    }
+
+    void Empty()
+    {
+        free(Slots);
+        Slots = nullptr;
+        Mask = 0;
+        NumEntries = 0;
+        LastValue = nullptr;
+    }
+
+    uint32_t Num() const { return NumEntries; }
+
+    //
+    // Iterates over all entries. The table must not be modified while
+    // iterating.
+    //
+    class TIterator
+    {
+    public:
+        explicit TIterator(TTextureCacheMap& InMap)
+            : Map(InMap)
+        {
+            Skip();
+        }
+
+        explicit operator bool() const { return Map.Slots && Index <= Map.Mask; }
+        void operator++() { ++Index; Skip(); }
+        uint64_t Key() const { return Map.Slots[Index].Key; }
+        V Value() const { return Map.Slots[Index].Value; }
+
+    private:
+        void Skip()
+        {
+            while (Map.Slots && Index <= Map.Mask && Map.Slots[Index].Distance == 0)
+                ++Index;
+        }
+
+        TTextureCacheMap&   Map;
+        uint32_t            Index{};
+    };
+
+private:
+    struct FSlot
+    {
+        uint64_t    Key;
+        V           Value;
+        uint32_t    Distance;   // 1 + distance from the home slot. 0 if the slot is empty
+    };
+
+    static uint64_t Mix(uint64_t Key)
+    {
+        Key ^= Key >> 33;
+        Key *= 0xFF51AFD7ED558CCDull;
+        Key ^= Key >> 33;
+        Key *= 0xC4CEB9FE1A85EC53ull;
+        Key ^= Key >> 33;
+        return Key;
+    }
+
+    void Grow()
+    {
+        FSlot* OldSlots = Slots;
+        const uint32_t OldCapacity = Slots ? Mask + 1 : 0;
+        const uint32_t NewCapacity = OldCapacity ? OldCapacity * 2 : 256;
+
+        Slots = static_cast<FSlot*>(calloc(NewCapacity, sizeof(FSlot)));
+        Mask = NewCapacity - 1;
+        NumEntries = 0;
+        for (uint32_t i = 0; i < OldCapacity; ++i)
+            if (OldSlots[i].Distance)
+                Set(OldSlots[i].Key, OldSlots[i].Value);
+        free(OldSlots);
+    }
+
+    FSlot*      Slots{};
+    uint32_t    Mask{};
+    uint32_t    NumEntries{};
+    uint64_t    LastKey{};
+    V           LastValue{};
+};
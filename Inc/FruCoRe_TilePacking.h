@@ -0,0 +1,74 @@
+/*=============================================================================
+    FruCoRe_TilePacking.h: Instance records for the tile program.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "FruCoRe_VertexPacking.h"
+
+//
+// Every tile is a single instance record. The vertex shader generates the
+// six corners of the quad from vertex_id, so a run of tiles that share
+// the same pipeline state, depth mode, and texture becomes one instanced
+// draw call.
+//
+#define TILE_VERTICES 6
+
+//
+// What a tile cost before we drew tiles as instances: six vertices with a
+// float4 position and a float4 UV each, plus a 48-byte instance record
+// (float4 DrawColor, float4 HitColor, UMult, VMult, UPan, VPan)
+//
+#define TILE_UNBATCHED_BYTES (TILE_VERTICES * 32 + 48)
+
+//
+// Fills in the instance record @Out for a tile that covers screen rectangle
+// (@X, @Y, @XL, @YL) at depth @Z, and maps texture rectangle (@U, @V, @UL,
+// @VL), in texels, onto it. @UMult and @VMult convert texels to normalized
+// texture coordinates. @Color holds four consecutive floats (e.g., an FPlane).
+//
+template<typename R>
+void PackTileInstance(R& Out, float X, float Y, float XL, float YL, float Z,
+                      float U, float V, float UL, float VL, float UMult, float VMult,
+                      const float* Color)
+{
+    const float Rect[4] = { X, Y, XL, YL };
+    const float UVRect[4] = { U * UMult, V * VMult, UL * UMult, VL * VMult };
+    memcpy(&Out.Rect, Rect, sizeof(Rect));
+    memcpy(&Out.UVRect, UVRect, sizeof(UVRect));
+    Out.Z = Z;
+    PackHalf4(Out.DrawColor.Bits, Color);
+}
+
+//
+// Adds instance @Instance of a primitive whose @Vertices vertices the vertex
+// shader generates from vertex_id. C must have the fields of
+// MultiDrawIndirectBuffer::DrawCommand. @Prev is the last draw command we
+// haven't encoded yet, or nullptr if there is none. If @Prev draws the same
+// primitive and ends right before @Instance, we add the instance to it and
+// return true. Otherwise, we fill in @Next as a new draw command for just
+// this instance and return false.
+//
+template<typename C> bool AddGeneratedInstance(C* Prev, C& Next, uint32_t Instance, uint32_t Vertices)
+{
+    if (Prev && !Prev->indexCount && Prev->vertexCount == Vertices &&
+        Prev->baseInstance + Prev->instanceCount == Instance)
+    {
+        Prev->instanceCount++;
+        return true;
+    }
+
+    Next.vertexStart = 0;
+    Next.vertexCount = Vertices;
+    Next.baseInstance = Instance;
+    Next.instanceCount = 1;
+    Next.indexStart = 0;
+    Next.indexCount = 0;
+    return false;
+}
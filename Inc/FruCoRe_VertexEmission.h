@@ -0,0 +1,150 @@
+/*=============================================================================
+    FruCoRe_VertexEmission.h: Bulk vertex emission into shared buffers.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    The kernels are templates, so the callers can plug in the engine's
+    vertex types and our packed vertex layouts.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "FruCoRe_VertexPacking.h"
+
+//
+// The kernels convert up to VERTEX_EMIT_BATCH vertices into a small buffer
+// on the stack, which stays in L1, and then stream the whole batch into the
+// vertex buffer. The vertex buffers live in shared memory and we never read
+// them back on the CPU, so there's no point in pulling them into the cache.
+// Small batches (e.g., most BSP polys) are written in place because
+// streaming them costs more than it saves.
+//
+#define VERTEX_EMIT_BATCH 32
+#define VERTEX_STREAM_MIN_BYTES 256
+
+//
+// Number of vertices we look ahead when we prefetch the source data. Mesh
+// and BSP vertices are reached through pointers and tend to be scattered
+// all over the memory stack.
+//
+#define VERTEX_PREFETCH_DISTANCE 8
+
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_nontemporal_store)
+#define FRUCORE_NONTEMPORAL_STORES 1
+#endif
+#endif
+
+//
+// Copies @Bytes bytes from @Src to @Dst, using non-temporal stores for the
+// 16-byte aligned part of @Dst if the compiler supports them
+//
+inline void StreamCopy(void* Dst, const void* Src, size_t Bytes)
+{
+#if FRUCORE_NONTEMPORAL_STORES
+    typedef uint32_t Vec4 __attribute__((vector_size(16)));
+    uint8_t* D = static_cast<uint8_t*>(Dst);
+    const uint8_t* S = static_cast<const uint8_t*>(Src);
+
+    size_t Head = (16 - (reinterpret_cast<uintptr_t>(D) & 15)) & 15;
+    Head = Head < Bytes ? Head : Bytes;
+    memcpy(D, S, Head);
+    D += Head;
+    S += Head;
+    Bytes -= Head;
+
+    for (; Bytes >= 16; D += 16, S += 16, Bytes -= 16)
+    {
+        Vec4 Value;
+        memcpy(&Value, S, sizeof(Value));
+        __builtin_nontemporal_store(Value, reinterpret_cast<Vec4*>(D));
+    }
+    memcpy(D, S, Bytes);
+#else
+    memcpy(Dst, Src, Bytes);
+#endif
+}
+
+//
+// Writes @Count Gouraud vertices to @Out and, if @OutFog is not null, their
+// fog colors to @OutFog. @GetPoint(i) must return a reference to the i-th
+// source vertex, which has a Point (X/Y/Z), U and V texture coordinates,
+// and Light and Fog colors stored as four consecutive floats. Every vertex
+// gets instance index @Instance.
+//
+template<typename V, typename F, typename G>
+void EmitGouraudVertices(V* Out, F* OutFog, uint32_t Count, uint32_t Instance, G&& GetPoint)
+{
+    V Batch[VERTEX_EMIT_BATCH];
+    F FogBatch[VERTEX_EMIT_BATCH];
+
+    for (uint32_t Start = 0; Start < Count; Start += VERTEX_EMIT_BATCH)
+    {
+        const uint32_t Num = Count - Start < VERTEX_EMIT_BATCH ? Count - Start : VERTEX_EMIT_BATCH;
+        const bool bStream = Num * sizeof(V) >= VERTEX_STREAM_MIN_BYTES;
+        V* Dst = bStream ? Batch : Out + Start;
+        F* FogDst = bStream ? FogBatch : (OutFog ? OutFog + Start : nullptr);
+
+        for (uint32_t i = 0; i < Num; ++i)
+        {
+            if (Start + i + VERTEX_PREFETCH_DISTANCE < Count)
+                __builtin_prefetch(&GetPoint(Start + i + VERTEX_PREFETCH_DISTANCE));
+
+            const auto& P = GetPoint(Start + i);
+            const float UV[2] = { P.U, P.V };
+            memcpy(&Dst[i].UV, UV, sizeof(UV));
+            Dst[i].Point = { P.Point.X, P.Point.Y, P.Point.Z };
+            Dst[i].Instance = Instance;
+            PackHalf4(Dst[i].LightColor.Bits, &P.Light.X);
+            if (OutFog)
+                PackHalf4(FogDst[i].Bits, &P.Fog.X);
+        }
+
+        if (bStream)
+        {
+            StreamCopy(Out + Start, Batch, Num * sizeof(V));
+            if (OutFog)
+                StreamCopy(OutFog + Start, FogBatch, Num * sizeof(F));
+        }
+    }
+}
+
+//
+// Writes the positions of @Count vertices to @Out, with instance index
+// @Instance. @GetPoint(i) must return a reference to the position (X/Y/Z) of
+// the i-th source vertex. Returns the smallest Z we wrote, so the caller
+// doesn't have to chase the pointers twice.
+//
+template<typename V, typename G>
+float EmitPositionVertices(V* Out, uint32_t Count, uint32_t Instance, G&& GetPoint)
+{
+    V Batch[VERTEX_EMIT_BATCH];
+    float MinZ = 3.402823466e+38f;
+
+    for (uint32_t Start = 0; Start < Count; Start += VERTEX_EMIT_BATCH)
+    {
+        const uint32_t Num = Count - Start < VERTEX_EMIT_BATCH ? Count - Start : VERTEX_EMIT_BATCH;
+        const bool bStream = Num * sizeof(V) >= VERTEX_STREAM_MIN_BYTES;
+        V* Dst = bStream ? Batch : Out + Start;
+
+        for (uint32_t i = 0; i < Num; ++i)
+        {
+            if (Start + i + VERTEX_PREFETCH_DISTANCE < Count)
+                __builtin_prefetch(&GetPoint(Start + i + VERTEX_PREFETCH_DISTANCE));
+
+            const auto& P = GetPoint(Start + i);
+            Dst[i].Point = { P.X, P.Y, P.Z };
+            Dst[i].Instance = Instance;
+            MinZ = P.Z < MinZ ? P.Z : MinZ;
+        }
+
+        if (bStream)
+            StreamCopy(Out + Start, Batch, Num * sizeof(V));
+    }
+    return MinZ;
+}
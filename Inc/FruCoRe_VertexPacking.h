@@ -0,0 +1,130 @@
+/*=============================================================================
+    FruCoRe_VertexPacking.h: Conversions for the compact vertex layouts.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+//
+// Converts @Value to an IEEE 754 half-precision float, rounding to nearest
+// even. This matches the conversions the GPU does when it reads a half, so
+// the shaders see exactly the same bits as a native __fp16 cast would give.
+// Values beyond the half range become infinity. NaNs stay NaNs.
+//
+inline uint16_t FloatToHalf(float Value)
+{
+#if defined(__ARM_FP16_FORMAT_IEEE)
+    // Apple Silicon converts in hardware
+    __fp16 Half = static_cast<__fp16>(Value);
+    uint16_t Result;
+    memcpy(&Result, &Half, sizeof(Result));
+    return Result;
+#else
+    uint32_t Bits;
+    memcpy(&Bits, &Value, sizeof(Bits));
+
+    const uint32_t Sign = (Bits >> 16) & 0x8000;
+    const uint32_t Abs = Bits & 0x7FFFFFFF;
+
+    // NaN and infinity
+    if (Abs >= 0x7F800000)
+        return static_cast<uint16_t>(Sign | 0x7C00 | (Abs > 0x7F800000 ? 0x0200 | ((Abs >> 13) & 0x3FF) : 0));
+
+    // Rounds to infinity
+    if (Abs >= 0x477FF000)
+        return static_cast<uint16_t>(Sign | 0x7C00);
+
+    // Normal halves. Adding the rounding bias can carry into the exponent,
+    // which is exactly what rounding up to the next power of two should do
+    if (Abs >= 0x38800000)
+    {
+        const uint32_t Rounded = Abs + 0x0FFF + ((Abs >> 13) & 1);
+        return static_cast<uint16_t>(Sign | ((Rounded - 0x38000000) >> 13));
+    }
+
+    // Subnormal halves. We shift the mantissa, including its implicit bit,
+    // into place and round on the bits we shift out
+    if (Abs >= 0x33000000)
+    {
+        const uint32_t Exponent = Abs >> 23;
+        const uint32_t Mantissa = (Abs & 0x7FFFFF) | 0x800000;
+        const uint32_t Shift = 126 - Exponent;
+        const uint32_t Half = Mantissa >> Shift;
+        const uint32_t Remainder = Mantissa & ((1u << Shift) - 1);
+        const uint32_t Midpoint = 1u << (Shift - 1);
+        const uint32_t RoundUp = Remainder > Midpoint || (Remainder == Midpoint && (Half & 1));
+        return static_cast<uint16_t>(Sign | (Half + RoundUp));
+    }
+
+    // Too small, even for a subnormal
+    return static_cast<uint16_t>(Sign);
+#endif
+}
+
+inline float HalfToFloat(uint16_t Half)
+{
+    const uint32_t Sign = static_cast<uint32_t>(Half & 0x8000) << 16;
+    const uint32_t Exponent = (Half >> 10) & 0x1F;
+    uint32_t Mantissa = Half & 0x3FF;
+    uint32_t Bits;
+
+    if (Exponent == 0x1F)
+    {
+        Bits = Sign | 0x7F800000 | (Mantissa << 13);
+    }
+    else if (Exponent != 0)
+    {
+        Bits = Sign | ((Exponent + 112) << 23) | (Mantissa << 13);
+    }
+    else if (Mantissa == 0)
+    {
+        Bits = Sign;
+    }
+    else
+    {
+        // Normalize the subnormal
+        uint32_t Shift = 0;
+        while (!(Mantissa & 0x400))
+        {
+            Mantissa <<= 1;
+            Shift++;
+        }
+        Bits = Sign | ((113 - Shift) << 23) | ((Mantissa & 0x3FF) << 13);
+    }
+
+    float Result;
+    memcpy(&Result, &Bits, sizeof(Result));
+    return Result;
+}
+
+// Packs four floats into the layout of a Metal half4
+inline void PackHalf4(uint16_t Out[4], float X, float Y, float Z, float W)
+{
+    Out[0] = FloatToHalf(X);
+    Out[1] = FloatToHalf(Y);
+    Out[2] = FloatToHalf(Z);
+    Out[3] = FloatToHalf(W);
+}
+
+// Same as above, but converts four consecutive floats (e.g., an FPlane) at once
+inline void PackHalf4(uint16_t Out[4], const float* In)
+{
+#if defined(__aarch64__)
+    vst1_u16(Out, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(In))));
+#elif defined(__F16C__)
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(Out), _mm_cvtps_ph(_mm_loadu_ps(In), _MM_FROUND_TO_NEAREST_INT));
+#else
+    PackHalf4(Out, In[0], In[1], In[2], In[3]);
+#endif
+}
@@ -24,56 +24,64 @@ vertex ComplexVertexOutput DrawComplexVertex
     uint InstanceID                         [[ instance_id ]],
     device const GlobalUniforms* Uniforms   [[ buffer(IDX_Uniforms)                  ]],
     device const ComplexInstanceData* Data  [[ buffer(IDX_DrawComplexInstanceData)   ]],
-    device const ComplexVertex* Vertices    [[ buffer(IDX_DrawComplexVertexData)     ]]
+    device const ComplexVertex* Vertices    [[ buffer(IDX_DrawComplexVertexData)     ]],
+    device const ComplexVertex* WorldVertices [[ buffer(IDX_DrawComplexWorldVertexData) ]],
+    constant FrameUniforms& FrameData       [[ buffer(IDX_FrameUniforms)             ]]
 )
 {
-    float4 InVertex = float4(Vertices[VertexID].Point.xyz, 1.0);
+    // Cached facets are in world space. Everything after this works in camera space.
+    // All other vertices tell us which instance data they belong to
+    const bool WorldSpace = VertexID >= COMPLEX_WORLD_VERTEX_BASE;
+    const uint Instance = WorldSpace ? InstanceID : Vertices[VertexID].Instance;
+    float4 InVertex = WorldSpace ?
+        FrameData.ViewMatrix * float4(float3(WorldVertices[VertexID - COMPLEX_WORLD_VERTEX_BASE].Point), 1.0) :
+        float4(float3(Vertices[VertexID].Point), 1.0);
 
     ComplexVertexOutput Result;
     Result.Position = Uniforms->ProjectionMatrix * InVertex;
 
     // Calculate texture coordinates
-    float3 MapCoordsXAxis = Data[InstanceID].SurfaceXAxis.xyz;
-    float3 MapCoordsYAxis = Data[InstanceID].SurfaceYAxis.xyz;
-    float  UDot    = Data[InstanceID].SurfaceXAxis.w;
-    float  VDot    = Data[InstanceID].SurfaceYAxis.w;
+    float3 MapCoordsXAxis = Data[Instance].SurfaceXAxis.xyz;
+    float3 MapCoordsYAxis = Data[Instance].SurfaceYAxis.xyz;
+    float  UDot    = Data[Instance].SurfaceXAxis.w;
+    float  VDot    = Data[Instance].SurfaceYAxis.w;
     float2 MapDot  = float2(dot(MapCoordsXAxis, InVertex.xyz) - UDot, dot(MapCoordsYAxis, InVertex.xyz) - VDot);
 
     // Texture UV to fragment
-    float2 TexMapMult = Data[InstanceID].DiffuseUV.xy;
-    float2 TexMapPan  = Data[InstanceID].DiffuseUV.zw;
+    float2 TexMapMult = Data[Instance].DiffuseUV.xy;
+    float2 TexMapPan  = Data[Instance].DiffuseUV.zw;
     Result.DiffuseUV  = (MapDot - TexMapPan) * TexMapMult;
 
     if (HasLightMap)
     {
-        float2 LightMapMult = Data[InstanceID].LightMapUV.xy;
-        float2 LightMapPan  = Data[InstanceID].LightMapUV.zw;
+        float2 LightMapMult = Data[Instance].LightMapUV.xy;
+        float2 LightMapPan  = Data[Instance].LightMapUV.zw;
         Result.LightMapUV   = (MapDot - LightMapPan) * LightMapMult;
     }
 
     if (HasFogMap)
     {
-        float2 FogMapMult = Data[InstanceID].FogMapUV.xy;
-        float2 FogMapPan  = Data[InstanceID].FogMapUV.zw;
+        float2 FogMapMult = Data[Instance].FogMapUV.xy;
+        float2 FogMapPan  = Data[Instance].FogMapUV.zw;
         Result.FogMapUV   = (MapDot - FogMapPan) * FogMapMult;
     }
 
     if (HasDetailTexture)
     {
-        float2 DetailMult = Data[InstanceID].DetailUV.xy;
-        float2 DetailPan  = Data[InstanceID].DetailUV.zw;
+        float2 DetailMult = Data[Instance].DetailUV.xy;
+        float2 DetailPan  = Data[Instance].DetailUV.zw;
         Result.DetailUV   = (MapDot - DetailPan) * DetailMult;
     }
 
     if (HasMacroTexture)
     {
-        float2 MacroMult = Data[InstanceID].MacroUV.xy;
-        float2 MacroPan  = Data[InstanceID].MacroUV.zw;
+        float2 MacroMult = Data[Instance].MacroUV.xy;
+        float2 MacroPan  = Data[Instance].MacroUV.zw;
         Result.MacroUV   = (MapDot - MacroPan) * MacroMult;
     }
 
-    Result.DiffuseInfo = Data[InstanceID].DiffuseInfo.xz;
-    Result.DrawColor = Data[InstanceID].DrawColor;
+    Result.DiffuseInfo = Data[Instance].DiffuseInfo.xz;
+    Result.DrawColor = Data[Instance].DrawColor;
     return Result;
 }
 
@@ -85,11 +93,14 @@ float4 fragment DrawComplexFragment
     texture2d< float, access::sample > FogMap           [[ texture(IDX_FogMap)        , function_constant(HasFogMap)        ]],
     texture2d< float, access::sample > DetailTexture    [[ texture(IDX_DetailTexture) , function_constant(HasDetailTexture) ]],
     texture2d< float, access::sample > MacroTexture     [[ texture(IDX_MacroTexture)  , function_constant(HasMacroTexture)  ]],
+    texture2d< float, access::sample > DiffusePalette   [[ texture(IDX_DiffusePalette), function_constant(IsPaletted)       ]],
     device const GlobalUniforms* Uniforms               [[ buffer(IDX_Uniforms)                                             ]]
 )
 {
-    constexpr sampler s(address::repeat, filter::linear);
-    float4 Color = DiffuseTexture.sample(s, in.DiffuseUV, bias(Uniforms->LODBias)).rgba;
+    constexpr sampler s(address::repeat, filter::linear, mip_filter::linear);
+    float4 Color = IsPaletted ?
+        SamplePaletted(DiffuseTexture, DiffusePalette, in.DiffuseUV, Uniforms->LODBias, true, false) :
+        DiffuseTexture.sample(s, in.DiffuseUV, bias(Uniforms->LODBias)).rgba;
     
     Color = ApplyPolyFlags(Color, float4(1.0));
     
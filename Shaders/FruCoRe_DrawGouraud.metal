@@ -24,10 +24,13 @@ vertex GouraudVertexOutput DrawGouraudVertex
     uint InstanceID                         [[ instance_id ]],
     device const GlobalUniforms* Uniforms   [[ buffer(IDX_Uniforms)                  ]],
     device const GouraudInstanceData* Data  [[ buffer(IDX_DrawGouraudInstanceData)   ]],
-    device const GouraudVertex* Vertices    [[ buffer(IDX_DrawGouraudVertexData)     ]]
+    device const GouraudVertex* Vertices    [[ buffer(IDX_DrawGouraudVertexData)     ]],
+    device const PackedHalf4* FogColors     [[ buffer(IDX_DrawGouraudFogData), function_constant(ShouldRenderFog) ]]
 )
 {
-    float4 InVertex = Vertices[VertexID].Point;
+    // Consecutive polys can share a draw call, so we find the instance data through the vertex
+    const uint Instance = Vertices[VertexID].Instance;
+    float4 InVertex = float4(float3(Vertices[VertexID].Point), 1.0);
     
     // Some z-hacking to make sure the weapon render properly
     //if (Data[InstanceID].DrawFlags & DF_NoNearZ)
@@ -39,12 +42,12 @@ vertex GouraudVertexOutput DrawGouraudVertex
     //if (Data[InstanceID].DrawFlags & DF_NoNearZ)
     //    Result.Position.w -= Uniforms->zNear - 1;
     
-    Result.LightColor   = Vertices[VertexID].LightColor * Uniforms->LightColorIntensity;
-    Result.FogColor     = Vertices[VertexID].FogColor;
-    Result.DiffuseUV    = Vertices[VertexID].UV.xy * Data[InstanceID].DiffuseInfo.xy;
-    Result.DiffuseInfo  = Data[InstanceID].DiffuseInfo.zw;
-    Result.DetailUV     = Vertices[VertexID].UV.xy * Data[InstanceID].DetailMacroInfo.xy;
-    Result.MacroUV      = Vertices[VertexID].UV.xy * Data[InstanceID].DetailMacroInfo.zw;
+    Result.LightColor   = float4(Vertices[VertexID].LightColor) * Uniforms->LightColorIntensity;
+    Result.FogColor     = ShouldRenderFog ? float4(FogColors[VertexID]) : float4(0.0);
+    Result.DiffuseUV    = Vertices[VertexID].UV.xy * Data[Instance].DiffuseInfo.xy;
+    Result.DiffuseInfo  = Data[Instance].DiffuseInfo.zw;
+    Result.DetailUV     = Vertices[VertexID].UV.xy * Data[Instance].DetailMacroInfo.xy;
+    Result.MacroUV      = Vertices[VertexID].UV.xy * Data[Instance].DetailMacroInfo.zw;
     return Result;
 }
 
@@ -54,11 +57,14 @@ float4 fragment DrawGouraudFragment
     texture2d< float, access::sample > DiffuseTexture [[ texture(IDX_DiffuseTexture)                                      ]],
     texture2d< float, access::sample > DetailTexture  [[ texture(IDX_DetailTexture) , function_constant(HasDetailTexture) ]],
     texture2d< float, access::sample > MacroTexture   [[ texture(IDX_MacroTexture)  , function_constant(HasMacroTexture)  ]],
+    texture2d< float, access::sample > DiffusePalette [[ texture(IDX_DiffusePalette), function_constant(IsPaletted)       ]],
     device const GlobalUniforms* Uniforms             [[ buffer(IDX_Uniforms)                                             ]]
 )
 {
-    constexpr sampler s( address::repeat, filter::linear );
-    float4 Color = DiffuseTexture.sample(s, in.DiffuseUV, bias(Uniforms->LODBias)).rgba;
+    constexpr sampler s( address::repeat, filter::linear, mip_filter::linear );
+    float4 Color = IsPaletted ?
+        SamplePaletted(DiffuseTexture, DiffusePalette, in.DiffuseUV, Uniforms->LODBias, true, false) :
+        DiffuseTexture.sample(s, in.DiffuseUV, bias(Uniforms->LODBias)).rgba;
     
     Color = ApplyPolyFlags(Color, in.LightColor);
     in.Position.w = 1.0;
@@ -13,17 +13,28 @@ typedef struct
     float2 UV;
 } TileVertexOutput;
 
+// Corners of the quad, as fractions of the tile's rectangle
+constant float2 TileCorners[] =
+{
+    float2(0, 0),
+    float2(1, 0),
+    float2(1, 1),
+    float2(0, 0),
+    float2(1, 1),
+    float2(0, 1)
+};
+
 vertex TileVertexOutput DrawTileVertex
 (
     uint VertexID [[vertex_id]],
     uint InstanceID [[instance_id]],
     device const GlobalUniforms* Uniforms   [[ buffer(IDX_Uniforms)             ]],
-    device const TileInstanceData* Data     [[ buffer(IDX_DrawTileInstanceData) ]],
-    device const TileVertex* Vertices       [[ buffer(IDX_DrawTileVertexData)   ]]
+    device const TileInstanceData* Data     [[ buffer(IDX_DrawTileInstanceData) ]]
 )
 {
     TileVertexOutput Result;
-    float4 InVertex  = Vertices[VertexID].Point;
+    const float2 Corner = TileCorners[VertexID];
+    float4 InVertex  = float4(Data[InstanceID].Rect.xy + Corner * Data[InstanceID].Rect.zw, Data[InstanceID].Z, 1.0);
     float4 Projected = Uniforms->ProjectionMatrix * InVertex;
     // Make sure that points _on_ the near plane have an NDC depth of 0
     // Projected.z -= Uniforms->zNear;
@@ -34,11 +45,8 @@ vertex TileVertexOutput DrawTileVertex
         Projected.z / Projected.w,
         1.f // We don't want any normalization so we set w to 1 here. This makes the clip space coordinates equal to the final NDC coordinates
     );
-    Result.UV = float2(
-        Vertices[VertexID].UV.x * Data[InstanceID].UMult,
-        Vertices[VertexID].UV.y * Data[InstanceID].VMult
-    );
-    Result.DrawColor = Data[InstanceID].DrawColor;
+    Result.UV = Data[InstanceID].UVRect.xy + Corner * Data[InstanceID].UVRect.zw;
+    Result.DrawColor = float4(Data[InstanceID].DrawColor);
     return Result;
 }
 
@@ -46,12 +54,15 @@ float4 fragment DrawTileFragment
 (
     TileVertexOutput in [[stage_in]],
     texture2d< float, access::sample > tex  [[ texture(IDX_DiffuseTexture) ]],
+    texture2d< float, access::sample > pal  [[ texture(IDX_DiffusePalette), function_constant(IsPaletted) ]],
     device const GlobalUniforms* Uniforms   [[ buffer(IDX_Uniforms)        ]]
 )
 {
-    constexpr sampler LinearRepeatSampler( address::repeat, filter::linear );
-    constexpr sampler NearestClampSampler(address::clamp_to_edge, filter::nearest, filter::nearest);
-    float4 Color = ApplyPolyFlags(tex.sample(NoSmooth ? NearestClampSampler : LinearRepeatSampler, in.UV, bias(Uniforms->LODBias)).rgba, float4(1.0));
+    constexpr sampler LinearRepeatSampler( address::repeat, filter::linear, mip_filter::linear );
+    constexpr sampler NearestClampSampler(address::clamp_to_edge, filter::nearest, mip_filter::nearest);
+    float4 Color = ApplyPolyFlags(IsPaletted ?
+        SamplePaletted(tex, pal, in.UV, Uniforms->LODBias, !NoSmooth, NoSmooth) :
+        tex.sample(NoSmooth ? NearestClampSampler : LinearRepeatSampler, in.UV, bias(Uniforms->LODBias)).rgba, float4(1.0));
     float4 TotalColor = Color * in.DrawColor;
 	if (!IsModulated)
        TotalColor.rgb *= Uniforms->Brightness;    
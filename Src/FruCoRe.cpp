@@ -10,6 +10,7 @@
 #define GENERATE_METAL_IMPLEMENTATION
 #include "FruCoRe.h"
 #include "FruCoRe_Helpers.h"
+#include "FruCoRe_TextureConversion.h"
 
 /*-----------------------------------------------------------------------------
 	Package Registration
@@ -37,9 +38,23 @@ void UFruCoReRenderDevice::StaticConstructor()
     new(GetClass(),TEXT("OneXBlending"), RF_Public)UBoolProperty(CPP_PROPERTY(OneXBlending), TEXT("Options"), CPF_Config );
     new(GetClass(),TEXT("ActorXBlending"), RF_Public)UBoolProperty(CPP_PROPERTY(ActorXBlending), TEXT("Options"), CPF_Config );
 	new(GetClass(),TEXT("UseGammaCorrection"), RF_Public)UBoolProperty(CPP_PROPERTY(UseGammaCorrection), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("UsePalettedTextures"), RF_Public)UBoolProperty(CPP_PROPERTY(UsePalettedTextures), TEXT("Options"), CPF_Config );
     new(GetClass(),TEXT("NumAASamples"), RF_Public)UIntProperty(CPP_PROPERTY(NumAASamples), TEXT("Options"), CPF_Config );
     new(GetClass(),TEXT("LODBias"), RF_Public)UFloatProperty(CPP_PROPERTY(LODBias), TEXT("Options"), CPF_Config );
     new(GetClass(),TEXT("GammaOffset"), RF_Public)UFloatProperty(CPP_PROPERTY(GammaOffset), TEXT("Options"), CPF_Config );
+    new(GetClass(),TEXT("TextureMemoryBudget"), RF_Public)UIntProperty(CPP_PROPERTY(TextureMemoryBudget), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("AsyncTextureUploads"), RF_Public)UBoolProperty(CPP_PROPERTY(AsyncTextureUploads), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("UseDiskCache"), RF_Public)UBoolProperty(CPP_PROPERTY(UseDiskCache), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("DiskCacheSize"), RF_Public)UIntProperty(CPP_PROPERTY(DiskCacheSize), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("CompressTextures"), RF_Public)UBoolProperty(CPP_PROPERTY(CompressTextures), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("PackLightMaps"), RF_Public)UBoolProperty(CPP_PROPERTY(PackLightMaps), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("GenerateMips"), RF_Public)UBoolProperty(CPP_PROPERTY(GenerateMips), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("UploadBudget"), RF_Public)UIntProperty(CPP_PROPERTY(UploadBudget), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("StreamTextures"), RF_Public)UBoolProperty(CPP_PROPERTY(StreamTextures), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("DeduplicateTextures"), RF_Public)UBoolProperty(CPP_PROPERTY(DeduplicateTextures), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("CacheWorldGeometry"), RF_Public)UBoolProperty(CPP_PROPERTY(CacheWorldGeometry), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("SortOpaqueDraws"), RF_Public)UBoolProperty(CPP_PROPERTY(SortOpaqueDraws), TEXT("Options"), CPF_Config );
+	new(GetClass(),TEXT("BatchDrawCalls"), RF_Public)UBoolProperty(CPP_PROPERTY(BatchDrawCalls), TEXT("Options"), CPF_Config );
 
 	UEnum* FramebufferBpcEnum = new(GetClass(), TEXT("FramebufferBpc")) UEnum(nullptr);
 	new(FramebufferBpcEnum->Names) FName(TEXT("8bpc"));
@@ -70,9 +85,23 @@ void UFruCoReRenderDevice::StaticConstructor()
     OneXBlending = false;
 	ActorXBlending = true;
 	UseGammaCorrection = true;
+	UsePalettedTextures = false;
     LODBias = 0.f;
     GammaOffset = 0.f;
     NumAASamples = 4;
+    TextureMemoryBudget = 0;
+	AsyncTextureUploads = true;
+	UseDiskCache = false;
+	DiskCacheSize = 512;
+	CompressTextures = false;
+	PackLightMaps = false;
+	GenerateMips = false;
+	UploadBudget = 0;
+	StreamTextures = false;
+	DeduplicateTextures = false;
+	CacheWorldGeometry = false;
+	SortOpaqueDraws = false;
+	BatchDrawCalls = false;
 	FramebufferBpc = FB_BPC_10bit; 
 }
 
@@ -231,6 +260,17 @@ UBOOL UFruCoReRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT
     }
 
 	debugf(NAME_DevGraphics, TEXT("Frucore: Created Device"));
+	debugf(NAME_DevGraphics, TEXT("Frucore: Using %ls palette expansion kernel"), appFromAnsi(GetExpandP8KernelName(GetBestExpandP8Kernel())));
+	
+	TextureJobGroup = dispatch_group_create();
+	
+	if (UseDiskCache)
+	{
+		TextureDiskCache.Open(appToAnsi(*GetDiskCachePath()), static_cast<QWORD>(Max(DiskCacheSize, 0)) * 1024 * 1024);
+		const auto DiskCacheStats = TextureDiskCache.GetStats();
+		debugf(NAME_DevGraphics, TEXT("Frucore: Mapped %d cached textures (%d KB) from %ls"),
+			   static_cast<INT>(DiskCacheStats.NumMappedEntries), static_cast<INT>(DiskCacheStats.MappedBytes / 1024), *GetDiskCachePath());
+	}
     
     SetMSAAOptions();
     MSAAComposePipelineState = BuildPostprocessPipelineState("MSAAComposeVertex", "MSAAComposeFragment", "MSAA Compose");
@@ -255,6 +295,9 @@ UBOOL UFruCoReRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT
     GlobalUniformsBuffer.Advance(1);
     
     RegisterTextureFormats();
+    bCanCompressTextures = Device->supportsBCTextureCompression();
+    if (CompressTextures && !bCanCompressTextures)
+        debugf(TEXT("Frucore: This device does not support BC texture compression. Ignoring CompressTextures"));
 
     InitShaders();
     
@@ -303,6 +346,16 @@ void UFruCoReRenderDevice::Exit()
         if (Tex)
             Tex->release();
     }
+    FinishTextureJobs(TRUE);
+    ReleaseRetiredTextures(TRUE);
+    DiscardPrecacheQueue();
+    DiscardDeferredUploads();
+    if (UseDiskCache && !TextureDiskCache.Save())
+        debugf(TEXT("Frucore: Failed to save texture cache to %ls"), *GetDiskCachePath());
+    TextureDiskCache.Close();
+    if (TextureJobGroup)
+        dispatch_release(TextureJobGroup);
+    TextureStaging.Free();
     if (CommandQueue)
         CommandQueue->release();
     if (Device)
@@ -314,17 +367,23 @@ void UFruCoReRenderDevice::Exit()
 -----------------------------------------------------------------------------*/
 void UFruCoReRenderDevice::Flush(INT AllowPrecache)
 {
-    for (auto It = TMap<FCacheID, CachedTexture*>::TIterator(BindMap); It; ++It)
-    {
-        auto Tex = It.Value();
-        if (Tex->Texture)
-        {
-            Tex->Texture->release();
-            Tex->Texture = nullptr;
-        }
-		delete Tex;
-    }
+    NumTextureFlushes++;
+    
+    // Wait for the workers so we don't free textures they're still writing to
+    FinishTextureJobs(TRUE);
+    ReleaseRetiredTextures(TRUE);
+    DiscardPrecacheQueue();
+    DiscardDeferredUploads();
+    
+    for (auto It = TTextureCacheMap<CachedTexture*>::TIterator(BindMap); It; ++It)
+        ReleaseCachedTexture(It.Value());
     BindMap.Empty();
+    check(SharedTextures.Num() == 0);
+    ReleaseAtlasPages();
+    if (auto ComplexShader = dynamic_cast<DrawComplexProgram*>(Shaders[SHADER_Complex]))
+        ComplexShader->FlushWorldGeometry();
+    memset(BoundTextures, 0, sizeof(BoundTextures));
+    memset(BoundMetalTextures, 0, sizeof(BoundMetalTextures));
 }
 
 /*-----------------------------------------------------------------------------
@@ -334,9 +393,40 @@ UBOOL UFruCoReRenderDevice::Exec(const TCHAR* Cmd, FOutputDevice& Ar)
 {
 	if( URenderDevice::Exec( Cmd, Ar ) )
 		return TRUE;
+	
+	if (ParseCommand(&Cmd, TEXT("FRUCORE")))
+	{
+		// FRUCORE DISKCACHE [VERBOSE] - Validates the texture cache file and prints its contents
+		if (ParseCommand(&Cmd, TEXT("DISKCACHE")))
+		{
+			const UBOOL Verbose = ParseCommand(&Cmd, TEXT("VERBOSE"));
+			FTextureDiskCache::Inspect(appToAnsi(*GetDiskCachePath()), Verbose, [](const char* Line, void* User)
+			{
+				static_cast<FOutputDevice*>(User)->Log(appFromAnsi(Line));
+			}, &Ar);
+			return TRUE;
+		}
+		
+		// FRUCORE TEXSTATS [CSV=<Filename>] - Prints the texture counters and optionally saves them as CSV
+		if (ParseCommand(&Cmd, TEXT("TEXSTATS")))
+		{
+			FString Filename;
+			Parse(Cmd, TEXT("CSV="), Filename);
+			PrintTextureStats(Ar, *Filename);
+			return TRUE;
+		}
+	}
 	return FALSE;
 }
 
+/*-----------------------------------------------------------------------------
+	GetDiskCachePath
+-----------------------------------------------------------------------------*/
+FString UFruCoReRenderDevice::GetDiskCachePath()
+{
+	return FString::Printf(TEXT("%ls") PATH_SEPARATOR TEXT("FruCoReTextures.cache"), *GSys->CachePath);
+}
+
 /*-----------------------------------------------------------------------------
 	Lock
 -----------------------------------------------------------------------------*/
@@ -350,8 +440,38 @@ void UFruCoReRenderDevice::Lock(FPlane _FlashScale, FPlane _FlashFog, FPlane Scr
 
 	RendererSuspended = FALSE;
 	__sync_fetch_and_add(&NumInFlightFrames, 1);
+	FrameNumber++;
+	
+	// Safe to do here since we're not bound to a command encoder yet
+	FlushPrecacheQueue();
+	FinishTextureJobs(FALSE);
+	FrameUploadBytes = 0;
+	FrameUploads = 0;
+	FrameTextureLocks = 0;
+	FrameLockCacheHits = 0;
+	FrameVertexBytes = 0;
+	FrameUnpackedVertexBytes = 0;
+	FrameTiles = 0;
+	FrameTileDraws = 0;
+	FrameDeferredBatches = 0;
+	FrameNativeDraws = 0;
+	FrameFlushesAvoided = 0;
+	DeferringDraws = FALSE;
+	if (auto ComplexShader = dynamic_cast<DrawComplexProgram*>(Shaders[SHADER_Complex]))
+	{
+		ComplexShader->FrameCachedFacetDraws = 0;
+		ComplexShader->FrameEmittedFacetDraws = 0;
+		ComplexShader->DrawBuffer.FrameMergedCommands = 0;
+	}
+	if (auto GouraudShader = dynamic_cast<DrawGouraudProgram*>(Shaders[SHADER_Gouraud]))
+		GouraudShader->DrawBuffer.FrameMergedCommands = 0;
+	UploadDeferredMips();
+	StreamTextureMips();
+	ReleaseRetiredTextures(FALSE);
+	EvictTextures();
 	
     SetDepthMode(DEPTH_Test_And_Write);
+    TextureStaging.ResetFrameStats();
     DrawingWeapon = false;
     FlashScale = _FlashScale;
     FlashFog = _FlashFog;
@@ -370,6 +490,7 @@ void UFruCoReRenderDevice::Unlock(UBOOL Blit)
 		return;
 	
     SetProgram(SHADER_None);
+    dynamic_cast<DrawGouraudProgram*>(Shaders[SHADER_Gouraud])->UnlockTextures();
     
     CommandEncoder->endEncoding();
     
@@ -407,7 +528,10 @@ void UFruCoReRenderDevice::Unlock(UBOOL Blit)
     if (Blit)
         CommandBuffer->presentDrawable(Drawable);
 
+	// Command buffers complete in submission order, so we don't need to worry about CompletedFrameNumber going backwards
+	const INT SubmittedFrameNumber = FrameNumber;
 	CommandBuffer->addCompletedHandler(^void( MTL::CommandBuffer* Buf ){
+			CompletedFrameNumber = SubmittedFrameNumber;
 			__sync_fetch_and_sub(&NumInFlightFrames, 1);
 		});
 		
@@ -460,11 +584,10 @@ void UFruCoReRenderDevice::GetStats(TCHAR* Result)
 		return;
 	
 
-	Stats += FString::Printf(TEXT("Buffer Counts: Simple %05d/%05d/%05d - Tile %05d/%05d/%05d - Complex %05d/%05d/%05d - Gouraud %05d/%05d/%05d"),
+	Stats += FString::Printf(TEXT("Buffer Counts: Simple %05d/%05d/%05d - Tile -----/%05d/%05d - Complex %05d/%05d/%05d - Gouraud %05d/%05d/%05d"),
 							 SimpleShader->VertexBuffer.BufferCount(),
 							 SimpleShader->InstanceDataBuffer.BufferCount(),
 							 SimpleShader->DrawBuffer.CommandBuffer.Num(),
-							 TileShader->VertexBuffer.BufferCount(),
 							 TileShader->InstanceDataBuffer.BufferCount(),
 							 TileShader->DrawBuffer.CommandBuffer.Num(),
 							 ComplexShader->VertexBuffer.BufferCount(),
@@ -473,6 +596,93 @@ void UFruCoReRenderDevice::GetStats(TCHAR* Result)
 							 GouraudShader->VertexBuffer.BufferCount(),
 							 GouraudShader->InstanceDataBuffer.BufferCount(),
 							 GouraudShader->DrawBuffer.CommandBuffer.Num());
+	Stats += FString::Printf(TEXT(" - Draw Calls: %d Native This Frame, %d Complex/%d Gouraud Draws Merged"),
+							 FrameNativeDraws,
+							 ComplexShader->DrawBuffer.FrameMergedCommands,
+							 GouraudShader->DrawBuffer.FrameMergedCommands);
+	Stats += FString::Printf(TEXT(" - Texture Memory: %d/%d MB, %d Evicted, %d MB Saved By %d Shared Textures"),
+							 static_cast<INT>(TextureMemoryUsed / (1024 * 1024)),
+							 TextureMemoryBudget,
+							 NumEvictedTextures,
+							 static_cast<INT>(SharedBytes / (1024 * 1024)),
+							 NumSharedTextures);
+	Stats += FString::Printf(TEXT(" - Texture Staging: %d KB, %d Allocations (%d This Frame)"),
+							 static_cast<INT>(TextureStaging.GetTotalCapacity() / 1024),
+							 TextureStaging.NumAllocations,
+							 TextureStaging.NumFrameAllocations);
+	if (AtlasPages.Num() > 0)
+	{
+		FLOAT Occupancy = 0.f;
+		INT NumPacked = 0;
+		for (INT i = 0; i < AtlasPages.Num(); ++i)
+		{
+			Occupancy += AtlasPages(i)->Packer.GetOccupancy();
+			NumPacked += AtlasPages(i)->Packer.GetNumRects();
+		}
+		Stats += FString::Printf(TEXT(" - Lightmap Atlas: %d Pages, %d Lightmaps, %d%% Occupancy, %d Resets"),
+								 AtlasPages.Num(),
+								 NumPacked,
+								 static_cast<INT>(Occupancy * 100.f / AtlasPages.Num()),
+								 NumAtlasResets);
+	}
+	Stats += FString::Printf(TEXT(" - Realtime Uploads: %d Partial, %d Full, %d Palette Only, %d Skipped"),
+							 NumPartialRealtimeUploads,
+							 NumFullRealtimeUploads,
+							 NumPaletteRealtimeUploads,
+							 NumSkippedRealtimeUploads);
+	if (UseDiskCache)
+	{
+		const auto DiskCacheStats = TextureDiskCache.GetStats();
+		Stats += FString::Printf(TEXT(" - Disk Cache: %d Hits, %d Misses, %d New (%d KB), %d Corrupt"),
+								 static_cast<INT>(DiskCacheStats.NumHits),
+								 static_cast<INT>(DiskCacheStats.NumMisses),
+								 static_cast<INT>(DiskCacheStats.NumPendingEntries),
+								 static_cast<INT>(DiskCacheStats.PendingBytes / 1024),
+								 static_cast<INT>(DiskCacheStats.NumCorruptEntries));
+	}
+	Stats += FString::Printf(TEXT(" - Textures: %d Resident, %d Hits, %d Misses, %d us P50/%d us P99 Conversion"),
+							 BindMap.Num(),
+							 static_cast<INT>(NumTextureCacheHits),
+							 static_cast<INT>(NumTextureCacheMisses),
+							 static_cast<INT>(ConversionTimes.GetPercentile(0.5)),
+							 static_cast<INT>(ConversionTimes.GetPercentile(0.99)));
+	Stats += FString::Printf(TEXT(" - Uploads: %d (%d KB) This Frame, %d KB Budget, %d Deferred"),
+							 FrameUploads,
+							 static_cast<INT>(FrameUploadBytes / 1024),
+							 UploadBudget,
+							 DeferredUploads.Num());
+	if (StreamTextures)
+		Stats += FString::Printf(TEXT(" - Streaming: %d Textures, %d Streamed In, %d Streamed Out"),
+								 StreamedTextures.Num(),
+								 NumStreamedIn,
+								 NumStreamedOut);
+	Stats += FString::Printf(TEXT(" - Gouraud Texture Locks: %d This Frame, %d Cache Hits"),
+							 FrameTextureLocks,
+							 FrameLockCacheHits);
+	Stats += FString::Printf(TEXT(" - Vertex Bandwidth: %d KB This Frame, %d KB With Unpacked Vertices"),
+							 static_cast<INT>(FrameVertexBytes / 1024),
+							 static_cast<INT>(FrameUnpackedVertexBytes / 1024));
+	Stats += FString::Printf(TEXT(" - Tiles: %d This Frame, %d Draws (Unbatched: One Per Tile), %d KB (%d KB Unbatched)"),
+							 FrameTiles,
+							 FrameTileDraws,
+							 static_cast<INT>(FrameTiles * sizeof(TileInstanceData) / 1024),
+							 static_cast<INT>(FrameTiles * TILE_UNBATCHED_BYTES / 1024));
+	if (CacheWorldGeometry)
+		Stats += FString::Printf(TEXT(" - World Geometry: %d Surfaces (%d KB), %d Cached/%d Emitted Draws This Frame, %d Resets"),
+								 ComplexShader->NumCachedSurfaces,
+								 static_cast<INT>(ComplexShader->NumWorldGeometryVertices * sizeof(ComplexVertex) / 1024),
+								 ComplexShader->FrameCachedFacetDraws,
+								 ComplexShader->FrameEmittedFacetDraws,
+								 ComplexShader->NumWorldGeometryResets);
+	if (SortOpaqueDraws)
+		Stats += FString::Printf(TEXT(" - Draw List: %d Deferred Batches, %d Flushes Avoided This Frame"),
+								 FrameDeferredBatches,
+								 FrameFlushesAvoided);
+	Stats += FString::Printf(TEXT(" - Texture Jobs: %d Queued, %d Resident, %.2f ms Avg/%.2f ms Max Time To Resident"),
+							 PendingTextureJobs.Num(),
+							 NumAsyncTextures,
+							 NumAsyncTextures ? TotalTimeToResident * 1000.0 / NumAsyncTextures : 0.0,
+							 MaxTimeToResident * 1000.0);
 	appStrcpy(Result, *Stats);
 }
 
@@ -526,13 +736,6 @@ void UFruCoReRenderDevice::SetSceneNode(FSceneNode* Frame)
     SetProjection(Frame, 0);
 }
 
-/*-----------------------------------------------------------------------------
-    PrecacheTexture
------------------------------------------------------------------------------*/
-void UFruCoReRenderDevice::PrecacheTexture(FTextureInfo& Info, DWORD PolyFlags)
-{
-}
-
 /*-----------------------------------------------------------------------------
 	SupportsTextureFormat
 -----------------------------------------------------------------------------*/
@@ -573,6 +776,14 @@ void UFruCoReRenderDevice::SetProgram(INT Program)
     {
         if (Shaders[ActiveProgram])
             Shaders[ActiveProgram]->DeactivateShader();
+        
+        // Only the complex and gouraud programs defer their draws. Anything
+        // else has to see the opaque draws we've deferred so far
+        if (DeferringDraws && Program != SHADER_Complex && Program != SHADER_Gouraud)
+        {
+            FlushDrawList();
+            DeferringDraws = FALSE;
+        }
         ActiveProgram = Program;
         if (Shaders[ActiveProgram])
             Shaders[ActiveProgram]->ActivateShader();
@@ -679,6 +890,37 @@ void UFruCoReRenderDevice::SetProjection(FSceneNode *Frame, UBOOL bNearZ)
         CreateMultisampleRenderTargets();
 }
 
+/*-----------------------------------------------------------------------------
+    SetFrameUniforms - Sets the view matrix for the cached world geometry.
+    We only do this for the first top-level scene node of every frame.
+    Returns TRUE if @Frame is the scene node whose view matrix is bound.
+-----------------------------------------------------------------------------*/
+UBOOL UFruCoReRenderDevice::SetFrameUniforms(FSceneNode* Frame)
+{
+    if (Frame->Parent)
+        return FALSE;
+    
+    if (FrameUniformsNumber == FrameNumber)
+        return appMemcmp(&FrameUniformsCoords, &Frame->Coords, sizeof(FCoords)) == 0;
+    
+    // World to camera space
+    const FCoords& C = Frame->Coords;
+    FrameUniformsData.ViewMatrix = simd_matrix_from_rows(
+        (simd::float4){ C.XAxis.X, C.XAxis.Y, C.XAxis.Z, -(C.Origin | C.XAxis) },
+        (simd::float4){ C.YAxis.X, C.YAxis.Y, C.YAxis.Z, -(C.Origin | C.YAxis) },
+        (simd::float4){ C.ZAxis.X, C.ZAxis.Y, C.ZAxis.Z, -(C.Origin | C.ZAxis) },
+        (simd::float4){ 0.f, 0.f, 0.f, 1.f }
+    );
+    FrameUniformsCoords = Frame->Coords;
+    FrameUniformsNumber = FrameNumber;
+    
+    // setVertexBytes copies the data into the command buffer, so this doesn't
+    // affect draws we've already encoded. The previous frame's draws are all
+    // encoded by now
+    CommandEncoder->setVertexBytes(&FrameUniformsData, sizeof(FrameUniforms), IDX_FrameUniforms);
+    return TRUE;
+}
+
 /*-----------------------------------------------------------------------------
     CreateRenderTargets
 -----------------------------------------------------------------------------*/
@@ -819,11 +1061,13 @@ void UFruCoReRenderDevice::CreateCommandEncoder(MTL::CommandBuffer *Buffer, bool
     CommandEncoder->setViewport(MetalViewport);
     
     GlobalUniformsBuffer.BindBuffer(CommandEncoder);
+    CommandEncoder->setVertexBytes(&FrameUniformsData, sizeof(FrameUniforms), IDX_FrameUniforms);
     
     if (ActivePipelineState)
         CommandEncoder->setRenderPipelineState(ActivePipelineState);
     
     memset(BoundTextures, 0, sizeof(BoundTextures));
+    memset(BoundMetalTextures, 0, sizeof(BoundMetalTextures));
 }
 
 /*-----------------------------------------------------------------------------
@@ -837,7 +1081,10 @@ void UFruCoReRenderDevice::SetDepthMode(DepthMode Mode)
         if (CommandEncoder)
         {
             Shaders[ActiveProgram]->Flush();
-            CommandEncoder->setDepthStencilState(DepthStencilStates[Mode]);
+            
+            // While we're deferring draws, FlushDrawList binds the state
+            if (!DeferringDraws)
+                CommandEncoder->setDepthStencilState(DepthStencilStates[Mode]);
         }
     }
 }
@@ -1010,6 +1257,146 @@ void UFruCoReRenderDevice::SetPipelineState(const MTL::RenderPipelineState *Stat
     if (Shaders[ActiveProgram])
         Shaders[ActiveProgram]->Flush();
     
-    CommandEncoder->setRenderPipelineState(State);
+    // While we're deferring draws, FlushDrawList binds the state
+    if (!DeferringDraws)
+        CommandEncoder->setRenderPipelineState(State);
     ActivePipelineState = State;
 }
+
+/*-----------------------------------------------------------------------------
+    IsDeferrableDraw - Opaque draws that write depth can be drawn in any
+    order without changing the result
+-----------------------------------------------------------------------------*/
+UBOOL UFruCoReRenderDevice::IsDeferrableDraw(DWORD PolyFlags)
+{
+    const auto Mode = GetBlendMode(PolyFlags);
+    return (PolyFlags & PF_Occlude) == PF_Occlude && (Mode == BLEND_None || Mode == BLEND_Masked);
+}
+
+/*-----------------------------------------------------------------------------
+    SetDrawDeferral - Starts or stops recording draws in the draw list. We
+    submit everything we've recorded when we stop, so the next draw ends up
+    on top of it
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::SetDrawDeferral(UBOOL Defer)
+{
+    // The editor relies on the draw order for hit testing
+    Defer = Defer && SortOpaqueDraws && !GIsEditor;
+    if (Defer == DeferringDraws)
+        return;
+    
+    // Pending commands belong to the mode they were buffered in
+    Shaders[ActiveProgram]->Flush();
+    if (DeferringDraws)
+        FlushDrawList();
+    DeferringDraws = Defer;
+}
+
+/*-----------------------------------------------------------------------------
+    DeferDraw - Adds a record for a batch the active program is about to
+    defer, with the state that is currently bound
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::DeferredDraw& UFruCoReRenderDevice::DeferDraw()
+{
+    const void* KeyTextures[DRAWKEY_NUM_TEXTURES];
+    for (INT i = 0; i < DRAWKEY_NUM_TEXTURES; ++i)
+        KeyTextures[i] = BoundMetalTextures[i];
+    
+    auto& Draw = DrawList.Add(MakeDrawSortKey(ActiveProgram, ActivePipelineState, CurrentDepthMode, KeyTextures));
+    Draw.Program = ActiveProgram;
+    Draw.PipelineState = ActivePipelineState;
+    Draw.Depth = CurrentDepthMode;
+    for (INT i = 0; i < IDX_DiffusePalette; ++i)
+        Draw.Textures[i] = BoundMetalTextures[i];
+    Draw.Textures[IDX_DiffusePalette] = BoundTextures[IDX_DiffuseTexture] ? BoundTextures[IDX_DiffuseTexture]->Palette : nullptr;
+    Draw.NumBindings = 0;
+    Draw.IndexBuffer = nullptr;
+    Draw.FirstCommand = static_cast<INT>(DeferredCommands.size());
+    Draw.NumCommands = 0;
+    FrameDeferredBatches++;
+    return Draw;
+}
+
+/*-----------------------------------------------------------------------------
+    FlushDrawList - Sorts the deferred draws by state and encodes them. We
+    only touch the encoder state that differs from the previous draw, then
+    restore the state the next draw expects
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::FlushDrawList()
+{
+    DrawList.Sort();
+    
+    const MTL::RenderPipelineState* State = nullptr;
+    INT Depth = -1;
+    MTL::Texture* Textures[IDX_DiffusePalette + 1] = {};
+    MTL::Buffer* VertexBuffers[IDX_DrawComplexWorldVertexData + 1] = {};
+    UBOOL UsedPrograms[SHADER_Max] = {};
+    INT StateChanges = 0;
+    
+    for (size_t i = 0; i < DrawList.Num(); ++i)
+    {
+        const auto& Draw = DrawList[i];
+        
+        // These are the changes that would have forced a flush
+        UBOOL Changed = FALSE;
+        if (Draw.PipelineState != State)
+        {
+            CommandEncoder->setRenderPipelineState(Draw.PipelineState);
+            State = Draw.PipelineState;
+            Changed = TRUE;
+        }
+        if (Draw.Depth != Depth)
+        {
+            CommandEncoder->setDepthStencilState(DepthStencilStates[Draw.Depth]);
+            Depth = Draw.Depth;
+            Changed = TRUE;
+        }
+        for (INT t = 0; t <= IDX_DiffusePalette; ++t)
+        {
+            // Unused slots keep whatever we bound last
+            if (Draw.Textures[t] && Draw.Textures[t] != Textures[t])
+            {
+                CommandEncoder->setFragmentTexture(Draw.Textures[t], t);
+                Textures[t] = Draw.Textures[t];
+                Changed = TRUE;
+            }
+        }
+        if (Changed)
+            StateChanges++;
+        
+        for (INT b = 0; b < Draw.NumBindings; ++b)
+        {
+            const auto& Binding = Draw.Bindings[b];
+            if (Binding.VertexIndex != -1 && VertexBuffers[Binding.VertexIndex] != Binding.Buffer)
+            {
+                CommandEncoder->setVertexBuffer(Binding.Buffer, 0, Binding.VertexIndex);
+                VertexBuffers[Binding.VertexIndex] = Binding.Buffer;
+            }
+            if (Binding.FragmentIndex != -1)
+                CommandEncoder->setFragmentBuffer(Binding.Buffer, 0, Binding.FragmentIndex);
+        }
+        UsedPrograms[Draw.Program] = TRUE;
+        
+        for (INT c = 0; c < Draw.NumCommands; ++c)
+            MultiDrawIndirectBuffer::EncodeCommand(MTL::PrimitiveTypeTriangle, CommandEncoder, Draw.IndexBuffer, DeferredCommands[Draw.FirstCommand + c]);
+        FrameNativeDraws += Draw.NumCommands;
+    }
+    
+    FrameFlushesAvoided += static_cast<INT>(DrawList.Num()) - StateChanges;
+    DrawList.Reset();
+    DeferredCommands.clear();
+    
+    // Restore the current state. We skipped the encoder calls for state
+    // changes while we were deferring, so we do this even if we have no draws
+    if (ActivePipelineState)
+        CommandEncoder->setRenderPipelineState(ActivePipelineState);
+    CommandEncoder->setDepthStencilState(DepthStencilStates[CurrentDepthMode]);
+    for (INT t = 0; t < IDX_DiffusePalette; ++t)
+        if (BoundMetalTextures[t])
+            CommandEncoder->setFragmentTexture(BoundMetalTextures[t], t);
+    if (BoundTextures[IDX_DiffuseTexture] && BoundTextures[IDX_DiffuseTexture]->Palette)
+        CommandEncoder->setFragmentTexture(BoundTextures[IDX_DiffuseTexture]->Palette, IDX_DiffusePalette);
+    for (INT p = 0; p < SHADER_Max; ++p)
+        if (UsedPrograms[p] && Shaders[p])
+            Shaders[p]->ActivateShader();
+}
@@ -0,0 +1,156 @@
+/*=============================================================================
+    FruCoRe_AtlasPacker.cpp: Rectangle packer for lightmap and fogmap atlases.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_AtlasPacker.h"
+
+#include <string.h>
+
+/*-----------------------------------------------------------------------------
+    Init/Reset
+-----------------------------------------------------------------------------*/
+void FSkylinePacker::Init(uint32_t InWidth, uint32_t InHeight, uint32_t InPadding)
+{
+    Width = InWidth;
+    Height = InHeight;
+    Padding = InPadding;
+    Reset();
+}
+
+void FSkylinePacker::Reset()
+{
+    Skyline.clear();
+    Skyline.push_back({0, 0, Width});
+    NumRects = 0;
+    UsedArea = 0;
+}
+
+float FSkylinePacker::GetOccupancy() const
+{
+    const uint64_t PageArea = static_cast<uint64_t>(Width) * Height;
+    return PageArea ? static_cast<float>(static_cast<double>(UsedArea) / PageArea) : 0.f;
+}
+
+/*-----------------------------------------------------------------------------
+    FitsAt
+-----------------------------------------------------------------------------*/
+bool FSkylinePacker::FitsAt(size_t Index, uint32_t RectWidth, uint32_t RectHeight, uint32_t& OutY) const
+{
+    if (Skyline[Index].X + RectWidth > Width)
+        return false;
+
+    // The rectangle rests on the highest segment it spans
+    uint32_t Y = 0;
+    uint32_t Remaining = RectWidth;
+    for (size_t i = Index; Remaining > 0; ++i)
+    {
+        if (i == Skyline.size())
+            return false;
+        Y = Skyline[i].Y > Y ? Skyline[i].Y : Y;
+        if (Y + RectHeight > Height)
+            return false;
+        Remaining -= Skyline[i].Width < Remaining ? Skyline[i].Width : Remaining;
+    }
+
+    OutY = Y;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+    Pack
+-----------------------------------------------------------------------------*/
+bool FSkylinePacker::Pack(uint32_t RectWidth, uint32_t RectHeight, uint32_t& OutX, uint32_t& OutY)
+{
+    const uint32_t PaddedWidth = RectWidth + 2 * Padding;
+    const uint32_t PaddedHeight = RectHeight + 2 * Padding;
+    if (RectWidth == 0 || RectHeight == 0 || PaddedWidth > Width || PaddedHeight > Height)
+        return false;
+
+    // Bottom-left heuristic: lowest top edge first, then the narrowest
+    // segment, so we fill gaps before we open up new space
+    size_t BestIndex = SIZE_MAX;
+    uint32_t BestTop = UINT32_MAX;
+    uint32_t BestWidth = UINT32_MAX;
+    for (size_t i = 0; i < Skyline.size(); ++i)
+    {
+        uint32_t Y;
+        if (!FitsAt(i, PaddedWidth, PaddedHeight, Y))
+            continue;
+        if (Y + PaddedHeight < BestTop || (Y + PaddedHeight == BestTop && Skyline[i].Width < BestWidth))
+        {
+            BestIndex = i;
+            BestTop = Y + PaddedHeight;
+            BestWidth = Skyline[i].Width;
+        }
+    }
+
+    if (BestIndex == SIZE_MAX)
+        return false;
+
+    const uint32_t X = Skyline[BestIndex].X;
+    Skyline.insert(Skyline.begin() + BestIndex, {X, BestTop, PaddedWidth});
+
+    // Shrink or remove the segments the new one covers
+    for (size_t i = BestIndex + 1; i < Skyline.size();)
+    {
+        const uint32_t End = X + PaddedWidth;
+        if (Skyline[i].X >= End)
+            break;
+
+        const uint32_t Overlap = End - Skyline[i].X;
+        if (Skyline[i].Width <= Overlap)
+        {
+            Skyline.erase(Skyline.begin() + i);
+            continue;
+        }
+
+        Skyline[i].X += Overlap;
+        Skyline[i].Width -= Overlap;
+        break;
+    }
+
+    // Merge neighbours at the same height
+    for (size_t i = 0; i + 1 < Skyline.size();)
+    {
+        if (Skyline[i].Y == Skyline[i + 1].Y)
+        {
+            Skyline[i].Width += Skyline[i + 1].Width;
+            Skyline.erase(Skyline.begin() + i + 1);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    NumRects++;
+    UsedArea += static_cast<uint64_t>(PaddedWidth) * PaddedHeight;
+    OutX = X + Padding;
+    OutY = BestTop - PaddedHeight + Padding;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+    PadImage
+-----------------------------------------------------------------------------*/
+void PadImage(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t Padding, uint32_t* Dst)
+{
+    const uint32_t DstPitch = USize + 2 * Padding;
+    for (uint32_t Y = 0; Y < VSize + 2 * Padding; ++Y)
+    {
+        const uint32_t SrcY = Y < Padding ? 0 : (Y - Padding >= VSize ? VSize - 1 : Y - Padding);
+        const uint32_t* SrcRow = Src + SrcY * USize;
+        uint32_t* DstRow = Dst + Y * DstPitch;
+
+        for (uint32_t X = 0; X < Padding; ++X)
+        {
+            DstRow[X] = SrcRow[0];
+            DstRow[Padding + USize + X] = SrcRow[USize - 1];
+        }
+        memcpy(DstRow + Padding, SrcRow, USize * sizeof(uint32_t));
+    }
+}
@@ -0,0 +1,356 @@
+/*=============================================================================
+    FruCoRe_DiskCache.cpp: Persistent cache of converted textures.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_DiskCache.h"
+#include "FruCoRe_TextureCache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*-----------------------------------------------------------------------------
+    ValidateCacheFile - Checks everything except for the entry checksums.
+    We only verify those when an entry is first used.
+-----------------------------------------------------------------------------*/
+static const char* ValidateCacheFile(const uint8_t* Data, uint64_t Size)
+{
+    if (Size < sizeof(FDiskCacheHeader))
+        return "File is too small";
+
+    const FDiskCacheHeader* Header = reinterpret_cast<const FDiskCacheHeader*>(Data);
+    if (Header->Magic != DISKCACHE_MAGIC)
+        return "Bad magic";
+    if (Header->Version != DISKCACHE_VERSION)
+        return "Unsupported version";
+    if (Header->FileSize != Size)
+        return "File size mismatch";
+    if (Header->NumEntries > (Size - sizeof(FDiskCacheHeader)) / sizeof(FDiskCacheEntry))
+        return "Entry table out of bounds";
+
+    const FDiskCacheEntry* Entries = reinterpret_cast<const FDiskCacheEntry*>(Data + sizeof(FDiskCacheHeader));
+    if (HashBytes64(Entries, Header->NumEntries * sizeof(FDiskCacheEntry)) != Header->TableChecksum)
+        return "Entry table checksum mismatch";
+
+    const uint64_t DataStart = sizeof(FDiskCacheHeader) + Header->NumEntries * sizeof(FDiskCacheEntry);
+    for (uint64_t i = 0; i < Header->NumEntries; ++i)
+    {
+        if (i > 0 && Entries[i].Key <= Entries[i - 1].Key)
+            return "Entry table is not sorted";
+        if (Entries[i].Offset < DataStart || Entries[i].Offset > Size || Entries[i].Size > Size - Entries[i].Offset)
+            return "Entry data out of bounds";
+    }
+    return nullptr;
+}
+
+/*-----------------------------------------------------------------------------
+    Open/Close
+-----------------------------------------------------------------------------*/
+FTextureDiskCache::~FTextureDiskCache()
+{
+    Close();
+}
+
+void FTextureDiskCache::Open(const char* InPath, uint64_t InMaxBytes)
+{
+    Close();
+
+    std::lock_guard<std::mutex> Guard(Lock);
+    Path = InPath;
+    MaxBytes = InMaxBytes;
+
+    const int File = open(InPath, O_RDONLY);
+    if (File < 0)
+        return;
+
+    struct stat Stat;
+    if (fstat(File, &Stat) == 0 && Stat.st_size > 0)
+    {
+        void* Data = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+        if (Data != MAP_FAILED)
+        {
+            Mapped = static_cast<const uint8_t*>(Data);
+            MappedSize = Stat.st_size;
+        }
+    }
+    close(File);
+
+    if (!Mapped)
+        return;
+
+    if (ValidateCacheFile(Mapped, MappedSize))
+    {
+        // We'll overwrite the file when we save
+        NumCorruptEntries++;
+        Unmap();
+        return;
+    }
+
+    const FDiskCacheHeader* Header = reinterpret_cast<const FDiskCacheHeader*>(Mapped);
+    Entries = reinterpret_cast<const FDiskCacheEntry*>(Mapped + sizeof(FDiskCacheHeader));
+    NumEntries = Header->NumEntries;
+    EntryStates.assign(NumEntries, ENTRY_Unverified);
+    EntryUsed.assign(NumEntries, 0);
+}
+
+void FTextureDiskCache::Unmap()
+{
+    if (Mapped)
+        munmap(const_cast<uint8_t*>(Mapped), MappedSize);
+    Mapped = nullptr;
+    MappedSize = 0;
+    Entries = nullptr;
+    NumEntries = 0;
+    EntryStates.clear();
+    EntryUsed.clear();
+}
+
+void FTextureDiskCache::Close()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+    Unmap();
+    Pending.clear();
+    PendingBytes = 0;
+}
+
+/*-----------------------------------------------------------------------------
+    Find/Add
+-----------------------------------------------------------------------------*/
+const uint8_t* FTextureDiskCache::Find(uint64_t Key, uint64_t Size)
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    const FDiskCacheEntry* End = Entries + NumEntries;
+    const FDiskCacheEntry* Entry = std::lower_bound(Entries, End, Key, [](const FDiskCacheEntry& A, uint64_t B)
+    {
+        return A.Key < B;
+    });
+
+    if (Entry != End && Entry->Key == Key && Entry->Size == Size)
+    {
+        const uint64_t Index = Entry - Entries;
+        if (EntryStates[Index] == ENTRY_Unverified)
+        {
+            const bool Valid = HashBytes64(Mapped + Entry->Offset, Entry->Size) == Entry->Checksum;
+            EntryStates[Index] = Valid ? ENTRY_Valid : ENTRY_Corrupt;
+            if (!Valid)
+                NumCorruptEntries++;
+        }
+
+        if (EntryStates[Index] == ENTRY_Valid)
+        {
+            EntryUsed[Index] = 1;
+            NumHits++;
+            return Mapped + Entry->Offset;
+        }
+    }
+
+    auto It = Pending.find(Key);
+    if (It != Pending.end() && It->second.size() == Size)
+    {
+        NumHits++;
+        return It->second.data();
+    }
+
+    NumMisses++;
+    return nullptr;
+}
+
+void FTextureDiskCache::Add(uint64_t Key, const void* Data, uint64_t Size)
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    // Entries we've used this session take priority when we save, so we
+    // stop adding new ones once they alone would fill the cache
+    if (PendingBytes + Size > MaxBytes || Pending.count(Key))
+        return;
+
+    const uint8_t* Bytes = static_cast<const uint8_t*>(Data);
+    Pending.emplace(Key, std::vector<uint8_t>(Bytes, Bytes + Size));
+    PendingBytes += Size;
+}
+
+/*-----------------------------------------------------------------------------
+    Save - We write the new file next to the old one and then rename it, so
+    a crash while saving cannot corrupt the existing cache.
+-----------------------------------------------------------------------------*/
+bool FTextureDiskCache::Save()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if (Path.empty() || (Pending.empty() && NumEntries == 0))
+        return true;
+
+    struct FSource
+    {
+        uint64_t        Key;
+        const uint8_t*  Data;
+        uint64_t        Size;
+    };
+    std::vector<FSource> Sources;
+    uint64_t TotalBytes = 0;
+
+    auto AddSource = [&](uint64_t Key, const uint8_t* Data, uint64_t Size)
+    {
+        if (TotalBytes + Size > MaxBytes)
+            return;
+        Sources.push_back({Key, Data, Size});
+        TotalBytes += Size;
+    };
+
+    // Priority: new entries, entries used this session, other valid entries
+    for (const auto& It : Pending)
+        AddSource(It.first, It.second.data(), It.second.size());
+    for (int Pass = 0; Pass < 2; ++Pass)
+    {
+        for (uint64_t i = 0; i < NumEntries; ++i)
+        {
+            if (EntryUsed[i] != (Pass == 0 ? 1 : 0) || EntryStates[i] == ENTRY_Corrupt || Pending.count(Entries[i].Key))
+                continue;
+            // Unverified entries get checked when the next session uses them
+            AddSource(Entries[i].Key, Mapped + Entries[i].Offset, Entries[i].Size);
+        }
+    }
+
+    std::sort(Sources.begin(), Sources.end(), [](const FSource& A, const FSource& B)
+    {
+        return A.Key < B.Key;
+    });
+
+    std::vector<FDiskCacheEntry> Table(Sources.size());
+    uint64_t Offset = sizeof(FDiskCacheHeader) + Table.size() * sizeof(FDiskCacheEntry);
+    for (size_t i = 0; i < Sources.size(); ++i)
+    {
+        Offset = (Offset + 15) & ~static_cast<uint64_t>(15);
+        Table[i].Key = Sources[i].Key;
+        Table[i].Offset = Offset;
+        Table[i].Size = Sources[i].Size;
+        Table[i].Checksum = HashBytes64(Sources[i].Data, Sources[i].Size);
+        Offset += Sources[i].Size;
+    }
+
+    FDiskCacheHeader Header;
+    Header.Magic = DISKCACHE_MAGIC;
+    Header.Version = DISKCACHE_VERSION;
+    Header.NumEntries = Table.size();
+    Header.FileSize = Offset;
+    Header.TableChecksum = HashBytes64(Table.data(), Table.size() * sizeof(FDiskCacheEntry));
+
+    const std::string TempPath = Path + ".tmp";
+    FILE* File = fopen(TempPath.c_str(), "wb");
+    if (!File)
+        return false;
+
+    bool Success = fwrite(&Header, sizeof(Header), 1, File) == 1;
+    if (Success && !Table.empty())
+        Success = fwrite(Table.data(), sizeof(FDiskCacheEntry), Table.size(), File) == Table.size();
+
+    static const uint8_t Padding[16] = {};
+    uint64_t Written = sizeof(FDiskCacheHeader) + Table.size() * sizeof(FDiskCacheEntry);
+    for (size_t i = 0; Success && i < Sources.size(); ++i)
+    {
+        const uint64_t PadBytes = Table[i].Offset - Written;
+        Success = (PadBytes == 0 || fwrite(Padding, PadBytes, 1, File) == 1) &&
+                  (Sources[i].Size == 0 || fwrite(Sources[i].Data, Sources[i].Size, 1, File) == 1);
+        Written = Table[i].Offset + Sources[i].Size;
+    }
+
+    Success = (fclose(File) == 0) && Success;
+    if (!Success || rename(TempPath.c_str(), Path.c_str()) != 0)
+    {
+        unlink(TempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+    Verify
+-----------------------------------------------------------------------------*/
+uint64_t FTextureDiskCache::Verify()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    uint64_t NumCorrupt = 0;
+    for (uint64_t i = 0; i < NumEntries; ++i)
+    {
+        if (EntryStates[i] == ENTRY_Unverified)
+        {
+            const bool Valid = HashBytes64(Mapped + Entries[i].Offset, Entries[i].Size) == Entries[i].Checksum;
+            EntryStates[i] = Valid ? ENTRY_Valid : ENTRY_Corrupt;
+            if (!Valid)
+                NumCorruptEntries++;
+        }
+        NumCorrupt += EntryStates[i] == ENTRY_Corrupt ? 1 : 0;
+    }
+    return NumCorrupt;
+}
+
+/*-----------------------------------------------------------------------------
+    GetStats
+-----------------------------------------------------------------------------*/
+FTextureDiskCache::FStats FTextureDiskCache::GetStats()
+{
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    FStats Result{};
+    Result.NumMappedEntries = NumEntries;
+    Result.MappedBytes = MappedSize;
+    Result.NumPendingEntries = Pending.size();
+    Result.PendingBytes = PendingBytes;
+    Result.NumHits = NumHits;
+    Result.NumMisses = NumMisses;
+    Result.NumCorruptEntries = NumCorruptEntries;
+    return Result;
+}
+
+/*-----------------------------------------------------------------------------
+    Inspect
+-----------------------------------------------------------------------------*/
+bool FTextureDiskCache::Inspect(const char* Path, bool Verbose, void (*Print)(const char* Line, void* User), void* User)
+{
+    char Line[256];
+
+    FTextureDiskCache Cache;
+    Cache.Open(Path, UINT64_MAX);
+    if (!Cache.Mapped)
+    {
+        snprintf(Line, sizeof(Line), "%s: %s", Path, Cache.NumCorruptEntries ? "not a valid texture cache" : "could not open file");
+        Print(Line, User);
+        return false;
+    }
+
+    uint64_t NumCorrupt = 0;
+    uint64_t DataBytes = 0;
+    for (uint64_t i = 0; i < Cache.NumEntries; ++i)
+    {
+        const FDiskCacheEntry& Entry = Cache.Entries[i];
+        const bool Valid = HashBytes64(Cache.Mapped + Entry.Offset, Entry.Size) == Entry.Checksum;
+        NumCorrupt += Valid ? 0 : 1;
+        DataBytes += Entry.Size;
+
+        if (Verbose || !Valid)
+        {
+            snprintf(Line, sizeof(Line), "  %016llx: %llu bytes at offset %llu%s",
+                     static_cast<unsigned long long>(Entry.Key),
+                     static_cast<unsigned long long>(Entry.Size),
+                     static_cast<unsigned long long>(Entry.Offset),
+                     Valid ? "" : " (CORRUPT)");
+            Print(Line, User);
+        }
+    }
+
+    snprintf(Line, sizeof(Line), "%s: version %u, %llu entries, %llu KB of texture data, %llu corrupt entries",
+             Path, DISKCACHE_VERSION,
+             static_cast<unsigned long long>(Cache.NumEntries),
+             static_cast<unsigned long long>(DataBytes / 1024),
+             static_cast<unsigned long long>(NumCorrupt));
+    Print(Line, User);
+    return NumCorrupt == 0;
+}
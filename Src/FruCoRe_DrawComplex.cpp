@@ -49,11 +49,6 @@ static void SetTextureHelper
 /*-----------------------------------------------------------------------------
     DrawComplexSurface
 -----------------------------------------------------------------------------*/
-static simd::float4 FVectorToFloat4(FVector& Vec)
-{
-    return simd::make_float4(Vec.X, Vec.Y, Vec.Z, 0.f);
-}
-
 void UFruCoReRenderDevice::DrawComplexSurface(FSceneNode *Frame, FSurfaceInfo &Surface, FSurfaceFacet &Facet)
 {
 	if (RendererSuspended)
@@ -69,9 +64,11 @@ void UFruCoReRenderDevice::DrawComplexSurface(FSceneNode *Frame, FSurfaceInfo &S
     
     DWORD Options = OPT_None;
     const auto PolyFlags = GetPolyFlagsAndShaderOptions(Surface.PolyFlags, Options);
+    SetDrawDeferral(IsDeferrableDraw(PolyFlags));
     
     // Bind all textures
     SetTextureHelper(this, DrawData, IDX_DiffuseTexture, *Surface.Texture, PolyFlags, 0.0, &DrawData->DiffuseUV, &DrawData->DiffuseInfo);
+    Options |= GetTextureShaderOptions(IDX_DiffuseTexture);
     
     if (Surface.LightMap)
     {
@@ -104,50 +101,341 @@ void UFruCoReRenderDevice::DrawComplexSurface(FSceneNode *Frame, FSurfaceInfo &S
 
     Shader->SelectPipelineState(GetBlendMode(PolyFlags), static_cast<ShaderOptions>(Options));
     SetDepthMode(((PolyFlags & PF_Occlude) == PF_Occlude) ? DEPTH_Test_And_Write : DEPTH_Test_No_Write);
-    Shader->DrawBuffer.StartDrawCall();
     
-    INT FacetVertexCount = 0;
-    for (FSavedPoly* Poly = Facet.Polys; Poly; Poly = Poly->Next)
+    // Nodes we've already cached in world space only cost us a draw
+    // command. The cached geometry is transformed by the view matrix of the
+    // top-level scene node, so we can only use it there
+    FLOAT FacetMinZ = BIG_NUMBER;
+    const UBOOL bCached = CacheWorldGeometry && (PolyFlags & (PF_Occlude|PF_Translucent|PF_Modulated)) == PF_Occlude && SetFrameUniforms(Frame) &&
+        Shader->FindCachedNodes(Frame, Surface, Facet, FacetMinZ);
+    if (bCached)
     {
-        const INT NumPts = Poly->NumPts;
-        if (NumPts < 3) //Skip invalid polygons,if any?
-            continue;
-
-        if (!Shader->VertexBuffer.CanBuffer((NumPts - 2) * 3))
+        // All nodes share this facet's instance data
+        UBOOL bFirst = true;
+        for (INT i = 0; i < Shader->FacetNodes.Num(); ++i)
+        {
+            auto& Node = Shader->CachedNodes(Shader->FacetNodes(i));
+            if (Node.LastDrawnFrame == FrameNumber)
+                continue;
+            Shader->DrawBuffer.AddDrawCall(COMPLEX_WORLD_VERTEX_BASE + Node.FirstVertex, Node.NumVertices, !bFirst);
+            Node.LastDrawnFrame = FrameNumber;
+            bFirst = false;
+        }
+        if (!bFirst)
         {
-            Shader->DrawBuffer.EndDrawCall(FacetVertexCount);
             Shader->InstanceDataBuffer.Advance(1);
+            Shader->FrameCachedFacetDraws++;
+        }
+    }
+    else
+    {
+        Shader->DrawBuffer.StartDrawCall();
+    
+        INT FacetVertexCount = 0;
+        INT FacetIndexCount = 0;
+        for (FSavedPoly* Poly = Facet.Polys; Poly; Poly = Poly->Next)
+        {
+            if (Poly->Next)
+                __builtin_prefetch(Poly->Next);
+        
+            const INT NumPts = Poly->NumPts;
+            if (NumPts < 3) //Skip invalid polygons,if any?
+                continue;
+
+            // We buffer each point once and triangulate the polygon with fan indices
+            const INT NumIndices = GetFanIndexCount(NumPts);
+            if (!Shader->VertexBuffer.CanBuffer(NumPts) || !Shader->IndexBuffer.CanBuffer(NumIndices))
+            {
+                Shader->DrawBuffer.EndDrawCall(FacetVertexCount, FacetIndexCount, BatchDrawCalls);
+                Shader->InstanceDataBuffer.Advance(1);
             
-            // Make a backup of the instance parameters so we can start our
-            // new instancedata buffer with a copy of the current parameters
-            ComplexInstanceData Tmp;
-            memcpy(&Tmp, DrawData, sizeof(ComplexInstanceData));
+                // Make a backup of the instance parameters so we can start our
+                // new instancedata buffer with a copy of the current parameters
+                ComplexInstanceData Tmp;
+                memcpy(&Tmp, DrawData, sizeof(ComplexInstanceData));
             
-            Shader->RotateBuffers();
+                Shader->RotateBuffers();
             
-            DrawData = Shader->InstanceDataBuffer.GetCurrentElementPtr();
-            memcpy(DrawData, &Tmp, sizeof(ComplexInstanceData));
+                DrawData = Shader->InstanceDataBuffer.GetCurrentElementPtr();
+                memcpy(DrawData, &Tmp, sizeof(ComplexInstanceData));
             
-            Shader->DrawBuffer.StartDrawCall();
-            FacetVertexCount = 0;
+                Shader->DrawBuffer.StartDrawCall();
+                FacetVertexCount = 0;
+                FacetIndexCount = 0;
+            }
+
+            // Buffer each point once
+            FTransform** In = &Poly->Pts[0];
+            const FLOAT PolyMinZ = EmitPositionVertices(Shader->VertexBuffer.GetCurrentElementPtr(), NumPts, Shader->InstanceDataBuffer.Index,
+                                                        [In](INT i) -> FVector& { return In[i]->Point; });
+            FacetMinZ = Min(FacetMinZ, PolyMinZ);
+            EmitFanIndices(Shader->IndexBuffer.GetCurrentElementPtr(), Shader->VertexBuffer.Index, NumPts);
+
+            FacetVertexCount  += NumPts;
+            FacetIndexCount   += NumIndices;
+            Shader->VertexBuffer.Advance(NumPts);
+            Shader->IndexBuffer.Advance(NumIndices);
+            CountVertices(NumPts, sizeof(ComplexVertex), sizeof(simd::float4));
         }
 
-        FTransform** In = &Poly->Pts[0];
-        auto Out = Shader->VertexBuffer.GetCurrentElementPtr();
+        Shader->DrawBuffer.EndDrawCall(FacetVertexCount, FacetIndexCount, BatchDrawCalls);
+        Shader->InstanceDataBuffer.Advance(1);
+    
+        Shader->FrameEmittedFacetDraws++;
+    }
+    
+    // Ask for the mips this facet needs. The closest point needs the most
+    // texels. The lengths of the map axes scale the texture on the surface
+    if (StreamTextures && FacetMinZ < BIG_NUMBER)
+    {
+        const FLOAT PixelSize = Max(FacetMinZ, 1.f) * Frame->RProj.Z;
+        const FLOAT AxisScale = Max(Facet.MapCoords.XAxis.Size(), Facet.MapCoords.YAxis.Size());
+        RequestStreamedMip(IDX_DiffuseTexture, PixelSize * AxisScale / Surface.Texture->UScale);
+        if (Surface.DetailTexture && DetailTextures)
+            RequestStreamedMip(IDX_DetailTexture, PixelSize * AxisScale / Surface.DetailTexture->UScale);
+        if (Surface.MacroTexture && MacroTextures)
+            RequestStreamedMip(IDX_MacroTexture, PixelSize * AxisScale / Surface.MacroTexture->UScale);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    FindCachedNodes - Finds the cached node of every polygon of @Facet and
+    stores them in FacetNodes. Returns false if the caller has to buffer the
+    facet itself. Caches the facet's surface if this is the first time we
+    see it.
+-----------------------------------------------------------------------------*/
+UBOOL UFruCoReRenderDevice::DrawComplexProgram::FindCachedNodes(FSceneNode* Frame, FSurfaceInfo& Surface, FSurfaceFacet& Facet, FLOAT& OutMinZ)
+{
+    // The editor can change the BSP at any time
+    ULevel* Level = Surface.Level;
+    if (GIsEditor || !Level || !Level->Model)
+        return false;
+    
+    if (Level != WorldGeometryLevel || Level->Model->Surfs.Num() != CachedSurfaces.Num())
+        BuildSurfaceLookup(Level);
+    
+    // The texture mapping tells us which surface to check the polygons against
+    const FVector Origin = Facet.MapCoords.Origin.TransformPointBy(Frame->Uncoords);
+    const FVector XAxis = Facet.MapCoords.XAxis.TransformVectorBy(Frame->Uncoords);
+    const FVector YAxis = Facet.MapCoords.YAxis.TransformVectorBy(Frame->Uncoords);
+    const FSurfaceMapping Mapping =
+    {
+        { Origin.X, Origin.Y, Origin.Z },
+        { XAxis.X, XAxis.Y, XAxis.Z },
+        { YAxis.X, YAxis.Y, YAxis.Z }
+    };
+    const INT iSurf = SurfaceLookup.Find(Mapping);
+    if (iSurf == -1)
+        return false;
+    
+    CachedSurface& Entry = CachedSurfaces(iSurf);
+    if (Entry.FirstVertex == -1 && Entry.NumVertices > 0)
+        CacheSurface(Level->Model, iSurf, Entry);
+    if (Entry.FirstVertex == -1)
+        return false;
+    
+    FacetNodes.Empty(FacetNodes.Num());
+    FLOAT MinZ = BIG_NUMBER;
+    for (FSavedPoly* Poly = Facet.Polys; Poly; Poly = Poly->Next)
+    {
+        if (Poly->NumPts < 3)
+            continue;
+        const INT iNode = FindClippedNode(Frame, Entry, Poly, MinZ);
+        if (iNode == -1)
+            return false;
+        FacetNodes.AddItem(iNode);
+    }
+    
+    OutMinZ = MinZ;
+    return FacetNodes.Num() > 0;
+}
+
+/*-----------------------------------------------------------------------------
+    FindClippedNode - Returns the index of the cached node of surface @Entry
+    that @Poly was clipped from, or -1 if there is none.
+-----------------------------------------------------------------------------*/
+#define CLIPPED_NODE_TOLERANCE 0.25f
+INT UFruCoReRenderDevice::DrawComplexProgram::FindClippedNode(FSceneNode* Frame, const CachedSurface& Entry, FSavedPoly* Poly, FLOAT& OutMinZ)
+{
+    const INT NumPts = Poly->NumPts;
+    FacetPoints.Empty(FacetPoints.Num());
+    FacetPoints.Add(NumPts * 3);
+    FBox Bounds(0);
+    for (INT i = 0; i < NumPts; ++i)
+    {
+        const FVector& Point = Poly->Pts[i]->Point;
+        const FVector World = Point.TransformPointBy(Frame->Uncoords);
+        FacetPoints(i * 3 + 0) = World.X;
+        FacetPoints(i * 3 + 1) = World.Y;
+        FacetPoints(i * 3 + 2) = World.Z;
+        Bounds += World;
+        OutMinZ = Min(OutMinZ, Point.Z);
+    }
+    Bounds = Bounds.ExpandBy(CLIPPED_NODE_TOLERANCE);
+    
+    // Points the engine added when it clipped the node are on the edge of the screen
+    auto OnFrustumEdge = [Frame, Poly](uint32_t i)
+    {
+        const FVector& Point = Poly->Pts[i]->Point;
+        if (Point.Z <= 0.f)
+            return false;
+        const FLOAT ScreenX = Abs(Point.X) * Frame->Proj.Z / Point.Z;
+        const FLOAT ScreenY = Abs(Point.Y) * Frame->Proj.Z / Point.Z;
+        return Abs(ScreenX - Frame->FX2) <= 1.f || Abs(ScreenY - Frame->FY2) <= 1.f;
+    };
+    
+    for (INT i = Entry.FirstNode; i < Entry.FirstNode + Entry.NumNodes; ++i)
+    {
+        const CachedNode& Node = CachedNodes(i);
+        if (!Node.Bounds.Intersect(Bounds))
+            continue;
+        if (IsClippedNode(&NodePoints(Node.FirstPoint * 3), Node.NumPoints, &FacetPoints(0), NumPts, CLIPPED_NODE_TOLERANCE, OnFrustumEdge))
+            return i;
+    }
+    return -1;
+}
 
-        for (INT i = 0; i < NumPts - 2 ; i++)
+/*-----------------------------------------------------------------------------
+    BuildSurfaceLookup - Indexes the texture mappings of all surfaces in
+    @Level, and counts the vertices we need to cache each of them.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawComplexProgram::BuildSurfaceLookup(ULevel* Level)
+{
+    FlushWorldGeometry();
+    
+    UModel* Model = Level->Model;
+    WorldGeometryLevel = Level;
+    CachedSurfaces.AddZeroed(Model->Surfs.Num());
+    for (INT iSurf = 0; iSurf < Model->Surfs.Num(); ++iSurf)
+    {
+        const FBspSurf& Surf = Model->Surfs(iSurf);
+        CachedSurface& Entry = CachedSurfaces(iSurf);
+        Entry.FirstVertex = -1;
+        for (INT i = 0; i < Surf.Nodes.Num(); ++i)
         {
-            (Out++)->Point = FVectorToFloat4(In[0    ]->Point);
-            (Out++)->Point = FVectorToFloat4(In[i + 1]->Point);
-            (Out++)->Point = FVectorToFloat4(In[i + 2]->Point);
+            const FBspNode& Node = Model->Nodes(Surf.Nodes(i));
+            if (Node.NumVertices >= 3)
+                Entry.NumVertices += GetFanIndexCount(Node.NumVertices);
         }
+        if (Entry.NumVertices == 0 || Entry.NumVertices > WORLDGEOMETRY_BUFFER_SIZE)
+        {
+            Entry.NumVertices = 0;
+            continue;
+        }
+        
+        const FVector& Origin = Model->Points(Surf.pBase);
+        const FVector& XAxis = Model->Vectors(Surf.vTextureU);
+        const FVector& YAxis = Model->Vectors(Surf.vTextureV);
+        const FSurfaceMapping Mapping =
+        {
+            { Origin.X, Origin.Y, Origin.Z },
+            { XAxis.X, XAxis.Y, XAxis.Z },
+            { YAxis.X, YAxis.Y, YAxis.Z }
+        };
+        SurfaceLookup.Add(iSurf, Mapping);
+    }
+    SurfaceLookup.Build();
+}
 
-        FacetVertexCount  += (NumPts - 2) * 3;
-        Shader->VertexBuffer.Advance((NumPts - 2) * 3);
+/*-----------------------------------------------------------------------------
+    CacheSurface - Stores each BSP node of surface @iSurf as an unfanned
+    triangle list, so we can draw it without indices, and keeps the node's
+    outline so we can match the engine's polygons against it.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawComplexProgram::CacheSurface(UModel* Model, INT iSurf, CachedSurface& Entry)
+{
+    if (!WorldGeometryBuffer || NumWorldGeometryVertices + Entry.NumVertices > WORLDGEOMETRY_BUFFER_SIZE)
+    {
+        // We never overwrite cached geometry, because draws in in-flight
+        // frames may still read it. Releasing the buffer is safe since the
+        // command buffers retain it
+        if (WorldGeometryBuffer)
+        {
+            // Pending and deferred draws may still reference the old buffer
+            Flush();
+            if (RenDev->DeferringDraws)
+                RenDev->FlushDrawList();
+            ResetWorldGeometry();
+            NumWorldGeometryResets++;
+        }
+        
+        WorldGeometryBuffer = RenDev->Device->newBuffer(WORLDGEOMETRY_BUFFER_SIZE * sizeof(ComplexVertex), MTL::ResourceStorageModeShared);
+        RenDev->CommandEncoder->setVertexBuffer(WorldGeometryBuffer, 0, IDX_DrawComplexWorldVertexData);
+    }
+    
+    const FBspSurf& Surf = Model->Surfs(iSurf);
+    Entry.FirstVertex = NumWorldGeometryVertices;
+    Entry.FirstNode = CachedNodes.Num();
+    Entry.NumNodes = 0;
+    auto Out = reinterpret_cast<ComplexVertex*>(WorldGeometryBuffer->contents()) + NumWorldGeometryVertices;
+    for (INT i = 0; i < Surf.Nodes.Num(); ++i)
+    {
+        const FBspNode& BspNode = Model->Nodes(Surf.Nodes(i));
+        if (BspNode.NumVertices < 3)
+            continue;
+        
+        CachedNode& Node = CachedNodes(CachedNodes.AddZeroed());
+        Node.FirstVertex = NumWorldGeometryVertices;
+        Node.NumVertices = GetFanIndexCount(BspNode.NumVertices);
+        Node.FirstPoint = NodePoints.Num() / 3;
+        Node.NumPoints = BspNode.NumVertices;
+        Node.LastDrawnFrame = -1;
+        Node.Bounds = FBox(0);
+        Entry.NumNodes++;
+        
+        const FVert* Verts = &Model->Verts(BspNode.iVertPool);
+        INT iPoint = NodePoints.Add(BspNode.NumVertices * 3);
+        for (INT j = 0; j < BspNode.NumVertices; ++j)
+        {
+            const FVector& Point = Model->Points(Verts[j].pVertex);
+            NodePoints(iPoint++) = Point.X;
+            NodePoints(iPoint++) = Point.Y;
+            NodePoints(iPoint++) = Point.Z;
+            Node.Bounds += Point;
+        }
+        
+        const FVector& First = Model->Points(Verts[0].pVertex);
+        for (INT j = 2; j < BspNode.NumVertices; ++j)
+        {
+            const FVector& Prev = Model->Points(Verts[j - 1].pVertex);
+            const FVector& Next = Model->Points(Verts[j].pVertex);
+            *Out++ = { { First.X, First.Y, First.Z } };
+            *Out++ = { { Prev.X, Prev.Y, Prev.Z } };
+            *Out++ = { { Next.X, Next.Y, Next.Z } };
+        }
+        NumWorldGeometryVertices += Node.NumVertices;
     }
+    
+    NumCachedSurfaces++;
+}
 
-    Shader->DrawBuffer.EndDrawCall(FacetVertexCount);
-    Shader->InstanceDataBuffer.Advance(1);
+/*-----------------------------------------------------------------------------
+    ResetWorldGeometry - Drops the cached geometry, but keeps the surface
+    lookup for the current level.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawComplexProgram::ResetWorldGeometry()
+{
+    for (INT i = 0; i < CachedSurfaces.Num(); ++i)
+        CachedSurfaces(i).FirstVertex = -1;
+    CachedNodes.Empty();
+    NodePoints.Empty();
+    
+    if (WorldGeometryBuffer)
+        WorldGeometryBuffer->release();
+    WorldGeometryBuffer = nullptr;
+    NumWorldGeometryVertices = 0;
+    NumCachedSurfaces = 0;
+}
+
+/*-----------------------------------------------------------------------------
+    FlushWorldGeometry
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawComplexProgram::FlushWorldGeometry()
+{
+    ResetWorldGeometry();
+    CachedSurfaces.Empty();
+    SurfaceLookup.Reset();
+    WorldGeometryLevel = nullptr;
 }
 
 /*-----------------------------------------------------------------------------
@@ -9,6 +9,27 @@
 #include "Render.h"
 #include "FruCoRe.h"
 
+/*-----------------------------------------------------------------------------
+    GetTexelsPerWorldUnit - Returns how many texels of the top mip triangle
+    @A, @B, @C maps onto one world unit, measured along its two edges from @A
+-----------------------------------------------------------------------------*/
+static FLOAT GetTexelsPerWorldUnit(const FTextureInfo& Info, const FTransTexture& A, const FTransTexture& B, const FTransTexture& C)
+{
+    FLOAT Result = 0.f;
+    const FTransTexture* Edges[2] = { &B, &C };
+    for (INT i = 0; i < 2; ++i)
+    {
+        const FLOAT WorldSize = (Edges[i]->Point - A.Point).Size();
+        if (WorldSize <= 0.f)
+            continue;
+        
+        const FLOAT DU = (Edges[i]->U - A.U) / Info.UScale;
+        const FLOAT DV = (Edges[i]->V - A.V) / Info.VScale;
+        Result = Max(Result, appSqrt(DU * DU + DV * DV) / WorldSize);
+    }
+    return Result;
+}
+
 /*-----------------------------------------------------------------------------
     RenDev Interface
 -----------------------------------------------------------------------------*/
@@ -24,8 +45,12 @@ void UFruCoReRenderDevice::DrawGouraudPolygon(FSceneNode* Frame, FTextureInfo& I
     if (NumPts < 3 /*|| Frame->Recursion > MAX_FRAME_RECURSION*/ ) //reject invalid.
         return;
 
+    // Quads and larger polygons are cheaper to buffer as indexed fans.
+    // Triangles are cheaper to buffer as is
+    const UBOOL bIndexed = ShouldIndexFan(NumPts, sizeof(GouraudVertex));
     auto InVertexCount  = NumPts - 2;
-    auto OutVertexCount = InVertexCount * 3;
+    auto OutVertexCount = bIndexed ? NumPts : InVertexCount * 3;
+    auto OutIndexCount  = bIndexed ? GetFanIndexCount(NumPts) : 0;
 
 #if ENGINE_VERSION==227
     if (Info.Modifier)
@@ -36,26 +61,39 @@ void UFruCoReRenderDevice::DrawGouraudPolygon(FSceneNode* Frame, FTextureInfo& I
     }
 #endif
 
-    if (!Shader->VertexBuffer.CanBuffer(OutVertexCount) || !Shader->InstanceDataBuffer.CanBuffer(1))
+    if (!Shader->VertexBuffer.CanBuffer(OutVertexCount) || !Shader->IndexBuffer.CanBuffer(OutIndexCount) || !Shader->InstanceDataBuffer.CanBuffer(1))
         Shader->RotateBuffers();
 
     Shader->PrepareDrawCall(Frame, Info, PolyFlags);
     
     Shader->DrawBuffer.StartDrawCall();
-    auto Out = Shader->VertexBuffer.GetCurrentElementPtr();
 
-    // Unfan and buffer
-    for (INT i=0; i < InVertexCount; i++)
+    if (bIndexed)
     {
-        Shader->BufferVert(Out++, Pts[0    ]);
-        Shader->BufferVert(Out++, Pts[i + 1]);
-        Shader->BufferVert(Out++, Pts[i + 2]);
+        // Buffer each point once
+        Shader->BufferVerts(NumPts, [Pts](INT i) -> FTransTexture& { return *Pts[i]; });
+        EmitFanIndices(Shader->IndexBuffer.GetCurrentElementPtr(), Shader->VertexBuffer.Index, NumPts);
+    }
+    else
+    {
+        // Unfan and buffer. Vertex i is corner i % 3 of triangle (0, t + 1, t + 2), where t = i / 3
+        Shader->BufferVerts(OutVertexCount, [Pts](INT i) -> FTransTexture& { return *Pts[(i % 3) ? i / 3 + i % 3 : 0]; });
     }
 
-    Shader->DrawBuffer.EndDrawCall(OutVertexCount);
-    Shader->VertexBuffer.Advance(OutVertexCount);
-    Shader->FinishDrawCall(Info);
+    Shader->DrawBuffer.EndDrawCall(OutVertexCount, OutIndexCount, BatchDrawCalls);
+    Shader->AdvanceVertices(OutVertexCount);
+    Shader->IndexBuffer.Advance(OutIndexCount);
     Shader->InstanceDataBuffer.Advance(1);
+    CountVertices(OutVertexCount, Shader->GetVertexBytes(), DrawGouraudProgram::UnpackedVertexBytes);
+    
+    // Ask for the mip this polygon needs, based on the density at its closest vertex
+    if (BoundTextures[IDX_DiffuseTexture] && BoundTextures[IDX_DiffuseTexture]->Stream)
+    {
+        FLOAT MinZ = Pts[0]->Point.Z;
+        for (INT i = 1; i < NumPts; ++i)
+            MinZ = Min(MinZ, Pts[i]->Point.Z);
+        RequestStreamedMip(IDX_DiffuseTexture, GetTexelsPerWorldUnit(Info, *Pts[0], *Pts[1], *Pts[2]) * Max(MinZ, 1.f) * Frame->RProj.Z);
+    }
 }
 
 #if ENGINE_VERSION==227 || UNREAL_TOURNAMENT_OLDUNREAL
@@ -82,42 +120,52 @@ void UFruCoReRenderDevice::DrawGouraudPolyList(FSceneNode* Frame, FTextureInfo&
     Shader->PrepareDrawCall(Frame, Info, PolyFlags);
 
     Shader->DrawBuffer.StartDrawCall();
-    auto Out = Shader->VertexBuffer.GetCurrentElementPtr();
-    auto End = Shader->VertexBuffer.GetLastElementPtr();
 
-    INT PolyListSize = 0;
-    for (INT i = 0; i < NumPts; i++)
+    INT Start = 0;
+    while (true)
     {
-        // Polylists can be bigger than the vertex buffer so check here if we
-        // need to split the mesh up into separate drawcalls
-        if ((i % 3 == 0) && (Out + 2 > End))
-        {
-            Shader->DrawBuffer.EndDrawCall(PolyListSize);
-            Shader->VertexBuffer.Advance(PolyListSize);
-            
-            GouraudInstanceData Tmp;
-            memcpy(&Tmp, Shader->InstanceDataBuffer.GetCurrentElementPtr(), sizeof(GouraudInstanceData));
-            Shader->InstanceDataBuffer.Advance(1);
-            
-            Shader->RotateBuffers();
-
-            Out = Shader->VertexBuffer.GetCurrentElementPtr();
-            End = Shader->VertexBuffer.GetLastElementPtr();
-
-            memcpy(Shader->InstanceDataBuffer.GetCurrentElementPtr(), &Tmp, sizeof(GouraudInstanceData));
-
-            Shader->DrawBuffer.StartDrawCall();
-            PolyListSize = 0;
-        }
+        // Buffer as many whole triangles as we can fit
+        const INT Room = static_cast<INT>(Shader->VertexBuffer.BufferSize - Shader->VertexBuffer.Index) / 3 * 3;
+        const INT PolyListSize = Min(NumPts - Start, Room);
+        Shader->BufferVerts(PolyListSize, [Pts, Start](INT i) -> FTransTexture& { return Pts[Start + i]; });
+        Shader->DrawBuffer.EndDrawCall(PolyListSize, 0, BatchDrawCalls);
+        Shader->AdvanceVertices(PolyListSize);
+        
+        Start += PolyListSize;
+        if (Start >= NumPts)
+            break;
+
+        // Polylists can be bigger than the vertex buffer so we may have
+        // to split the mesh up into separate drawcalls
+        GouraudInstanceData Tmp;
+        memcpy(&Tmp, Shader->InstanceDataBuffer.GetCurrentElementPtr(), sizeof(GouraudInstanceData));
+        Shader->InstanceDataBuffer.Advance(1);
+        
+        Shader->RotateBuffers();
+
+        memcpy(Shader->InstanceDataBuffer.GetCurrentElementPtr(), &Tmp, sizeof(GouraudInstanceData));
 
-        Shader->BufferVert(Out++, &Pts[i]);
-        PolyListSize++;
+        Shader->DrawBuffer.StartDrawCall();
     }
 
-    Shader->DrawBuffer.EndDrawCall(PolyListSize);
-    Shader->VertexBuffer.Advance(PolyListSize);
-    Shader->FinishDrawCall(Info);
     Shader->InstanceDataBuffer.Advance(1);
+    CountVertices(NumPts, Shader->GetVertexBytes(), DrawGouraudProgram::UnpackedVertexBytes);
+    
+    // Meshes can have thousands of triangles, so we only sample a few of them
+    if (BoundTextures[IDX_DiffuseTexture] && BoundTextures[IDX_DiffuseTexture]->Stream)
+    {
+        const INT NumTris = NumPts / 3;
+        const INT Stride = Max(1, NumTris / 16);
+        FLOAT TexelsPerUnit = 0.f;
+        FLOAT MinZ = Pts[0].Point.Z;
+        for (INT Tri = 0; Tri < NumTris; Tri += Stride)
+        {
+            const FTransTexture* Tri0 = &Pts[Tri * 3];
+            TexelsPerUnit = Max(TexelsPerUnit, GetTexelsPerWorldUnit(Info, Tri0[0], Tri0[1], Tri0[2]));
+            MinZ = Min(MinZ, Min(Tri0[0].Point.Z, Min(Tri0[1].Point.Z, Tri0[2].Point.Z)));
+        }
+        RequestStreamedMip(IDX_DiffuseTexture, TexelsPerUnit * Max(MinZ, 1.f) * Frame->RProj.Z);
+    }
 }
 #endif
 
@@ -199,15 +247,6 @@ void UFruCoReRenderDevice::DrawGouraudTriangles(const FSceneNode* Frame, const F
 }
 #endif
 
-void UFruCoReRenderDevice::DrawGouraudProgram::BufferVert(GouraudVertex* Vert, FTransTexture* P)
-{
-    Vert->Point       = simd::make_float4(P->Point.X, P->Point.Y, P->Point.Z, 1.f);
-    Vert->Normal      = simd::make_float4(P->Normal.X, P->Normal.Y, P->Normal.Z, 1.f);
-    Vert->UV          = simd::make_float4(P->U, P->V, 0.f, 0.f);
-    Vert->LightColor  = simd::make_float4(P->Light.X, P->Light.Y, P->Light.Z, P->Light.W);
-    Vert->FogColor    = simd::make_float4(P->Fog.X, P->Fog.Y, P->Fog.Z, P->Fog.W);
-}
-
 void UFruCoReRenderDevice::DrawGouraudProgram::PrepareDrawCall(FSceneNode* Frame, FTextureInfo& Info, DWORD PolyFlags)
 {
     BOOL NoNearZ = ((GUglyHackFlags & HACKFLAGS_NoNearZ) == HACKFLAGS_NoNearZ);
@@ -224,8 +263,10 @@ void UFruCoReRenderDevice::DrawGouraudProgram::PrepareDrawCall(FSceneNode* Frame
     
     LastShaderOptions = OPT_None;
     PolyFlags = RenDev->GetPolyFlagsAndShaderOptions(PolyFlags, LastShaderOptions);
+    RenDev->SetDrawDeferral(IsDeferrableDraw(PolyFlags));
 
     RenDev->SetTexture(IDX_DiffuseTexture, Info, PolyFlags, 0.f);
+    LastShaderOptions |= RenDev->GetTextureShaderOptions(IDX_DiffuseTexture);
     Data->DiffuseInfo = simd::make_float4(RenDev->BoundTextures[IDX_DiffuseTexture]->UMult, RenDev->BoundTextures[IDX_DiffuseTexture]->VMult, 1.f, 1.f);
     
     if (Info.Texture)
@@ -236,12 +277,7 @@ void UFruCoReRenderDevice::DrawGouraudProgram::PrepareDrawCall(FSceneNode* Frame
 
     if (Info.Texture && Info.Texture->DetailTexture && RenDev->DetailTextures)
     {
-#if ENGINE_VERSION==227
-		DetailTextureInfo = *Info.Texture->DetailTexture->GetTexture(INDEX_NONE, RenDev);
-#else
-        Info.Texture->DetailTexture->Lock(DetailTextureInfo, Frame->Viewport->CurrentTime, -1, RenDev);
-#endif
-		RenDev->SetTexture(IDX_DetailTexture, DetailTextureInfo, PolyFlags, 0.f);
+        BindLockedTexture(IDX_DetailTexture, LockTexture(Frame, Info.Texture->DetailTexture), PolyFlags);
         Data->DetailMacroInfo[0] = RenDev->BoundTextures[IDX_DetailTexture]->UMult;
         Data->DetailMacroInfo[1] = RenDev->BoundTextures[IDX_DetailTexture]->VMult;
         LastShaderOptions |= OPT_DetailTexture;
@@ -249,12 +285,7 @@ void UFruCoReRenderDevice::DrawGouraudProgram::PrepareDrawCall(FSceneNode* Frame
 
     if (Info.Texture && Info.Texture->MacroTexture && RenDev->MacroTextures)
     {
-#if ENGINE_VERSION==227
-		MacroTextureInfo = *Info.Texture->MacroTexture->GetTexture(INDEX_NONE, RenDev);
-#else
-        Info.Texture->MacroTexture->Lock(MacroTextureInfo, Frame->Viewport->CurrentTime, -1, RenDev);
-#endif
-		RenDev->SetTexture(IDX_MacroTexture, MacroTextureInfo, PolyFlags, 0.f);
+        BindLockedTexture(IDX_MacroTexture, LockTexture(Frame, Info.Texture->MacroTexture), PolyFlags);
         Data->DetailMacroInfo[2] = RenDev->BoundTextures[IDX_MacroTexture]->UMult;
         Data->DetailMacroInfo[3] = RenDev->BoundTextures[IDX_MacroTexture]->VMult;
         LastShaderOptions |= OPT_MacroTexture;
@@ -264,16 +295,75 @@ void UFruCoReRenderDevice::DrawGouraudProgram::PrepareDrawCall(FSceneNode* Frame
     RenDev->SetDepthMode(((PolyFlags & PF_Occlude) == PF_Occlude) ? DEPTH_Test_And_Write : DEPTH_Test_No_Write);
 }
 
-void UFruCoReRenderDevice::DrawGouraudProgram::FinishDrawCall(FTextureInfo& Info)
+/*-----------------------------------------------------------------------------
+    LockTexture - Returns the locked texture info for @Texture, or locks it
+    if this is the first draw that uses it in this frame
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::DrawGouraudProgram::LockedTexture* UFruCoReRenderDevice::DrawGouraudProgram::LockTexture(FSceneNode* Frame, UTexture* Texture)
 {
-    GouraudInstanceData* Data = InstanceDataBuffer.GetCurrentElementPtr();
-#if ENGINE_VERSION!=227
-    if (LastShaderOptions & OPT_DetailTexture)
-        Info.Texture->DetailTexture->Unlock(DetailTextureInfo);
+    // We rarely see more than a handful of detail and macro textures per frame
+    for (INT i = 0; i < LockedTextures.Num(); ++i)
+    {
+        LockedTexture* Locked = LockedTextures(i);
+#if ENGINE_VERSION==227
+        if (Locked->Texture == Texture)
+#else
+        if (Locked->Texture == Texture && Locked->Time == Frame->Viewport->CurrentTime)
+#endif
+        {
+            RenDev->FrameLockCacheHits++;
+            return Locked;
+        }
+    }
+    
+    LockedTexture* Locked = new LockedTexture;
+    Locked->Texture = Texture;
+#if ENGINE_VERSION==227
+    Locked->Info = *Texture->GetTexture(INDEX_NONE, RenDev);
+#else
+    Locked->Time = Frame->Viewport->CurrentTime;
+    Texture->Lock(Locked->Info, Locked->Time, -1, RenDev);
+#endif
+    Locked->CacheID = Locked->Info.CacheID;
+    Locked->PolyFlags = 0;
+    Locked->Bound = nullptr;
+    Locked->FlushCount = 0;
+    LockedTextures.AddItem(Locked);
+    RenDev->FrameTextureLocks++;
+    return Locked;
+}
 
-    if (LastShaderOptions & OPT_MacroTexture)
-        Info.Texture->MacroTexture->Unlock(MacroTextureInfo);
+/*-----------------------------------------------------------------------------
+    BindLockedTexture - Binds @Locked to @TexNum. If the cache entry we bound
+    for it last time is still bound there, SetTexture would not do anything
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawGouraudProgram::BindLockedTexture(INT TexNum, LockedTexture* Locked, DWORD PolyFlags)
+{
+    if (Locked->Bound && RenDev->BoundTextures[TexNum] == Locked->Bound && Locked->PolyFlags == PolyFlags &&
+        Locked->FlushCount == RenDev->NumTextureFlushes)
+        return;
+    
+    // SetTexture may have tagged the cache ID for different PolyFlags
+    Locked->Info.CacheID = Locked->CacheID;
+    RenDev->SetTexture(TexNum, Locked->Info, PolyFlags, 0.f);
+    Locked->PolyFlags = PolyFlags;
+    Locked->Bound = RenDev->BoundTextures[TexNum];
+    Locked->FlushCount = RenDev->NumTextureFlushes;
+}
+
+/*-----------------------------------------------------------------------------
+    UnlockTextures - Unlocks everything we locked in this frame
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DrawGouraudProgram::UnlockTextures()
+{
+    for (INT i = 0; i < LockedTextures.Num(); ++i)
+    {
+#if ENGINE_VERSION!=227
+        LockedTextures(i)->Texture->Unlock(LockedTextures(i)->Info);
 #endif
+        delete LockedTextures(i);
+    }
+    LockedTextures.Empty();
 }
 
 void UFruCoReRenderDevice::DrawGouraudProgram::PushClipPlane(const FPlane &ClipPlane)
@@ -30,9 +30,13 @@ void UFruCoReRenderDevice::DrawTile(FSceneNode* Frame, FTextureInfo& Info, FLOAT
         
     Color.W = (Info.Texture && Info.Texture->Alpha > 0.f) ? Info.Texture->Alpha : 1.f;
     
-    if (!Shader->VertexBuffer.CanBuffer(6) || !Shader->InstanceDataBuffer.CanBuffer(1))
+    if (!Shader->InstanceDataBuffer.CanBuffer(1))
         Shader->RotateBuffers();
     
+    SetTexture(IDX_DiffuseTexture, Info, PolyFlags, 0.f);
+    const auto Texture = BoundTextures[IDX_DiffuseTexture];
+    Options |= GetTextureShaderOptions(IDX_DiffuseTexture);
+    
     Shader->SelectPipelineState(GetBlendMode(PolyFlags), static_cast<ShaderOptions>(Options));
     
     // Hack to render HUD on top of everything in 469
@@ -42,41 +46,17 @@ void UFruCoReRenderDevice::DrawTile(FSceneNode* Frame, FTextureInfo& Info, FLOAT
     else
 #endif
     SetDepthMode(((PolyFlags & PF_Occlude) == PF_Occlude) ? DEPTH_Test_And_Write : DEPTH_Test_No_Write);
-        
-    SetTexture(IDX_DiffuseTexture, Info, PolyFlags, 0.f);
-    const auto Texture = BoundTextures[IDX_DiffuseTexture];
-    
-    auto InstanceData = Shader->InstanceDataBuffer.GetCurrentElementPtr();
-    InstanceData->DrawColor = simd_make_float4(Color.X, Color.Y, Color.Z, Color.W);
-    InstanceData->UPan      = Info.Pan.X;
-    InstanceData->VPan      = Info.Pan.Y;
-    InstanceData->UMult     = Texture->UMult;
-    InstanceData->VMult     = Texture->VMult;
-    
-    // Buffer the tile
-    Shader->DrawBuffer.StartDrawCall();
-    auto Out = Shader->VertexBuffer.GetCurrentElementPtr();
     
     // X/XL/Y/YL are screen space coordinates
     // Z is the depth in camera/eye space
-    
-    Out[0].Point = simd::make_float4(X      , Y     , Z, 1.f);
-    Out[1].Point = simd::make_float4(X + XL , Y     , Z, 1.f);
-    Out[2].Point = simd::make_float4(X + XL , Y + YL, Z, 1.f);
-    Out[3].Point = simd::make_float4(X      , Y     , Z, 1.f);
-    Out[4].Point = simd::make_float4(X + XL , Y + YL, Z, 1.f);
-    Out[5].Point = simd::make_float4(X      , Y + YL, Z, 1.f);
-    
-    Out[0].UV = simd::make_float4(U         , V     , 0.f, 0.f);
-    Out[1].UV = simd::make_float4(U + UL    , V     , 0.f, 0.f);
-    Out[2].UV = simd::make_float4(U + UL    , V + VL, 0.f, 0.f);
-    Out[3].UV = simd::make_float4(U         , V     , 0.f, 0.f);
-    Out[4].UV = simd::make_float4(U + UL    , V + VL, 0.f, 0.f);
-    Out[5].UV = simd::make_float4(U         , V + VL, 0.f, 0.f);
-    
-    Shader->VertexBuffer.Advance(6);
+    auto InstanceData = Shader->InstanceDataBuffer.GetCurrentElementPtr();
+    PackTileInstance(*InstanceData, X, Y, XL, YL, Z, U, V, UL, VL, Texture->UMult, Texture->VMult, &Color.X);
     Shader->InstanceDataBuffer.Advance(1);
-    Shader->DrawBuffer.EndDrawCall(6);
+    
+    // Tiles that share the same state are drawn with one instanced draw call
+    if (Shader->DrawBuffer.AddGeneratedInstance(TILE_VERTICES))
+        FrameTileDraws++;
+    FrameTiles++;
 }
 
 /*-----------------------------------------------------------------------------
@@ -0,0 +1,343 @@
+/*=============================================================================
+    FruCoRe_MipGeneration.cpp: Mip chain generation for single-mip textures.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_MipGeneration.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FRUCORE_X86 1
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define FRUCORE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*-----------------------------------------------------------------------------
+    Gamma tables. We decode into floats, and encode from a 12-bit linear
+    value, which is precise enough to round-trip every 8-bit sRGB value.
+-----------------------------------------------------------------------------*/
+#define LINEAR_TO_SRGB_ENTRIES 4096
+
+struct FGammaTables
+{
+    float   SRGBToLinear[256];
+    uint8_t LinearToSRGB[LINEAR_TO_SRGB_ENTRIES];
+
+    FGammaTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            const double C = i / 255.0;
+            SRGBToLinear[i] = static_cast<float>(C <= 0.04045 ? C / 12.92 : pow((C + 0.055) / 1.055, 2.4));
+        }
+        for (int i = 0; i < LINEAR_TO_SRGB_ENTRIES; ++i)
+        {
+            const double L = i / static_cast<double>(LINEAR_TO_SRGB_ENTRIES - 1);
+            const double C = L <= 0.0031308 ? L * 12.92 : 1.055 * pow(L, 1.0 / 2.4) - 0.055;
+            LinearToSRGB[i] = static_cast<uint8_t>(C * 255.0 + 0.5);
+        }
+    }
+};
+
+static const FGammaTables& GetGammaTables()
+{
+    static const FGammaTables Tables;
+    return Tables;
+}
+
+/*-----------------------------------------------------------------------------
+    GetFullMipCount
+-----------------------------------------------------------------------------*/
+uint32_t GetFullMipCount(uint32_t USize, uint32_t VSize)
+{
+    uint32_t Size = USize > VSize ? USize : VSize;
+    uint32_t Result = 1;
+    while (Size > 1)
+    {
+        Size /= 2;
+        Result++;
+    }
+    return Result;
+}
+
+/*-----------------------------------------------------------------------------
+    DownsampleTexel - Filters one 2x2 block. @Texels holds the top-left,
+    top-right, bottom-left, and bottom-right texel, in that order.
+-----------------------------------------------------------------------------*/
+static inline uint32_t DownsampleTexel(const FGammaTables& Tables, const uint32_t Texels[4])
+{
+    // Uniform blocks are common in UI and mod textures
+    if (Texels[0] == Texels[1] && Texels[0] == Texels[2] && Texels[0] == Texels[3])
+        return Texels[0];
+
+    float Color[3] = {};
+    float PlainColor[3] = {};
+    uint32_t AlphaSum = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const uint32_t Alpha = Texels[i] >> 24;
+        const float Weight = static_cast<float>(Alpha);
+        for (int c = 0; c < 3; ++c)
+        {
+            const float Linear = Tables.SRGBToLinear[(Texels[i] >> (8 * c)) & 0xFF];
+            Color[c] += Linear * Weight;
+            PlainColor[c] += Linear;
+        }
+        AlphaSum += Alpha;
+    }
+
+    // Fall back to an unweighted average if all four are transparent
+    const float Scale = AlphaSum ? 1.f / static_cast<float>(AlphaSum) : 0.25f;
+    const float* Sum = AlphaSum ? Color : PlainColor;
+
+    uint32_t Result = ((AlphaSum + 2) / 4) << 24;
+    for (int c = 0; c < 3; ++c)
+    {
+        float Linear = Sum[c] * Scale;
+        Linear = Linear < 1.f ? Linear : 1.f;
+        Result |= static_cast<uint32_t>(Tables.LinearToSRGB[static_cast<uint32_t>(Linear * (LINEAR_TO_SRGB_ENTRIES - 1) + 0.5f)]) << (8 * c);
+    }
+    return Result;
+}
+
+#if FRUCORE_X86 || FRUCORE_NEON
+/*-----------------------------------------------------------------------------
+    DownsampleFour - Filters four adjacent 2x2 blocks, i.e., 8 texels of
+    @Row0 and @Row1. This does the same math as DownsampleTexel, in the same
+    order, but for four output texels at once. The gamma tables have no
+    SIMD equivalent, so we still look up every channel individually.
+-----------------------------------------------------------------------------*/
+static inline void DownsampleFour(const FGammaTables& Tables, const uint32_t* Row0, const uint32_t* Row1, uint32_t* Out)
+{
+    // Taps[t][i] is tap t (see DownsampleTexel) of output texel i
+    alignas(16) uint32_t Taps[4][4];
+    alignas(16) uint32_t Uniform[4];
+    alignas(16) uint32_t AlphaSum[4];
+
+#if FRUCORE_X86
+    // Split the even and odd columns
+    const __m128 Row0Lo = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0)));
+    const __m128 Row0Hi = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + 4)));
+    const __m128 Row1Lo = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1)));
+    const __m128 Row1Hi = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + 4)));
+    const __m128i T0 = _mm_castps_si128(_mm_shuffle_ps(Row0Lo, Row0Hi, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i T1 = _mm_castps_si128(_mm_shuffle_ps(Row0Lo, Row0Hi, _MM_SHUFFLE(3, 1, 3, 1)));
+    const __m128i T2 = _mm_castps_si128(_mm_shuffle_ps(Row1Lo, Row1Hi, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i T3 = _mm_castps_si128(_mm_shuffle_ps(Row1Lo, Row1Hi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+    const __m128i IsUniform = _mm_and_si128(_mm_cmpeq_epi32(T0, T1), _mm_and_si128(_mm_cmpeq_epi32(T0, T2), _mm_cmpeq_epi32(T0, T3)));
+    if (_mm_movemask_ps(_mm_castsi128_ps(IsUniform)) == 0xF)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Out), T0);
+        return;
+    }
+
+    const __m128i A0 = _mm_srli_epi32(T0, 24);
+    const __m128i A1 = _mm_srli_epi32(T1, 24);
+    const __m128i A2 = _mm_srli_epi32(T2, 24);
+    const __m128i A3 = _mm_srli_epi32(T3, 24);
+    const __m128i ASum = _mm_add_epi32(_mm_add_epi32(A0, A1), _mm_add_epi32(A2, A3));
+
+    _mm_store_si128(reinterpret_cast<__m128i*>(Taps[0]), T0);
+    _mm_store_si128(reinterpret_cast<__m128i*>(Taps[1]), T1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(Taps[2]), T2);
+    _mm_store_si128(reinterpret_cast<__m128i*>(Taps[3]), T3);
+    _mm_store_si128(reinterpret_cast<__m128i*>(Uniform), IsUniform);
+    _mm_store_si128(reinterpret_cast<__m128i*>(AlphaSum), ASum);
+#else
+    const uint32x4x2_t Cols0 = vld2q_u32(Row0);
+    const uint32x4x2_t Cols1 = vld2q_u32(Row1);
+    const uint32x4_t T0 = Cols0.val[0];
+    const uint32x4_t T1 = Cols0.val[1];
+    const uint32x4_t T2 = Cols1.val[0];
+    const uint32x4_t T3 = Cols1.val[1];
+
+    const uint32x4_t IsUniform = vandq_u32(vceqq_u32(T0, T1), vandq_u32(vceqq_u32(T0, T2), vceqq_u32(T0, T3)));
+    if (vminvq_u32(IsUniform) == 0xFFFFFFFFu)
+    {
+        vst1q_u32(Out, T0);
+        return;
+    }
+
+    const uint32x4_t A0 = vshrq_n_u32(T0, 24);
+    const uint32x4_t A1 = vshrq_n_u32(T1, 24);
+    const uint32x4_t A2 = vshrq_n_u32(T2, 24);
+    const uint32x4_t A3 = vshrq_n_u32(T3, 24);
+    const uint32x4_t ASum = vaddq_u32(vaddq_u32(A0, A1), vaddq_u32(A2, A3));
+
+    vst1q_u32(Taps[0], T0);
+    vst1q_u32(Taps[1], T1);
+    vst1q_u32(Taps[2], T2);
+    vst1q_u32(Taps[3], T3);
+    vst1q_u32(Uniform, IsUniform);
+    vst1q_u32(AlphaSum, ASum);
+#endif
+
+    // Linear[c][t][i] is channel c of Taps[t][i], decoded to linear space
+    alignas(16) float Linear[3][4][4];
+    for (int t = 0; t < 4; ++t)
+        for (int i = 0; i < 4; ++i)
+            for (int c = 0; c < 3; ++c)
+                Linear[c][t][i] = Tables.SRGBToLinear[(Taps[t][i] >> (8 * c)) & 0xFF];
+
+    alignas(16) uint32_t Index[3][4];
+#if FRUCORE_X86
+    const __m128 W0 = _mm_cvtepi32_ps(A0);
+    const __m128 W1 = _mm_cvtepi32_ps(A1);
+    const __m128 W2 = _mm_cvtepi32_ps(A2);
+    const __m128 W3 = _mm_cvtepi32_ps(A3);
+    const __m128 HasAlpha = _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(ASum, _mm_setzero_si128()), _mm_set1_epi32(-1)));
+    const __m128 Scale = _mm_or_ps(_mm_and_ps(HasAlpha, _mm_div_ps(_mm_set1_ps(1.f), _mm_cvtepi32_ps(ASum))), _mm_andnot_ps(HasAlpha, _mm_set1_ps(0.25f)));
+
+    for (int c = 0; c < 3; ++c)
+    {
+        const __m128 L0 = _mm_load_ps(Linear[c][0]);
+        const __m128 L1 = _mm_load_ps(Linear[c][1]);
+        const __m128 L2 = _mm_load_ps(Linear[c][2]);
+        const __m128 L3 = _mm_load_ps(Linear[c][3]);
+        const __m128 Color = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(L0, W0), _mm_mul_ps(L1, W1)), _mm_mul_ps(L2, W2)), _mm_mul_ps(L3, W3));
+        const __m128 PlainColor = _mm_add_ps(_mm_add_ps(_mm_add_ps(L0, L1), L2), L3);
+        const __m128 Sum = _mm_or_ps(_mm_and_ps(HasAlpha, Color), _mm_andnot_ps(HasAlpha, PlainColor));
+        const __m128 Value = _mm_min_ps(_mm_mul_ps(Sum, Scale), _mm_set1_ps(1.f));
+        const __m128 Scaled = _mm_add_ps(_mm_mul_ps(Value, _mm_set1_ps(static_cast<float>(LINEAR_TO_SRGB_ENTRIES - 1))), _mm_set1_ps(0.5f));
+        _mm_store_si128(reinterpret_cast<__m128i*>(Index[c]), _mm_cvttps_epi32(Scaled));
+    }
+#else
+    const float32x4_t W0 = vcvtq_f32_u32(A0);
+    const float32x4_t W1 = vcvtq_f32_u32(A1);
+    const float32x4_t W2 = vcvtq_f32_u32(A2);
+    const float32x4_t W3 = vcvtq_f32_u32(A3);
+    const uint32x4_t HasAlpha = vmvnq_u32(vceqq_u32(ASum, vdupq_n_u32(0)));
+    const float32x4_t Scale = vbslq_f32(HasAlpha, vdivq_f32(vdupq_n_f32(1.f), vcvtq_f32_u32(ASum)), vdupq_n_f32(0.25f));
+
+    for (int c = 0; c < 3; ++c)
+    {
+        const float32x4_t L0 = vld1q_f32(Linear[c][0]);
+        const float32x4_t L1 = vld1q_f32(Linear[c][1]);
+        const float32x4_t L2 = vld1q_f32(Linear[c][2]);
+        const float32x4_t L3 = vld1q_f32(Linear[c][3]);
+        const float32x4_t Color = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(L0, W0), vmulq_f32(L1, W1)), vmulq_f32(L2, W2)), vmulq_f32(L3, W3));
+        const float32x4_t PlainColor = vaddq_f32(vaddq_f32(vaddq_f32(L0, L1), L2), L3);
+        const float32x4_t Sum = vbslq_f32(HasAlpha, Color, PlainColor);
+        const float32x4_t Value = vminq_f32(vmulq_f32(Sum, Scale), vdupq_n_f32(1.f));
+        const float32x4_t Scaled = vaddq_f32(vmulq_f32(Value, vdupq_n_f32(static_cast<float>(LINEAR_TO_SRGB_ENTRIES - 1))), vdupq_n_f32(0.5f));
+        vst1q_u32(Index[c], vcvtq_u32_f32(Scaled));
+    }
+#endif
+
+    for (int i = 0; i < 4; ++i)
+    {
+        Out[i] = Uniform[i] ? Taps[0][i] :
+            (((AlphaSum[i] + 2) / 4) << 24) |
+            static_cast<uint32_t>(Tables.LinearToSRGB[Index[0][i]]) |
+            (static_cast<uint32_t>(Tables.LinearToSRGB[Index[1][i]]) << 8) |
+            (static_cast<uint32_t>(Tables.LinearToSRGB[Index[2][i]]) << 16);
+    }
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+    DownsampleMip
+-----------------------------------------------------------------------------*/
+static void DownsampleRows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst, bool UseSIMD)
+{
+    const FGammaTables& Tables = GetGammaTables();
+    const uint32_t DstUSize = USize > 1 ? USize / 2 : 1;
+    const uint32_t DstVSize = VSize > 1 ? VSize / 2 : 1;
+
+    for (uint32_t Y = 0; Y < DstVSize; ++Y)
+    {
+        // Images with a dimension of 1 only get filtered along the other one
+        const uint32_t* Row0 = Src + (2 * Y < VSize ? 2 * Y : VSize - 1) * USize;
+        const uint32_t* Row1 = Src + (2 * Y + 1 < VSize ? 2 * Y + 1 : VSize - 1) * USize;
+        uint32_t* Out = Dst + Y * DstUSize;
+
+        uint32_t X = 0;
+#if FRUCORE_X86 || FRUCORE_NEON
+        // Every block in the vector loop has two distinct source columns
+        if (UseSIMD && USize > 1)
+        {
+            for (; X + 4 <= DstUSize; X += 4)
+                DownsampleFour(Tables, Row0 + 2 * X, Row1 + 2 * X, Out + X);
+        }
+#endif
+
+        for (; X < DstUSize; ++X)
+        {
+            const uint32_t X0 = 2 * X < USize ? 2 * X : USize - 1;
+            const uint32_t X1 = 2 * X + 1 < USize ? 2 * X + 1 : USize - 1;
+            const uint32_t Texels[4] = { Row0[X0], Row0[X1], Row1[X0], Row1[X1] };
+            Out[X] = DownsampleTexel(Tables, Texels);
+        }
+    }
+}
+
+void DownsampleMip(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst)
+{
+    DownsampleRows(Src, USize, VSize, Dst, true);
+}
+
+void DownsampleMipScalar(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst)
+{
+    DownsampleRows(Src, USize, VSize, Dst, false);
+}
+
+/*-----------------------------------------------------------------------------
+    ComputeAlphaCoverage
+-----------------------------------------------------------------------------*/
+float ComputeAlphaCoverage(const uint32_t* Texels, size_t Count, uint8_t Threshold)
+{
+    if (Count == 0)
+        return 0.f;
+
+    size_t Covered = 0;
+    for (size_t i = 0; i < Count; ++i)
+        Covered += (Texels[i] >> 24) >= Threshold ? 1 : 0;
+    return static_cast<float>(static_cast<double>(Covered) / Count);
+}
+
+/*-----------------------------------------------------------------------------
+    ScaleAlphaToCoverage - Scaling alpha by Threshold/Cutoff makes exactly
+    the texels with alpha >= Cutoff pass the alpha test, so we only have to
+    pick the cutoff whose coverage is closest to the target.
+-----------------------------------------------------------------------------*/
+void ScaleAlphaToCoverage(uint32_t* Texels, size_t Count, float TargetCoverage, uint8_t Threshold)
+{
+    if (Count == 0 || Threshold == 0)
+        return;
+
+    size_t Histogram[256] = {};
+    for (size_t i = 0; i < Count; ++i)
+        Histogram[Texels[i] >> 24]++;
+
+    const double Target = static_cast<double>(TargetCoverage) * Count;
+    uint32_t Cutoff = Threshold;
+    double BestError = 1e300;
+    size_t Covered = 0;
+    for (uint32_t c = 255; c >= 1; --c)
+    {
+        Covered += Histogram[c];
+        const double Error = fabs(static_cast<double>(Covered) - Target);
+        if (Error < BestError)
+        {
+            BestError = Error;
+            Cutoff = c;
+        }
+    }
+
+    if (Cutoff == Threshold)
+        return;
+
+    for (size_t i = 0; i < Count; ++i)
+    {
+        uint32_t Alpha = ((Texels[i] >> 24) * Threshold) / Cutoff;
+        Alpha = Alpha < 255 ? Alpha : 255;
+        Texels[i] = (Texels[i] & 0x00FFFFFFu) | (Alpha << 24);
+    }
+}
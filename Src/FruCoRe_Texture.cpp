@@ -7,6 +7,9 @@
 =============================================================================*/
 
 #include "FruCoRe.h"
+#include "FruCoRe_TextureConversion.h"
+#include "FruCoRe_TextureCompression.h"
+#include "FruCoRe_MipGeneration.h"
 
 /*-----------------------------------------------------------------------------
     P8ToRGBA8 - P8 is not a format GPUs support natively, so we convert all P8
@@ -21,8 +24,11 @@
     texture around: one with a masked out palette[0] color (suitable for
     PF_Masked rendering) and one with the original palette[0] color (for all
     other polyflags).
+ 
+    Conversion functions may run on a worker thread, so they must not touch
+    any engine state. The caller loads the texture data.
 -----------------------------------------------------------------------------*/
-BYTE* P8ToRGBA8(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel)
+void P8ToRGBA8(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
 {
     FColor  LocalPal[256];
     FColor* Palette = Info.Palette;
@@ -36,33 +42,121 @@ BYTE* P8ToRGBA8(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel)
     
     auto Mip = Info.Mips[MipLevel];
     auto Count = Mip->USize * Mip->VSize;
-    auto Ptr = new DWORD[Count];
     
-    Info.Load();
-    for (auto i = 0; i < Count; i++)
+    // Same as *Ptr++ = GET_COLOR_DWORD(Palette[Mip->DataPtr[i]]) for every texel,
+    // but vectorized. See FruCoRe_TextureConversion.cpp
+    ExpandP8(reinterpret_cast<const DWORD*>(Palette), Mip->DataPtr, reinterpret_cast<DWORD*>(Dest), Count);
+}
+
+/*-----------------------------------------------------------------------------
+    Load-time BC1/BC3 compression (see CompressTextures). The encoder itself
+    lives in FruCoRe_TextureCompression.cpp. We split large mips into bands
+    of block rows and encode the bands on all cores.
+-----------------------------------------------------------------------------*/
+#define COMPRESSION_BAND_ROWS 16 // In blocks
+static void CompressMip(const DWORD* Src, INT USize, INT VSize, UBOOL bAlpha, BYTE* Dest)
+{
+    const INT NumBlockRows = (VSize + 3) / 4;
+    const INT NumBands = (NumBlockRows + COMPRESSION_BAND_ROWS - 1) / COMPRESSION_BAND_ROWS;
+    auto EncodeRows = bAlpha ? &EncodeBC3Rows : &EncodeBC1Rows;
+    
+    if (NumBands <= 1)
     {
-        *Ptr++ = GET_COLOR_DWORD(Palette[Mip->DataPtr[i]]);
+        EncodeRows(Src, USize, VSize, 0, NumBlockRows, Dest);
+        return;
     }
     
-    return reinterpret_cast<BYTE*>(Ptr - Count);
+    dispatch_apply(NumBands, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t Band){
+        const INT FirstRow = static_cast<INT>(Band) * COMPRESSION_BAND_ROWS;
+        EncodeRows(Src, USize, VSize, FirstRow, Min(COMPRESSION_BAND_ROWS, NumBlockRows - FirstRow), Dest);
+    });
+}
+
+static void P8ToBC(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging, UBOOL bAlpha)
+{
+    // @Dest is in the caller's main staging buffer, so we expand into the scratch buffer
+    auto Mip = Info.Mips[MipLevel];
+    DWORD* RGBA = reinterpret_cast<DWORD*>(Staging.ReserveScratch(Mip->USize * Mip->VSize * 4));
+    P8ToRGBA8(Info, PolyFlags, MipLevel, reinterpret_cast<BYTE*>(RGBA), Staging);
+    CompressMip(RGBA, Mip->USize, Mip->VSize, bAlpha, Dest);
+}
+
+void P8ToBC1(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    P8ToBC(Info, PolyFlags, MipLevel, Dest, Staging, FALSE);
+}
+
+void P8ToBC3(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    P8ToBC(Info, PolyFlags, MipLevel, Dest, Staging, TRUE);
+}
+
+void RGBA8ToBC1(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    auto Mip = Info.Mips[MipLevel];
+    CompressMip(reinterpret_cast<const DWORD*>(Mip->DataPtr), Mip->USize, Mip->VSize, FALSE, Dest);
+}
+
+void RGBA8ToBC3(FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    auto Mip = Info.Mips[MipLevel];
+    CompressMip(reinterpret_cast<const DWORD*>(Mip->DataPtr), Mip->USize, Mip->VSize, TRUE, Dest);
 }
 
 /*-----------------------------------------------------------------------------
-    RegisterTextureFormats - Note: I have not reviewed any of the block sizes!
+    RegisterTextureFormats - The block width and bytes per block determine
+    both the row pitch we pass to replaceRegion and the amount of GPU memory
+    we account for each texture.
 -----------------------------------------------------------------------------*/
 void UFruCoReRenderDevice::RegisterTextureFormats()
 {
-    TextureFormats.Set(TEXF_P8      , {MTL::PixelFormatRGBA8Unorm   , 4, &P8ToRGBA8 });
-    TextureFormats.Set(TEXF_RGBA8_  , {MTL::PixelFormatRGBA8Unorm   , 4, nullptr    });
-    TextureFormats.Set(TEXF_BGRA8   , {MTL::PixelFormatRGBA8Unorm   , 4, nullptr    });
-    TextureFormats.Set(TEXF_BGRA8_LM, {MTL::PixelFormatRGBA8Unorm   , 4, nullptr    });
-    TextureFormats.Set(TEXF_BC1     , {MTL::PixelFormatBC1_RGBA     , 2, nullptr    });
-    TextureFormats.Set(TEXF_BC2     , {MTL::PixelFormatBC2_RGBA     , 4, nullptr    });
-    TextureFormats.Set(TEXF_BC3     , {MTL::PixelFormatBC3_RGBA     , 4, nullptr    });
-    TextureFormats.Set(TEXF_BC4     , {MTL::PixelFormatBC4_RUnorm   , 4, nullptr    });
-    TextureFormats.Set(TEXF_BC5     , {MTL::PixelFormatBC5_RGUnorm  , 4, nullptr    });
-    TextureFormats.Set(TEXF_BC6H    , {MTL::PixelFormatBC6H_RGBFloat, 4, nullptr    });
-    TextureFormats.Set(TEXF_BC7     , {MTL::PixelFormatBC7_RGBAUnorm, 4, nullptr    });
+    TextureFormats.Set(TEXF_P8      , {MTL::PixelFormatRGBA8Unorm   , 1,  4, &P8ToRGBA8 });
+    TextureFormats.Set(TEXF_RGBA8_  , {MTL::PixelFormatRGBA8Unorm   , 1,  4, nullptr    });
+    TextureFormats.Set(TEXF_BGRA8   , {MTL::PixelFormatRGBA8Unorm   , 1,  4, nullptr    });
+    TextureFormats.Set(TEXF_BGRA8_LM, {MTL::PixelFormatRGBA8Unorm   , 1,  4, nullptr    });
+    TextureFormats.Set(TEXF_BC1     , {MTL::PixelFormatBC1_RGBA     , 4,  8, nullptr    });
+    TextureFormats.Set(TEXF_BC2     , {MTL::PixelFormatBC2_RGBA     , 4, 16, nullptr    });
+    TextureFormats.Set(TEXF_BC3     , {MTL::PixelFormatBC3_RGBA     , 4, 16, nullptr    });
+    TextureFormats.Set(TEXF_BC4     , {MTL::PixelFormatBC4_RUnorm   , 4,  8, nullptr    });
+    TextureFormats.Set(TEXF_BC5     , {MTL::PixelFormatBC5_RGUnorm  , 4, 16, nullptr    });
+    TextureFormats.Set(TEXF_BC6H    , {MTL::PixelFormatBC6H_RGBFloat, 4, 16, nullptr    });
+    TextureFormats.Set(TEXF_BC7     , {MTL::PixelFormatBC7_RGBAUnorm, 4, 16, nullptr    });
+    
+    // Formats we can compress at load time. We use BC3 for textures with an alpha channel
+    CompressedTextureFormats.Set(TEXF_P8        , {MTL::PixelFormatBC1_RGBA, 4,  8, &P8ToBC1   });
+    CompressedTextureFormats.Set(TEXF_RGBA8_    , {MTL::PixelFormatBC1_RGBA, 4,  8, &RGBA8ToBC1});
+    CompressedTextureFormats.Set(TEXF_BGRA8     , {MTL::PixelFormatBC1_RGBA, 4,  8, &RGBA8ToBC1});
+    AlphaCompressedTextureFormats.Set(TEXF_P8    , {MTL::PixelFormatBC3_RGBA, 4, 16, &P8ToBC3   });
+    AlphaCompressedTextureFormats.Set(TEXF_RGBA8_, {MTL::PixelFormatBC3_RGBA, 4, 16, &RGBA8ToBC3});
+    AlphaCompressedTextureFormats.Set(TEXF_BGRA8 , {MTL::PixelFormatBC3_RGBA, 4, 16, &RGBA8ToBC3});
+}
+
+/*-----------------------------------------------------------------------------
+    FindTextureFormat - Picks the format we upload the given texture in
+-----------------------------------------------------------------------------*/
+const UFruCoReRenderDevice::TextureFormat* UFruCoReRenderDevice::FindTextureFormat(FTextureInfo& Info, DWORD PolyFlags)
+{
+    // Realtime textures change too often to compress them. We also skip
+    // textures whose top mip doesn't consist of full blocks
+    if (CompressTextures && bCanCompressTextures && !Info.bRealtime && (Info.USize & 3) == 0 && (Info.VSize & 3) == 0)
+    {
+        UBOOL bAlpha = FALSE;
+        if (Info.Format == TEXF_P8)
+        {
+            // Masked texels are the only ones with alpha in P8 textures
+            bAlpha = (PolyFlags & PF_Masked) != 0;
+        }
+        else if (CompressedTextureFormats.Find(Info.Format))
+        {
+            Info.Load();
+            bAlpha = HasTranslucentTexels(reinterpret_cast<const DWORD*>(Info.Mips[0]->DataPtr), Info.Mips[0]->USize * Info.Mips[0]->VSize);
+        }
+        
+        auto Result = (bAlpha ? AlphaCompressedTextureFormats : CompressedTextureFormats).Find(Info.Format);
+        if (Result)
+            return Result;
+    }
+    return TextureFormats.Find(Info.Format);
 }
 
 /*-----------------------------------------------------------------------------
@@ -72,25 +166,380 @@ void UFruCoReRenderDevice::RegisterTextureFormats()
     texture: one with a masked Palette[0].A and one with the original
     Palette[0].A. FixCacheID ensures that these two copies have different
     cache IDs.
+ 
+    Paletted textures do not need a separate masked copy because the shaders
+    handle masking. They do need their own tag though, since we can still use
+    the same texture in non-paletted form (e.g., as a detail texture).
 -----------------------------------------------------------------------------*/
 #define MASKED_TEXTURE_TAG 4
-static void FixCacheID(FTextureInfo& Info, DWORD PolyFlags)
+#define PALETTED_TEXTURE_TAG 8
+static void FixCacheID(FTextureInfo& Info, DWORD PolyFlags, UBOOL bPaletted)
 {
-    if ((PolyFlags & PF_Masked) && Info.Format == TEXF_P8)
+    if (bPaletted)
+    {
+        Info.CacheID |= PALETTED_TEXTURE_TAG;
+    }
+    else if ((PolyFlags & PF_Masked) && Info.Format == TEXF_P8)
     {
         // We're writing this tag into unused CacheID bits
         Info.CacheID |= MASKED_TEXTURE_TAG;
     }
 }
 
+/*-----------------------------------------------------------------------------
+    UploadPalettedTexture - Uploads a P8 texture as an R8 index texture with a
+    separate 256x1 RGBA8 palette texture. This takes a quarter of the memory
+    of an expanded texture and does not require any CPU-side conversion.
+-----------------------------------------------------------------------------*/
+static void UploadPalettedTexture(MTL::Device* Device, FTextureInfo& Info, MTL::Texture*& Indices, MTL::Texture*& Palette)
+{
+    if (!Indices)
+    {
+        MTL::TextureDescriptor* TextureDescriptor = MTL::TextureDescriptor::alloc()->init();
+        TextureDescriptor->setWidth( Info.USize );
+        TextureDescriptor->setHeight( Info.VSize );
+        TextureDescriptor->setTextureType( MTL::TextureType2D );
+        TextureDescriptor->setStorageMode( MTL::StorageModeShared );
+        TextureDescriptor->setUsage( MTL::ResourceUsageSample | MTL::ResourceUsageRead );
+        TextureDescriptor->setPixelFormat( MTL::PixelFormatR8Unorm );
+        TextureDescriptor->setMipmapLevelCount( Info.NumMips );
+        Indices = Device->newTexture(TextureDescriptor);
+        
+        TextureDescriptor->setWidth( 256 );
+        TextureDescriptor->setHeight( 1 );
+        TextureDescriptor->setPixelFormat( MTL::PixelFormatRGBA8Unorm );
+        TextureDescriptor->setMipmapLevelCount( 1 );
+        Palette = Device->newTexture(TextureDescriptor);
+        TextureDescriptor->release();
+    }
+    
+    Info.Load();
+    
+    for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+    {
+        auto USize = Info.Mips[MipLevel]->USize;
+        auto VSize = Info.Mips[MipLevel]->VSize;
+        Indices->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), MipLevel, Info.Mips[MipLevel]->DataPtr, USize);
+    }
+    
+    Palette->replaceRegion(MTL::Region(0, 0, 0, 256, 1, 1), 0, Info.Palette, 256 * sizeof(FColor));
+}
+
+/*-----------------------------------------------------------------------------
+    CreateMetalTexture
+-----------------------------------------------------------------------------*/
+static MTL::Texture* CreateMetalTexture(MTL::Device* Device, MTL::PixelFormat Format, INT USize, INT VSize, INT NumMips)
+{
+    MTL::TextureDescriptor* TextureDescriptor = MTL::TextureDescriptor::alloc()->init();
+    TextureDescriptor->setWidth( USize );
+    TextureDescriptor->setHeight( VSize );
+    TextureDescriptor->setTextureType( MTL::TextureType2D );
+    TextureDescriptor->setStorageMode( MTL::StorageModeShared );
+    TextureDescriptor->setUsage( MTL::ResourceUsageSample | MTL::ResourceUsageRead );
+    TextureDescriptor->setPixelFormat( Format );
+    TextureDescriptor->setMipmapLevelCount( NumMips );
+    
+    MTL::Texture* Result = Device->newTexture(TextureDescriptor);
+    TextureDescriptor->release();
+    return Result;
+}
+
+/*-----------------------------------------------------------------------------
+    GetTextureContentKey - Disk cache key for the converted mip chain of a
+    texture. Bump TEXTURE_CONVERSION_VERSION whenever a conversion function
+    or the mip generator changes its output. @TextureFormat is null for paletted uploads.
+-----------------------------------------------------------------------------*/
+#define TEXTURE_CONVERSION_VERSION 1
+static QWORD GetSourceMipSize(INT Format, INT USize, INT VSize)
+{
+    switch (Format)
+    {
+        case TEXF_P8:
+            return static_cast<QWORD>(USize) * VSize;
+        case TEXF_BC1:
+        case TEXF_BC4:
+            return GetMipSizeBytes(USize, VSize, 4, 8);
+        case TEXF_BC2:
+        case TEXF_BC3:
+        case TEXF_BC5:
+        case TEXF_BC6H:
+        case TEXF_BC7:
+            return GetMipSizeBytes(USize, VSize, 4, 16);
+        default:
+            return static_cast<QWORD>(USize) * VSize * 4;
+    }
+}
+
+static QWORD GetTextureContentKey(FTextureInfo& Info, DWORD PolyFlags, const UFruCoReRenderDevice::TextureFormat* TextureFormat)
+{
+    const DWORD Params[] =
+    {
+        TEXTURE_CONVERSION_VERSION,
+        TextureFormat ? static_cast<DWORD>(TextureFormat->MetalFormat) : ~0u,
+        static_cast<DWORD>(Info.Format),
+        (PolyFlags & PF_Masked) ? 1u : 0u,
+        static_cast<DWORD>(Info.NumMips),
+        static_cast<DWORD>(Info.USize),
+        static_cast<DWORD>(Info.VSize)
+    };
+    
+    QWORD Key = HashBytes64(Params, sizeof(Params));
+    if (Info.Palette)
+        Key = HashBytes64(Info.Palette, 256 * sizeof(FColor), Key);
+    for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+        Key = HashBytes64(Info.Mips[MipLevel]->DataPtr, GetSourceMipSize(Info.Format, Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize), Key);
+    return Key;
+}
+
+/*-----------------------------------------------------------------------------
+    ConvertMip - Runs the conversion function of @TextureFormat and records
+    how long it took. Safe to call from a worker thread.
+-----------------------------------------------------------------------------*/
+FTimeHistogram UFruCoReRenderDevice::ConversionTimes;
+static void ConvertMip(const UFruCoReRenderDevice::TextureFormat* TextureFormat, FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, BYTE* Dest, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    const DOUBLE StartTime = appSeconds();
+    TextureFormat->ConversionFunction(Info, PolyFlags, MipLevel, Dest, Staging);
+    UFruCoReRenderDevice::ConversionTimes.Add(appSeconds() - StartTime);
+}
+
+/*-----------------------------------------------------------------------------
+    UploadMip - Converts mip @MipLevel and uploads it to mip @DestLevel of
+    @Dest. If @Format is nullptr, we upload a checkerboard texture instead.
+-----------------------------------------------------------------------------*/
+static void UploadMip(MTL::Texture* Dest, INT DestLevel, const UFruCoReRenderDevice::TextureFormat* TextureFormat, FTextureInfo& Info, DWORD PolyFlags, INT MipLevel, UFruCoReRenderDevice::StagingArena& Staging)
+{
+    auto VSize = Info.Mips[MipLevel]->VSize;
+    auto USize = Info.Mips[MipLevel]->USize;
+    BYTE* TextureData = nullptr;
+    
+    // Move the texture data into the Metal texture backing store
+    if (TextureFormat && TextureFormat->ConversionFunction)
+    {
+        TextureData = Staging.Reserve(USize * VSize * 4);
+        ConvertMip(TextureFormat, Info, PolyFlags, MipLevel, TextureData, Staging);
+    }
+    else if (TextureFormat)
+    {
+        TextureData = Info.Mips[MipLevel]->DataPtr;
+    }
+    else
+    {
+        // Generate checkerboard texture (code copied from XOpenGLDrv)
+        static const DWORD PaletteBM[16] =
+        {
+            0x00000000u, 0x000000FFu, 0x0000FF00u, 0x0000FFFFu,
+            0x00FF0000u, 0x00FF00FFu, 0x00FFFF00u, 0x00FFFFFFu,
+            0xFF000000u, 0xFF0000FFu, 0xFF00FF00u, 0xFF00FFFFu,
+            0xFFFF0000u, 0xFFFF00FFu, 0xFFFFFF00u, 0xFFFFFFFFu,
+        };
+        TextureData = Staging.Reserve(USize * VSize * 4);
+        DWORD* Ptr = reinterpret_cast<DWORD*>(TextureData);
+        for (INT i = 0; i < USize * VSize; i++)
+            *Ptr++ = PaletteBM[(i / 16 + i / (256 * 16)) % 16];
+    }
+    
+    Dest->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), DestLevel, TextureData, TextureFormat ? TextureFormat->GetBytesPerRow(USize) : USize * 4);
+}
+
+/*-----------------------------------------------------------------------------
+    UploadMips - Converts mips @FirstMip and up and uploads them to @Dest,
+    starting at mip level 0 of @Dest. If @Format is nullptr, we upload a
+    checkerboard texture instead.
+ 
+    If @DiskCache is not nullptr, we skip the conversion for textures that
+    are in the cache and we add the textures that aren't.
+ 
+    This is safe to call from a worker thread, as long as the GPU cannot see
+    @Dest yet and the caller has already loaded the texture data.
+-----------------------------------------------------------------------------*/
+static void UploadMips(MTL::Texture* Dest, const UFruCoReRenderDevice::TextureFormat* TextureFormat, FTextureInfo& Info, DWORD PolyFlags, INT FirstMip, UFruCoReRenderDevice::StagingArena& Staging, FTextureDiskCache* DiskCache)
+{
+    if (DiskCache && TextureFormat && TextureFormat->ConversionFunction)
+    {
+        const QWORD Key = GetTextureContentKey(Info, PolyFlags, TextureFormat);
+        const QWORD ChainSize = GetMipChainSizeBytes(Info.Mips[0]->USize, Info.Mips[0]->VSize, Info.NumMips, TextureFormat->BlockWidth, TextureFormat->BytesPerBlock);
+        
+        // Cached mip chains are stored back to back, in the same order as Info.Mips
+        const BYTE* Cached = DiskCache->Find(Key, ChainSize);
+        if (Cached || FirstMip == 0)
+        {
+            BYTE* Chain = Cached ? nullptr : Staging.Reserve(ChainSize);
+            QWORD Offset = 0;
+            for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+            {
+                auto USize = Info.Mips[MipLevel]->USize;
+                auto VSize = Info.Mips[MipLevel]->VSize;
+                if (!Cached)
+                    ConvertMip(TextureFormat, Info, PolyFlags, MipLevel, Chain + Offset, Staging);
+                if (MipLevel >= FirstMip)
+                    Dest->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), MipLevel - FirstMip, (Cached ? Cached : Chain) + Offset, TextureFormat->GetBytesPerRow(USize));
+                Offset += GetMipSizeBytes(USize, VSize, TextureFormat->BlockWidth, TextureFormat->BytesPerBlock);
+            }
+            
+            if (!Cached)
+                DiskCache->Add(Key, Chain, ChainSize);
+            return;
+        }
+    }
+    
+    for (INT MipLevel = FirstMip; MipLevel < Info.NumMips; ++MipLevel)
+        UploadMip(Dest, MipLevel - FirstMip, TextureFormat, Info, PolyFlags, MipLevel, Staging);
+}
+
+/*-----------------------------------------------------------------------------
+    UploadGeneratedMips - Uploads the only mip of a single-mip RGBA8 texture,
+    followed by the smaller mips we generate from it (see GenerateMips).
+    @Dest determines how many mips we generate.
+ 
+    If @DiskCache is not nullptr, we store the generated chain in the cache,
+    so we only run the mip generator once for every texture.
+-----------------------------------------------------------------------------*/
+static void UploadGeneratedMips(MTL::Texture* Dest, const UFruCoReRenderDevice::TextureFormat* TextureFormat, FTextureInfo& Info, DWORD PolyFlags, UFruCoReRenderDevice::StagingArena& Staging, FTextureDiskCache* DiskCache)
+{
+    INT USize = Info.Mips[0]->USize;
+    INT VSize = Info.Mips[0]->VSize;
+    const INT NumMips = static_cast<INT>(Dest->mipmapLevelCount());
+    const QWORD ChainSize = GetMipChainSizeBytes(USize, VSize, NumMips, 1, 4);
+    
+    // The source only has one mip, so we fold the number of generated mips
+    // into the key. Otherwise we'd collide with the ungenerated chain
+    QWORD Key = 0;
+    if (DiskCache)
+    {
+        Key = HashBytes64(&NumMips, sizeof(NumMips), GetTextureContentKey(Info, PolyFlags, TextureFormat));
+        if (const BYTE* Cached = DiskCache->Find(Key, ChainSize))
+        {
+            for (INT MipLevel = 0; MipLevel < NumMips; ++MipLevel)
+            {
+                Dest->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), MipLevel, Cached, USize * 4);
+                Cached += static_cast<QWORD>(USize) * VSize * 4;
+                USize = Max(USize / 2, 1);
+                VSize = Max(VSize / 2, 1);
+            }
+            return;
+        }
+    }
+    
+    // We generate every mip from the unfiltered mip above it, so we ping-pong
+    // between two buffers and apply the alpha coverage correction to a copy.
+    // The chain we add to the disk cache holds the mips as we uploaded them
+    const QWORD TopBytes = static_cast<QWORD>(USize) * VSize * 4;
+    const QWORD SecondBytes = static_cast<QWORD>(Max(USize / 2, 1)) * Max(VSize / 2, 1) * 4;
+    BYTE* Buffer = Staging.Reserve(TopBytes + 2 * SecondBytes + (DiskCache ? ChainSize : 0));
+    DWORD* Current = reinterpret_cast<DWORD*>(Buffer);
+    DWORD* Next = reinterpret_cast<DWORD*>(Buffer + TopBytes);
+    DWORD* Scaled = reinterpret_cast<DWORD*>(Buffer + TopBytes + SecondBytes);
+    BYTE* Chain = DiskCache ? Buffer + TopBytes + 2 * SecondBytes : nullptr;
+    
+    if (TextureFormat->ConversionFunction)
+        ConvertMip(TextureFormat, Info, PolyFlags, 0, reinterpret_cast<BYTE*>(Current), Staging);
+    else
+        appMemcpy(Current, Info.Mips[0]->DataPtr, TopBytes);
+    Dest->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), 0, Current, USize * 4);
+    if (Chain)
+        appMemcpy(Chain, Current, TopBytes);
+    QWORD Offset = TopBytes;
+    
+    // Masked textures should not lose texels to the alpha test in the smaller mips
+    const UBOOL bPreserveCoverage = (PolyFlags & PF_Masked) != 0;
+    const FLOAT Coverage = bPreserveCoverage ? ComputeAlphaCoverage(Current, USize * VSize, MIPGEN_MASK_THRESHOLD) : 0.f;
+    
+    for (INT MipLevel = 1; MipLevel < NumMips; ++MipLevel)
+    {
+        DownsampleMip(Current, USize, VSize, Next);
+        USize = Max(USize / 2, 1);
+        VSize = Max(VSize / 2, 1);
+        Exchange(Current, Next);
+        
+        const DWORD* Upload = Current;
+        if (bPreserveCoverage)
+        {
+            appMemcpy(Scaled, Current, USize * VSize * 4);
+            ScaleAlphaToCoverage(Scaled, USize * VSize, Coverage, MIPGEN_MASK_THRESHOLD);
+            Upload = Scaled;
+        }
+        Dest->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), MipLevel, Upload, USize * 4);
+        if (Chain)
+            appMemcpy(Chain + Offset, Upload, USize * VSize * 4);
+        Offset += static_cast<QWORD>(USize) * VSize * 4;
+    }
+    
+    if (Chain)
+        DiskCache->Add(Key, Chain, ChainSize);
+}
+
+/*-----------------------------------------------------------------------------
+    GetPlaceholderMip - Returns the first mip that is small enough to upload
+    synchronously, or 0 if the texture is too small to bother preparing it
+    in the background.
+-----------------------------------------------------------------------------*/
+#define PLACEHOLDER_MAX_SIZE 32
+static INT GetPlaceholderMip(FTextureInfo& Info)
+{
+    for (INT MipLevel = 1; MipLevel < Info.NumMips; ++MipLevel)
+        if (Info.Mips[MipLevel]->USize <= PLACEHOLDER_MAX_SIZE && Info.Mips[MipLevel]->VSize <= PLACEHOLDER_MAX_SIZE)
+            return MipLevel;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+    GetRealTimeChangeCount
+-----------------------------------------------------------------------------*/
+static INT GetRealTimeChangeCount(FTextureInfo& Info)
+{
+#if UNREAL_TOURNAMENT_OLDUNREAL
+    return Info.Texture ? Info.Texture->RealtimeChangeCount : 0;
+#elif ENGINE_VERSION==227
+    return static_cast<INT>(Info.RenderTag);
+#else
+    return 0;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+    HashRealtimeSource - Hashes the source texels and the palette of a
+    realtime texture separately, so we can tell which of the two changed
+    since we last uploaded it
+-----------------------------------------------------------------------------*/
+static void HashRealtimeSource(FTextureInfo& Info, QWORD& OutDataHash, QWORD& OutPaletteHash)
+{
+    OutDataHash = 0;
+    for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+        OutDataHash = HashBytes64(Info.Mips[MipLevel]->DataPtr, GetSourceMipSize(Info.Format, Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize), OutDataHash);
+    OutPaletteHash = Info.Palette ? HashBytes64(Info.Palette, 256 * sizeof(FColor)) : 0;
+}
+
+/*-----------------------------------------------------------------------------
+    AddCachedTexture - Creates a new cache entry that takes ownership of the
+    given Metal textures
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::CachedTexture* UFruCoReRenderDevice::AddCachedTexture(QWORD CacheID, BYTE Format, MTL::Texture* MetalTexture, MTL::Texture* MetalPalette, QWORD SizeBytes)
+{
+    CachedTexture* Texture = new CachedTexture{};
+    Texture->CacheID = CacheID;
+    Texture->Format = Format;
+    Texture->Texture = MetalTexture;
+    Texture->Palette = MetalPalette;
+    Texture->SizeBytes = SizeBytes;
+    BindMap.Set(CacheID, Texture);
+    TextureMemoryUsed += SizeBytes;
+    return Texture;
+}
+
 /*-----------------------------------------------------------------------------
     SetTexture
 -----------------------------------------------------------------------------*/
 void UFruCoReRenderDevice::SetTexture(INT TexNum, FTextureInfo &Info, DWORD PolyFlags, FLOAT PanBias)
 {
-    FixCacheID(Info, PolyFlags);
+    // We only support paletted textures in the diffuse texture slot
+    const UBOOL bPaletted = UsePalettedTextures && Info.Format == TEXF_P8 && TexNum == IDX_DiffuseTexture;
+    
+    FixCacheID(Info, PolyFlags, bPaletted);
     
     CachedTexture* Texture = BindMap.FindRef(Info.CacheID);
+    if (!Texture)
+        NumTextureCacheMisses++;
 
 #if UNREAL_TOURNAMENT_OLDUNREAL
     if (Texture && !Info.NeedsRealtimeUpdate(Texture->RealTimeChangeCount))
@@ -100,8 +549,13 @@ void UFruCoReRenderDevice::SetTexture(INT TexNum, FTextureInfo &Info, DWORD Poly
 	if (Texture && !Info.bRealtimeChanged)
 #endif
     {
-        if (BoundTextures[TexNum] != Texture)
-            Shaders[ActiveProgram]->Flush();
+        // Up to date
+        NumTextureCacheHits++;
+    }
+    else if (UploadToAtlas(Texture, TexNum, Info, PolyFlags))
+    {
+        // Packed into an atlas page. The draws we've buffered so far don't
+        // sample the region we just wrote, so there's no need to flush
     }
     else
     {
@@ -112,97 +566,1234 @@ void UFruCoReRenderDevice::SetTexture(INT TexNum, FTextureInfo &Info, DWORD Poly
 #endif
         
         MTL::Texture* MetalTexture = Texture ? Texture->Texture : nullptr;
-        
-        BOOL bShouldDeleteTextureData = FALSE;
-        BYTE* TextureData = nullptr;
+        MTL::Texture* MetalPalette = Texture ? Texture->Palette : nullptr;
+        QWORD SizeBytes = 0;
+        const TextureFormat* PendingFormat = nullptr;
+        const TextureFormat* DeferredFormat = nullptr;
+        const TextureFormat* StreamFormat = nullptr;
+        INT ResidentMip = 0;
         
         // Look up the texture format
-        auto TextureFormat = TextureFormats.Find(Info.Format);
-        if (!TextureFormat)
-        {
-            debugf(TEXT("Frucore: Unsupported texture format: %d (%ls)"), Info.Format, *FTextureFormatString(Info.Format));
-            
-            // Generate checkerboard texture (code copied from XOpenGLDrv)
-            DWORD PaletteBM[16] =
-            {
-                0x00000000u, 0x000000FFu, 0x0000FF00u, 0x0000FFFFu,
-                0x00FF0000u, 0x00FF00FFu, 0x00FFFF00u, 0x00FFFFFFu,
-                0xFF000000u, 0xFF0000FFu, 0xFF00FF00u, 0xFF00FFFFu,
-                0xFFFF0000u, 0xFFFF00FFu, 0xFFFFFF00u, 0xFFFFFFFFu,
-            };
-            TextureData = new BYTE[256 * 256 * 4];
-            DWORD* Ptr = reinterpret_cast<DWORD*>(TextureData);
-            for (INT i = 0; i < (256 * 256); i++)
-                *Ptr++ = PaletteBM[(i / 16 + i / (256 * 16)) % 16];
-            bShouldDeleteTextureData = TRUE;
-        }
-        
-        // Allocate a new texture
-        if (!Texture)
+        const TextureFormat* TextureFormat = bPaletted ? nullptr : FindTextureFormat(Info, PolyFlags);
+        
+        // In streaming mode, large textures start out with their small
+        // mips only. Draws request the larger ones once they need them
+        const INT StreamMip = (!Texture && StreamTextures && TextureFormat && !Info.bRealtime) ? GetInitialStreamingMip(Info, TextureFormat) : 0;
+        
+        // New, non-realtime textures can be prepared in the background.
+        // We upload the small mips right away and use them as a placeholder
+        const INT PlaceholderMip = (!Texture && !StreamMip && AsyncTextureUploads && TextureFormat && !Info.bRealtime) ? GetPlaceholderMip(Info) : 0;
+        
+        // Mod packages often import the same texture data under several
+        // names. If we've already uploaded it, we just share that texture.
+        // Textures we prepare in the background get hashed by the worker
+        const UBOOL bDeduplicate = !Texture && CanDeduplicate(TexNum, Info);
+        if (bDeduplicate && !PlaceholderMip)
+            Info.Load();
+        const QWORD ContentKey = (bDeduplicate && !PlaceholderMip) ? GetContentKey(TexNum, Info, PolyFlags, TextureFormat, bPaletted) : 0;
+        CachedTexture* Duplicate = ContentKey ? AddSharedCachedTexture(Info.CacheID, Info.Format, ContentKey) : nullptr;
+        
+        // Realtime textures often report changes that don't change any
+        // texels. Palette-animated textures only change their palette
+        QWORD DataHash = 0, PaletteHash = 0;
+        if (Info.bRealtime)
         {
-            MTL::TextureDescriptor* TextureDescriptor = MTL::TextureDescriptor::alloc()->init();
-            TextureDescriptor->setWidth( Info.USize );
-            TextureDescriptor->setHeight( Info.VSize );
-            TextureDescriptor->setTextureType( MTL::TextureType2D );
-            TextureDescriptor->setStorageMode( MTL::StorageModeShared );
-            TextureDescriptor->setUsage( MTL::ResourceUsageSample | MTL::ResourceUsageRead );
-            TextureDescriptor->setPixelFormat(TextureFormat ? TextureFormat->MetalFormat : MTL::PixelFormatRGBA8Unorm);
-            TextureDescriptor->setMipmapLevelCount( Info.NumMips );
-            
-            MetalTexture = Device->newTexture(TextureDescriptor);
-            TextureDescriptor->release();
+            Info.Load();
+            HashRealtimeSource(Info, DataHash, PaletteHash);
         }
+        const UBOOL bSameData = Texture && Info.bRealtime && Texture->DataHash == DataHash;
         
-        Info.Load();
-        
-        for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+        if (Duplicate)
+        {
+            Texture = Duplicate;
+        }
+        else if (bSameData && Texture->PaletteHash == PaletteHash)
+        {
+            NumSkippedRealtimeUploads++;
+        }
+        else if (bSameData && Texture->Palette)
+        {
+            // The indices are still valid, so we only need the new palette
+            Texture->Palette->replaceRegion(MTL::Region(0, 0, 0, 256, 1, 1), 0, Info.Palette, 256 * sizeof(FColor));
+            if (Texture->Shadow)
+                appMemcpy(Texture->Shadow + Info.Mips[0]->USize * Info.Mips[0]->VSize, Info.Palette, 256 * sizeof(FColor));
+            CountUpload(256 * sizeof(FColor));
+            NumPaletteRealtimeUploads++;
+        }
+        else if (Texture && UploadDirtyRegions(Texture, Info, PolyFlags))
+        {
+            // Only uploaded the parts of the texture that changed
+        }
+        else if (bPaletted)
+        {
+            if (Texture)
+                NumFullRealtimeUploads++;
+            UploadPalettedTexture(Device, Info, MetalTexture, MetalPalette);
+            SizeBytes = GetMipChainSizeBytes(Info.USize, Info.VSize, Info.NumMips, 1, 1) + 256 * sizeof(FColor);
+            CountUpload(SizeBytes);
+        }
+        else
         {
-            auto VSize = Info.Mips[MipLevel]->VSize;
-            auto USize = Info.Mips[MipLevel]->USize;
+            if (Texture)
+                NumFullRealtimeUploads++;
+            
+            if (!TextureFormat)
+                debugf(TEXT("Frucore: Unsupported texture format: %d (%ls)"), Info.Format, *FTextureFormatString(Info.Format));
             
-            // Move the texture data into the Metal texture backing store
-            if (TextureFormat && TextureFormat->ConversionFunction)
+            Info.Load();
+            
+            if (StreamMip > 0)
+                StreamFormat = TextureFormat;
+            if (PlaceholderMip > 0)
+                PendingFormat = TextureFormat;
+            const INT FirstMip = StreamMip ? StreamMip : PlaceholderMip;
+            
+            // We can generate the missing mips of single-mip RGBA8 textures.
+            // Lightmaps and fogmaps are neither minified much nor sRGB colors,
+            // so we only do this for the textures that carry surface detail
+            const UBOOL bGenerateMips = GenerateMips && Info.NumMips == 1 && !Info.bRealtime && (Info.USize > 1 || Info.VSize > 1) &&
+                (TexNum == IDX_DiffuseTexture || TexNum == IDX_DetailTexture || TexNum == IDX_MacroTexture) &&
+                TextureFormat && TextureFormat->MetalFormat == MTL::PixelFormatRGBA8Unorm && TextureFormat->BlockWidth == 1;
+            const INT NumMips = bGenerateMips ? static_cast<INT>(GetFullMipCount(Info.USize, Info.VSize)) : Info.NumMips - FirstMip;
+            
+            // If we're over this frame's upload budget, we only upload the
+            // small mips now and upload the rest in the next frames
+            if (!Texture && !FirstMip && !bGenerateMips && TextureFormat && !Info.bRealtime)
+                ResidentMip = GetBudgetedResidentMip(Info, TextureFormat);
+            if (ResidentMip > 0)
+                DeferredFormat = TextureFormat;
+            
+            SizeBytes = TextureFormat ?
+                GetMipChainSizeBytes(Info.Mips[FirstMip]->USize, Info.Mips[FirstMip]->VSize, NumMips, TextureFormat->BlockWidth, TextureFormat->BytesPerBlock) :
+                GetMipChainSizeBytes(Info.USize, Info.VSize, Info.NumMips, 1, 4);
+            
+            // Allocate a new texture
+            if (!Texture)
             {
-                TextureData = TextureFormat->ConversionFunction(Info, PolyFlags, MipLevel);
-                bShouldDeleteTextureData = TRUE;
+                MetalTexture = CreateMetalTexture(Device,
+                    TextureFormat ? TextureFormat->MetalFormat : MTL::PixelFormatRGBA8Unorm,
+                    Info.Mips[FirstMip]->USize,
+                    Info.Mips[FirstMip]->VSize,
+                    NumMips);
             }
-            else if (TextureFormat)
+            
+            if (bGenerateMips)
             {
-                TextureData = Info.Mips[MipLevel]->DataPtr;
+                UploadGeneratedMips(MetalTexture, TextureFormat, Info, PolyFlags, TextureStaging, GetDiskCache());
+                CountUpload(SizeBytes);
+            }
+            else if (ResidentMip > 0)
+            {
+                for (INT MipLevel = ResidentMip; MipLevel < Info.NumMips; ++MipLevel)
+                    UploadMip(MetalTexture, MipLevel, TextureFormat, Info, PolyFlags, MipLevel, TextureStaging);
+                CountUpload(GetMipChainSizeBytes(Info.Mips[ResidentMip]->USize, Info.Mips[ResidentMip]->VSize, Info.NumMips - ResidentMip, TextureFormat->BlockWidth, TextureFormat->BytesPerBlock));
+            }
+            else
+            {
+                UploadMips(MetalTexture, TextureFormat, Info, PolyFlags, FirstMip, TextureStaging, Info.bRealtime ? nullptr : GetDiskCache());
+                CountUpload(SizeBytes);
             }
-            
-            MetalTexture->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), MipLevel, TextureData, USize * TextureFormat->BlockSize);
         }
 
 		if (!Texture)
 		{
-			Texture = new CachedTexture;
-			Texture->CacheID = Info.CacheID;
-			Texture->Texture = MetalTexture;
-			BindMap.Set(Info.CacheID, Texture);
+			Texture = AddCachedTexture(Info.CacheID, Info.Format, MetalTexture, MetalPalette, SizeBytes);
+			
+			if (PendingFormat)
+				QueueTextureJob(Texture, Info, PolyFlags, PendingFormat, bDeduplicate);
+			else if (DeferredFormat)
+				DeferMipUploads(Texture, Info, PolyFlags, DeferredFormat, ResidentMip);
+			else if (StreamFormat)
+				StartStreaming(Texture, Info, PolyFlags, StreamFormat, FirstMip);
+			
+			Texture->ContentKey = ContentKey;
+			ShareCachedTexture(Texture);
 		}
 		
-#if UNREAL_TOURNAMENT_OLDUNREAL
-		Texture->RealTimeChangeCount = Info.Texture ? Info.Texture->RealtimeChangeCount : 0;
-#elif ENGINE_VERSION==227
-		Texture->RealTimeChangeCount = static_cast<INT>(Info.RenderTag);
-#else
-		Texture->RealTimeChangeCount = 0;
-#endif
-		
-        if (bShouldDeleteTextureData)
-            delete[] TextureData;
+		Texture->RealTimeChangeCount = GetRealTimeChangeCount(Info);
+		Texture->DataHash = DataHash;
+		Texture->PaletteHash = PaletteHash;
     }
     
+    Texture->LastUsedFrame = FrameNumber;
+    if (Texture->Page)
+        Texture->Page->LastUsedFrame = FrameNumber;
+    if (Texture->Shared)
+        Texture->Shared->LastUsedFrame = FrameNumber;
+    
+    // Entries in the same atlas page share a Metal texture. We only have to
+    // flush when the Metal texture itself changes
     if (BoundTextures[TexNum] != Texture)
     {
-        CommandEncoder->setFragmentTexture(Texture->Texture, TexNum);
+        if (BoundMetalTextures[TexNum] != Texture->Texture)
+        {
+            Shaders[ActiveProgram]->Flush();
+            if (!DeferringDraws)
+                CommandEncoder->setFragmentTexture(Texture->Texture, TexNum);
+            BoundMetalTextures[TexNum] = Texture->Texture;
+        }
+        if (Texture->Palette && !DeferringDraws)
+            CommandEncoder->setFragmentTexture(Texture->Palette, IDX_DiffusePalette);
         BoundTextures[TexNum] = Texture;
     }
     
     // recalculate texture params
     Texture->UPan  = Info.Pan.X + PanBias * Info.UScale;
     Texture->VPan  = Info.Pan.Y + PanBias * Info.VScale;
-    Texture->UMult = 1.f / (Info.UScale * static_cast<FLOAT>(Info.USize));
-    Texture->VMult = 1.f / (Info.VScale * static_cast<FLOAT>(Info.VSize));
+    if (Texture->Page)
+    {
+        // Fold the atlas transform into the texture params. The shaders
+        // compute (Coord - Pan) * Mult, so we scale Mult down to the page size
+        // and move the texture's position in the page into Pan
+        const FLOAT PageSize = static_cast<FLOAT>(Texture->Page->Packer.GetWidth());
+        Texture->UPan -= Texture->AtlasX * Info.UScale;
+        Texture->VPan -= Texture->AtlasY * Info.VScale;
+        Texture->UMult = 1.f / (Info.UScale * PageSize);
+        Texture->VMult = 1.f / (Info.VScale * PageSize);
+    }
+    else
+    {
+        Texture->UMult = 1.f / (Info.UScale * static_cast<FLOAT>(Info.USize));
+        Texture->VMult = 1.f / (Info.VScale * static_cast<FLOAT>(Info.VSize));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    UploadToAtlas - Packs small, single-mip lightmaps and fogmaps into shared
+    atlas pages. Every BSP surface has its own lightmap and fogmap, so
+    binding them individually would force a flush for nearly every surface.
+ 
+    If @Texture is null, we try to allocate a region for a new cache entry.
+    If @Texture is an existing atlas entry, we upload its new contents into
+    the region it already has. Returns FALSE if the caller should upload the
+    texture as a standalone texture instead.
+-----------------------------------------------------------------------------*/
+#define ATLAS_PAGE_SIZE         1024
+#define ATLAS_MAX_PAGES         16
+#define ATLAS_MAX_TEXTURE_SIZE  256
+#define ATLAS_PADDING           1
+UBOOL UFruCoReRenderDevice::UploadToAtlas(CachedTexture*& Texture, INT TexNum, FTextureInfo& Info, DWORD PolyFlags)
+{
+    if (Texture && !Texture->Page)
+        return FALSE;
+    
+    const INT USize = Info.Mips[0]->USize;
+    const INT VSize = Info.Mips[0]->VSize;
+    auto TextureFormat = FindTextureFormat(Info, PolyFlags);
+    
+    if (!Texture)
+    {
+        if (!PackLightMaps || (TexNum != IDX_LightMap && TexNum != IDX_FogMap) || Info.NumMips != 1 ||
+            USize > ATLAS_MAX_TEXTURE_SIZE || VSize > ATLAS_MAX_TEXTURE_SIZE ||
+            !TextureFormat || TextureFormat->MetalFormat != MTL::PixelFormatRGBA8Unorm || TextureFormat->BlockWidth != 1)
+            return FALSE;
+        
+        INT X, Y;
+        AtlasPage* Page = AllocateAtlasRegion(USize, VSize, X, Y);
+        if (!Page)
+            return FALSE;
+        
+        // The page accounts for the memory, so the entry itself is free
+        Texture = AddCachedTexture(Info.CacheID, Info.Format, Page->Texture, nullptr, 0);
+        Texture->Page = Page;
+        Texture->AtlasX = X;
+        Texture->AtlasY = Y;
+        Page->CacheIDs.AddItem(Info.CacheID);
+    }
+    
+#if !UNREAL_TOURNAMENT_OLDUNREAL
+    Info.bRealtimeChanged = false;
+#endif
+    
+    // We need room for the padded texture, and for the converted texture
+    // if the source format needs conversion
+    const INT PaddedUSize = USize + 2 * ATLAS_PADDING;
+    const INT PaddedVSize = VSize + 2 * ATLAS_PADDING;
+    DWORD* Padded = reinterpret_cast<DWORD*>(TextureStaging.Reserve((PaddedUSize * PaddedVSize + USize * VSize) * 4));
+    
+    Info.Load();
+    const DWORD* TextureData = reinterpret_cast<const DWORD*>(Info.Mips[0]->DataPtr);
+    if (TextureFormat->ConversionFunction)
+    {
+        DWORD* Converted = Padded + PaddedUSize * PaddedVSize;
+        ConvertMip(TextureFormat, Info, PolyFlags, 0, reinterpret_cast<BYTE*>(Converted), TextureStaging);
+        TextureData = Converted;
+    }
+    PadImage(TextureData, USize, VSize, ATLAS_PADDING, Padded);
+    
+    Texture->Texture->replaceRegion(MTL::Region(Texture->AtlasX - ATLAS_PADDING, Texture->AtlasY - ATLAS_PADDING, 0, PaddedUSize, PaddedVSize, 1), 0, Padded, PaddedUSize * 4);
+    CountUpload(PaddedUSize * PaddedVSize * 4);
+    Texture->RealTimeChangeCount = GetRealTimeChangeCount(Info);
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+    AllocateAtlasRegion - Finds room for a @USize x @VSize texture in one of
+    the atlas pages. When all pages are full, we start over in the least
+    recently used page the GPU is no longer reading from.
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::AtlasPage* UFruCoReRenderDevice::AllocateAtlasRegion(INT USize, INT VSize, INT& OutX, INT& OutY)
+{
+    uint32_t X, Y;
+    for (INT i = 0; i < AtlasPages.Num(); ++i)
+    {
+        if (AtlasPages(i)->Packer.Pack(USize, VSize, X, Y))
+        {
+            OutX = X;
+            OutY = Y;
+            return AtlasPages(i);
+        }
+    }
+    
+    AtlasPage* Page = nullptr;
+    if (AtlasPages.Num() < ATLAS_MAX_PAGES)
+    {
+        Page = new AtlasPage{};
+        Page->Texture = CreateMetalTexture(Device, MTL::PixelFormatRGBA8Unorm, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1);
+        Page->Packer.Init(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, ATLAS_PADDING);
+        AtlasPages.AddItem(Page);
+        TextureMemoryUsed += GetMipChainSizeBytes(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1, 1, 4);
+    }
+    else
+    {
+        for (INT i = 0; i < AtlasPages.Num(); ++i)
+            if (AtlasPages(i)->LastUsedFrame <= CompletedFrameNumber && (!Page || AtlasPages(i)->LastUsedFrame < Page->LastUsedFrame))
+                Page = AtlasPages(i);
+        if (!Page)
+            return nullptr;
+        ResetAtlasPage(Page);
+    }
+    
+    if (!Page->Packer.Pack(USize, VSize, X, Y))
+        return nullptr;
+    OutX = X;
+    OutY = Y;
+    return Page;
+}
+
+/*-----------------------------------------------------------------------------
+    ResetAtlasPage - Removes all cache entries that live in @Page. The GPU
+    must be done with the page, and none of its entries may be bound.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::ResetAtlasPage(AtlasPage* Page)
+{
+    for (INT i = 0; i < Page->CacheIDs.Num(); ++i)
+    {
+        CachedTexture* Texture = BindMap.FindRef(Page->CacheIDs(i));
+        if (Texture && Texture->Page == Page)
+        {
+            BindMap.Remove(Page->CacheIDs(i));
+            ReleaseCachedTexture(Texture);
+        }
+    }
+    Page->CacheIDs.Empty();
+    Page->Packer.Reset();
+    NumAtlasResets++;
+}
+
+/*-----------------------------------------------------------------------------
+    ReleaseAtlasPages - The caller must have released the cache entries in
+    these pages already
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::ReleaseAtlasPages()
+{
+    for (INT i = 0; i < AtlasPages.Num(); ++i)
+    {
+        AtlasPages(i)->Texture->release();
+        TextureMemoryUsed -= Min(TextureMemoryUsed, GetMipChainSizeBytes(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1, 1, 4));
+        delete AtlasPages(i);
+    }
+    AtlasPages.Empty();
+}
+
+/*-----------------------------------------------------------------------------
+    UploadDirtyRegions - Procedural textures such as FireTextures often only
+    change in a small part of the texture. For single-mip realtime P8
+    textures, we keep a shadow copy of the indices we last uploaded and only
+    expand and upload the rows that changed since then.
+ 
+    Returns FALSE if the caller should do a full upload instead. This is the
+    case when we see a texture change for the first time, when the palette
+    changed, or when most of the texture changed.
+-----------------------------------------------------------------------------*/
+#define MAX_DIRTY_RECTS 8
+UBOOL UFruCoReRenderDevice::UploadDirtyRegions(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags)
+{
+    if (Info.Format != TEXF_P8 || Info.NumMips != 1)
+        return FALSE;
+    
+    const INT USize = Info.Mips[0]->USize;
+    const INT VSize = Info.Mips[0]->VSize;
+    const INT NumTexels = USize * VSize;
+    
+    Info.Load();
+    
+    // The shadow copy holds the indices followed by the palette
+    const BYTE* Indices = Info.Mips[0]->DataPtr;
+    if (!Texture->Shadow || appMemcmp(Texture->Shadow + NumTexels, Info.Palette, 256 * sizeof(FColor)) != 0)
+    {
+        if (!Texture->Shadow)
+            Texture->Shadow = new BYTE[NumTexels + 256 * sizeof(FColor)];
+        appMemcpy(Texture->Shadow, Indices, NumTexels);
+        appMemcpy(Texture->Shadow + NumTexels, Info.Palette, 256 * sizeof(FColor));
+        return FALSE;
+    }
+    
+    FDirtyRect Rects[MAX_DIRTY_RECTS];
+    uint64_t DirtyTexels = 0;
+    const INT NumRects = static_cast<INT>(DiffP8Rows(Indices, Texture->Shadow, USize, VSize, Rects, MAX_DIRTY_RECTS, &DirtyTexels));
+    
+    // Expanding and uploading many small regions is slower than one big upload
+    if (DirtyTexels * 2 > static_cast<uint64_t>(NumTexels))
+        return FALSE;
+    
+    // Paletted textures hold the raw indices, so we can upload straight from the source
+    if (Texture->Palette)
+    {
+        for (INT i = 0; i < NumRects; ++i)
+            Texture->Texture->replaceRegion(MTL::Region(Rects[i].X, Rects[i].Y, 0, Rects[i].Width, Rects[i].Height, 1), 0, Indices + Rects[i].Y * USize + Rects[i].X, USize);
+    }
+    else
+    {
+        FColor  LocalPal[256];
+        appMemcpy(LocalPal, Info.Palette, 256 * sizeof(FColor));
+        if (PolyFlags & PF_Masked)
+            LocalPal[0] = FColor(0, 0, 0, 0);
+        
+        for (INT i = 0; i < NumRects; ++i)
+        {
+            DWORD* TextureData = reinterpret_cast<DWORD*>(TextureStaging.Reserve(Rects[i].Width * Rects[i].Height * 4));
+            ExpandP8Rect(reinterpret_cast<const DWORD*>(LocalPal), Indices, USize, Rects[i], TextureData);
+            Texture->Texture->replaceRegion(MTL::Region(Rects[i].X, Rects[i].Y, 0, Rects[i].Width, Rects[i].Height, 1), 0, TextureData, Rects[i].Width * 4);
+        }
+    }
+    
+    CountUpload(DirtyTexels * (Texture->Palette ? 1 : 4));
+    NumPartialRealtimeUploads++;
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+    GetTextureShaderOptions - Returns the shader options we need to sample the
+    texture that is currently bound to slot @TexNum
+-----------------------------------------------------------------------------*/
+DWORD UFruCoReRenderDevice::GetTextureShaderOptions(INT TexNum)
+{
+    const auto Texture = BoundTextures[TexNum];
+    return (Texture && Texture->Palette) ? OPT_PalettedTexture : OPT_None;
+}
+
+/*-----------------------------------------------------------------------------
+    ReleaseCachedTexture - Releases the GPU resources for a texture we've
+    already removed from the BindMap
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::ReleaseCachedTexture(CachedTexture* Texture)
+{
+    check(!Texture->PendingJob);
+    if (Texture->Stream)
+    {
+        StreamedTextures.RemoveItem(Texture->Stream);
+        delete Texture->Stream;
+    }
+    delete[] Texture->Shadow;
+    if (Texture->Texture && !Texture->Page)
+        Texture->Texture->release();
+    if (Texture->Palette)
+        Texture->Palette->release();
+    
+    if (Texture->Shared)
+    {
+        // The memory only goes away with the last user
+        SharedTexture* Shared = Texture->Shared;
+        if (--Shared->NumUsers == 0)
+        {
+            SharedTextures.Remove(Texture->ContentKey);
+            TextureMemoryUsed -= Min(TextureMemoryUsed, Shared->SizeBytes);
+            delete Shared;
+        }
+        else
+        {
+            NumSharedTextures--;
+            SharedBytes -= Min(SharedBytes, Shared->SizeBytes);
+        }
+    }
+    else
+    {
+        TextureMemoryUsed -= Min(TextureMemoryUsed, Texture->SizeBytes);
+    }
+    delete Texture;
+}
+
+/*-----------------------------------------------------------------------------
+    EvictTextures - Evicts the least recently used textures until we're back
+    within the TextureMemoryBudget. This must be called between frames since
+    it can evict textures that are in BoundTextures.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::EvictTextures()
+{
+    const QWORD BudgetBytes = static_cast<QWORD>(TextureMemoryBudget) * 1024 * 1024;
+    if (TextureMemoryBudget <= 0 || TextureMemoryUsed <= BudgetBytes)
+        return;
+    
+    // Entries that share a texture only free its memory once all of them
+    // are gone, so we evict them as a group
+    struct EvictionCandidate
+    {
+        INT             LastUsedFrame;
+        QWORD           SizeBytes;
+        CachedTexture*  Texture;        // Null for a group of entries that share a texture
+        SharedTexture*  Shared;
+        QWORD           ContentKey;
+    };
+    TArray<EvictionCandidate> Candidates;
+    for (auto It = TTextureCacheMap<CachedTexture*>::TIterator(BindMap); It; ++It)
+    {
+        CachedTexture* Texture = It.Value();
+        if (!Texture->PendingJob && !Texture->Page && !Texture->Shared) // A worker is still writing to this one, or the entry lives in an atlas page
+            Candidates.AddItem({Texture->LastUsedFrame, Texture->SizeBytes, Texture, nullptr, 0});
+    }
+    for (auto It = TTextureCacheMap<SharedTexture*>::TIterator(SharedTextures); It; ++It)
+        Candidates.AddItem({It.Value()->LastUsedFrame, It.Value()->SizeBytes, nullptr, It.Value(), It.Key()});
+    if (Candidates.Num() == 0)
+        return;
+    
+    TArray<EvictionCandidate*> Entries;
+    TArray<EvictionCandidate*> Selected;
+    for (INT i = 0; i < Candidates.Num(); ++i)
+        Entries.AddItem(&Candidates(i));
+    Selected.Add(Entries.Num());
+    
+    const INT NumSelected = static_cast<INT>(SelectTexturesToEvict(&Entries(0), Entries.Num(), TextureMemoryUsed, BudgetBytes, CompletedFrameNumber, &Selected(0)));
+    TArray<CachedTexture*> Evicted;
+    TTextureCacheMap<SharedTexture*> EvictedGroups;
+    for (INT i = 0; i < NumSelected; ++i)
+    {
+        if (Selected(i)->Texture)
+            Evicted.AddItem(Selected(i)->Texture);
+        else
+            EvictedGroups.Set(Selected(i)->ContentKey, Selected(i)->Shared);
+    }
+    if (EvictedGroups.Num() > 0)
+    {
+        for (auto It = TTextureCacheMap<CachedTexture*>::TIterator(BindMap); It; ++It)
+            if (It.Value()->Shared && EvictedGroups.FindRef(It.Value()->ContentKey))
+                Evicted.AddItem(It.Value());
+    }
+    
+    for (INT i = 0; i < Evicted.Num(); ++i)
+    {
+        BindMap.Remove(Evicted(i)->CacheID);
+        ReleaseCachedTexture(Evicted(i));
+    }
+    
+    NumEvictedTextures += Evicted.Num();
+}
+
+/*-----------------------------------------------------------------------------
+    CreateTextureJob - Captures everything a worker needs to convert mips
+    0 to @NumCopiedMips - 1 of the given texture. The caller must have
+    loaded the texture data already.
+ 
+    Jobs outlive the SetTexture or PrecacheTexture call that created them,
+    but the engine is free to unlock, reload, or garbage collect the
+    texture once that call returns. The job therefore copies the palette
+    and the source mips, and never touches the engine's copies again. We
+    only copy the texels of the mips the job may still have to convert.
+    The other mips keep their dimensions, but have no DataPtr.
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::TextureJob* UFruCoReRenderDevice::CreateTextureJob(FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT NumCopiedMips)
+{
+    TextureJob* Job = new TextureJob;
+    Job->Texture = nullptr;
+    Job->MetalTexture = nullptr;
+    Job->Info = Info;
+    if (Info.Palette)
+    {
+        appMemcpy(Job->Palette, Info.Palette, sizeof(Job->Palette));
+        Job->Info.Palette = Job->Palette;
+    }
+    
+    INT SourceBytes = 0;
+    for (INT MipLevel = 0; MipLevel < NumCopiedMips; ++MipLevel)
+        SourceBytes += static_cast<INT>(GetSourceMipSize(Info.Format, Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize));
+    Job->SourceData.Add(SourceBytes);
+    Job->SourceMips.Add(Info.NumMips);
+    
+    BYTE* Data = SourceBytes ? &Job->SourceData(0) : nullptr;
+    for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+    {
+        Job->SourceMips(MipLevel) = *Info.Mips[MipLevel];
+        Job->SourceMips(MipLevel).DataPtr = nullptr;
+        Job->Info.Mips[MipLevel] = &Job->SourceMips(MipLevel);
+        if (MipLevel >= NumCopiedMips)
+            continue;
+        
+        const INT MipBytes = static_cast<INT>(GetSourceMipSize(Info.Format, Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize));
+        appMemcpy(Data, Info.Mips[MipLevel]->DataPtr, MipBytes);
+        Job->SourceMips(MipLevel).DataPtr = Data;
+        Data += MipBytes;
+    }
+    
+    Job->RealTimeChangeCount = GetRealTimeChangeCount(Info);
+    Job->PolyFlags = PolyFlags;
+    Job->Format = *Format;
+    Job->SizeBytes = GetMipChainSizeBytes(Info.USize, Info.VSize, Info.NumMips, Format->BlockWidth, Format->BytesPerBlock);
+    Job->QueueTime = appSeconds();
+    Job->bDeduplicate = FALSE;
+    Job->ContentKey = 0;
+    Job->Done = 0;
+    Job->ResidentMip = 0;
+    return Job;
+}
+
+/*-----------------------------------------------------------------------------
+    QueueTextureJob - Hands the full mip chain of @Texture to a worker
+    thread. @Texture keeps its placeholder until FinishTextureJobs swaps in
+    the real texture. If @bDeduplicate is true, the worker also computes
+    the texture's content key.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::QueueTextureJob(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, UBOOL bDeduplicate)
+{
+    TextureJob* Job = CreateTextureJob(Info, PolyFlags, Format, Info.NumMips);
+    Job->Texture = Texture;
+    Job->bDeduplicate = bDeduplicate;
+    Job->MetalTexture = CreateMetalTexture(Device, Format->MetalFormat, Info.USize, Info.VSize, Info.NumMips);
+    
+    Texture->PendingJob = Job;
+    PendingTextureJobs.AddItem(Job);
+    
+    FTextureDiskCache* DiskCache = GetDiskCache();
+    dispatch_group_async(TextureJobGroup, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        StagingArena Staging;
+        if (Job->bDeduplicate)
+            Job->ContentKey = GetTextureContentKey(Job->Info, Job->PolyFlags, &Job->Format);
+        UploadMips(Job->MetalTexture, &Job->Format, Job->Info, Job->PolyFlags, 0, Staging, DiskCache);
+        __sync_synchronize();
+        Job->Done = 1;
+    });
+}
+
+/*-----------------------------------------------------------------------------
+    FinishTextureJobs - Swaps the textures of all completed jobs into the
+    cache. This must be called between frames because the command encoder
+    may still have the placeholders bound. If @Wait is true, we first wait
+    for all queued jobs to complete.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::FinishTextureJobs(UBOOL Wait)
+{
+    if (PendingTextureJobs.Num() == 0)
+        return;
+    
+    if (Wait)
+        dispatch_group_wait(TextureJobGroup, DISPATCH_TIME_FOREVER);
+    
+    const DOUBLE Now = appSeconds();
+    for (INT i = 0; i < PendingTextureJobs.Num(); ++i)
+    {
+        TextureJob* Job = PendingTextureJobs(i);
+        if (!Job->Done)
+            continue;
+        __sync_synchronize();
+        
+        // In-flight frames may still be sampling from the placeholder
+        CachedTexture* Texture = Job->Texture;
+        RetiredTextures.AddItem({Texture->Texture, Texture->LastUsedFrame});
+        TextureMemoryUsed -= Min(TextureMemoryUsed, Texture->SizeBytes);
+        Texture->PendingJob = nullptr;
+        
+        // The worker may have found that we've already uploaded the same
+        // texture under another name. The GPU never saw the job's texture
+        // in that case, so we can release it right away
+        if (SharedTexture* Shared = Job->ContentKey ? SharedTextures.FindRef(Job->ContentKey) : nullptr)
+        {
+            Job->MetalTexture->release();
+            UseSharedTexture(Texture, Shared, Job->ContentKey);
+        }
+        else
+        {
+            TextureMemoryUsed += Job->SizeBytes;
+            Texture->Texture = Job->MetalTexture;
+            Texture->SizeBytes = Job->SizeBytes;
+            Texture->ContentKey = Job->ContentKey;
+            CountUpload(Job->SizeBytes);
+            ShareCachedTexture(Texture);
+        }
+        
+        const DOUBLE TimeToResident = Now - Job->QueueTime;
+        TotalTimeToResident += TimeToResident;
+        MaxTimeToResident = Max(MaxTimeToResident, TimeToResident);
+        NumAsyncTextures++;
+        
+        delete Job;
+        PendingTextureJobs.Remove(i--);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    ReleaseRetiredTextures - Releases textures we've replaced once the GPU no
+    longer uses them. If @All is true, we release them unconditionally.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::ReleaseRetiredTextures(UBOOL All)
+{
+    for (INT i = 0; i < RetiredTextures.Num(); ++i)
+    {
+        if (All || RetiredTextures(i).LastUsedFrame <= CompletedFrameNumber)
+        {
+            RetiredTextures(i).Texture->release();
+            RetiredTextures.Remove(i--);
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    GetBudgetedResidentMip - Returns the first mip we should upload right
+    away to stay within this frame's UploadBudget, or 0 if the entire mip
+    chain fits. We always upload at least the smallest mip.
+-----------------------------------------------------------------------------*/
+INT UFruCoReRenderDevice::GetBudgetedResidentMip(FTextureInfo& Info, const TextureFormat* Format)
+{
+    if (UploadBudget <= 0 || Info.NumMips <= 1)
+        return 0;
+    
+    const QWORD BudgetBytes = static_cast<QWORD>(UploadBudget) * 1024;
+    const QWORD Remaining = BudgetBytes > FrameUploadBytes ? BudgetBytes - FrameUploadBytes : 0;
+    
+    QWORD ChainBytes = 0;
+    for (INT MipLevel = Info.NumMips - 1; MipLevel >= 0; --MipLevel)
+    {
+        ChainBytes += GetMipSizeBytes(Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize, Format->BlockWidth, Format->BytesPerBlock);
+        if (ChainBytes > Remaining)
+            return Min(MipLevel + 1, Info.NumMips - 1);
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+    DeferMipUploads - @Texture holds the full mip chain, but we've only
+    uploaded mips @ResidentMip and up. Until we've uploaded the rest, we
+    sample through a texture view that only covers the resident mips.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DeferMipUploads(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT ResidentMip)
+{
+    TextureJob* Job = CreateTextureJob(Info, PolyFlags, Format, ResidentMip);
+    Job->Texture = Texture;
+    Job->MetalTexture = Texture->Texture;
+    Job->ResidentMip = ResidentMip;
+    
+    Texture->Texture = Job->MetalTexture->newTextureView(Format->MetalFormat, MTL::TextureType2D, NS::Range(ResidentMip, Info.NumMips - ResidentMip), NS::Range(0, 1));
+    Texture->PendingJob = Job;
+    DeferredUploads.AddItem(Job);
+}
+
+/*-----------------------------------------------------------------------------
+    UploadDeferredMips - Uploads the next larger mips of deferred textures,
+    oldest first, until we run out of budget. This must be called between
+    frames because we replace the texture views.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::UploadDeferredMips()
+{
+    const QWORD BudgetBytes = static_cast<QWORD>(UploadBudget) * 1024;
+    while (DeferredUploads.Num() > 0)
+    {
+        TextureJob* Job = DeferredUploads(0);
+        CachedTexture* Texture = Job->Texture;
+        const INT MipLevel = Job->ResidentMip - 1;
+        const QWORD MipBytes = GetMipSizeBytes(Job->Info.Mips[MipLevel]->USize, Job->Info.Mips[MipLevel]->VSize, Job->Format.BlockWidth, Job->Format.BytesPerBlock);
+        
+        // We always upload at least one mip per frame, even if it exceeds the budget
+        if (FrameUploadBytes > 0 && FrameUploadBytes + MipBytes > BudgetBytes)
+            break;
+        
+        UploadMip(Job->MetalTexture, MipLevel, &Job->Format, Job->Info, Job->PolyFlags, MipLevel, TextureStaging);
+        CountUpload(MipBytes);
+        Job->ResidentMip = MipLevel;
+        
+        // In-flight frames may still be sampling from the old view
+        RetiredTextures.AddItem({Texture->Texture, Texture->LastUsedFrame});
+        if (MipLevel > 0)
+        {
+            Texture->Texture = Job->MetalTexture->newTextureView(Job->Format.MetalFormat, MTL::TextureType2D, NS::Range(MipLevel, Job->Info.NumMips - MipLevel), NS::Range(0, 1));
+            continue;
+        }
+        
+        Texture->Texture = Job->MetalTexture;
+        Texture->PendingJob = nullptr;
+        ShareCachedTexture(Texture);
+        DeferredUploads.Remove(0);
+        delete Job;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    DiscardDeferredUploads - Leaves the textures in their partially uploaded
+    state, so the caller can release them
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DiscardDeferredUploads()
+{
+    for (INT i = 0; i < DeferredUploads.Num(); ++i)
+    {
+        TextureJob* Job = DeferredUploads(i);
+        Job->Texture->PendingJob = nullptr;
+        Job->MetalTexture->release(); // The view keeps its parent texture alive
+        delete Job;
+    }
+    DeferredUploads.Empty();
+}
+
+/*-----------------------------------------------------------------------------
+    CanDeduplicate - Returns true if we should look for other cache entries
+    with the same contents as the given texture
+-----------------------------------------------------------------------------*/
+UBOOL UFruCoReRenderDevice::CanDeduplicate(INT TexNum, FTextureInfo& Info)
+{
+    // Realtime textures change their contents. Lightmaps and fogmaps are
+    // unique to their surface, so hashing them is a waste of time
+    return DeduplicateTextures && !Info.bRealtime && TexNum != IDX_LightMap && TexNum != IDX_FogMap;
+}
+
+/*-----------------------------------------------------------------------------
+    GetContentKey - Returns the key under which we share the texture with
+    other cache entries, or 0 if we shouldn't share it. @Format is the
+    format FindTextureFormat picked for the texture, or null for paletted
+    textures. The caller must have loaded the texture data already.
+-----------------------------------------------------------------------------*/
+QWORD UFruCoReRenderDevice::GetContentKey(INT TexNum, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, UBOOL bPaletted)
+{
+    if (!CanDeduplicate(TexNum, Info) || (!bPaletted && !Format))
+        return 0;
+    
+    return GetTextureContentKey(Info, PolyFlags, Format);
+}
+
+/*-----------------------------------------------------------------------------
+    AddSharedCachedTexture - Adds a cache entry that uses the texture we've
+    already uploaded for @ContentKey. Returns null if there is no such
+    texture.
+-----------------------------------------------------------------------------*/
+UFruCoReRenderDevice::CachedTexture* UFruCoReRenderDevice::AddSharedCachedTexture(QWORD CacheID, BYTE Format, QWORD ContentKey)
+{
+    SharedTexture* Shared = SharedTextures.FindRef(ContentKey);
+    if (!Shared)
+        return nullptr;
+    
+    CachedTexture* Texture = AddCachedTexture(CacheID, Format, nullptr, nullptr, 0);
+    UseSharedTexture(Texture, Shared, ContentKey);
+    return Texture;
+}
+
+/*-----------------------------------------------------------------------------
+    UseSharedTexture - Makes @Texture another user of @Shared. @Texture must
+    not hold a Metal texture of its own.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::UseSharedTexture(CachedTexture* Texture, SharedTexture* Shared, QWORD ContentKey)
+{
+    // Every entry releases its own reference
+    Shared->Texture->retain();
+    if (Shared->Palette)
+        Shared->Palette->retain();
+    
+    // The memory is already accounted for, and EvictTextures evicts all
+    // users of a shared texture together
+    Texture->Texture = Shared->Texture;
+    Texture->Palette = Shared->Palette;
+    Texture->SizeBytes = 0;
+    Texture->ContentKey = ContentKey;
+    Texture->Shared = Shared;
+    
+    Shared->LastUsedFrame = Max(Shared->LastUsedFrame, Texture->LastUsedFrame);
+    Shared->NumUsers++;
+    NumSharedTextures++;
+    SharedBytes += Shared->SizeBytes;
+}
+
+/*-----------------------------------------------------------------------------
+    ShareCachedTexture - Lets entries we add later use the texture of
+    @Texture. We only share textures whose Metal texture never changes, so
+    we have to wait until placeholders and partial uploads are complete.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::ShareCachedTexture(CachedTexture* Texture)
+{
+    if (!Texture->ContentKey || Texture->Shared || Texture->PendingJob || Texture->Stream || Texture->Page ||
+        SharedTextures.FindRef(Texture->ContentKey))
+        return;
+    
+    SharedTexture* Shared = new SharedTexture;
+    Shared->Texture = Texture->Texture;
+    Shared->Palette = Texture->Palette;
+    Shared->SizeBytes = Texture->SizeBytes;
+    Shared->LastUsedFrame = Texture->LastUsedFrame;
+    Shared->NumUsers = 1;
+    SharedTextures.Set(Texture->ContentKey, Shared);
+    Texture->Shared = Shared;
+}
+
+/*-----------------------------------------------------------------------------
+    GetInitialStreamingMip - Returns the largest mip that is small enough to
+    make resident right away, or 0 if we shouldn't stream the texture at all.
+-----------------------------------------------------------------------------*/
+#define STREAMING_INITIAL_SIZE  256     // Largest mip we upload before a draw asks for it
+#define STREAMING_DROP_FRAMES   300     // Frames a mip must go unused before we drop it under memory pressure
+INT UFruCoReRenderDevice::GetInitialStreamingMip(FTextureInfo& Info, const TextureFormat* Format)
+{
+    // Our views and mip uploads work on whole compression blocks
+    for (INT MipLevel = 0; MipLevel < Info.NumMips; ++MipLevel)
+        if (Info.Mips[MipLevel]->USize <= STREAMING_INITIAL_SIZE && Info.Mips[MipLevel]->VSize <= STREAMING_INITIAL_SIZE)
+            return (Info.Mips[MipLevel]->USize >= Format->BlockWidth && Info.Mips[MipLevel]->VSize >= Format->BlockWidth) ? MipLevel : 0;
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+    StartStreaming - @Texture only holds mips @ResidentMip and up. We keep a
+    copy of the larger mips around so we can upload them later. The smaller
+    mips stay resident for as long as the texture does, so we don't copy
+    those.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::StartStreaming(CachedTexture* Texture, FTextureInfo& Info, DWORD PolyFlags, const TextureFormat* Format, INT ResidentMip)
+{
+    TextureJob* Stream = CreateTextureJob(Info, PolyFlags, Format, ResidentMip);
+    Stream->Texture = Texture;
+    Stream->ResidentMip = ResidentMip;
+    Stream->InitialMip = ResidentMip;
+    Stream->WantedMip = ResidentMip;
+    Stream->LastWantedFrame = FrameNumber;
+    Stream->LastTopMipUseFrame = FrameNumber;
+    
+    Texture->Stream = Stream;
+    StreamedTextures.AddItem(Stream);
+}
+
+/*-----------------------------------------------------------------------------
+    RequestStreamedMip - Called by the draw functions after they've bound a
+    texture to @TexNum. @TexelsPerPixel is the number of texels of the top
+    mip the draw maps onto one pixel. The GPU would sample the mip with
+    (roughly) one texel per pixel, so that's the one we ask for.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::RequestStreamedMip(INT TexNum, FLOAT TexelsPerPixel)
+{
+    CachedTexture* Texture = BoundTextures[TexNum];
+    if (!Texture || !Texture->Stream)
+        return;
+    
+    TextureJob* Stream = Texture->Stream;
+    INT MipLevel = 0;
+    while (TexelsPerPixel >= 2.f && MipLevel < Stream->InitialMip)
+    {
+        TexelsPerPixel *= 0.5f;
+        MipLevel++;
+    }
+    
+    if (Stream->LastWantedFrame != FrameNumber)
+    {
+        Stream->WantedMip = MipLevel;
+        Stream->LastWantedFrame = FrameNumber;
+    }
+    else
+    {
+        Stream->WantedMip = Min(Stream->WantedMip, MipLevel);
+    }
+    
+    if (MipLevel <= Stream->ResidentMip)
+        Stream->LastTopMipUseFrame = FrameNumber;
+}
+
+/*-----------------------------------------------------------------------------
+    SetStreamedMip - Replaces the texture of a streamed texture with one that
+    holds mips @MipLevel and up. Metal can't add or remove mips from an
+    existing texture, so we allocate a new one. We convert the mips that
+    weren't resident yet from the stream's copy of the source data, and
+    copy the ones that were out of the old texture. This must be called
+    between frames.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::SetStreamedMip(TextureJob* Stream, INT MipLevel)
+{
+    CachedTexture* Texture = Stream->Texture;
+    FTextureInfo& Info = Stream->Info;
+    const TextureFormat& Format = Stream->Format;
+    const INT NumMips = Info.NumMips - MipLevel;
+    const QWORD SizeBytes = GetMipChainSizeBytes(Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize, NumMips, Format.BlockWidth, Format.BytesPerBlock);
+    
+    MTL::Texture* MetalTexture = CreateMetalTexture(Device, Format.MetalFormat, Info.Mips[MipLevel]->USize, Info.Mips[MipLevel]->VSize, NumMips);
+    for (INT Level = MipLevel; Level < Info.NumMips; ++Level)
+    {
+        if (Level < Stream->ResidentMip)
+        {
+            UploadMip(MetalTexture, Level - MipLevel, &Format, Info, Stream->PolyFlags, Level, TextureStaging);
+            continue;
+        }
+        
+        // Our textures use shared storage and the GPU never writes to them
+        const INT USize = Info.Mips[Level]->USize;
+        const INT VSize = Info.Mips[Level]->VSize;
+        BYTE* Data = TextureStaging.Reserve(GetMipSizeBytes(USize, VSize, Format.BlockWidth, Format.BytesPerBlock));
+        Texture->Texture->getBytes(Data, Format.GetBytesPerRow(USize), MTL::Region(0, 0, 0, USize, VSize, 1), Level - Stream->ResidentMip);
+        MetalTexture->replaceRegion(MTL::Region(0, 0, 0, USize, VSize, 1), Level - MipLevel, Data, Format.GetBytesPerRow(USize));
+    }
+    CountUpload(SizeBytes);
+    
+    // In-flight frames may still be sampling from the old texture
+    RetiredTextures.AddItem({Texture->Texture, Texture->LastUsedFrame});
+    
+    TextureMemoryUsed -= Min(TextureMemoryUsed, Texture->SizeBytes);
+    TextureMemoryUsed += SizeBytes;
+    Texture->Texture = MetalTexture;
+    Texture->SizeBytes = SizeBytes;
+    Stream->ResidentMip = MipLevel;
+}
+
+/*-----------------------------------------------------------------------------
+    StreamTextureMips - Uploads the larger mips that draws asked for in the
+    previous frame, and drops large mips that haven't been needed for a
+    while if we're over the TextureMemoryBudget. Uploads count against the
+    UploadBudget. This must be called between frames.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::StreamTextureMips()
+{
+    const QWORD UploadBudgetBytes = UploadBudget > 0 ? static_cast<QWORD>(UploadBudget) * 1024 : ~0ull;
+    const UBOOL bMemoryPressure = TextureMemoryBudget > 0 && TextureMemoryUsed > static_cast<QWORD>(TextureMemoryBudget) * 1024 * 1024;
+    
+    for (INT i = 0; i < StreamedTextures.Num(); ++i)
+    {
+        TextureJob* Stream = StreamedTextures(i);
+        
+        // Draws from the frame we just finished
+        if (Stream->WantedMip < Stream->ResidentMip && Stream->LastWantedFrame >= FrameNumber - 1)
+        {
+            const FMipmapBase* Mip = Stream->Info.Mips[Stream->WantedMip];
+            const QWORD Bytes = GetMipChainSizeBytes(Mip->USize, Mip->VSize, Stream->Info.NumMips - Stream->WantedMip, Stream->Format.BlockWidth, Stream->Format.BytesPerBlock);
+            
+            // We always stream in at least one texture per frame, even if it exceeds the budget
+            if (FrameUploadBytes > 0 && FrameUploadBytes + Bytes > UploadBudgetBytes)
+                continue;
+            
+            SetStreamedMip(Stream, Stream->WantedMip);
+            Stream->LastTopMipUseFrame = FrameNumber;
+            NumStreamedIn++;
+        }
+        else if (bMemoryPressure && Stream->ResidentMip < Stream->InitialMip && FrameNumber - Stream->LastTopMipUseFrame > STREAMING_DROP_FRAMES)
+        {
+            // Drop one mip at a time. The next one gets another
+            // STREAMING_DROP_FRAMES to prove it's still needed
+            SetStreamedMip(Stream, Stream->ResidentMip + 1);
+            Stream->LastTopMipUseFrame = FrameNumber;
+            NumStreamedOut++;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    PrecacheTexture - The engine calls this for every texture in the level
+    during its precache phase. We only queue the textures here. The next
+    Lock call converts and uploads the entire queue in one go.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::PrecacheTexture(FTextureInfo& Info, DWORD PolyFlags)
+{
+    // Realtime textures get reuploaded when they change anyway
+    if (Info.bRealtime)
+        return;
+    
+    // The engine only precaches diffuse textures, so the paletted path applies
+    const UBOOL bPaletted = UsePalettedTextures && Info.Format == TEXF_P8;
+    
+#if UNREAL_TOURNAMENT_OLDUNREAL
+    // Meshes can pick up PF_Masked from their skins rather than from the
+    // PolyFlags the engine passes in here, so precache the masked copy too
+    if (!bPaletted && Info.Format == TEXF_P8 && !(PolyFlags & PF_Masked) && Info.Texture && (Info.Texture->PolyFlags & PF_Masked))
+    {
+        const QWORD OriginalCacheID = Info.CacheID;
+        PrecacheTexture(Info, PolyFlags | PF_Masked);
+        Info.CacheID = OriginalCacheID;
+    }
+#endif
+    
+    FixCacheID(Info, PolyFlags, bPaletted);
+    if (BindMap.FindRef(Info.CacheID))
+        return;
+    
+    Info.Load();
+    
+    if (bPaletted)
+    {
+        const QWORD ContentKey = GetContentKey(IDX_DiffuseTexture, Info, PolyFlags, nullptr, TRUE);
+        auto Texture = ContentKey ? AddSharedCachedTexture(Info.CacheID, Info.Format, ContentKey) : nullptr;
+        if (!Texture)
+        {
+            // No conversion needed so there's no point in deferring this
+            MTL::Texture* MetalTexture = nullptr;
+            MTL::Texture* MetalPalette = nullptr;
+            UploadPalettedTexture(Device, Info, MetalTexture, MetalPalette);
+            Texture = AddCachedTexture(Info.CacheID, Info.Format, MetalTexture, MetalPalette, GetMipChainSizeBytes(Info.USize, Info.VSize, Info.NumMips, 1, 1) + 256 * sizeof(FColor));
+            Texture->ContentKey = ContentKey;
+            ShareCachedTexture(Texture);
+            CountUpload(Texture->SizeBytes);
+        }
+        Texture->RealTimeChangeCount = GetRealTimeChangeCount(Info);
+        Texture->LastUsedFrame = FrameNumber;
+        return;
+    }
+    
+    auto TextureFormat = FindTextureFormat(Info, PolyFlags);
+    if (!TextureFormat)
+        return;
+    
+    // Precaching the full mip chain would defeat the purpose of streaming.
+    // SetTexture uploads the small mips on first use
+    if (StreamTextures && GetInitialStreamingMip(Info, TextureFormat) > 0)
+        return;
+    
+    PrecacheQueue.AddItem(CreateTextureJob(Info, PolyFlags, TextureFormat, Info.NumMips));
+}
+
+/*-----------------------------------------------------------------------------
+    FlushPrecacheQueue - Converts and uploads all queued precache textures.
+    The conversion runs on all cores. We process the queue in batches so we
+    can register each batch of textures as soon as it's done.
+-----------------------------------------------------------------------------*/
+#define PRECACHE_BATCH_SIZE 256
+void UFruCoReRenderDevice::FlushPrecacheQueue()
+{
+    if (PrecacheQueue.Num() == 0)
+        return;
+    
+    const DOUBLE StartTime = appSeconds();
+    const INT NumCPUs = Max<INT>(1, static_cast<INT>(NS::ProcessInfo::processInfo()->activeProcessorCount()));
+    INT NumTextures = 0;
+    QWORD NumBytes = 0;
+    
+    // The engine can precache the same texture more than once
+    TArray<TextureJob*> Jobs;
+    for (INT i = 0; i < PrecacheQueue.Num(); ++i)
+    {
+        TextureJob* Job = PrecacheQueue(i);
+        if (BindMap.FindRef(Job->Info.CacheID))
+        {
+            delete Job;
+            continue;
+        }
+        
+        const QWORD ContentKey = GetContentKey(IDX_DiffuseTexture, Job->Info, Job->PolyFlags, &Job->Format, FALSE);
+        if (CachedTexture* Duplicate = ContentKey ? AddSharedCachedTexture(Job->Info.CacheID, Job->Info.Format, ContentKey) : nullptr)
+        {
+            Duplicate->LastUsedFrame = FrameNumber;
+            delete Job;
+            continue;
+        }
+        
+        // We finish all uploads before we draw anything, so later copies
+        // in the queue can share this texture right away
+        Job->MetalTexture = CreateMetalTexture(Device, Job->Format.MetalFormat, Job->Info.USize, Job->Info.VSize, Job->Info.NumMips);
+        Job->Texture = AddCachedTexture(Job->Info.CacheID, Job->Info.Format, Job->MetalTexture, nullptr, Job->SizeBytes);
+        Job->Texture->ContentKey = ContentKey;
+        ShareCachedTexture(Job->Texture);
+        CountUpload(Job->SizeBytes);
+        Jobs.AddItem(Job);
+    }
+    PrecacheQueue.Empty();
+    
+    for (INT First = 0; First < Jobs.Num(); First += PRECACHE_BATCH_SIZE)
+    {
+        TextureJob** Batch = &Jobs(First);
+        const INT BatchSize = Min(Jobs.Num() - First, PRECACHE_BATCH_SIZE);
+        
+        // Every worker keeps grabbing the next unconverted texture, so a
+        // few large textures don't hold up the entire batch
+        FTextureDiskCache* DiskCache = GetDiskCache();
+        volatile INT NextJob = 0;
+        volatile INT* NextJobPtr = &NextJob;
+        dispatch_apply(Min(BatchSize, NumCPUs), dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t Worker){
+            StagingArena Staging;
+            for (INT i = __sync_fetch_and_add(NextJobPtr, 1); i < BatchSize; i = __sync_fetch_and_add(NextJobPtr, 1))
+                UploadMips(Batch[i]->MetalTexture, &Batch[i]->Format, Batch[i]->Info, Batch[i]->PolyFlags, 0, Staging, DiskCache);
+        });
+        
+        for (INT i = 0; i < BatchSize; ++i)
+        {
+            Batch[i]->Texture->RealTimeChangeCount = Batch[i]->RealTimeChangeCount;
+            Batch[i]->Texture->LastUsedFrame = FrameNumber;
+            NumBytes += Batch[i]->SizeBytes;
+            NumTextures++;
+            delete Batch[i];
+        }
+    }
+    
+    debugf(NAME_DevGraphics, TEXT("Frucore: Precached %d textures (%d KB) in %.2f ms"),
+           NumTextures, static_cast<INT>(NumBytes / 1024), (appSeconds() - StartTime) * 1000.0);
+}
+
+/*-----------------------------------------------------------------------------
+    DiscardPrecacheQueue
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::DiscardPrecacheQueue()
+{
+    for (INT i = 0; i < PrecacheQueue.Num(); ++i)
+        delete PrecacheQueue(i);
+    PrecacheQueue.Empty();
+}
+
+/*-----------------------------------------------------------------------------
+    PrintTextureStats - Prints the texture subsystem counters. If
+    @CSVFilename is set, we also write them to that file, so they can be
+    compared across builds.
+-----------------------------------------------------------------------------*/
+void UFruCoReRenderDevice::PrintTextureStats(FOutputDevice& Ar, const TCHAR* CSVFilename)
+{
+    INT   ResidentCount[256] = {};
+    QWORD ResidentBytes[256] = {};
+    for (auto It = TTextureCacheMap<CachedTexture*>::TIterator(BindMap); It; ++It)
+    {
+        ResidentCount[It.Value()->Format]++;
+        ResidentBytes[It.Value()->Format] += It.Value()->SizeBytes;
+    }
+    
+    // The Value column holds bytes, or microseconds for the conversion times
+    FString CSV = TEXT("Category,Name,Count,Value\n");
+    auto AddRow = [&](const TCHAR* Category, const TCHAR* Name, QWORD Count, QWORD Value)
+    {
+        Ar.Logf(TEXT("%ls %ls: %llu (%llu)"), Category, Name, static_cast<unsigned long long>(Count), static_cast<unsigned long long>(Value));
+        CSV += FString::Printf(TEXT("%ls,%ls,%llu,%llu\n"), Category, Name, static_cast<unsigned long long>(Count), static_cast<unsigned long long>(Value));
+    };
+    
+    for (INT Format = 0; Format < 256; ++Format)
+        if (ResidentCount[Format])
+            AddRow(TEXT("Resident"), *FTextureFormatString(static_cast<ETextureFormat>(Format)), ResidentCount[Format], ResidentBytes[Format]);
+    if (AtlasPages.Num() > 0)
+        AddRow(TEXT("Resident"), TEXT("AtlasPages"), AtlasPages.Num(), AtlasPages.Num() * GetMipChainSizeBytes(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1, 1, 4));
+    AddRow(TEXT("Resident"), TEXT("Total"), BindMap.Num(), TextureMemoryUsed);
+    
+    AddRow(TEXT("Uploads"), TEXT("ThisFrame"), FrameUploads, FrameUploadBytes);
+    AddRow(TEXT("Uploads"), TEXT("Total"), TotalUploads, TotalUploadBytes);
+    AddRow(TEXT("Uploads"), TEXT("Deferred"), DeferredUploads.Num(), 0);
+    AddRow(TEXT("Uploads"), TEXT("Queued"), PendingTextureJobs.Num(), 0);
+    AddRow(TEXT("Uploads"), TEXT("StreamedIn"), NumStreamedIn, 0);
+    AddRow(TEXT("Uploads"), TEXT("StreamedOut"), NumStreamedOut, 0);
+    
+    AddRow(TEXT("Realtime"), TEXT("Partial"), NumPartialRealtimeUploads, 0);
+    AddRow(TEXT("Realtime"), TEXT("Full"), NumFullRealtimeUploads, 0);
+    AddRow(TEXT("Realtime"), TEXT("PaletteOnly"), NumPaletteRealtimeUploads, 0);
+    AddRow(TEXT("Realtime"), TEXT("Skipped"), NumSkippedRealtimeUploads, 0);
+    
+    AddRow(TEXT("Cache"), TEXT("Hits"), NumTextureCacheHits, 0);
+    AddRow(TEXT("Cache"), TEXT("Misses"), NumTextureCacheMisses, 0);
+    AddRow(TEXT("Cache"), TEXT("Evicted"), NumEvictedTextures, 0);
+    AddRow(TEXT("Cache"), TEXT("Flushes"), NumTextureFlushes, 0);
+    AddRow(TEXT("Cache"), TEXT("Shared"), NumSharedTextures, SharedBytes);
+    
+    // One row per histogram bucket, named after its upper bound
+    for (INT Bucket = 0; Bucket < TIME_HISTOGRAM_BUCKETS; ++Bucket)
+    {
+        if (!ConversionTimes.Buckets[Bucket])
+            continue;
+        const FString Name = Bucket < TIME_HISTOGRAM_BUCKETS - 1 ?
+            FString::Printf(TEXT("Below%lluus"), static_cast<unsigned long long>(FTimeHistogram::GetBucketLimit(Bucket))) :
+            FString(TEXT("Longer"));
+        AddRow(TEXT("Conversion"), *Name, ConversionTimes.Buckets[Bucket], 0);
+    }
+    AddRow(TEXT("Conversion"), TEXT("Total"), ConversionTimes.NumSamples, ConversionTimes.TotalMicroseconds);
+    
+    if (CSVFilename && *CSVFilename)
+    {
+        if (appSaveStringToFile(CSV, CSVFilename))
+            Ar.Logf(TEXT("Frucore: Saved texture stats to %ls"), CSVFilename);
+        else
+            Ar.Logf(TEXT("Frucore: Failed to save texture stats to %ls"), CSVFilename);
+    }
 }
@@ -0,0 +1,419 @@
+/*=============================================================================
+    FruCoRe_TextureCompression.cpp: CPU-side BC1/BC3 block encoder.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_TextureCompression.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FRUCORE_X86 1
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define FRUCORE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*-----------------------------------------------------------------------------
+    Helpers
+-----------------------------------------------------------------------------*/
+static inline uint32_t Channel(uint32_t Texel, int Index)
+{
+    return (Texel >> (Index * 8)) & 0xFF;
+}
+
+static inline uint32_t MakeTexel(uint32_t R, uint32_t G, uint32_t B, uint32_t A)
+{
+    return R | (G << 8) | (B << 16) | (A << 24);
+}
+
+static inline uint16_t PackRGB565(uint32_t Texel)
+{
+    const uint32_t R = (Channel(Texel, 0) * 31 + 127) / 255;
+    const uint32_t G = (Channel(Texel, 1) * 63 + 127) / 255;
+    const uint32_t B = (Channel(Texel, 2) * 31 + 127) / 255;
+    return static_cast<uint16_t>((R << 11) | (G << 5) | B);
+}
+
+static inline uint32_t UnpackRGB565(uint16_t Color)
+{
+    const uint32_t R = (Color >> 11) & 31;
+    const uint32_t G = (Color >> 5) & 63;
+    const uint32_t B = Color & 31;
+    return MakeTexel((R << 3) | (R >> 2), (G << 2) | (G >> 4), (B << 3) | (B >> 2), 255);
+}
+
+static inline uint32_t Lerp3(uint32_t A, uint32_t B)
+{
+    // (2A + B) / 3 for every channel
+    return MakeTexel((2 * Channel(A, 0) + Channel(B, 0)) / 3,
+                     (2 * Channel(A, 1) + Channel(B, 1)) / 3,
+                     (2 * Channel(A, 2) + Channel(B, 2)) / 3,
+                     255);
+}
+
+/*-----------------------------------------------------------------------------
+    GetBoundingBox - Per-channel minimum and maximum of a 4x4 block
+-----------------------------------------------------------------------------*/
+static inline void GetBoundingBox(const uint32_t Texels[16], uint32_t& Min, uint32_t& Max)
+{
+#if FRUCORE_X86
+    const __m128i T0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Texels     ));
+    const __m128i T1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Texels +  4));
+    const __m128i T2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Texels +  8));
+    const __m128i T3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Texels + 12));
+
+    __m128i Lo = _mm_min_epu8(_mm_min_epu8(T0, T1), _mm_min_epu8(T2, T3));
+    __m128i Hi = _mm_max_epu8(_mm_max_epu8(T0, T1), _mm_max_epu8(T2, T3));
+    Lo = _mm_min_epu8(Lo, _mm_shuffle_epi32(Lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    Hi = _mm_max_epu8(Hi, _mm_shuffle_epi32(Hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    Lo = _mm_min_epu8(Lo, _mm_shuffle_epi32(Lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    Hi = _mm_max_epu8(Hi, _mm_shuffle_epi32(Hi, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    Min = static_cast<uint32_t>(_mm_cvtsi128_si32(Lo));
+    Max = static_cast<uint32_t>(_mm_cvtsi128_si32(Hi));
+#elif FRUCORE_NEON
+    const uint8x16_t T0 = vld1q_u8(reinterpret_cast<const uint8_t*>(Texels     ));
+    const uint8x16_t T1 = vld1q_u8(reinterpret_cast<const uint8_t*>(Texels +  4));
+    const uint8x16_t T2 = vld1q_u8(reinterpret_cast<const uint8_t*>(Texels +  8));
+    const uint8x16_t T3 = vld1q_u8(reinterpret_cast<const uint8_t*>(Texels + 12));
+
+    uint8x16_t Lo = vminq_u8(vminq_u8(T0, T1), vminq_u8(T2, T3));
+    uint8x16_t Hi = vmaxq_u8(vmaxq_u8(T0, T1), vmaxq_u8(T2, T3));
+    Lo = vminq_u8(Lo, vextq_u8(Lo, Lo, 8));
+    Hi = vmaxq_u8(Hi, vextq_u8(Hi, Hi, 8));
+    Lo = vminq_u8(Lo, vextq_u8(Lo, Lo, 4));
+    Hi = vmaxq_u8(Hi, vextq_u8(Hi, Hi, 4));
+
+    Min = vgetq_lane_u32(vreinterpretq_u32_u8(Lo), 0);
+    Max = vgetq_lane_u32(vreinterpretq_u32_u8(Hi), 0);
+#else
+    Min = 0xFFFFFFFFu;
+    Max = 0;
+    for (int c = 0; c < 4; ++c)
+    {
+        uint32_t Lo = 255, Hi = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            const uint32_t Value = Channel(Texels[i], c);
+            Lo = Value < Lo ? Value : Lo;
+            Hi = Value > Hi ? Value : Hi;
+        }
+        Min = (Min & ~(0xFFu << (c * 8))) | (Lo << (c * 8));
+        Max = (Max & ~(0xFFu << (c * 8))) | (Hi << (c * 8));
+    }
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+    EncodeColorBlock - Range fit for the RGB channels. Writes the 8-byte BC1
+    color block. The alpha channel of @Texels is ignored.
+-----------------------------------------------------------------------------*/
+static void EncodeColorBlock(const uint32_t Texels[16], uint8_t Out[8])
+{
+    uint32_t Min, Max;
+    GetBoundingBox(Texels, Min, Max);
+
+    // Inset the bounding box by 1/16th of its size to reduce the average error
+    uint32_t InsetMin = 0, InsetMax = 0;
+    for (int c = 0; c < 3; ++c)
+    {
+        const uint32_t Lo = Channel(Min, c);
+        const uint32_t Hi = Channel(Max, c);
+        const uint32_t Inset = (Hi - Lo) >> 4;
+        InsetMin |= (Lo + Inset) << (c * 8);
+        InsetMax |= (Hi - Inset) << (c * 8);
+    }
+
+    // The packed max color is always >= the packed min color. If they're
+    // equal, the block is in 3-color mode, but index 0 still selects Color0
+    const uint16_t Color0 = PackRGB565(InsetMax);
+    const uint16_t Color1 = PackRGB565(InsetMin);
+
+    uint32_t Palette[4];
+    Palette[0] = UnpackRGB565(Color0);
+    Palette[1] = UnpackRGB565(Color1);
+    Palette[2] = Lerp3(Palette[0], Palette[1]);
+    Palette[3] = Lerp3(Palette[1], Palette[0]);
+
+    uint32_t Indices = 0;
+    if (Color0 != Color1)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            uint32_t BestIndex = 0;
+            int32_t BestError = 0x7FFFFFFF;
+            for (uint32_t p = 0; p < 4; ++p)
+            {
+                const int32_t DR = static_cast<int32_t>(Channel(Texels[i], 0)) - static_cast<int32_t>(Channel(Palette[p], 0));
+                const int32_t DG = static_cast<int32_t>(Channel(Texels[i], 1)) - static_cast<int32_t>(Channel(Palette[p], 1));
+                const int32_t DB = static_cast<int32_t>(Channel(Texels[i], 2)) - static_cast<int32_t>(Channel(Palette[p], 2));
+                const int32_t Error = DR * DR + DG * DG + DB * DB;
+                if (Error < BestError)
+                {
+                    BestError = Error;
+                    BestIndex = p;
+                }
+            }
+            Indices |= BestIndex << (i * 2);
+        }
+    }
+
+    Out[0] = Color0 & 0xFF;
+    Out[1] = Color0 >> 8;
+    Out[2] = Color1 & 0xFF;
+    Out[3] = Color1 >> 8;
+    memcpy(Out + 4, &Indices, 4);
+}
+
+/*-----------------------------------------------------------------------------
+    EncodeAlphaBlock - Writes the 8-byte BC3 alpha block. We always use the
+    8-value mode with the exact minimum and maximum alpha as the endpoints,
+    so fully transparent and fully opaque texels stay exact.
+-----------------------------------------------------------------------------*/
+static void EncodeAlphaBlock(const uint32_t Texels[16], uint8_t Out[8])
+{
+    uint32_t Min, Max;
+    GetBoundingBox(Texels, Min, Max);
+
+    const uint32_t Alpha0 = Channel(Max, 3);
+    const uint32_t Alpha1 = Channel(Min, 3);
+
+    uint32_t Palette[8];
+    Palette[0] = Alpha0;
+    Palette[1] = Alpha1;
+    for (uint32_t i = 1; i < 7; ++i)
+        Palette[i + 1] = ((7 - i) * Alpha0 + i * Alpha1) / 7;
+
+    uint64_t Indices = 0;
+    if (Alpha0 != Alpha1)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            const int32_t Alpha = static_cast<int32_t>(Channel(Texels[i], 3));
+            uint64_t BestIndex = 0;
+            int32_t BestError = 256;
+            for (uint32_t p = 0; p < 8; ++p)
+            {
+                const int32_t Error = abs(Alpha - static_cast<int32_t>(Palette[p]));
+                if (Error < BestError)
+                {
+                    BestError = Error;
+                    BestIndex = p;
+                }
+            }
+            Indices |= BestIndex << (i * 3);
+        }
+    }
+
+    Out[0] = static_cast<uint8_t>(Alpha0);
+    Out[1] = static_cast<uint8_t>(Alpha1);
+    for (int i = 0; i < 6; ++i)
+        Out[2 + i] = static_cast<uint8_t>(Indices >> (i * 8));
+}
+
+/*-----------------------------------------------------------------------------
+    Block encoders
+-----------------------------------------------------------------------------*/
+void EncodeBC1Block(const uint32_t Texels[16], uint8_t Out[BC1_BLOCK_BYTES])
+{
+    EncodeColorBlock(Texels, Out);
+}
+
+void EncodeBC3Block(const uint32_t Texels[16], uint8_t Out[BC3_BLOCK_BYTES])
+{
+    EncodeAlphaBlock(Texels, Out);
+
+    // Replace the color of fully transparent texels by that of a visible
+    // texel so they don't affect the bounding box
+    int Visible = -1;
+    for (int i = 0; i < 16 && Visible < 0; ++i)
+        if (Channel(Texels[i], 3) != 0)
+            Visible = i;
+
+    if (Visible < 0)
+    {
+        EncodeColorBlock(Texels, Out + 8);
+        return;
+    }
+
+    uint32_t ColorTexels[16];
+    for (int i = 0; i < 16; ++i)
+        ColorTexels[i] = Channel(Texels[i], 3) ? Texels[i] : Texels[Visible];
+    EncodeColorBlock(ColorTexels, Out + 8);
+}
+
+/*-----------------------------------------------------------------------------
+    Block decoders
+-----------------------------------------------------------------------------*/
+static void DecodeColorBlock(const uint8_t In[8], uint32_t Texels[16], bool AlwaysFourColors)
+{
+    const uint16_t Color0 = In[0] | (In[1] << 8);
+    const uint16_t Color1 = In[2] | (In[3] << 8);
+
+    uint32_t Palette[4];
+    Palette[0] = UnpackRGB565(Color0);
+    Palette[1] = UnpackRGB565(Color1);
+    if (Color0 > Color1 || AlwaysFourColors)
+    {
+        Palette[2] = Lerp3(Palette[0], Palette[1]);
+        Palette[3] = Lerp3(Palette[1], Palette[0]);
+    }
+    else
+    {
+        Palette[2] = MakeTexel((Channel(Palette[0], 0) + Channel(Palette[1], 0)) / 2,
+                               (Channel(Palette[0], 1) + Channel(Palette[1], 1)) / 2,
+                               (Channel(Palette[0], 2) + Channel(Palette[1], 2)) / 2,
+                               255);
+        Palette[3] = 0;
+    }
+
+    uint32_t Indices;
+    memcpy(&Indices, In + 4, 4);
+    for (int i = 0; i < 16; ++i)
+        Texels[i] = Palette[(Indices >> (i * 2)) & 3];
+}
+
+void DecodeBC1Block(const uint8_t In[BC1_BLOCK_BYTES], uint32_t Texels[16])
+{
+    DecodeColorBlock(In, Texels, false);
+}
+
+void DecodeBC3Block(const uint8_t In[BC3_BLOCK_BYTES], uint32_t Texels[16])
+{
+    DecodeColorBlock(In + 8, Texels, true);
+
+    const uint32_t Alpha0 = In[0];
+    const uint32_t Alpha1 = In[1];
+    uint32_t Palette[8];
+    Palette[0] = Alpha0;
+    Palette[1] = Alpha1;
+    if (Alpha0 > Alpha1)
+    {
+        for (uint32_t i = 1; i < 7; ++i)
+            Palette[i + 1] = ((7 - i) * Alpha0 + i * Alpha1) / 7;
+    }
+    else
+    {
+        for (uint32_t i = 1; i < 5; ++i)
+            Palette[i + 1] = ((5 - i) * Alpha0 + i * Alpha1) / 5;
+        Palette[6] = 0;
+        Palette[7] = 255;
+    }
+
+    uint64_t Indices = 0;
+    for (int i = 0; i < 6; ++i)
+        Indices |= static_cast<uint64_t>(In[2 + i]) << (i * 8);
+    for (int i = 0; i < 16; ++i)
+        Texels[i] = (Texels[i] & 0x00FFFFFFu) | (Palette[(Indices >> (i * 3)) & 7] << 24);
+}
+
+/*-----------------------------------------------------------------------------
+    Image encoders/decoders
+-----------------------------------------------------------------------------*/
+static inline void LoadBlock(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t BlockX, uint32_t BlockY, uint32_t Texels[16])
+{
+    for (uint32_t y = 0; y < 4; ++y)
+    {
+        const uint32_t SrcY = (BlockY * 4 + y < VSize) ? BlockY * 4 + y : VSize - 1;
+        const uint32_t* Row = Src + static_cast<size_t>(SrcY) * USize;
+        if (BlockX * 4 + 4 <= USize)
+        {
+            memcpy(Texels + y * 4, Row + BlockX * 4, 16);
+            continue;
+        }
+        for (uint32_t x = 0; x < 4; ++x)
+            Texels[y * 4 + x] = Row[(BlockX * 4 + x < USize) ? BlockX * 4 + x : USize - 1];
+    }
+}
+
+template<void (*EncodeBlock)(const uint32_t*, uint8_t*), size_t BlockBytes>
+static void EncodeRows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t FirstBlockRow, uint32_t NumBlockRows, uint8_t* Dst)
+{
+    const uint32_t BlocksX = (USize + 3) / 4;
+    uint32_t Texels[16];
+    for (uint32_t BlockY = FirstBlockRow; BlockY < FirstBlockRow + NumBlockRows; ++BlockY)
+    {
+        uint8_t* Out = Dst + static_cast<size_t>(BlockY) * BlocksX * BlockBytes;
+        for (uint32_t BlockX = 0; BlockX < BlocksX; ++BlockX, Out += BlockBytes)
+        {
+            LoadBlock(Src, USize, VSize, BlockX, BlockY, Texels);
+            EncodeBlock(Texels, Out);
+        }
+    }
+}
+
+void EncodeBC1Rows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t FirstBlockRow, uint32_t NumBlockRows, uint8_t* Dst)
+{
+    EncodeRows<&EncodeBC1Block, BC1_BLOCK_BYTES>(Src, USize, VSize, FirstBlockRow, NumBlockRows, Dst);
+}
+
+void EncodeBC3Rows(const uint32_t* Src, uint32_t USize, uint32_t VSize, uint32_t FirstBlockRow, uint32_t NumBlockRows, uint8_t* Dst)
+{
+    EncodeRows<&EncodeBC3Block, BC3_BLOCK_BYTES>(Src, USize, VSize, FirstBlockRow, NumBlockRows, Dst);
+}
+
+template<void (*DecodeBlock)(const uint8_t*, uint32_t*), size_t BlockBytes>
+static void DecodeImage(const uint8_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst)
+{
+    uint32_t Texels[16];
+    for (uint32_t BlockY = 0; BlockY < (VSize + 3) / 4; ++BlockY)
+    {
+        for (uint32_t BlockX = 0; BlockX < (USize + 3) / 4; ++BlockX, Src += BlockBytes)
+        {
+            DecodeBlock(Src, Texels);
+            for (uint32_t y = 0; y < 4 && BlockY * 4 + y < VSize; ++y)
+                for (uint32_t x = 0; x < 4 && BlockX * 4 + x < USize; ++x)
+                    Dst[static_cast<size_t>(BlockY * 4 + y) * USize + BlockX * 4 + x] = Texels[y * 4 + x];
+        }
+    }
+}
+
+void DecodeBC1Image(const uint8_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst)
+{
+    DecodeImage<&DecodeBC1Block, BC1_BLOCK_BYTES>(Src, USize, VSize, Dst);
+}
+
+void DecodeBC3Image(const uint8_t* Src, uint32_t USize, uint32_t VSize, uint32_t* Dst)
+{
+    DecodeImage<&DecodeBC3Block, BC3_BLOCK_BYTES>(Src, USize, VSize, Dst);
+}
+
+/*-----------------------------------------------------------------------------
+    HasTranslucentTexels
+-----------------------------------------------------------------------------*/
+bool HasTranslucentTexels(const uint32_t* Texels, size_t Count)
+{
+    uint32_t Alpha = 0xFF000000u;
+    for (size_t i = 0; i < Count; ++i)
+        Alpha &= Texels[i];
+    return Alpha != 0xFF000000u;
+}
+
+/*-----------------------------------------------------------------------------
+    ComputePSNR
+-----------------------------------------------------------------------------*/
+double ComputePSNR(const uint32_t* A, const uint32_t* B, size_t Count, bool IncludeAlpha)
+{
+    const int NumChannels = IncludeAlpha ? 4 : 3;
+    double SquaredError = 0.0;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        for (int c = 0; c < NumChannels; ++c)
+        {
+            const double Delta = static_cast<double>(Channel(A[i], c)) - static_cast<double>(Channel(B[i], c));
+            SquaredError += Delta * Delta;
+        }
+    }
+
+    if (SquaredError == 0.0 || Count == 0)
+        return 999.0;
+    const double MSE = SquaredError / (static_cast<double>(Count) * NumChannels);
+    return 10.0 * log10(255.0 * 255.0 / MSE);
+}
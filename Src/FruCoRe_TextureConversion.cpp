@@ -0,0 +1,338 @@
+/*=============================================================================
+    FruCoRe_TextureConversion.cpp: CPU-side texture conversion kernels.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_TextureConversion.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FRUCORE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define FRUCORE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*-----------------------------------------------------------------------------
+    ExpandP8Scalar - Reference implementation
+-----------------------------------------------------------------------------*/
+void ExpandP8Scalar(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count)
+{
+    for (size_t i = 0; i < Count; ++i)
+        Dst[i] = Palette[Src[i]];
+}
+
+#if FRUCORE_X86
+/*-----------------------------------------------------------------------------
+    ExpandP8SSE2 - SSE2 has no gather instruction, so we do the lookups with
+    scalar loads but we read the indices and write the texels 16 at a time.
+-----------------------------------------------------------------------------*/
+static void ExpandP8SSE2(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count)
+{
+    size_t i = 0;
+    for (; i + 16 <= Count; i += 16)
+    {
+        const __m128i Indices = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Src + i));
+        uint64_t Lo = static_cast<uint64_t>(_mm_cvtsi128_si64(Indices));
+        uint64_t Hi = static_cast<uint64_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(Indices, Indices)));
+
+        const __m128i T0 = _mm_setr_epi32(Palette[(Lo      ) & 0xFF], Palette[(Lo >>  8) & 0xFF], Palette[(Lo >> 16) & 0xFF], Palette[(Lo >> 24) & 0xFF]);
+        const __m128i T1 = _mm_setr_epi32(Palette[(Lo >> 32) & 0xFF], Palette[(Lo >> 40) & 0xFF], Palette[(Lo >> 48) & 0xFF], Palette[(Lo >> 56)       ]);
+        const __m128i T2 = _mm_setr_epi32(Palette[(Hi      ) & 0xFF], Palette[(Hi >>  8) & 0xFF], Palette[(Hi >> 16) & 0xFF], Palette[(Hi >> 24) & 0xFF]);
+        const __m128i T3 = _mm_setr_epi32(Palette[(Hi >> 32) & 0xFF], Palette[(Hi >> 40) & 0xFF], Palette[(Hi >> 48) & 0xFF], Palette[(Hi >> 56)       ]);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + i     ), T0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + i +  4), T1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + i +  8), T2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + i + 12), T3);
+    }
+    ExpandP8Scalar(Palette, Src + i, Dst + i, Count - i);
+}
+
+/*-----------------------------------------------------------------------------
+    ExpandP8AVX2 - Zero-extends 8 indices at a time and gathers the palette
+    entries directly.
+-----------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void ExpandP8AVX2(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count)
+{
+    const int* Table = reinterpret_cast<const int*>(Palette);
+    size_t i = 0;
+    for (; i + 16 <= Count; i += 16)
+    {
+        const __m256i I0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Src + i    )));
+        const __m256i I1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(Src + i + 8)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst + i    ), _mm256_i32gather_epi32(Table, I0, 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst + i + 8), _mm256_i32gather_epi32(Table, I1, 4));
+    }
+    ExpandP8Scalar(Palette, Src + i, Dst + i, Count - i);
+}
+
+static bool CPUSupportsAVX2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+#endif
+
+#if FRUCORE_NEON
+/*-----------------------------------------------------------------------------
+    ExpandP8NEON - NEON has no gather either, but it does have 64-byte table
+    lookups. We split the palette into four 256-byte planes (one per color
+    channel) and look up each plane with four TBL instructions. VST4 then
+    interleaves the planes back into RGBA texels.
+-----------------------------------------------------------------------------*/
+static void ExpandP8NEON(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count)
+{
+    if (Count < 64)
+    {
+        ExpandP8Scalar(Palette, Src, Dst, Count);
+        return;
+    }
+
+    alignas(16) uint8_t Planes[4][256];
+    const uint8_t* PalBytes = reinterpret_cast<const uint8_t*>(Palette);
+    for (int i = 0; i < 256; ++i)
+    {
+        Planes[0][i] = PalBytes[i * 4 + 0];
+        Planes[1][i] = PalBytes[i * 4 + 1];
+        Planes[2][i] = PalBytes[i * 4 + 2];
+        Planes[3][i] = PalBytes[i * 4 + 3];
+    }
+
+    uint8x16x4_t Tables[4][4];
+    for (int c = 0; c < 4; ++c)
+        for (int t = 0; t < 4; ++t)
+            Tables[c][t] = vld1q_u8_x4(&Planes[c][t * 64]);
+
+    const uint8x16_t Step = vdupq_n_u8(64);
+    size_t i = 0;
+    for (; i + 16 <= Count; i += 16)
+    {
+        const uint8x16_t I0 = vld1q_u8(Src + i);
+        const uint8x16_t I1 = vsubq_u8(I0, Step);
+        const uint8x16_t I2 = vsubq_u8(I1, Step);
+        const uint8x16_t I3 = vsubq_u8(I2, Step);
+
+        // Out-of-range TBL lookups return 0, so OR-ing the four sub-tables
+        // gives us the full 256-entry lookup
+        uint8x16x4_t Out;
+        for (int c = 0; c < 4; ++c)
+        {
+            Out.val[c] = vorrq_u8(
+                vorrq_u8(vqtbl4q_u8(Tables[c][0], I0), vqtbl4q_u8(Tables[c][1], I1)),
+                vorrq_u8(vqtbl4q_u8(Tables[c][2], I2), vqtbl4q_u8(Tables[c][3], I3)));
+        }
+        vst4q_u8(reinterpret_cast<uint8_t*>(Dst + i), Out);
+    }
+    ExpandP8Scalar(Palette, Src + i, Dst + i, Count - i);
+}
+#endif
+
+/*-----------------------------------------------------------------------------
+    Kernel selection
+-----------------------------------------------------------------------------*/
+ExpandP8Func GetExpandP8Kernel(EExpandP8Kernel Kernel)
+{
+    switch (Kernel)
+    {
+        case EXPANDP8_Scalar:
+            return &ExpandP8Scalar;
+#if FRUCORE_X86
+        case EXPANDP8_SSE2:
+            return &ExpandP8SSE2;
+        case EXPANDP8_AVX2:
+            return CPUSupportsAVX2() ? &ExpandP8AVX2 : nullptr;
+#endif
+#if FRUCORE_NEON
+        case EXPANDP8_NEON:
+            return &ExpandP8NEON;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+const char* GetExpandP8KernelName(EExpandP8Kernel Kernel)
+{
+    switch (Kernel)
+    {
+        case EXPANDP8_Scalar: return "Scalar";
+        case EXPANDP8_SSE2:   return "SSE2";
+        case EXPANDP8_AVX2:   return "AVX2";
+        case EXPANDP8_NEON:   return "NEON";
+        default:              return "Unknown";
+    }
+}
+
+EExpandP8Kernel GetBestExpandP8Kernel()
+{
+    static const EExpandP8Kernel Best = []()
+    {
+        for (int i = EXPANDP8_Max - 1; i > EXPANDP8_Scalar; --i)
+            if (GetExpandP8Kernel(static_cast<EExpandP8Kernel>(i)))
+                return static_cast<EExpandP8Kernel>(i);
+        return EXPANDP8_Scalar;
+    }();
+    return Best;
+}
+
+void ExpandP8(const uint32_t* Palette, const uint8_t* Src, uint32_t* Dst, size_t Count)
+{
+    static const ExpandP8Func Kernel = GetExpandP8Kernel(GetBestExpandP8Kernel());
+    Kernel(Palette, Src, Dst, Count);
+}
+
+/*-----------------------------------------------------------------------------
+    DiffP8Rows - Procedural textures usually either change almost entirely
+    (e.g., water) or only in a few rows (e.g., a small fire at the bottom of
+    the texture). We therefore only track changes at row granularity and
+    narrow down the changed columns within each band of changed rows.
+-----------------------------------------------------------------------------*/
+static inline uint32_t FirstDifference(const uint8_t* A, const uint8_t* B, uint32_t Count)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= Count; i += 8)
+    {
+        uint64_t WA, WB;
+        memcpy(&WA, A + i, 8);
+        memcpy(&WB, B + i, 8);
+        if (WA != WB)
+            break;
+    }
+    while (i < Count && A[i] == B[i])
+        i++;
+    return i;
+}
+
+static inline uint32_t LastDifference(const uint8_t* A, const uint8_t* B, uint32_t Count)
+{
+    uint32_t i = Count;
+    for (; i >= 8; i -= 8)
+    {
+        uint64_t WA, WB;
+        memcpy(&WA, A + i - 8, 8);
+        memcpy(&WB, B + i - 8, 8);
+        if (WA != WB)
+            break;
+    }
+    while (i > 0 && A[i - 1] == B[i - 1])
+        i--;
+    return i;
+}
+
+size_t DiffP8Rows(const uint8_t* Src, uint8_t* Shadow, uint32_t USize, uint32_t VSize, FDirtyRect* OutRects, size_t MaxRects, uint64_t* OutDirtyTexels)
+{
+    size_t NumRects = 0;
+    uint64_t DirtyTexels = 0;
+    bool InBand = false;
+    uint32_t BandMinX = 0, BandMaxX = 0;
+
+    for (uint32_t Y = 0; Y < VSize; ++Y)
+    {
+        const uint8_t* SrcRow = Src + static_cast<size_t>(Y) * USize;
+        uint8_t* ShadowRow = Shadow + static_cast<size_t>(Y) * USize;
+
+        const uint32_t First = FirstDifference(SrcRow, ShadowRow, USize);
+        if (First == USize)
+        {
+            InBand = false;
+            continue;
+        }
+        const uint32_t Last = LastDifference(SrcRow, ShadowRow, USize);
+        memcpy(ShadowRow + First, SrcRow + First, Last - First);
+
+        if (!InBand && NumRects < MaxRects)
+        {
+            FDirtyRect& Rect = OutRects[NumRects++];
+            Rect.X = First;
+            Rect.Y = Y;
+            Rect.Width = Last - First;
+            Rect.Height = 1;
+            BandMinX = First;
+            BandMaxX = Last;
+            InBand = true;
+            continue;
+        }
+
+        // Grow the current band (or the last one if we're out of rects)
+        FDirtyRect& Rect = OutRects[NumRects - 1];
+        BandMinX = First < BandMinX ? First : BandMinX;
+        BandMaxX = Last > BandMaxX ? Last : BandMaxX;
+        Rect.X = BandMinX;
+        Rect.Width = BandMaxX - BandMinX;
+        Rect.Height = Y - Rect.Y + 1;
+        InBand = true;
+    }
+
+    for (size_t i = 0; i < NumRects; ++i)
+        DirtyTexels += static_cast<uint64_t>(OutRects[i].Width) * OutRects[i].Height;
+    if (OutDirtyTexels)
+        *OutDirtyTexels = DirtyTexels;
+    return NumRects;
+}
+
+/*-----------------------------------------------------------------------------
+    ExpandP8Rect
+-----------------------------------------------------------------------------*/
+void ExpandP8Rect(const uint32_t* Palette, const uint8_t* Src, uint32_t SrcPitch, const FDirtyRect& Rect, uint32_t* Dst)
+{
+    for (uint32_t Y = 0; Y < Rect.Height; ++Y)
+        ExpandP8(Palette, Src + static_cast<size_t>(Rect.Y + Y) * SrcPitch + Rect.X, Dst + static_cast<size_t>(Y) * Rect.Width, Rect.Width);
+}
+
+/*-----------------------------------------------------------------------------
+    SamplePalettedReference
+-----------------------------------------------------------------------------*/
+static void PalettedTexelReference(const uint8_t* Indices, int USize, int VSize, const uint32_t* Palette, bool Masked, bool Clamp, int X, int Y, float Out[4])
+{
+    X = Clamp ? std::min(std::max(X, 0), USize - 1) : ((X % USize) + USize) % USize;
+    Y = Clamp ? std::min(std::max(Y, 0), VSize - 1) : ((Y % VSize) + VSize) % VSize;
+    const uint8_t Index = Indices[Y * USize + X];
+    const uint32_t Color = (Masked && Index == 0) ? 0 : Palette[Index];
+    const uint8_t* Bytes = reinterpret_cast<const uint8_t*>(&Color);
+    for (int c = 0; c < 4; ++c)
+        Out[c] = Bytes[c] / 255.f;
+}
+
+void SamplePalettedReference(const uint8_t* Indices, int USize, int VSize, const uint32_t* Palette, bool Masked, bool Bilinear, bool Clamp, float U, float V, float Out[4])
+{
+    const float X = U * USize;
+    const float Y = V * VSize;
+
+    if (!Bilinear)
+    {
+        PalettedTexelReference(Indices, USize, VSize, Palette, Masked, Clamp, static_cast<int>(floorf(X)), static_cast<int>(floorf(Y)), Out);
+        return;
+    }
+
+    const float PX = X - 0.5f;
+    const float PY = Y - 0.5f;
+    const int X0 = static_cast<int>(floorf(PX));
+    const int Y0 = static_cast<int>(floorf(PY));
+    const float FX = PX - floorf(PX);
+    const float FY = PY - floorf(PY);
+
+    float T00[4], T10[4], T01[4], T11[4];
+    PalettedTexelReference(Indices, USize, VSize, Palette, Masked, Clamp, X0    , Y0    , T00);
+    PalettedTexelReference(Indices, USize, VSize, Palette, Masked, Clamp, X0 + 1, Y0    , T10);
+    PalettedTexelReference(Indices, USize, VSize, Palette, Masked, Clamp, X0    , Y0 + 1, T01);
+    PalettedTexelReference(Indices, USize, VSize, Palette, Masked, Clamp, X0 + 1, Y0 + 1, T11);
+
+    for (int c = 0; c < 4; ++c)
+    {
+        const float Top    = T00[c] + (T10[c] - T00[c]) * FX;
+        const float Bottom = T01[c] + (T11[c] - T01[c]) * FX;
+        Out[c] = Top + (Bottom - Top) * FY;
+    }
+}
@@ -0,0 +1,56 @@
+/*=============================================================================
+    FruCoRe_Bench.cpp: Benchmark runner for the Metal-free components.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+
+#include <string.h>
+
+struct FBenchmark
+{
+    const char* Name;
+    FBenchFunc  Func;
+    FBenchmark* Next;
+};
+
+static FBenchmark*& GetBenchmarks()
+{
+    static FBenchmark* Benchmarks = nullptr;
+    return Benchmarks;
+}
+
+FBenchRegistrar::FBenchRegistrar(const char* Name, FBenchFunc Func)
+{
+    FBenchmark** Tail = &GetBenchmarks();
+    while (*Tail)
+        Tail = &(*Tail)->Next;
+    *Tail = new FBenchmark{ Name, Func, nullptr };
+}
+
+int main(int argc, char** argv)
+{
+    int NumRun = 0;
+    for (FBenchmark* Bench = GetBenchmarks(); Bench; Bench = Bench->Next)
+    {
+        bool bSelected = argc <= 1;
+        for (int i = 1; i < argc && !bSelected; ++i)
+            bSelected = strcmp(argv[i], Bench->Name) == 0;
+        if (!bSelected)
+            continue;
+
+        printf("== %s\n", Bench->Name);
+        Bench->Func();
+        NumRun++;
+    }
+
+    if (NumRun == 0)
+    {
+        fprintf(stderr, "No matching benchmarks\n");
+        return 1;
+    }
+    return 0;
+}
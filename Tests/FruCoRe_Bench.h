@@ -0,0 +1,60 @@
+/*=============================================================================
+    FruCoRe_Bench.h: Minimal benchmark harness for the Metal-free components.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+//
+// Benchmarks register themselves like test cases do (see FruCoRe_Tests.h).
+// The runner runs either all of them, or the ones named on the command line.
+//
+typedef void (*FBenchFunc)();
+
+struct FBenchRegistrar
+{
+    FBenchRegistrar(const char* Name, FBenchFunc Func);
+};
+
+#define BENCHMARK(Name) \
+    static void Bench_##Name(); \
+    static FBenchRegistrar BenchRegistrar_##Name(#Name, &Bench_##Name); \
+    static void Bench_##Name()
+
+//
+// Runs @Func repeatedly for at least @MinSeconds and returns the average
+// time per call in seconds. The first call warms up the caches and is not
+// timed.
+//
+template<typename F> double TimeBenchmark(F&& Func, double MinSeconds = 0.2)
+{
+    typedef std::chrono::steady_clock FClock;
+
+    Func();
+
+    size_t NumCalls = 0;
+    const FClock::time_point Start = FClock::now();
+    double Elapsed = 0.0;
+    do
+    {
+        Func();
+        NumCalls++;
+        Elapsed = std::chrono::duration<double>(FClock::now() - Start).count();
+    } while (Elapsed < MinSeconds);
+
+    return Elapsed / static_cast<double>(NumCalls);
+}
+
+// Keeps the compiler from optimizing away results we don't otherwise use
+template<typename T> void KeepResult(const T& Value)
+{
+    asm volatile("" : : "g"(&Value) : "memory");
+}
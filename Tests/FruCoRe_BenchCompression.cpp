@@ -0,0 +1,56 @@
+/*=============================================================================
+    FruCoRe_BenchCompression.cpp: Benchmarks for FruCoRe_TextureCompression.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureCompression.h"
+
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    EncodeBC - Single-threaded encoder throughput and quality. The renderer
+    spreads the block rows of large textures over several worker threads.
+-----------------------------------------------------------------------------*/
+BENCHMARK(EncodeBC)
+{
+    FTestRandom Random;
+    const uint32_t Sizes[] = { 64, 256, 1024 };
+    printf("%-8s%-11s%14s%10s\n", "Format", "Size", "MTexels/s", "PSNR");
+
+    for (uint32_t Size : Sizes)
+    {
+        std::vector<uint32_t> Image(Size * Size);
+        for (uint32_t Y = 0; Y < Size; ++Y)
+            for (uint32_t X = 0; X < Size; ++X)
+                Image[Y * Size + X] = ((X * 255 / Size + Random.Range(0, 7)) & 0xFF) | (((Y * 255 / Size + Random.Range(0, 7)) & 0xFF) << 8) | 0x80FF0000;
+
+        std::vector<uint8_t> Encoded(Size / 4 * Size / 4 * BC3_BLOCK_BYTES);
+        std::vector<uint32_t> Decoded(Size * Size);
+
+        for (int Format = 0; Format < 2; ++Format)
+        {
+            const double Seconds = TimeBenchmark([&]()
+            {
+                if (Format == 0)
+                    EncodeBC1Rows(Image.data(), Size, Size, 0, Size / 4, Encoded.data());
+                else
+                    EncodeBC3Rows(Image.data(), Size, Size, 0, Size / 4, Encoded.data());
+                KeepResult(Encoded[0]);
+            });
+
+            if (Format == 0)
+                DecodeBC1Image(Encoded.data(), Size, Size, Decoded.data());
+            else
+                DecodeBC3Image(Encoded.data(), Size, Size, Decoded.data());
+
+            char SizeName[32];
+            snprintf(SizeName, sizeof(SizeName), "%ux%u", Size, Size);
+            printf("%-8s%-11s%14.1f%7.1f dB\n", Format == 0 ? "BC1" : "BC3", SizeName, Size * Size / Seconds / 1e6, ComputePSNR(Image.data(), Decoded.data(), Image.size(), Format == 1));
+        }
+    }
+}
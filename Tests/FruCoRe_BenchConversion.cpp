@@ -0,0 +1,115 @@
+/*=============================================================================
+    FruCoRe_BenchConversion.cpp: Benchmarks for FruCoRe_TextureConversion.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureConversion.h"
+
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    ExpandP8 - Output bandwidth of every kernel this CPU supports, for the
+    texture sizes we usually see in the stock and community packages
+-----------------------------------------------------------------------------*/
+BENCHMARK(ExpandP8)
+{
+    FTestRandom Random;
+    uint32_t Palette[256];
+    for (uint32_t& Color : Palette)
+        Color = Random.Next();
+
+    const uint32_t Sizes[] = { 64, 256, 1024, 2048 };
+    printf("%-8s", "Kernel");
+    for (uint32_t Size : Sizes)
+        printf("%12ux%-5u", Size, Size);
+    printf("\n");
+
+    for (int Kernel = 0; Kernel < EXPANDP8_Max; ++Kernel)
+    {
+        ExpandP8Func Func = GetExpandP8Kernel(static_cast<EExpandP8Kernel>(Kernel));
+        if (!Func)
+            continue;
+
+        printf("%-8s", GetExpandP8KernelName(static_cast<EExpandP8Kernel>(Kernel)));
+        for (uint32_t Size : Sizes)
+        {
+            const size_t Count = static_cast<size_t>(Size) * Size;
+            std::vector<uint8_t> Src(Count);
+            std::vector<uint32_t> Dst(Count);
+            for (uint8_t& Index : Src)
+                Index = static_cast<uint8_t>(Random.Next());
+
+            const double Seconds = TimeBenchmark([&]()
+            {
+                Func(Palette, Src.data(), Dst.data(), Count);
+                KeepResult(Dst[0]);
+            });
+            printf("%13.0f MB/s", Count * sizeof(uint32_t) / Seconds / (1024.0 * 1024.0));
+        }
+        printf("\n");
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    DirtyRegions - Diff and partial expansion of synthetic fire-like frames
+    compared with expanding the full texture. A FireTexture's sparks usually
+    live in the bottom part of the texture, and the rows above them don't
+    change from one frame to the next.
+-----------------------------------------------------------------------------*/
+static void MakeFireFrame(FTestRandom& Random, uint32_t USize, uint32_t VSize, double Coverage, std::vector<uint8_t>& Frame)
+{
+    const uint32_t FirstRow = VSize - static_cast<uint32_t>(VSize * Coverage);
+    for (uint32_t Y = FirstRow; Y < VSize; ++Y)
+        for (uint32_t X = 0; X < USize; ++X)
+            Frame[Y * USize + X] = static_cast<uint8_t>((Frame[Y * USize + X] + Random.Range(0, 3)) & 0xFF);
+}
+
+BENCHMARK(DirtyRegions)
+{
+    FTestRandom Random;
+    uint32_t Palette[256];
+    for (uint32_t& Color : Palette)
+        Color = Random.Next();
+
+    const uint32_t USize = 256, VSize = 256;
+    const double Coverages[] = { 0.05, 0.25, 0.5, 1.0 };
+    printf("%-10s%16s%16s%16s\n", "Changed", "Full expand", "Diff + expand", "Dirty texels");
+
+    for (double Coverage : Coverages)
+    {
+        // The benchmark alternates between two frames, so every call sees changes
+        std::vector<uint8_t> Frames[2] = { std::vector<uint8_t>(USize * VSize, 0), std::vector<uint8_t>(USize * VSize, 0) };
+        MakeFireFrame(Random, USize, VSize, Coverage, Frames[1]);
+        std::vector<uint8_t> Shadow = Frames[0];
+        std::vector<uint32_t> Dst(USize * VSize);
+        FDirtyRect Rects[8];
+        uint64_t DirtyTexels = 0;
+        int Current = 0;
+
+        const double FullSeconds = TimeBenchmark([&]()
+        {
+            ExpandP8(Palette, Frames[Current ^= 1].data(), Dst.data(), Dst.size());
+            KeepResult(Dst[0]);
+        });
+
+        const double DirtySeconds = TimeBenchmark([&]()
+        {
+            const std::vector<uint8_t>& Src = Frames[Current ^= 1];
+            const size_t NumRects = DiffP8Rows(Src.data(), Shadow.data(), USize, VSize, Rects, 8, &DirtyTexels);
+            uint32_t* Out = Dst.data();
+            for (size_t i = 0; i < NumRects; ++i)
+            {
+                ExpandP8Rect(Palette, Src.data(), USize, Rects[i], Out);
+                Out += Rects[i].Width * Rects[i].Height;
+            }
+            KeepResult(Dst[0]);
+        });
+
+        printf("%9.0f%%%13.1f us%13.1f us%16llu\n", Coverage * 100.0, FullSeconds * 1e6, DirtySeconds * 1e6, static_cast<unsigned long long>(DirtyTexels));
+    }
+}
@@ -0,0 +1,46 @@
+/*=============================================================================
+    FruCoRe_BenchMipGeneration.cpp: Benchmarks for FruCoRe_MipGeneration.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_MipGeneration.h"
+#include "FruCoRe_Tests.h"
+
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    DownsampleMip - Source megatexels per second for noisy textures, where
+    hardly any 2x2 block is uniform, and for flat textures with a few
+    details, like most UI textures
+-----------------------------------------------------------------------------*/
+BENCHMARK(DownsampleMip)
+{
+    FTestRandom Random;
+    const uint32_t Size = 1024;
+    printf("%-8s%14s%14s\n", "Image", "Scalar", "SIMD");
+
+    for (int Pattern = 0; Pattern < 2; ++Pattern)
+    {
+        std::vector<uint32_t> Src(Size * Size);
+        for (uint32_t& Texel : Src)
+            Texel = Pattern == 0 ? Random.Next() | 0xFF000000 : (Random.Range(0, 63) ? 0xFF203040 : Random.Next());
+        std::vector<uint32_t> Dst(Size * Size / 4);
+
+        const double ScalarSeconds = TimeBenchmark([&]()
+        {
+            DownsampleMipScalar(Src.data(), Size, Size, Dst.data());
+            KeepResult(Dst[0]);
+        });
+        const double SIMDSeconds = TimeBenchmark([&]()
+        {
+            DownsampleMip(Src.data(), Size, Size, Dst.data());
+            KeepResult(Dst[0]);
+        });
+
+        printf("%-8s%8.1f MT/s%8.1f MT/s\n", Pattern == 0 ? "Noise" : "Flat", Src.size() / ScalarSeconds / 1e6, Src.size() / SIMDSeconds / 1e6);
+    }
+}
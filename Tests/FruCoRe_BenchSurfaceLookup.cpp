@@ -0,0 +1,88 @@
+/*=============================================================================
+    FruCoRe_BenchSurfaceLookup.cpp: Benchmarks for FruCoRe_SurfaceLookup.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_SurfaceLookupTypes.h"
+#include "FruCoRe_TextureCache.h"
+
+/*-----------------------------------------------------------------------------
+    FacetLookup - Finding the cached copy of a facet by its texture mapping,
+    compared with hashing every point of the facet in world space. A BSP
+    surface usually has a handful of nodes, each with 4 to 8 points.
+-----------------------------------------------------------------------------*/
+static uint64_t HashFacetPoints(const FFakeCamera& Camera, const float* Points, uint32_t NumPoints)
+{
+    uint64_t Key = 0;
+    for (uint32_t i = 0; i < NumPoints; ++i)
+    {
+        float World[3];
+        Camera.ToWorld(&Points[i * 3], World, true);
+        const int32_t Quantized[3] = { static_cast<int32_t>(lrintf(World[0] * 4.f)), static_cast<int32_t>(lrintf(World[1] * 4.f)), static_cast<int32_t>(lrintf(World[2] * 4.f)) };
+        Key = HashBytes64(Quantized, sizeof(Quantized), Key);
+    }
+    return Key;
+}
+
+BENCHMARK(FacetLookup)
+{
+    FTestRandom Random;
+    const FFakeCamera Camera(Random);
+
+    // Roughly the surface count of a large map
+    const int NumSurfaces = 8000;
+    std::vector<FSurfaceMapping> Surfaces;
+    FSurfaceLookup Lookup;
+    for (int i = 0; i < NumSurfaces; ++i)
+    {
+        Surfaces.push_back(MakeFakeSurface(Random));
+        Lookup.Add(i, Surfaces.back());
+    }
+    Lookup.Build();
+
+    // Camera-space texture mappings, as the engine passes them
+    std::vector<FSurfaceMapping> Facets(NumSurfaces);
+    for (int i = 0; i < NumSurfaces; ++i)
+    {
+        Camera.ToCamera(Surfaces[i].Origin, Facets[i].Origin, true);
+        Camera.ToCamera(Surfaces[i].XAxis, Facets[i].XAxis, false);
+        Camera.ToCamera(Surfaces[i].YAxis, Facets[i].YAxis, false);
+    }
+
+    printf("%-10s%16s%16s\n", "Points", "Hash points", "Lookup");
+    const uint32_t PointCounts[] = { 4, 16, 64 };
+    for (uint32_t NumPoints : PointCounts)
+    {
+        std::vector<float> Points(NumSurfaces * NumPoints * 3);
+        for (float& Coord : Points)
+            Coord = static_cast<float>(Random.Range(0, 8191)) - 4096.f;
+
+        const double HashSeconds = TimeBenchmark([&]()
+        {
+            uint64_t Sum = 0;
+            for (int i = 0; i < NumSurfaces; ++i)
+                Sum += HashFacetPoints(Camera, &Points[i * NumPoints * 3], NumPoints);
+            KeepResult(Sum);
+        });
+
+        const double LookupSeconds = TimeBenchmark([&]()
+        {
+            int32_t Sum = 0;
+            for (int i = 0; i < NumSurfaces; ++i)
+            {
+                FSurfaceMapping World;
+                Camera.ToWorld(Facets[i].Origin, World.Origin, true);
+                Camera.ToWorld(Facets[i].XAxis, World.XAxis, false);
+                Camera.ToWorld(Facets[i].YAxis, World.YAxis, false);
+                Sum += Lookup.Find(World);
+            }
+            KeepResult(Sum);
+        });
+
+        printf("%-10u%13.1f ns%13.1f ns\n", NumPoints, HashSeconds * 1e9 / NumSurfaces, LookupSeconds * 1e9 / NumSurfaces);
+    }
+}
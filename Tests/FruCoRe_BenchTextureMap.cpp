@@ -0,0 +1,66 @@
+/*=============================================================================
+    FruCoRe_BenchTextureMap.cpp: Benchmarks for FruCoRe_TextureMap.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureMap.h"
+
+#include <unordered_map>
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    TextureMapLookup - Lookups per second for a cache with a typical number of
+    textures. std::unordered_map stands in for the engine's TMap, which uses
+    chained buckets too. The "Repeated" column looks up each texture several
+    times in a row, like the polys of a mesh that share one skin.
+-----------------------------------------------------------------------------*/
+BENCHMARK(TextureMapLookup)
+{
+    FTestRandom Random;
+    const size_t Counts[] = { 256, 2048, 16384 };
+    printf("%-10s%-16s%14s%14s\n", "Textures", "Map", "Random", "Repeated");
+
+    for (size_t Count : Counts)
+    {
+        std::vector<uint64_t> Keys(Count);
+        for (uint64_t& Key : Keys)
+            Key = (static_cast<uint64_t>(Random.Range(0, 7)) << 56) | (static_cast<uint64_t>(Random.Next()) << 4);
+
+        std::vector<uint64_t> RandomKeys(65536), RepeatedKeys(65536);
+        for (size_t i = 0; i < RandomKeys.size(); ++i)
+            RandomKeys[i] = Keys[Random.Range(0, Count - 1)];
+        for (size_t i = 0; i < RepeatedKeys.size(); i += 8)
+            for (size_t j = 0; j < 8; ++j)
+                RepeatedKeys[i + j] = RandomKeys[i];
+
+        TTextureCacheMap<uint64_t*> Map;
+        std::unordered_map<uint64_t, uint64_t*> Reference;
+        for (uint64_t& Key : Keys)
+        {
+            Map.Set(Key, &Key);
+            Reference[Key] = &Key;
+        }
+
+        auto TimeLookups = [&](const std::vector<uint64_t>& Lookups, auto&& Find)
+        {
+            const double Seconds = TimeBenchmark([&]()
+            {
+                uintptr_t Sum = 0;
+                for (uint64_t Key : Lookups)
+                    Sum += reinterpret_cast<uintptr_t>(Find(Key));
+                KeepResult(Sum);
+            });
+            return Lookups.size() / Seconds / 1e6;
+        };
+
+        auto FindFlat = [&](uint64_t Key) { return Map.FindRef(Key); };
+        auto FindChained = [&](uint64_t Key) { return Reference.find(Key)->second; };
+        printf("%-10zu%-16s%10.1f M/s%10.1f M/s\n", Count, "TTextureCacheMap", TimeLookups(RandomKeys, FindFlat), TimeLookups(RepeatedKeys, FindFlat));
+        printf("%-10zu%-16s%10.1f M/s%10.1f M/s\n", Count, "unordered_map", TimeLookups(RandomKeys, FindChained), TimeLookups(RepeatedKeys, FindChained));
+    }
+}
@@ -0,0 +1,75 @@
+/*=============================================================================
+    FruCoRe_BenchVertexEmission.cpp: Benchmarks for FruCoRe_VertexEmission.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Bench.h"
+#include "FruCoRe_VertexEmission.h"
+#include "FruCoRe_VertexEmissionTypes.h"
+
+/*-----------------------------------------------------------------------------
+    EmitGouraud - Vertices per second for the batched kernel, compared with
+    writing every vertex straight into the destination buffer, like the draw
+    functions used to. Each poly has PolySize vertices. The destination is
+    much larger than the cache, like the vertex buffer rings. The source
+    vertices are either reached in memory order, like most mesh vertices,
+    or scattered all over a large pool.
+-----------------------------------------------------------------------------*/
+static void EmitNaive(FFakeGouraudVertex* Out, FFakeHalf4* OutFog, uint32_t Count, FFakeSourceVertex* const* Points)
+{
+    for (uint32_t i = 0; i < Count; ++i)
+    {
+        const FFakeSourceVertex& P = *Points[i];
+        Out[i].Point = { P.Point.X, P.Point.Y, P.Point.Z };
+        Out[i].Instance = 0;
+        Out[i].UV[0] = P.U;
+        Out[i].UV[1] = P.V;
+        PackHalf4(Out[i].LightColor.Bits, P.Light.X, P.Light.Y, P.Light.Z, P.Light.W);
+        PackHalf4(OutFog[i].Bits, P.Fog.X, P.Fog.Y, P.Fog.Z, P.Fog.W);
+    }
+}
+
+BENCHMARK(EmitGouraud)
+{
+    FTestRandom Random;
+    const uint32_t NumVertices = 1 << 20;
+    FFakeVertexPool Pool(Random, NumVertices);
+    std::vector<FFakeGouraudVertex> Vertices(NumVertices);
+    std::vector<FFakeHalf4> Fog(NumVertices);
+
+    const uint32_t PolySizes[] = { 4, 16, 256 };
+    printf("%-11s%-10s%14s%14s\n", "Source", "PolySize", "Naive", "Batched");
+    for (int Order = 0; Order < 2; ++Order)
+    {
+        for (uint32_t i = 0; i < NumVertices; ++i)
+            Pool.Pointers[i] = &Pool.Vertices[i];
+        if (Order == 1)
+            for (uint32_t i = NumVertices - 1; i > 0; --i)
+                std::swap(Pool.Pointers[i], Pool.Pointers[Random.Range(0, i)]);
+
+        for (uint32_t PolySize : PolySizes)
+        {
+            const double NaiveSeconds = TimeBenchmark([&]()
+            {
+                for (uint32_t Start = 0; Start < NumVertices; Start += PolySize)
+                    EmitNaive(&Vertices[Start], &Fog[Start], PolySize, &Pool.Pointers[Start]);
+                KeepResult(Vertices[0]);
+            });
+
+            const double BatchedSeconds = TimeBenchmark([&]()
+            {
+                for (uint32_t Start = 0; Start < NumVertices; Start += PolySize)
+                {
+                    FFakeSourceVertex* const* Points = &Pool.Pointers[Start];
+                    EmitGouraudVertices(&Vertices[Start], &Fog[Start], PolySize, 0, [Points](uint32_t i) -> const FFakeSourceVertex& { return *Points[i]; });
+                }
+                KeepResult(Vertices[0]);
+            });
+
+            printf("%-11s%-10u%8.1f MV/s%8.1f MV/s\n", Order == 0 ? "Sequential" : "Scattered", PolySize, NumVertices / NaiveSeconds / 1e6, NumVertices / BatchedSeconds / 1e6);
+        }
+    }
+}
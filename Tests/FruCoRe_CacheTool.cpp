@@ -0,0 +1,69 @@
+/*=============================================================================
+    FruCoRe_CacheTool.cpp: Command line tool for the texture disk cache.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_DiskCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void PrintLine(const char* Line, void*)
+{
+    printf("%s\n", Line);
+}
+
+static int Usage()
+{
+    fprintf(stderr,
+        "Usage:\n"
+        "  FruCoReCacheTool inspect <File> [-v]     Validates the cache and prints a summary (and every entry with -v)\n"
+        "  FruCoReCacheTool compact <File> [MaxMB]  Drops corrupt entries and trims the cache to MaxMB of texture data\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+        return Usage();
+
+    const char* Command = argv[1];
+    const char* Path = argv[2];
+
+    if (strcmp(Command, "inspect") == 0)
+    {
+        const bool Verbose = argc > 3 && strcmp(argv[3], "-v") == 0;
+        return FTextureDiskCache::Inspect(Path, Verbose, PrintLine, nullptr) ? 0 : 1;
+    }
+
+    if (strcmp(Command, "compact") == 0)
+    {
+        const uint64_t MaxBytes = argc > 3 ? strtoull(argv[3], nullptr, 10) * 1024 * 1024 : UINT64_MAX;
+
+        FTextureDiskCache Cache;
+        Cache.Open(Path, MaxBytes);
+        const FTextureDiskCache::FStats Before = Cache.GetStats();
+        if (Before.NumMappedEntries == 0)
+        {
+            fprintf(stderr, "%s: %s\n", Path, Before.NumCorruptEntries ? "not a valid texture cache" : "empty or missing");
+            return 1;
+        }
+
+        const uint64_t NumCorrupt = Cache.Verify();
+        if (!Cache.Save())
+        {
+            fprintf(stderr, "%s: could not write the compacted cache\n", Path);
+            return 1;
+        }
+        Cache.Close();
+
+        printf("%s: dropped %llu corrupt entries\n", Path, static_cast<unsigned long long>(NumCorrupt));
+        return FTextureDiskCache::Inspect(Path, false, PrintLine, nullptr) ? 0 : 1;
+    }
+
+    return Usage();
+}
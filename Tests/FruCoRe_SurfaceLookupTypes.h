@@ -0,0 +1,89 @@
+/*=============================================================================
+    FruCoRe_SurfaceLookupTypes.h: Fake BSP surfaces and cameras for the
+    surface lookup tests and benchmarks.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include "FruCoRe_SurfaceLookup.h"
+#include "FruCoRe_Tests.h"
+
+#include <math.h>
+#include <vector>
+
+//
+// A camera with the same conventions as FCoords: the axes are orthonormal,
+// and a world point transforms to camera space as ((P - Origin) | Axis)
+//
+struct FFakeCamera
+{
+    float Origin[3];
+    float Axes[3][3];
+
+    explicit FFakeCamera(FTestRandom& Random)
+    {
+        const double Yaw = Random.Range(0, 65535) * (2.0 * M_PI / 65536.0);
+        const double Pitch = (static_cast<int>(Random.Range(0, 32767)) - 16384) * (M_PI / 65536.0);
+        const double SY = sin(Yaw), CY = cos(Yaw), SP = sin(Pitch), CP = cos(Pitch);
+        const double Forward[3] = { CP * CY, CP * SY, SP };
+        const double Right[3] = { -SY, CY, 0.0 };
+        const double Up[3] = { -SP * CY, -SP * SY, CP };
+        for (int i = 0; i < 3; ++i)
+        {
+            Origin[i] = static_cast<float>(static_cast<int>(Random.Range(0, 65535)) - 32768) + Random.Range(0, 99) / 100.f;
+            Axes[0][i] = static_cast<float>(Right[i]);
+            Axes[1][i] = static_cast<float>(Up[i]);
+            Axes[2][i] = static_cast<float>(Forward[i]);
+        }
+    }
+
+    void ToCamera(const float* In, float* Out, bool bPoint) const
+    {
+        float Rel[3];
+        for (int i = 0; i < 3; ++i)
+            Rel[i] = In[i] - (bPoint ? Origin[i] : 0.f);
+        for (int i = 0; i < 3; ++i)
+            Out[i] = Rel[0] * Axes[i][0] + Rel[1] * Axes[i][1] + Rel[2] * Axes[i][2];
+    }
+
+    void ToWorld(const float* In, float* Out, bool bPoint) const
+    {
+        for (int i = 0; i < 3; ++i)
+            Out[i] = In[0] * Axes[0][i] + In[1] * Axes[1][i] + In[2] * Axes[2][i] + (bPoint ? Origin[i] : 0.f);
+    }
+
+    // What DrawComplexSurface reconstructs from a facet's camera-space texture mapping
+    FSurfaceMapping RoundTrip(const FSurfaceMapping& World) const
+    {
+        FSurfaceMapping Camera, Result;
+        ToCamera(World.Origin, Camera.Origin, true);
+        ToCamera(World.XAxis, Camera.XAxis, false);
+        ToCamera(World.YAxis, Camera.YAxis, false);
+        ToWorld(Camera.Origin, Result.Origin, true);
+        ToWorld(Camera.XAxis, Result.XAxis, false);
+        ToWorld(Camera.YAxis, Result.YAxis, false);
+        return Result;
+    }
+};
+
+//
+// Surfaces like the editor makes them: base points on the grid, and
+// texture axes along the world axes, scaled by the texture's DrawScale
+//
+inline FSurfaceMapping MakeFakeSurface(FTestRandom& Random)
+{
+    static const float Scales[] = { 0.25f, 0.5f, 1.f, 2.f };
+    FSurfaceMapping Mapping = {};
+    const int Normal = static_cast<int>(Random.Range(0, 2));
+    const int U = (Normal + 1) % 3;
+    const int V = (Normal + 2) % 3;
+    for (int i = 0; i < 3; ++i)
+        Mapping.Origin[i] = static_cast<float>(static_cast<int>(Random.Range(0, 4095)) - 2048) * 16.f;
+    Mapping.XAxis[U] = Scales[Random.Range(0, 3)];
+    Mapping.YAxis[V] = -Scales[Random.Range(0, 3)];
+    return Mapping;
+}
@@ -0,0 +1,172 @@
+/*=============================================================================
+    FruCoRe_TestAtlasPacker.cpp: Tests for FruCoRe_AtlasPacker.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_AtlasPacker.h"
+#include "FruCoRe_Tests.h"
+
+#include <vector>
+
+struct FPackedRect
+{
+    uint32_t X, Y, Width, Height;
+};
+
+// Checks that the padded rectangles stay on the page and never overlap
+static bool IsValidPacking(const FSkylinePacker& Packer, const std::vector<FPackedRect>& Rects)
+{
+    const uint32_t Padding = Packer.GetPadding();
+    std::vector<uint8_t> Coverage(Packer.GetWidth() * Packer.GetHeight(), 0);
+    for (const FPackedRect& Rect : Rects)
+    {
+        if (Rect.X < Padding || Rect.Y < Padding ||
+            Rect.X + Rect.Width + Padding > Packer.GetWidth() ||
+            Rect.Y + Rect.Height + Padding > Packer.GetHeight())
+            return false;
+
+        for (uint32_t Y = Rect.Y - Padding; Y < Rect.Y + Rect.Height + Padding; ++Y)
+            for (uint32_t X = Rect.X - Padding; X < Rect.X + Rect.Width + Padding; ++X)
+                if (Coverage[Y * Packer.GetWidth() + X]++)
+                    return false;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+    FSkylinePacker
+-----------------------------------------------------------------------------*/
+TEST(AtlasPacker, FillsRowsBottomLeft)
+{
+    FSkylinePacker Packer;
+    Packer.Init(64, 64, 0);
+
+    // Four 32x32 rects fill the page exactly
+    std::vector<FPackedRect> Rects;
+    for (int i = 0; i < 4; ++i)
+    {
+        FPackedRect Rect = { 0, 0, 32, 32 };
+        CHECK(Packer.Pack(Rect.Width, Rect.Height, Rect.X, Rect.Y));
+        Rects.push_back(Rect);
+    }
+    CHECK(Rects[0].X == 0 && Rects[0].Y == 0);
+    CHECK(Rects[1].X == 32 && Rects[1].Y == 0);
+    CHECK(IsValidPacking(Packer, Rects));
+    CHECK(Packer.GetOccupancy() == 1.f);
+
+    uint32_t X, Y;
+    CHECK(!Packer.Pack(1, 1, X, Y));
+    CHECK_EQ(Packer.GetNumRects(), 4);
+}
+
+TEST(AtlasPacker, AccountsForPadding)
+{
+    FSkylinePacker Packer;
+    Packer.Init(32, 32, 2);
+
+    uint32_t X, Y;
+    CHECK(!Packer.Pack(30, 4, X, Y));
+    CHECK(!Packer.Pack(0, 4, X, Y));
+    CHECK(Packer.Pack(28, 4, X, Y));
+    CHECK(X == 2 && Y == 2);
+    CHECK_EQ(Packer.GetUsedArea(), 32 * 8);
+
+    // The next rect starts below the first one's padding
+    CHECK(Packer.Pack(4, 4, X, Y));
+    CHECK(X == 2 && Y == 10);
+}
+
+TEST(AtlasPacker, ResetEmptiesThePage)
+{
+    FSkylinePacker Packer;
+    Packer.Init(16, 16, 1);
+
+    uint32_t X, Y;
+    while (Packer.Pack(6, 6, X, Y))
+        ;
+    CHECK(Packer.GetNumRects() > 0);
+
+    Packer.Reset();
+    CHECK_EQ(Packer.GetNumRects(), 0);
+    CHECK_EQ(Packer.GetUsedArea(), 0);
+    CHECK(Packer.Pack(14, 14, X, Y));
+}
+
+TEST(AtlasPacker, RandomizedPacking)
+{
+    FTestRandom Random;
+    for (int Round = 0; Round < 50; ++Round)
+    {
+        FSkylinePacker Packer;
+        Packer.Init(Random.Range(16, 256), Random.Range(16, 256), Random.Range(0, 2));
+
+        std::vector<FPackedRect> Rects;
+        uint64_t UsedArea = 0;
+        for (int i = 0; i < 200; ++i)
+        {
+            FPackedRect Rect = { 0, 0, Random.Range(1, 40), Random.Range(1, 40) };
+            if (!Packer.Pack(Rect.Width, Rect.Height, Rect.X, Rect.Y))
+                continue;
+            Rects.push_back(Rect);
+            UsedArea += static_cast<uint64_t>(Rect.Width + 2 * Packer.GetPadding()) * (Rect.Height + 2 * Packer.GetPadding());
+        }
+
+        CHECK(IsValidPacking(Packer, Rects));
+        CHECK_EQ(Packer.GetNumRects(), Rects.size());
+        CHECK_EQ(Packer.GetUsedArea(), UsedArea);
+        CHECK(Packer.GetOccupancy() <= 1.f);
+    }
+}
+
+TEST(AtlasPacker, LightMapOccupancy)
+{
+    // Typical lightmap sizes go from 1x1 up to a few dozen texels per side.
+    // The packer should fill most of a page before it gives up
+    FTestRandom Random;
+    FSkylinePacker Packer;
+    Packer.Init(1024, 1024, 1);
+
+    uint32_t X, Y;
+    int NumFailures = 0;
+    while (NumFailures < 16)
+    {
+        if (!Packer.Pack(Random.Range(1, 32), Random.Range(1, 32), X, Y))
+            NumFailures++;
+    }
+    CHECK(Packer.GetOccupancy() > 0.85f);
+}
+
+/*-----------------------------------------------------------------------------
+    PadImage
+-----------------------------------------------------------------------------*/
+TEST(AtlasPacker, PadImageReplicatesEdges)
+{
+    const uint32_t Src[] =
+    {
+        1, 2, 3,
+        4, 5, 6,
+    };
+    const uint32_t Expected[] =
+    {
+        1, 1, 1, 2, 3, 3, 3,
+        1, 1, 1, 2, 3, 3, 3,
+        1, 1, 1, 2, 3, 3, 3,
+        4, 4, 4, 5, 6, 6, 6,
+        4, 4, 4, 5, 6, 6, 6,
+        4, 4, 4, 5, 6, 6, 6,
+    };
+
+    uint32_t Dst[7 * 6];
+    PadImage(Src, 3, 2, 2, Dst);
+    for (int i = 0; i < 7 * 6; ++i)
+        CHECK_EQ(Dst[i], Expected[i]);
+
+    // No padding is a plain copy
+    uint32_t Copy[6];
+    PadImage(Src, 3, 2, 0, Copy);
+    for (int i = 0; i < 6; ++i)
+        CHECK_EQ(Copy[i], Src[i]);
+}
@@ -0,0 +1,182 @@
+/*=============================================================================
+    FruCoRe_TestCompression.cpp: Tests for FruCoRe_TextureCompression.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureCompression.h"
+
+#include <string.h>
+#include <vector>
+
+static uint32_t MakeTexel(uint32_t R, uint32_t G, uint32_t B, uint32_t A)
+{
+    return R | (G << 8) | (B << 16) | (A << 24);
+}
+
+// Smooth gradient with some noise, which is roughly what the stock textures look like
+static std::vector<uint32_t> MakeTestImage(FTestRandom& Random, uint32_t USize, uint32_t VSize, bool Masked)
+{
+    std::vector<uint32_t> Image(USize * VSize);
+    for (uint32_t Y = 0; Y < VSize; ++Y)
+    {
+        for (uint32_t X = 0; X < USize; ++X)
+        {
+            const uint32_t Noise = Random.Range(0, 7);
+            const uint32_t R = (X * 255 / USize + Noise) & 0xFF;
+            const uint32_t G = (Y * 255 / VSize + Noise) & 0xFF;
+            const uint32_t B = ((X + Y) * 127 / (USize + VSize) + 64) & 0xFF;
+            const uint32_t A = Masked && ((X / 8 + Y / 8) & 1) ? 0 : 255;
+            Image[Y * USize + X] = MakeTexel(R, G, B, A);
+        }
+    }
+    return Image;
+}
+
+/*-----------------------------------------------------------------------------
+    Single blocks
+-----------------------------------------------------------------------------*/
+TEST(Compression, SolidBlocksRoundTrip)
+{
+    // Colors that are exactly representable in RGB565
+    const uint32_t Colors[] = { MakeTexel(0, 0, 0, 255), MakeTexel(255, 255, 255, 255), MakeTexel(0xFF, 0x00, 0x00, 255), MakeTexel(0x84, 0x82, 0x84, 255) };
+    for (uint32_t Color : Colors)
+    {
+        uint32_t Texels[16];
+        for (uint32_t& Texel : Texels)
+            Texel = Color;
+
+        uint8_t BC1[BC1_BLOCK_BYTES], BC3[BC3_BLOCK_BYTES];
+        uint32_t Decoded[16];
+        EncodeBC1Block(Texels, BC1);
+        DecodeBC1Block(BC1, Decoded);
+        CHECK(memcmp(Texels, Decoded, sizeof(Texels)) == 0);
+
+        EncodeBC3Block(Texels, BC3);
+        DecodeBC3Block(BC3, Decoded);
+        CHECK(memcmp(Texels, Decoded, sizeof(Texels)) == 0);
+    }
+}
+
+TEST(Compression, BC3KeepsExtremeAlphaValues)
+{
+    FTestRandom Random;
+    for (int Round = 0; Round < 100; ++Round)
+    {
+        uint32_t Texels[16];
+        for (uint32_t& Texel : Texels)
+            Texel = (Random.Next() & 0x00FFFFFF) | (Random.Range(0, 1) ? 0xFF000000 : 0);
+
+        uint8_t Block[BC3_BLOCK_BYTES];
+        uint32_t Decoded[16];
+        EncodeBC3Block(Texels, Block);
+        DecodeBC3Block(Block, Decoded);
+
+        // Masked textures must stay exactly masked
+        for (int i = 0; i < 16; ++i)
+            CHECK_EQ(Decoded[i] >> 24, Texels[i] >> 24);
+    }
+}
+
+TEST(Compression, BC1DecodesOpaque)
+{
+    FTestRandom Random;
+    for (int Round = 0; Round < 100; ++Round)
+    {
+        uint32_t Texels[16];
+        for (uint32_t& Texel : Texels)
+            Texel = Random.Next() | 0xFF000000;
+
+        uint8_t Block[BC1_BLOCK_BYTES];
+        uint32_t Decoded[16];
+        EncodeBC1Block(Texels, Block);
+        DecodeBC1Block(Block, Decoded);
+        CHECK(!HasTranslucentTexels(Decoded, 16));
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    Whole images
+-----------------------------------------------------------------------------*/
+TEST(Compression, RowsMatchSingleBlocks)
+{
+    FTestRandom Random;
+    const uint32_t USize = 32, VSize = 16;
+    const std::vector<uint32_t> Image = MakeTestImage(Random, USize, VSize, true);
+
+    std::vector<uint8_t> Rows(USize / 4 * VSize / 4 * BC3_BLOCK_BYTES);
+    EncodeBC3Rows(Image.data(), USize, VSize, 0, VSize / 4, Rows.data());
+
+    for (uint32_t BlockY = 0; BlockY < VSize / 4; ++BlockY)
+    {
+        for (uint32_t BlockX = 0; BlockX < USize / 4; ++BlockX)
+        {
+            uint32_t Texels[16];
+            for (uint32_t i = 0; i < 16; ++i)
+                Texels[i] = Image[(BlockY * 4 + i / 4) * USize + BlockX * 4 + i % 4];
+
+            uint8_t Block[BC3_BLOCK_BYTES];
+            EncodeBC3Block(Texels, Block);
+            CHECK(memcmp(Block, &Rows[(BlockY * USize / 4 + BlockX) * BC3_BLOCK_BYTES], BC3_BLOCK_BYTES) == 0);
+        }
+    }
+}
+
+TEST(Compression, SplitRowsMatchWholeImage)
+{
+    FTestRandom Random;
+    const uint32_t USize = 64, VSize = 64;
+    const std::vector<uint32_t> Image = MakeTestImage(Random, USize, VSize, false);
+    const size_t Bytes = USize / 4 * VSize / 4 * BC1_BLOCK_BYTES;
+
+    std::vector<uint8_t> Whole(Bytes), Split(Bytes);
+    EncodeBC1Rows(Image.data(), USize, VSize, 0, VSize / 4, Whole.data());
+    EncodeBC1Rows(Image.data(), USize, VSize, 0, 5, Split.data());
+    EncodeBC1Rows(Image.data(), USize, VSize, 5, VSize / 4 - 5, Split.data());
+    CHECK(Whole == Split);
+}
+
+TEST(Compression, PadsPartialBlocks)
+{
+    // A 6x3 image needs 2x1 blocks. The padding replicates the edge texels, so
+    // a solid image stays solid
+    const uint32_t Color = MakeTexel(0xFF, 0x00, 0xFF, 255);
+    const std::vector<uint32_t> Image(6 * 3, Color);
+    std::vector<uint8_t> Encoded(2 * BC1_BLOCK_BYTES);
+    EncodeBC1Rows(Image.data(), 6, 3, 0, 1, Encoded.data());
+
+    std::vector<uint32_t> Decoded(6 * 3);
+    DecodeBC1Image(Encoded.data(), 6, 3, Decoded.data());
+    CHECK(Decoded == Image);
+}
+
+TEST(Compression, Quality)
+{
+    FTestRandom Random;
+    const uint32_t USize = 128, VSize = 128;
+    const std::vector<uint32_t> Image = MakeTestImage(Random, USize, VSize, true);
+    std::vector<uint8_t> Encoded(USize / 4 * VSize / 4 * BC3_BLOCK_BYTES);
+    std::vector<uint32_t> Decoded(USize * VSize);
+
+    CHECK(ComputePSNR(Image.data(), Image.data(), Image.size(), true) == 999.0);
+
+    EncodeBC1Rows(Image.data(), USize, VSize, 0, VSize / 4, Encoded.data());
+    DecodeBC1Image(Encoded.data(), USize, VSize, Decoded.data());
+    CHECK(ComputePSNR(Image.data(), Decoded.data(), Image.size(), false) > 35.0);
+
+    EncodeBC3Rows(Image.data(), USize, VSize, 0, VSize / 4, Encoded.data());
+    DecodeBC3Image(Encoded.data(), USize, VSize, Decoded.data());
+    CHECK(ComputePSNR(Image.data(), Decoded.data(), Image.size(), true) > 35.0);
+}
+
+TEST(Compression, HasTranslucentTexels)
+{
+    std::vector<uint32_t> Texels(37, 0xFF123456);
+    CHECK(!HasTranslucentTexels(Texels.data(), Texels.size()));
+    Texels[36] = 0xFE123456;
+    CHECK(HasTranslucentTexels(Texels.data(), Texels.size()));
+    CHECK(!HasTranslucentTexels(Texels.data(), 36));
+}
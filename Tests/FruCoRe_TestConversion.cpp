@@ -0,0 +1,308 @@
+/*=============================================================================
+    FruCoRe_TestConversion.cpp: Tests for FruCoRe_TextureConversion.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureConversion.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+static void MakeRandomPalette(FTestRandom& Random, uint32_t Palette[256])
+{
+    for (int i = 0; i < 256; ++i)
+        Palette[i] = Random.Next();
+}
+
+/*-----------------------------------------------------------------------------
+    Palette expansion
+-----------------------------------------------------------------------------*/
+TEST(Conversion, ExpandP8KernelsMatchScalar)
+{
+    FTestRandom Random;
+    uint32_t Palette[256];
+    MakeRandomPalette(Random, Palette);
+
+    // Odd counts and offsets exercise the scalar tails and unaligned accesses
+    const size_t Counts[] = { 0, 1, 15, 16, 17, 31, 64, 1000, 4096 + 7 };
+    std::vector<uint8_t> Src(8192 + 16);
+    for (uint8_t& Index : Src)
+        Index = static_cast<uint8_t>(Random.Next());
+
+    for (int Kernel = 0; Kernel < EXPANDP8_Max; ++Kernel)
+    {
+        ExpandP8Func Func = GetExpandP8Kernel(static_cast<EExpandP8Kernel>(Kernel));
+        if (!Func)
+            continue;
+
+        for (size_t Count : Counts)
+        {
+            for (size_t Offset = 0; Offset < 4; ++Offset)
+            {
+                std::vector<uint32_t> Expected(Count + 4, 0xDEADBEEF);
+                std::vector<uint32_t> Actual(Count + 4, 0xDEADBEEF);
+                ExpandP8Scalar(Palette, Src.data() + Offset, Expected.data() + Offset, Count);
+                Func(Palette, Src.data() + Offset, Actual.data() + Offset, Count);
+                CHECK(Expected == Actual);
+            }
+        }
+    }
+}
+
+TEST(Conversion, BestKernelIsSupported)
+{
+    const EExpandP8Kernel Best = GetBestExpandP8Kernel();
+    CHECK(GetExpandP8Kernel(Best) != nullptr);
+    CHECK(GetExpandP8KernelName(Best) != nullptr);
+    CHECK(GetExpandP8Kernel(EXPANDP8_Scalar) != nullptr);
+}
+
+/*-----------------------------------------------------------------------------
+    Paletted sampling. The paletted upload path must look exactly like
+    sampling the texture P8ToRGBA8 would have produced, including the
+    transparent palette entry 0 of masked textures.
+-----------------------------------------------------------------------------*/
+
+// Expands @Indices the way P8ToRGBA8 does
+static std::vector<uint32_t> ExpandLikeP8ToRGBA8(const std::vector<uint8_t>& Indices, const uint32_t Palette[256], bool Masked)
+{
+    uint32_t LocalPalette[256];
+    memcpy(LocalPalette, Palette, sizeof(LocalPalette));
+    if (Masked)
+        LocalPalette[0] = 0;
+
+    std::vector<uint32_t> Result(Indices.size());
+    ExpandP8(LocalPalette, Indices.data(), Result.data(), Indices.size());
+    return Result;
+}
+
+// What the GPU returns for a repeat or clamp-to-edge addressed RGBA8Unorm texture
+static void SampleRGBA8(const std::vector<uint32_t>& Texels, int USize, int VSize, bool Bilinear, bool Clamp, float U, float V, float Out[4])
+{
+    auto Fetch = [&](int X, int Y, int Channel)
+    {
+        X = Clamp ? std::min(std::max(X, 0), USize - 1) : ((X % USize) + USize) % USize;
+        Y = Clamp ? std::min(std::max(Y, 0), VSize - 1) : ((Y % VSize) + VSize) % VSize;
+        return ((Texels[Y * USize + X] >> (8 * Channel)) & 0xFF) / 255.f;
+    };
+
+    const float X = U * USize;
+    const float Y = V * VSize;
+    for (int c = 0; c < 4; ++c)
+    {
+        if (!Bilinear)
+        {
+            Out[c] = Fetch(static_cast<int>(floorf(X)), static_cast<int>(floorf(Y)), c);
+            continue;
+        }
+
+        const int X0 = static_cast<int>(floorf(X - 0.5f));
+        const int Y0 = static_cast<int>(floorf(Y - 0.5f));
+        const float FX = (X - 0.5f) - floorf(X - 0.5f);
+        const float FY = (Y - 0.5f) - floorf(Y - 0.5f);
+        const float Top    = Fetch(X0, Y0, c) * (1.f - FX) + Fetch(X0 + 1, Y0, c) * FX;
+        const float Bottom = Fetch(X0, Y0 + 1, c) * (1.f - FX) + Fetch(X0 + 1, Y0 + 1, c) * FX;
+        Out[c] = Top * (1.f - FY) + Bottom * FY;
+    }
+}
+
+TEST(Conversion, SamplePalettedMatchesExpandedTexture)
+{
+    FTestRandom Random;
+    uint32_t Palette[256];
+    MakeRandomPalette(Random, Palette);
+
+    const int USize = 16, VSize = 8;
+    std::vector<uint8_t> Indices(USize * VSize);
+    for (uint8_t& Index : Indices)
+        Index = static_cast<uint8_t>(Random.Range(0, 3) == 0 ? 0 : Random.Next()); // Plenty of masked texels
+
+    for (int Masked = 0; Masked < 2; ++Masked)
+    {
+        const std::vector<uint32_t> Expanded = ExpandLikeP8ToRGBA8(Indices, Palette, Masked != 0);
+        for (int Mode = 0; Mode < 4; ++Mode)
+        {
+            const bool Bilinear = (Mode & 1) != 0;
+            const bool Clamp = (Mode & 2) != 0;
+            float MaxError = 0.f;
+            for (int i = 0; i < 2000; ++i)
+            {
+                // Includes coordinates outside [0, 1) to test the addressing
+                const float U = static_cast<float>(Random.Range(0, 4000)) / 1000.f - 1.5f;
+                const float V = static_cast<float>(Random.Range(0, 4000)) / 1000.f - 1.5f;
+
+                float Expected[4], Actual[4];
+                SampleRGBA8(Expanded, USize, VSize, Bilinear, Clamp, U, V, Expected);
+                SamplePalettedReference(Indices.data(), USize, VSize, Palette, Masked != 0, Bilinear, Clamp, U, V, Actual);
+                for (int c = 0; c < 4; ++c)
+                    MaxError = fmaxf(MaxError, fabsf(Expected[c] - Actual[c]));
+            }
+            CHECK(MaxError < 1e-5f);
+        }
+    }
+}
+
+TEST(Conversion, SamplePalettedMasksIndexZero)
+{
+    uint32_t Palette[256];
+    for (int i = 0; i < 256; ++i)
+        Palette[i] = 0xFF000000u | (i * 0x010101u);
+
+    // A 2x1 texture with a masked texel on the left
+    const uint8_t Indices[2] = { 0, 200 };
+    float Color[4];
+
+    SamplePalettedReference(Indices, 2, 1, Palette, true, false, false, 0.25f, 0.5f, Color);
+    CHECK(Color[0] == 0.f && Color[3] == 0.f);
+
+    SamplePalettedReference(Indices, 2, 1, Palette, false, false, false, 0.25f, 0.5f, Color);
+    CHECK(Color[0] == 0.f && Color[3] == 1.f);
+
+    // Halfway between the two texel centers, the masked texel contributes
+    // black at zero alpha, just like it does in the expanded texture
+    SamplePalettedReference(Indices, 2, 1, Palette, true, true, false, 0.5f, 0.5f, Color);
+    CHECK(fabsf(Color[0] - 100.f / 255.f) < 1e-6f);
+    CHECK(fabsf(Color[3] - 0.5f) < 1e-6f);
+
+    SamplePalettedReference(Indices, 2, 1, Palette, true, false, false, 0.75f, 0.5f, Color);
+    CHECK(fabsf(Color[0] - 200.f / 255.f) < 1e-6f && Color[3] == 1.f);
+}
+
+TEST(Conversion, SamplePalettedClampDoesNotBleed)
+{
+    uint32_t Palette[256];
+    for (int i = 0; i < 256; ++i)
+        Palette[i] = 0xFF000000u | (i * 0x010101u);
+
+    // A font glyph: opaque on the right edge, masked on the left edge
+    const uint8_t Indices[2] = { 0, 200 };
+    float Color[4];
+
+    // Right next to the right edge, repeat addressing pulls in the masked
+    // texel from the other side. Clamping does not
+    SamplePalettedReference(Indices, 2, 1, Palette, true, true, false, 0.99f, 0.5f, Color);
+    CHECK(Color[3] < 1.f);
+    SamplePalettedReference(Indices, 2, 1, Palette, true, true, true, 0.99f, 0.5f, Color);
+    CHECK(fabsf(Color[0] - 200.f / 255.f) < 1e-6f && Color[3] == 1.f);
+
+    // Nearest filtering outside [0, 1) sticks to the edge texel
+    SamplePalettedReference(Indices, 2, 1, Palette, true, false, true, 1.3f, 0.5f, Color);
+    CHECK(fabsf(Color[0] - 200.f / 255.f) < 1e-6f && Color[3] == 1.f);
+    SamplePalettedReference(Indices, 2, 1, Palette, true, false, false, 1.3f, 0.5f, Color);
+    CHECK(Color[3] == 0.f);
+}
+
+/*-----------------------------------------------------------------------------
+    Dirty region tracking for realtime P8 textures
+-----------------------------------------------------------------------------*/
+
+// Every texel that differs between @Before and @After must be inside a rect
+static bool RectsCoverChanges(const std::vector<uint8_t>& Before, const std::vector<uint8_t>& After, uint32_t USize, uint32_t VSize, const FDirtyRect* Rects, size_t NumRects)
+{
+    for (uint32_t Y = 0; Y < VSize; ++Y)
+    {
+        for (uint32_t X = 0; X < USize; ++X)
+        {
+            if (Before[Y * USize + X] == After[Y * USize + X])
+                continue;
+
+            bool bCovered = false;
+            for (size_t i = 0; i < NumRects && !bCovered; ++i)
+                bCovered = X >= Rects[i].X && X < Rects[i].X + Rects[i].Width && Y >= Rects[i].Y && Y < Rects[i].Y + Rects[i].Height;
+            if (!bCovered)
+                return false;
+        }
+    }
+    return true;
+}
+
+TEST(Conversion, DiffP8RowsUnchanged)
+{
+    std::vector<uint8_t> Src(64 * 32, 7);
+    std::vector<uint8_t> Shadow = Src;
+    FDirtyRect Rects[4];
+    uint64_t DirtyTexels = 1;
+    CHECK_EQ(DiffP8Rows(Src.data(), Shadow.data(), 64, 32, Rects, 4, &DirtyTexels), 0);
+    CHECK_EQ(DirtyTexels, 0);
+}
+
+TEST(Conversion, DiffP8RowsMergesBands)
+{
+    const uint32_t USize = 64, VSize = 32;
+    std::vector<uint8_t> Shadow(USize * VSize, 0);
+    std::vector<uint8_t> Src = Shadow;
+
+    // Two bands of changed rows, separated by unchanged rows
+    Src[3 * USize + 10] = 1;
+    Src[4 * USize + 20] = 1;
+    Src[20 * USize + 63] = 1;
+
+    FDirtyRect Rects[4];
+    uint64_t DirtyTexels = 0;
+    const std::vector<uint8_t> Before = Shadow;
+    CHECK_EQ(DiffP8Rows(Src.data(), Shadow.data(), USize, VSize, Rects, 4, &DirtyTexels), 2);
+    CHECK(Rects[0].X == 10 && Rects[0].Y == 3 && Rects[0].Width == 11 && Rects[0].Height == 2);
+    CHECK(Rects[1].X == 63 && Rects[1].Y == 20 && Rects[1].Width == 1 && Rects[1].Height == 1);
+    CHECK_EQ(DirtyTexels, 11 * 2 + 1);
+
+    // The shadow copy is now up to date
+    CHECK(Shadow == Src);
+    CHECK(RectsCoverChanges(Before, Src, USize, VSize, Rects, 2));
+}
+
+TEST(Conversion, DiffP8RowsRandomized)
+{
+    FTestRandom Random;
+    for (int Round = 0; Round < 200; ++Round)
+    {
+        const uint32_t USize = Random.Range(1, 96);
+        const uint32_t VSize = Random.Range(1, 64);
+        std::vector<uint8_t> Shadow(USize * VSize);
+        for (uint8_t& Index : Shadow)
+            Index = static_cast<uint8_t>(Random.Next());
+
+        std::vector<uint8_t> Src = Shadow;
+        const uint32_t NumChanges = Random.Range(0, 20);
+        for (uint32_t i = 0; i < NumChanges; ++i)
+            Src[Random.Range(0, USize * VSize - 1)] ^= static_cast<uint8_t>(Random.Range(1, 255));
+
+        // Includes rect counts small enough to force merging
+        const size_t MaxRects = Random.Range(1, 8);
+        FDirtyRect Rects[8];
+        const std::vector<uint8_t> Before = Shadow;
+        const size_t NumRects = DiffP8Rows(Src.data(), Shadow.data(), USize, VSize, Rects, MaxRects, nullptr);
+
+        CHECK(NumRects <= MaxRects);
+        CHECK(Shadow == Src);
+        CHECK(RectsCoverChanges(Before, Src, USize, VSize, Rects, NumRects));
+        for (size_t i = 0; i < NumRects; ++i)
+            CHECK(Rects[i].X + Rects[i].Width <= USize && Rects[i].Y + Rects[i].Height <= VSize);
+    }
+}
+
+TEST(Conversion, ExpandP8RectMatchesFullExpansion)
+{
+    FTestRandom Random;
+    uint32_t Palette[256];
+    MakeRandomPalette(Random, Palette);
+
+    const uint32_t USize = 40, VSize = 24;
+    std::vector<uint8_t> Src(USize * VSize);
+    for (uint8_t& Index : Src)
+        Index = static_cast<uint8_t>(Random.Next());
+    std::vector<uint32_t> Full(USize * VSize);
+    ExpandP8Scalar(Palette, Src.data(), Full.data(), Full.size());
+
+    const FDirtyRect Rect = { 3, 5, 21, 7 };
+    std::vector<uint32_t> Packed(Rect.Width * Rect.Height);
+    ExpandP8Rect(Palette, Src.data(), USize, Rect, Packed.data());
+    for (uint32_t Y = 0; Y < Rect.Height; ++Y)
+        for (uint32_t X = 0; X < Rect.Width; ++X)
+            CHECK_EQ(Packed[Y * Rect.Width + X], Full[(Rect.Y + Y) * USize + Rect.X + X]);
+}
@@ -0,0 +1,323 @@
+/*=============================================================================
+    FruCoRe_TestDiskCache.cpp: Tests for FruCoRe_DiskCache.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_DiskCache.h"
+#include "FruCoRe_TextureCache.h"
+#include "FruCoRe_Tests.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+//
+// A cache file in the temp directory that is deleted when the test ends
+//
+struct FTempCacheFile
+{
+    std::string Path;
+
+    FTempCacheFile()
+    {
+        char Template[] = "/tmp/FruCoReDiskCacheXXXXXX";
+        const int File = mkstemp(Template);
+        if (File >= 0)
+            close(File);
+        unlink(Template);
+        Path = Template;
+    }
+
+    ~FTempCacheFile()
+    {
+        unlink(Path.c_str());
+        unlink((Path + ".tmp").c_str());
+    }
+
+    std::vector<uint8_t> Read() const
+    {
+        std::vector<uint8_t> Result;
+        if (FILE* File = fopen(Path.c_str(), "rb"))
+        {
+            uint8_t Buffer[4096];
+            size_t Bytes;
+            while ((Bytes = fread(Buffer, 1, sizeof(Buffer), File)) > 0)
+                Result.insert(Result.end(), Buffer, Buffer + Bytes);
+            fclose(File);
+        }
+        return Result;
+    }
+
+    void Write(const std::vector<uint8_t>& Data) const
+    {
+        if (FILE* File = fopen(Path.c_str(), "wb"))
+        {
+            fwrite(Data.data(), 1, Data.size(), File);
+            fclose(File);
+        }
+    }
+};
+
+static std::vector<uint8_t> MakeEntryData(FTestRandom& Random, size_t Size)
+{
+    std::vector<uint8_t> Data(Size);
+    for (uint8_t& Byte : Data)
+        Byte = static_cast<uint8_t>(Random.Next());
+    return Data;
+}
+
+static bool FindMatches(FTextureDiskCache& Cache, uint64_t Key, const std::vector<uint8_t>& Data)
+{
+    const uint8_t* Found = Cache.Find(Key, Data.size());
+    return Found && memcmp(Found, Data.data(), Data.size()) == 0;
+}
+
+// Saves entries 1, 2 and 3 with 1000, 2000 and 3000 bytes of data
+static void SaveThreeEntries(const FTempCacheFile& File, std::vector<uint8_t> (&Data)[3])
+{
+    FTestRandom Random;
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    for (int i = 0; i < 3; ++i)
+    {
+        Data[i] = MakeEntryData(Random, (i + 1) * 1000);
+        Cache.Add(i + 1, Data[i].data(), Data[i].size());
+    }
+    Cache.Save();
+}
+
+static FDiskCacheEntry* GetEntryTable(std::vector<uint8_t>& File)
+{
+    return reinterpret_cast<FDiskCacheEntry*>(File.data() + sizeof(FDiskCacheHeader));
+}
+
+static void UpdateTableChecksum(std::vector<uint8_t>& File)
+{
+    FDiskCacheHeader* Header = reinterpret_cast<FDiskCacheHeader*>(File.data());
+    Header->TableChecksum = HashBytes64(GetEntryTable(File), Header->NumEntries * sizeof(FDiskCacheEntry));
+}
+
+/*-----------------------------------------------------------------------------
+    Round trip
+-----------------------------------------------------------------------------*/
+TEST(DiskCache, SavedEntriesSurviveReopening)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 3u);
+    for (int i = 0; i < 3; ++i)
+        CHECK(FindMatches(Cache, i + 1, Data[i]));
+
+    // Keys and sizes must both match
+    CHECK(Cache.Find(4, 1000) == nullptr);
+    CHECK(Cache.Find(1, 999) == nullptr);
+    CHECK_EQ(Cache.GetStats().NumHits, 3u);
+    CHECK_EQ(Cache.GetStats().NumMisses, 2u);
+    CHECK_EQ(Cache.Verify(), 0u);
+
+    // New entries are visible before we save them
+    FTestRandom Random(7);
+    const std::vector<uint8_t> Extra = MakeEntryData(Random, 500);
+    Cache.Add(10, Extra.data(), Extra.size());
+    CHECK(FindMatches(Cache, 10, Extra));
+    CHECK(Cache.Save());
+    Cache.Close();
+
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 4u);
+    CHECK(FindMatches(Cache, 10, Extra));
+    CHECK(FindMatches(Cache, 2, Data[1]));
+
+    // Entry data is 16-byte aligned
+    std::vector<uint8_t> Bytes = File.Read();
+    for (uint64_t i = 0; i < 4; ++i)
+        CHECK_EQ(GetEntryTable(Bytes)[i].Offset % 16, 0u);
+}
+
+/*-----------------------------------------------------------------------------
+    File validation
+-----------------------------------------------------------------------------*/
+static void CheckRejected(const FTempCacheFile& File, const std::vector<uint8_t>& Bytes)
+{
+    File.Write(Bytes);
+
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 0u);
+    CHECK_EQ(Cache.GetStats().NumCorruptEntries, 1u);
+    CHECK(Cache.Find(1, 1000) == nullptr);
+    CHECK(!FTextureDiskCache::Inspect(File.Path.c_str(), false, [](const char*, void*) {}, nullptr));
+}
+
+TEST(DiskCache, RejectsBadHeaders)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+    const std::vector<uint8_t> Good = File.Read();
+    CHECK(FTextureDiskCache::Inspect(File.Path.c_str(), false, [](const char*, void*) {}, nullptr));
+
+    std::vector<uint8_t> Bytes = Good;
+    reinterpret_cast<FDiskCacheHeader*>(Bytes.data())->Magic ^= 1;
+    CheckRejected(File, Bytes);
+
+    Bytes = Good;
+    reinterpret_cast<FDiskCacheHeader*>(Bytes.data())->Version++;
+    CheckRejected(File, Bytes);
+
+    // Truncated files
+    Bytes = Good;
+    Bytes.resize(Bytes.size() - 1);
+    CheckRejected(File, Bytes);
+
+    Bytes.resize(sizeof(FDiskCacheHeader) - 1);
+    CheckRejected(File, Bytes);
+}
+
+TEST(DiskCache, RejectsBadEntryTables)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+    const std::vector<uint8_t> Good = File.Read();
+
+    // Any change to the table breaks its checksum
+    std::vector<uint8_t> Bytes = Good;
+    GetEntryTable(Bytes)[1].Size--;
+    CheckRejected(File, Bytes);
+
+    // Tables that pass the checksum but point outside the file
+    Bytes = Good;
+    GetEntryTable(Bytes)[2].Offset = Bytes.size();
+    GetEntryTable(Bytes)[2].Size = 1;
+    UpdateTableChecksum(Bytes);
+    CheckRejected(File, Bytes);
+
+    Bytes = Good;
+    GetEntryTable(Bytes)[2].Size = UINT64_MAX;
+    UpdateTableChecksum(Bytes);
+    CheckRejected(File, Bytes);
+
+    // Or into the table itself
+    Bytes = Good;
+    GetEntryTable(Bytes)[0].Offset = 0;
+    UpdateTableChecksum(Bytes);
+    CheckRejected(File, Bytes);
+
+    // Find relies on the table being sorted
+    Bytes = Good;
+    std::swap(GetEntryTable(Bytes)[0], GetEntryTable(Bytes)[1]);
+    UpdateTableChecksum(Bytes);
+    CheckRejected(File, Bytes);
+}
+
+/*-----------------------------------------------------------------------------
+    Entry validation
+-----------------------------------------------------------------------------*/
+TEST(DiskCache, RejectsCorruptEntries)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+
+    // Flip one byte of entry 2's data
+    std::vector<uint8_t> Bytes = File.Read();
+    Bytes[GetEntryTable(Bytes)[1].Offset + 123] ^= 0x40;
+    File.Write(Bytes);
+    CHECK(!FTextureDiskCache::Inspect(File.Path.c_str(), false, [](const char*, void*) {}, nullptr));
+
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 3u);
+    CHECK(Cache.Find(2, Data[1].size()) == nullptr);
+    CHECK_EQ(Cache.GetStats().NumCorruptEntries, 1u);
+
+    // We only count it once
+    CHECK(Cache.Find(2, Data[1].size()) == nullptr);
+    CHECK_EQ(Cache.GetStats().NumCorruptEntries, 1u);
+    CHECK(FindMatches(Cache, 1, Data[0]));
+    CHECK(FindMatches(Cache, 3, Data[2]));
+
+    // Saving drops the corrupt entry
+    CHECK(Cache.Save());
+    Cache.Close();
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 2u);
+    CHECK(FTextureDiskCache::Inspect(File.Path.c_str(), false, [](const char*, void*) {}, nullptr));
+}
+
+TEST(DiskCache, VerifyFindsUnusedCorruptEntries)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+
+    std::vector<uint8_t> Bytes = File.Read();
+    Bytes[GetEntryTable(Bytes)[2].Offset] ^= 1;
+    File.Write(Bytes);
+
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.Verify(), 1u);
+    CHECK_EQ(Cache.GetStats().NumCorruptEntries, 1u);
+    CHECK(Cache.Find(3, Data[2].size()) == nullptr);
+    CHECK(Cache.Save());
+    Cache.Close();
+
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 2u);
+    CHECK_EQ(Cache.Verify(), 0u);
+}
+
+/*-----------------------------------------------------------------------------
+    Size limit
+-----------------------------------------------------------------------------*/
+TEST(DiskCache, AddRespectsMaxBytes)
+{
+    FTempCacheFile File;
+    FTestRandom Random;
+    const std::vector<uint8_t> Data = MakeEntryData(Random, 1000);
+
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), 2500);
+    Cache.Add(1, Data.data(), Data.size());
+    Cache.Add(2, Data.data(), Data.size());
+    Cache.Add(3, Data.data(), Data.size());
+    CHECK_EQ(Cache.GetStats().NumPendingEntries, 2u);
+    CHECK_EQ(Cache.GetStats().PendingBytes, 2000u);
+    CHECK(Cache.Find(3, Data.size()) == nullptr);
+
+    // Adding the same key twice keeps the first copy
+    Cache.Add(1, Data.data(), 10);
+    CHECK_EQ(Cache.GetStats().NumPendingEntries, 2u);
+    CHECK(Cache.Find(1, 10) == nullptr);
+}
+
+TEST(DiskCache, SaveRespectsMaxBytes)
+{
+    FTempCacheFile File;
+    std::vector<uint8_t> Data[3];
+    SaveThreeEntries(File, Data);
+
+    // Entries we've used this session win over the others
+    FTextureDiskCache Cache;
+    Cache.Open(File.Path.c_str(), 4500);
+    CHECK(FindMatches(Cache, 3, Data[2]));
+    CHECK(Cache.Save());
+    Cache.Close();
+
+    Cache.Open(File.Path.c_str(), UINT64_MAX);
+    CHECK_EQ(Cache.GetStats().NumMappedEntries, 2u);
+    CHECK(FindMatches(Cache, 3, Data[2]));
+    CHECK(FindMatches(Cache, 1, Data[0]));
+    CHECK(Cache.Find(2, Data[1].size()) == nullptr);
+}
@@ -0,0 +1,128 @@
+/*=============================================================================
+    FruCoRe_TestDrawBatching.cpp: Tests for FruCoRe_DrawBatching.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_DrawBatching.h"
+#include "FruCoRe_Tests.h"
+
+// Same fields as MultiDrawIndirectBuffer::DrawCommand
+struct FFakeDrawCommand
+{
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t vertexStart;
+    uint32_t baseInstance;
+    uint32_t indexCount;
+    uint32_t indexStart;
+};
+
+static FFakeDrawCommand MakeIndexed(uint32_t IndexStart, uint32_t IndexCount, uint32_t VertexCount, uint32_t BaseInstance)
+{
+    return FFakeDrawCommand{ VertexCount, 1, 0, BaseInstance, IndexCount, IndexStart };
+}
+
+static FFakeDrawCommand MakeNonIndexed(uint32_t VertexStart, uint32_t VertexCount, uint32_t BaseInstance)
+{
+    return FFakeDrawCommand{ VertexCount, 1, VertexStart, BaseInstance, 0, 0 };
+}
+
+TEST(DrawBatching, MergesAdjacentIndexedDraws)
+{
+    FFakeDrawCommand Prev = MakeIndexed(0, 12, 6, 0);
+    CHECK(MergeDrawCommands(Prev, MakeIndexed(12, 9, 5, 1)));
+    CHECK_EQ(Prev.indexStart, 0u);
+    CHECK_EQ(Prev.indexCount, 21u);
+    CHECK_EQ(Prev.vertexCount, 11u);
+    CHECK_EQ(Prev.instanceCount, 1u);
+    CHECK_EQ(Prev.baseInstance, 0u);
+}
+
+TEST(DrawBatching, MergesAdjacentNonIndexedDraws)
+{
+    FFakeDrawCommand Prev = MakeNonIndexed(30, 3, 4);
+    CHECK(MergeDrawCommands(Prev, MakeNonIndexed(33, 6, 5)));
+    CHECK_EQ(Prev.vertexStart, 30u);
+    CHECK_EQ(Prev.vertexCount, 9u);
+    CHECK_EQ(Prev.indexCount, 0u);
+    CHECK_EQ(Prev.baseInstance, 4u);
+}
+
+TEST(DrawBatching, KeepsSeparatedDraws)
+{
+    FFakeDrawCommand Indexed = MakeIndexed(0, 12, 6, 0);
+    const FFakeDrawCommand IndexedCopy = Indexed;
+    CHECK(!MergeDrawCommands(Indexed, MakeIndexed(13, 9, 5, 1)));
+    CHECK(!MergeDrawCommands(Indexed, MakeIndexed(0, 12, 6, 1)));
+    CHECK_EQ(Indexed.indexCount, IndexedCopy.indexCount);
+    CHECK_EQ(Indexed.vertexCount, IndexedCopy.vertexCount);
+
+    FFakeDrawCommand NonIndexed = MakeNonIndexed(30, 3, 0);
+    CHECK(!MergeDrawCommands(NonIndexed, MakeNonIndexed(34, 3, 1)));
+    CHECK(!MergeDrawCommands(NonIndexed, MakeNonIndexed(27, 3, 1)));
+    CHECK_EQ(NonIndexed.vertexCount, 3u);
+}
+
+TEST(DrawBatching, KeepsMixedDraws)
+{
+    FFakeDrawCommand Indexed = MakeIndexed(0, 12, 6, 0);
+    CHECK(!MergeDrawCommands(Indexed, MakeNonIndexed(6, 3, 1)));
+    CHECK_EQ(Indexed.vertexCount, 6u);
+
+    FFakeDrawCommand NonIndexed = MakeNonIndexed(0, 3, 0);
+    CHECK(!MergeDrawCommands(NonIndexed, MakeIndexed(0, 3, 3, 1)));
+    CHECK_EQ(NonIndexed.indexCount, 0u);
+}
+
+TEST(DrawBatching, KeepsInstancedDraws)
+{
+    FFakeDrawCommand Instanced = MakeNonIndexed(0, 6, 0);
+    Instanced.instanceCount = 4;
+    CHECK(!MergeDrawCommands(Instanced, MakeNonIndexed(6, 6, 4)));
+    CHECK_EQ(Instanced.vertexCount, 6u);
+
+    FFakeDrawCommand Single = MakeNonIndexed(0, 6, 0);
+    FFakeDrawCommand NextInstanced = MakeNonIndexed(6, 6, 1);
+    NextInstanced.instanceCount = 2;
+    CHECK(!MergeDrawCommands(Single, NextInstanced));
+    CHECK_EQ(Single.vertexCount, 6u);
+}
+
+TEST(DrawBatching, EmptyDrawsMergeWithAnything)
+{
+    FFakeDrawCommand Prev = MakeIndexed(0, 12, 6, 0);
+    CHECK(MergeDrawCommands(Prev, MakeNonIndexed(100, 0, 3)));
+    CHECK_EQ(Prev.indexCount, 12u);
+    CHECK_EQ(Prev.vertexCount, 6u);
+    CHECK_EQ(Prev.baseInstance, 0u);
+
+    FFakeDrawCommand Empty = MakeNonIndexed(0, 0, 0);
+    CHECK(MergeDrawCommands(Empty, MakeIndexed(24, 9, 5, 7)));
+    CHECK_EQ(Empty.indexStart, 24u);
+    CHECK_EQ(Empty.indexCount, 9u);
+    CHECK_EQ(Empty.vertexCount, 5u);
+    CHECK_EQ(Empty.baseInstance, 7u);
+}
+
+TEST(DrawBatching, MergesRunsOfDraws)
+{
+    // One native draw for a run of facets that each have their own instance data
+    FTestRandom Random;
+    FFakeDrawCommand Prev = {};
+    uint32_t NextIndex = 0, NextVertex = 0;
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        const uint32_t NumVertices = Random.Range(3, 16);
+        const uint32_t NumIndices = (NumVertices - 2) * 3;
+        CHECK(MergeDrawCommands(Prev, MakeIndexed(NextIndex, NumIndices, NumVertices, i)));
+        NextIndex += NumIndices;
+        NextVertex += NumVertices;
+    }
+    CHECK_EQ(Prev.indexStart, 0u);
+    CHECK_EQ(Prev.indexCount, NextIndex);
+    CHECK_EQ(Prev.vertexCount, NextVertex);
+    CHECK_EQ(Prev.baseInstance, 0u);
+}
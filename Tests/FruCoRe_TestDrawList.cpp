@@ -0,0 +1,114 @@
+/*=============================================================================
+    FruCoRe_TestDrawList.cpp: Tests for FruCoRe_DrawList.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_DrawList.h"
+#include "FruCoRe_Tests.h"
+
+struct FFakeDraw
+{
+    int Id;
+};
+
+/*-----------------------------------------------------------------------------
+    Sort keys
+-----------------------------------------------------------------------------*/
+TEST(DrawList, KeyFieldsFillAllBits)
+{
+    CHECK_EQ(DRAWKEY_PROGRAM_BITS + DRAWKEY_PIPELINE_BITS + DRAWKEY_DEPTH_BITS + DRAWKEY_DIFFUSE_BITS +
+             DRAWKEY_LIGHTMAP_BITS + DRAWKEY_FOGMAP_BITS + DRAWKEY_DETAIL_BITS + DRAWKEY_MACRO_BITS, 64);
+
+    const void* NoTextures[DRAWKEY_NUM_TEXTURES] = {};
+    CHECK_EQ(MakeDrawSortKey(0, nullptr, 0, NoTextures), 0ull);
+    CHECK_EQ(MakeDrawSortKey(7, nullptr, 0, NoTextures), 7ull << 61);
+    CHECK_EQ(MakeDrawSortKey(0, nullptr, 3, NoTextures), 3ull << 45);
+}
+
+TEST(DrawList, NullPointersHashToZero)
+{
+    FTestRandom Random;
+    CHECK_EQ(HashDrawKeyPointer(nullptr, 15), 0ull);
+    for (int i = 0; i < 10000; ++i)
+    {
+        const uintptr_t Address = (static_cast<uintptr_t>(Random.Next()) << 4) | 16;
+        const uint64_t Hash = HashDrawKeyPointer(reinterpret_cast<const void*>(Address), 6);
+        CHECK(Hash != 0);
+        CHECK(Hash < 64);
+    }
+}
+
+TEST(DrawList, TexturesOnlyAffectTheirOwnField)
+{
+    int Objects[DRAWKEY_NUM_TEXTURES + 1];
+    const uint32_t Bits[DRAWKEY_NUM_TEXTURES] = { DRAWKEY_DIFFUSE_BITS, DRAWKEY_LIGHTMAP_BITS, DRAWKEY_FOGMAP_BITS, DRAWKEY_DETAIL_BITS, DRAWKEY_MACRO_BITS };
+
+    uint32_t Shift = 0;
+    for (int Slot = DRAWKEY_NUM_TEXTURES - 1; Slot >= 0; --Slot)
+    {
+        const void* Textures[DRAWKEY_NUM_TEXTURES] = {};
+        Textures[Slot] = &Objects[Slot];
+        const uint64_t Key = MakeDrawSortKey(0, nullptr, 0, Textures);
+        CHECK_EQ(Key, HashDrawKeyPointer(&Objects[Slot], Bits[Slot]) << Shift);
+        Shift += Bits[Slot];
+    }
+
+    // The program outranks everything below it
+    const void* AllTextures[DRAWKEY_NUM_TEXTURES] = { &Objects[0], &Objects[1], &Objects[2], &Objects[3], &Objects[4] };
+    const void* NoTextures[DRAWKEY_NUM_TEXTURES] = {};
+    CHECK(MakeDrawSortKey(1, nullptr, 0, NoTextures) > MakeDrawSortKey(0, &Objects[5], 3, AllTextures));
+}
+
+/*-----------------------------------------------------------------------------
+    Deferred draw list
+-----------------------------------------------------------------------------*/
+TEST(DrawList, SortsByKeyAndKeepsEngineOrder)
+{
+    FTestRandom Random;
+    TDeferredDrawList<FFakeDraw> List;
+    const int NumDraws = 5000;
+    for (int i = 0; i < NumDraws; ++i)
+        List.Add(Random.Range(0, 15)).Id = i;
+    CHECK_EQ(List.Num(), static_cast<size_t>(NumDraws));
+
+    List.Sort();
+    for (size_t i = 1; i < List.Num(); ++i)
+    {
+        CHECK(List.GetKey(i - 1) <= List.GetKey(i));
+        if (List.GetKey(i - 1) == List.GetKey(i))
+            CHECK(List[i - 1].Id < List[i].Id);
+    }
+}
+
+TEST(DrawList, AddAfterSortSortsAgain)
+{
+    TDeferredDrawList<FFakeDraw> List;
+    List.Add(5).Id = 0;
+    List.Add(1).Id = 1;
+    List.Sort();
+    CHECK_EQ(List[0].Id, 1);
+
+    List.Add(0).Id = 2;
+    List.Sort();
+    CHECK_EQ(List.Num(), static_cast<size_t>(3));
+    CHECK_EQ(List[0].Id, 2);
+    CHECK_EQ(List[1].Id, 1);
+    CHECK_EQ(List[2].Id, 0);
+}
+
+TEST(DrawList, ResetEmptiesTheList)
+{
+    TDeferredDrawList<FFakeDraw> List;
+    for (int Frame = 0; Frame < 3; ++Frame)
+    {
+        for (int i = 0; i < 100; ++i)
+            List.Add(100 - i).Id = i;
+        List.Sort();
+        CHECK_EQ(List[0].Id, 99);
+        List.Reset();
+        CHECK_EQ(List.Num(), static_cast<size_t>(0));
+    }
+}
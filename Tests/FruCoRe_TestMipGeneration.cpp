@@ -0,0 +1,122 @@
+/*=============================================================================
+    FruCoRe_TestMipGeneration.cpp: Tests for FruCoRe_MipGeneration.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_MipGeneration.h"
+#include "FruCoRe_Tests.h"
+
+#include <stdlib.h>
+#include <vector>
+
+static uint32_t MakeTexel(uint32_t R, uint32_t G, uint32_t B, uint32_t A)
+{
+    return R | (G << 8) | (B << 16) | (A << 24);
+}
+
+// Largest per-channel difference between two texels
+static int ChannelError(uint32_t A, uint32_t B)
+{
+    int Result = 0;
+    for (int c = 0; c < 4; ++c)
+    {
+        const int Error = abs(static_cast<int>((A >> (8 * c)) & 0xFF) - static_cast<int>((B >> (8 * c)) & 0xFF));
+        Result = Error > Result ? Error : Result;
+    }
+    return Result;
+}
+
+/*-----------------------------------------------------------------------------
+    DownsampleMip
+-----------------------------------------------------------------------------*/
+TEST(MipGeneration, FullMipCount)
+{
+    CHECK_EQ(GetFullMipCount(1, 1), 1);
+    CHECK_EQ(GetFullMipCount(256, 256), 9);
+    CHECK_EQ(GetFullMipCount(256, 16), 9);
+    CHECK_EQ(GetFullMipCount(3, 5), 3);
+}
+
+TEST(MipGeneration, SIMDMatchesScalar)
+{
+    // The vector path does the same float math in the same order, so it
+    // should match exactly. We allow one step of rounding in case the
+    // compiler fuses the scalar path's multiply-adds
+    FTestRandom Random;
+    const uint32_t Sizes[][2] = { { 1, 1 }, { 1, 9 }, { 9, 1 }, { 2, 2 }, { 8, 2 }, { 10, 6 }, { 17, 3 }, { 64, 64 }, { 256, 32 } };
+    for (const uint32_t* Size : Sizes)
+    {
+        for (int Pattern = 0; Pattern < 4; ++Pattern)
+        {
+            const uint32_t USize = Size[0], VSize = Size[1];
+            std::vector<uint32_t> Src(USize * VSize);
+            for (uint32_t& Texel : Src)
+            {
+                switch (Pattern)
+                {
+                case 0: Texel = Random.Next(); break;                                                  // Noise
+                case 1: Texel = Random.Next() | 0xFF000000; break;                                     // Opaque
+                case 2: Texel = Random.Range(0, 1) ? Random.Next() | 0xFF000000 : 0; break;           // Masked
+                default: Texel = Random.Range(0, 3) ? 0xFF336699 : Random.Next(); break;               // Mostly uniform
+                }
+            }
+
+            const size_t DstCount = (USize > 1 ? USize / 2 : 1) * (VSize > 1 ? VSize / 2 : 1);
+            std::vector<uint32_t> Expected(DstCount), Actual(DstCount);
+            DownsampleMipScalar(Src.data(), USize, VSize, Expected.data());
+            DownsampleMip(Src.data(), USize, VSize, Actual.data());
+            for (size_t i = 0; i < DstCount; ++i)
+                CHECK(ChannelError(Expected[i], Actual[i]) <= 1);
+        }
+    }
+}
+
+TEST(MipGeneration, UniformBlocksStayExact)
+{
+    const std::vector<uint32_t> Src(16 * 16, MakeTexel(12, 34, 56, 78));
+    std::vector<uint32_t> Dst(8 * 8);
+    DownsampleMip(Src.data(), 16, 16, Dst.data());
+    for (uint32_t Texel : Dst)
+        CHECK_EQ(Texel, MakeTexel(12, 34, 56, 78));
+}
+
+TEST(MipGeneration, TransparentTexelsDontDarken)
+{
+    // Masked-out texels of P8 textures are black. They must not bleed into
+    // the color of the opaque ones
+    const uint32_t White = MakeTexel(255, 255, 255, 255);
+    const uint32_t Src[] = { White, 0, 0, White, White, 0, 0, White };
+    uint32_t Dst[2];
+    DownsampleMip(Src, 4, 2, Dst);
+    CHECK_EQ(Dst[0] & 0x00FFFFFF, 0x00FFFFFF);
+    CHECK_EQ(Dst[0] >> 24, 128);
+
+    // Averaging in linear space: black and white make a light grey in sRGB
+    const uint32_t Black = MakeTexel(0, 0, 0, 255);
+    const uint32_t Checker[] = { Black, White, White, Black };
+    DownsampleMip(Checker, 2, 2, Dst);
+    CHECK(ChannelError(Dst[0], MakeTexel(188, 188, 188, 255)) <= 1);
+}
+
+/*-----------------------------------------------------------------------------
+    Alpha coverage
+-----------------------------------------------------------------------------*/
+TEST(MipGeneration, ScaleAlphaToCoverage)
+{
+    // A quarter of the texels pass the alpha test, but after filtering
+    // their alpha is too low for any of them to pass
+    std::vector<uint32_t> Texels(64);
+    for (size_t i = 0; i < Texels.size(); ++i)
+        Texels[i] = MakeTexel(1, 2, 3, i % 4 == 0 ? 100 : 20);
+    CHECK(ComputeAlphaCoverage(Texels.data(), Texels.size(), MIPGEN_MASK_THRESHOLD) == 0.f);
+
+    ScaleAlphaToCoverage(Texels.data(), Texels.size(), 0.25f, MIPGEN_MASK_THRESHOLD);
+    CHECK(ComputeAlphaCoverage(Texels.data(), Texels.size(), MIPGEN_MASK_THRESHOLD) == 0.25f);
+
+    // Colors are untouched
+    for (uint32_t Texel : Texels)
+        CHECK_EQ(Texel & 0x00FFFFFF, MakeTexel(1, 2, 3, 0));
+}
@@ -0,0 +1,89 @@
+/*=============================================================================
+    FruCoRe_TestPolygonFans.cpp: Tests for FruCoRe_PolygonFans.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_PolygonFans.h"
+#include "FruCoRe_Tests.h"
+
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    Fan indices
+-----------------------------------------------------------------------------*/
+TEST(PolygonFans, IndexCounts)
+{
+    CHECK_EQ(GetFanIndexCount(0), 0);
+    CHECK_EQ(GetFanIndexCount(2), 0);
+    CHECK_EQ(GetFanIndexCount(3), 3);
+    CHECK_EQ(GetFanIndexCount(4), 6);
+    CHECK_EQ(GetFanIndexCount(16), 42);
+}
+
+TEST(PolygonFans, EmitsFanTriangles)
+{
+    // Degenerate polygons emit nothing
+    uint16_t Indices[64];
+    CHECK(EmitFanIndices(Indices, 5, 2) == Indices);
+
+    const uint16_t Expected[] = { 100, 101, 102, 100, 102, 103, 100, 103, 104 };
+    uint16_t* End = EmitFanIndices(Indices, 100, 5);
+    CHECK_EQ(End - Indices, GetFanIndexCount(5));
+    for (size_t i = 0; i < sizeof(Expected) / sizeof(Expected[0]); ++i)
+        CHECK_EQ(Indices[i], Expected[i]);
+}
+
+TEST(PolygonFans, ConsecutivePolygons)
+{
+    // Polygons written back to back reference only their own vertices, and
+    // every vertex of every polygon gets used
+    FTestRandom Random;
+    std::vector<uint16_t> Indices;
+    std::vector<uint32_t> FirstVertices, PointCounts;
+    uint32_t NumVertices = 0;
+    while (NumVertices < 60000)
+    {
+        const uint32_t NumPts = Random.Range(3, 16);
+        const size_t Offset = Indices.size();
+        Indices.resize(Offset + GetFanIndexCount(NumPts));
+        CHECK(EmitFanIndices(&Indices[Offset], NumVertices, NumPts) == Indices.data() + Indices.size());
+        FirstVertices.push_back(NumVertices);
+        PointCounts.push_back(NumPts);
+        NumVertices += NumPts;
+    }
+    CHECK(NumVertices <= FAN_MAX_VERTICES);
+
+    size_t Index = 0;
+    for (size_t Poly = 0; Poly < FirstVertices.size(); ++Poly)
+    {
+        std::vector<bool> Used(PointCounts[Poly], false);
+        for (uint32_t i = 0; i < GetFanIndexCount(PointCounts[Poly]); ++i, ++Index)
+        {
+            CHECK(Indices[Index] >= FirstVertices[Poly] && Indices[Index] < FirstVertices[Poly] + PointCounts[Poly]);
+            Used[Indices[Index] - FirstVertices[Poly]] = true;
+        }
+        for (bool bUsed : Used)
+            CHECK(bUsed);
+    }
+}
+
+/*-----------------------------------------------------------------------------
+    Size heuristic
+-----------------------------------------------------------------------------*/
+TEST(PolygonFans, ShouldIndexFan)
+{
+    // Triangles never benefit
+    CHECK(!ShouldIndexFan(3, 12));
+    CHECK(!ShouldIndexFan(3, 64));
+
+    // Quads with 12-byte vertices: 4 * 12 + 6 * 2 = 60 bytes against 6 * 12 = 72
+    CHECK_EQ(GetIndexedFanBytes(4, 12), 60);
+    CHECK_EQ(GetUnfannedBytes(4, 12), 72);
+    CHECK(ShouldIndexFan(4, 12));
+
+    // Vertices smaller than the indices they replace never benefit
+    CHECK(!ShouldIndexFan(8, 2));
+}
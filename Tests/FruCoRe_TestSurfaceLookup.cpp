@@ -0,0 +1,210 @@
+/*=============================================================================
+    FruCoRe_TestSurfaceLookup.cpp: Tests for FruCoRe_SurfaceLookup.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_SurfaceLookupTypes.h"
+#include "FruCoRe_Tests.h"
+
+TEST(SurfaceLookup, FindsSurfacesThroughCameraSpace)
+{
+    FTestRandom Random;
+    std::vector<FSurfaceMapping> Surfaces;
+    FSurfaceLookup Lookup;
+    for (int i = 0; i < 5000; ++i)
+    {
+        Surfaces.push_back(MakeFakeSurface(Random));
+        Lookup.Add(i, Surfaces.back());
+    }
+    Lookup.Build();
+    CHECK_EQ(Lookup.Num(), Surfaces.size());
+
+    // The random surfaces can collide, so we only count the lookups that
+    // find the wrong surface or fail for a surface that has no twin
+    int NumWrong = 0, NumMissed = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+        const int Surf = static_cast<int>(Random.Range(0, static_cast<uint32_t>(Surfaces.size()) - 1));
+        const FFakeCamera Camera(Random);
+        const int Found = Lookup.Find(Camera.RoundTrip(Surfaces[Surf]));
+        if (Found == -1)
+            NumMissed++;
+        else if (Found != Surf)
+            NumWrong++;
+    }
+    CHECK_EQ(NumWrong, 0);
+    CHECK(NumMissed < 20);
+}
+
+TEST(SurfaceLookup, MissesUnknownSurfaces)
+{
+    FTestRandom Random;
+    FSurfaceLookup Lookup;
+    FSurfaceMapping Known = MakeFakeSurface(Random);
+    Lookup.Add(7, Known);
+    Lookup.Build();
+    CHECK_EQ(Lookup.Find(Known), 7);
+
+    // Same base point, different texture alignment
+    FSurfaceMapping Rotated = Known;
+    for (int i = 0; i < 3; ++i)
+    {
+        Rotated.XAxis[i] = Known.YAxis[i];
+        Rotated.YAxis[i] = Known.XAxis[i];
+    }
+    CHECK_EQ(Lookup.Find(Rotated), -1);
+
+    // Same alignment, but moved by a unit
+    FSurfaceMapping Moved = Known;
+    Moved.Origin[0] += 1.f;
+    CHECK_EQ(Lookup.Find(Moved), -1);
+
+    // Same alignment, but a different texture scale
+    FSurfaceMapping Scaled = Known;
+    for (int i = 0; i < 3; ++i)
+        Scaled.XAxis[i] *= 1.01f;
+    CHECK_EQ(Lookup.Find(Scaled), -1);
+
+    FSurfaceLookup Empty;
+    Empty.Build();
+    CHECK_EQ(Empty.Find(Known), -1);
+}
+
+TEST(SurfaceLookup, RejectsAmbiguousSurfaces)
+{
+    // Two brushes with the same texture alignment on the same plane
+    FTestRandom Random;
+    FSurfaceLookup Lookup;
+    const FSurfaceMapping Twin = MakeFakeSurface(Random);
+    Lookup.Add(1, Twin);
+    Lookup.Add(2, MakeFakeSurface(Random));
+    Lookup.Add(3, Twin);
+    Lookup.Build();
+    CHECK_EQ(Lookup.Find(Twin), -1);
+}
+
+TEST(SurfaceLookup, ToleratesOffGridBasePoints)
+{
+    FTestRandom Random;
+    FSurfaceLookup Lookup;
+    FSurfaceMapping Surface = MakeFakeSurface(Random);
+    Surface.Origin[0] += 0.3f;
+    Surface.Origin[1] -= 0.2f;
+    Lookup.Add(0, Surface);
+    Lookup.Build();
+
+    for (int i = 0; i < 100; ++i)
+        CHECK_EQ(Lookup.Find(FFakeCamera(Random).RoundTrip(Surface)), 0);
+}
+
+/*-----------------------------------------------------------------------------
+    Matching facet polygons with cached nodes
+-----------------------------------------------------------------------------*/
+
+// A 256x128 wall on the X=64 plane
+static const float WallNode[] =
+{
+    64.f,   0.f,   0.f,
+    64.f, 256.f,   0.f,
+    64.f, 256.f, 128.f,
+    64.f,   0.f, 128.f,
+};
+
+static bool NeverOnEdge(uint32_t)
+{
+    return false;
+}
+
+TEST(SurfaceLookup, MatchesUnclippedNodes)
+{
+    CHECK(IsClippedNode(WallNode, 4, WallNode, 4, 0.25f, NeverOnEdge));
+
+    // The engine may start the polygon at any vertex, and the points pick
+    // up a little error on their way through camera space
+    FTestRandom Random;
+    for (int i = 0; i < 100; ++i)
+    {
+        const FFakeCamera Camera(Random);
+        const uint32_t Start = Random.Range(0, 3);
+        float Points[12];
+        for (uint32_t j = 0; j < 4; ++j)
+        {
+            float CameraPoint[3];
+            Camera.ToCamera(&WallNode[((Start + j) % 4) * 3], CameraPoint, true);
+            Camera.ToWorld(CameraPoint, &Points[j * 3], true);
+        }
+        CHECK(IsClippedNode(WallNode, 4, Points, 4, 0.25f, NeverOnEdge));
+    }
+}
+
+TEST(SurfaceLookup, MatchesNodesClippedToTheFrustum)
+{
+    // The right edge of the screen cuts the wall at Y=100
+    const float Clipped[] =
+    {
+        64.f,   0.f,   0.f,
+        64.f, 100.f,   0.f,
+        64.f, 100.f, 128.f,
+        64.f,   0.f, 128.f,
+    };
+    auto OnEdge = [&](uint32_t i) { return Clipped[i * 3 + 1] == 100.f; };
+    CHECK(IsClippedNode(WallNode, 4, Clipped, 4, 0.25f, OnEdge));
+
+    // The same polygon can't be the wall if the engine didn't clip it
+    CHECK(!IsClippedNode(WallNode, 4, Clipped, 4, 0.25f, NeverOnEdge));
+
+    // A corner of the screen clips the wall into a pentagon
+    const float Corner[] =
+    {
+        64.f,   0.f,   0.f,
+        64.f, 256.f,   0.f,
+        64.f, 256.f,  50.f,
+        64.f, 200.f, 128.f,
+        64.f,   0.f, 128.f,
+    };
+    auto OnCornerEdge = [](uint32_t i) { return i == 2 || i == 3; };
+    CHECK(IsClippedNode(WallNode, 4, Corner, 5, 0.25f, OnCornerEdge));
+}
+
+TEST(SurfaceLookup, RejectsOtherPolygons)
+{
+    auto AlwaysOnEdge = [](uint32_t) { return true; };
+
+    // A mover on the same plane, inside the wall
+    const float Inside[] =
+    {
+        64.f,  32.f,  32.f,
+        64.f,  96.f,  32.f,
+        64.f,  96.f,  96.f,
+        64.f,  32.f,  96.f,
+    };
+    CHECK(!IsClippedNode(WallNode, 4, Inside, 4, 0.25f, NeverOnEdge));
+
+    // Half of the wall, without any clipped points
+    const float Half[] =
+    {
+        64.f,   0.f,   0.f,
+        64.f, 256.f,   0.f,
+        64.f, 256.f, 128.f,
+    };
+    CHECK(!IsClippedNode(WallNode, 4, Half, 3, 0.25f, NeverOnEdge));
+
+    // Off the plane
+    float Moved[12];
+    for (int i = 0; i < 12; ++i)
+        Moved[i] = WallNode[i] + (i % 3 == 0 ? 1.f : 0.f);
+    CHECK(!IsClippedNode(WallNode, 4, Moved, 4, 0.25f, AlwaysOnEdge));
+
+    // On the plane, but sticking out of the wall
+    const float Outside[] =
+    {
+        64.f,   0.f,   0.f,
+        64.f, 300.f,   0.f,
+        64.f, 300.f, 128.f,
+        64.f,   0.f, 128.f,
+    };
+    CHECK(!IsClippedNode(WallNode, 4, Outside, 4, 0.25f, AlwaysOnEdge));
+}
@@ -0,0 +1,176 @@
+/*=============================================================================
+    FruCoRe_TestTextureCache.cpp: Tests for FruCoRe_TextureCache.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TextureCache.h"
+
+#include <algorithm>
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+    Size tracking
+-----------------------------------------------------------------------------*/
+TEST(TextureCache, MipSizes)
+{
+    // RGBA8
+    CHECK_EQ(GetMipSizeBytes(256, 128, 1, 4), 256 * 128 * 4);
+    CHECK_EQ(GetMipChainSizeBytes(4, 2, 3, 1, 4), (8 + 2 + 1) * 4);
+
+    // BC1 mips never get smaller than one 8-byte block
+    CHECK_EQ(GetMipSizeBytes(1, 1, 4, 8), 8);
+    CHECK_EQ(GetMipSizeBytes(6, 5, 4, 8), 4 * 8);
+    CHECK_EQ(GetMipChainSizeBytes(16, 16, 5, 4, 8), (16 + 4 + 1 + 1 + 1) * 8);
+
+    // Non-square chains keep halving the long side after the short one hits 1
+    CHECK_EQ(GetMipChainSizeBytes(8, 1, 4, 1, 1), 8 + 4 + 2 + 1);
+}
+
+TEST(TextureCache, HashChaining)
+{
+    const uint8_t Data[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    CHECK(HashBytes64(Data, sizeof(Data)) == HashBytes64(Data, sizeof(Data)));
+    CHECK(HashBytes64(Data, sizeof(Data)) != HashBytes64(Data, sizeof(Data) - 1));
+    CHECK(HashBytes64(Data, sizeof(Data), 1) != HashBytes64(Data, sizeof(Data), 2));
+
+    // Moving bytes between the chained calls changes the hash
+    CHECK(HashBytes64(Data + 4, 7, HashBytes64(Data, 4)) != HashBytes64(Data + 5, 6, HashBytes64(Data, 5)));
+}
+
+/*-----------------------------------------------------------------------------
+    Eviction policy. A fake allocator stands in for the renderer's cache.
+-----------------------------------------------------------------------------*/
+struct FFakeTexture
+{
+    int32_t  LastUsedFrame;
+    uint64_t SizeBytes;
+};
+
+struct FFakeAllocator
+{
+    std::vector<FFakeTexture*> Textures;
+    uint64_t UsedBytes = 0;
+
+    ~FFakeAllocator()
+    {
+        for (FFakeTexture* Texture : Textures)
+            delete Texture;
+    }
+
+    FFakeTexture* Allocate(int32_t Frame, uint64_t Bytes)
+    {
+        Textures.push_back(new FFakeTexture{ Frame, Bytes });
+        UsedBytes += Bytes;
+        return Textures.back();
+    }
+
+    // Runs the policy and frees what it selected. Returns the evicted textures
+    std::vector<FFakeTexture> Evict(uint64_t BudgetBytes, int32_t CompletedFrame)
+    {
+        std::vector<FFakeTexture*> Entries = Textures;
+        std::vector<FFakeTexture*> Evicted(Entries.size());
+        const size_t NumEvicted = SelectTexturesToEvict(Entries.data(), Entries.size(), UsedBytes, BudgetBytes, CompletedFrame, Evicted.data());
+
+        std::vector<FFakeTexture> Result;
+        for (size_t i = 0; i < NumEvicted; ++i)
+        {
+            Result.push_back(*Evicted[i]);
+            UsedBytes -= Evicted[i]->SizeBytes;
+            Textures.erase(std::find(Textures.begin(), Textures.end(), Evicted[i]));
+            delete Evicted[i];
+        }
+        return Result;
+    }
+};
+
+TEST(TextureCache, EvictsNothingWithinBudget)
+{
+    FFakeAllocator Allocator;
+    Allocator.Allocate(1, 100);
+    Allocator.Allocate(2, 100);
+    CHECK(Allocator.Evict(200, 10).empty());
+    CHECK_EQ(Allocator.UsedBytes, 200);
+}
+
+TEST(TextureCache, EvictsLeastRecentlyUsedFirst)
+{
+    FFakeAllocator Allocator;
+    Allocator.Allocate(5, 100);
+    Allocator.Allocate(1, 100);
+    Allocator.Allocate(3, 100);
+    Allocator.Allocate(4, 100);
+
+    const std::vector<FFakeTexture> Evicted = Allocator.Evict(250, 10);
+    CHECK_EQ(Evicted.size(), 2);
+    CHECK_EQ(Evicted[0].LastUsedFrame, 1);
+    CHECK_EQ(Evicted[1].LastUsedFrame, 3);
+    CHECK_EQ(Allocator.UsedBytes, 200);
+}
+
+TEST(TextureCache, StopsOnceWithinBudget)
+{
+    // One large texture is enough to get back within the budget
+    FFakeAllocator Allocator;
+    Allocator.Allocate(1, 1000);
+    Allocator.Allocate(2, 10);
+    Allocator.Allocate(3, 10);
+
+    const std::vector<FFakeTexture> Evicted = Allocator.Evict(500, 10);
+    CHECK_EQ(Evicted.size(), 1);
+    CHECK_EQ(Allocator.UsedBytes, 20);
+}
+
+TEST(TextureCache, NeverEvictsInFlightTextures)
+{
+    // The GPU has only finished frame 3, so frames 4 and 5 may still sample these
+    FFakeAllocator Allocator;
+    Allocator.Allocate(2, 100);
+    Allocator.Allocate(4, 100);
+    Allocator.Allocate(5, 100);
+
+    const std::vector<FFakeTexture> Evicted = Allocator.Evict(0, 3);
+    CHECK_EQ(Evicted.size(), 1);
+    CHECK_EQ(Evicted[0].LastUsedFrame, 2);
+    CHECK_EQ(Allocator.UsedBytes, 200);
+}
+
+TEST(TextureCache, RandomizedPolicy)
+{
+    FTestRandom Random;
+    for (int Round = 0; Round < 200; ++Round)
+    {
+        FFakeAllocator Allocator;
+        const int NumTextures = static_cast<int>(Random.Range(1, 64));
+        for (int i = 0; i < NumTextures; ++i)
+            Allocator.Allocate(static_cast<int32_t>(Random.Range(0, 100)), Random.Range(1, 1 << 20));
+
+        const uint64_t Budget = Random.Range(0, 32 << 20);
+        const int32_t CompletedFrame = static_cast<int32_t>(Random.Range(0, 100));
+        const std::vector<FFakeTexture> Evicted = Allocator.Evict(Budget, CompletedFrame);
+
+        int32_t OldestKept = 0x7FFFFFFF;
+        int32_t NewestEvicted = -1;
+        for (const FFakeTexture* Texture : Allocator.Textures)
+            if (Texture->LastUsedFrame <= CompletedFrame)
+                OldestKept = std::min(OldestKept, Texture->LastUsedFrame);
+        for (const FFakeTexture& Texture : Evicted)
+        {
+            CHECK(Texture.LastUsedFrame <= CompletedFrame);
+            NewestEvicted = std::max(NewestEvicted, Texture.LastUsedFrame);
+        }
+
+        // Either we're within the budget, or we've evicted everything we could
+        CHECK(Allocator.UsedBytes <= Budget || OldestKept == 0x7FFFFFFF);
+
+        // We never kept an older texture while evicting a newer one
+        CHECK(NewestEvicted <= OldestKept);
+
+        // We stopped as soon as we were within the budget
+        if (!Evicted.empty())
+            CHECK(Allocator.UsedBytes + Evicted.back().SizeBytes > Budget);
+    }
+}
@@ -0,0 +1,100 @@
+/*=============================================================================
+    FruCoRe_TestTextureMap.cpp: Tests for FruCoRe_TextureMap.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_TextureMap.h"
+#include "FruCoRe_Tests.h"
+
+#include <unordered_map>
+#include <vector>
+
+struct FFakeCachedTexture
+{
+    uint64_t CacheID;
+};
+
+/*-----------------------------------------------------------------------------
+    TTextureCacheMap
+-----------------------------------------------------------------------------*/
+TEST(TextureMap, SetFindRemove)
+{
+    TTextureCacheMap<FFakeCachedTexture*> Map;
+    FFakeCachedTexture A{1}, B{2};
+    CHECK(Map.FindRef(1) == nullptr);
+    Map.Remove(1);
+
+    Map.Set(1, &A);
+    Map.Set(2, &B);
+    CHECK(Map.FindRef(1) == &A);
+    CHECK(Map.FindRef(2) == &B);
+    CHECK_EQ(Map.Num(), 2);
+
+    // Replacing a value must not return the stale one we found last
+    Map.Set(2, &A);
+    CHECK(Map.FindRef(2) == &A);
+    CHECK_EQ(Map.Num(), 2);
+
+    // Neither must removing it
+    Map.Remove(2);
+    CHECK(Map.FindRef(2) == nullptr);
+    CHECK(Map.FindRef(1) == &A);
+    CHECK_EQ(Map.Num(), 1);
+
+    Map.Empty();
+    CHECK(Map.FindRef(1) == nullptr);
+    CHECK_EQ(Map.Num(), 0);
+}
+
+TEST(TextureMap, MatchesUnorderedMap)
+{
+    // Cache IDs only differ in a few low and high bits, so use keys that
+    // look like them to exercise long probe sequences
+    FTestRandom Random;
+    std::vector<FFakeCachedTexture> Textures(4096);
+    for (size_t i = 0; i < Textures.size(); ++i)
+        Textures[i].CacheID = (static_cast<uint64_t>(Random.Range(0, 7)) << 56) | (Random.Range(0, 2047) << 4);
+
+    TTextureCacheMap<FFakeCachedTexture*> Map;
+    std::unordered_map<uint64_t, FFakeCachedTexture*> Reference;
+    for (int Step = 0; Step < 100000; ++Step)
+    {
+        FFakeCachedTexture* Texture = &Textures[Random.Range(0, Textures.size() - 1)];
+        switch (Random.Range(0, 2))
+        {
+        case 0:
+            Map.Set(Texture->CacheID, Texture);
+            Reference[Texture->CacheID] = Texture;
+            break;
+        case 1:
+            Map.Remove(Texture->CacheID);
+            Reference.erase(Texture->CacheID);
+            break;
+        default:
+        {
+            auto It = Reference.find(Texture->CacheID);
+            CHECK(Map.FindRef(Texture->CacheID) == (It != Reference.end() ? It->second : nullptr));
+            break;
+        }
+        }
+    }
+
+    CHECK_EQ(Map.Num(), Reference.size());
+    size_t NumIterated = 0;
+    for (TTextureCacheMap<FFakeCachedTexture*>::TIterator It(Map); It; ++It)
+    {
+        CHECK(Reference[It.Key()] == It.Value());
+        NumIterated++;
+    }
+    CHECK_EQ(NumIterated, Reference.size());
+}
+
+TEST(TextureMap, EmptyIterator)
+{
+    TTextureCacheMap<FFakeCachedTexture*> Map;
+    TTextureCacheMap<FFakeCachedTexture*>::TIterator It(Map);
+    CHECK(!It);
+}
@@ -0,0 +1,153 @@
+/*=============================================================================
+    FruCoRe_TestTilePacking.cpp: Tests for FruCoRe_TilePacking.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_TilePacking.h"
+
+#include <vector>
+
+// Same layout as TileInstanceData in FruCoRe_DrawTile_Metal.h
+struct FFakeTileInstance
+{
+    float Rect[4];
+    float UVRect[4];
+    float Z;
+    struct alignas(8) { uint16_t Bits[4]; } DrawColor;
+};
+
+// Same fields as MultiDrawIndirectBuffer::DrawCommand
+struct FFakeDrawCommand
+{
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t vertexStart;
+    uint32_t baseInstance;
+    uint32_t indexCount;
+    uint32_t indexStart;
+};
+
+//
+// Mirrors MultiDrawIndirectBuffer::AddGeneratedInstance. Commands before
+// @Enqueued have been encoded already, as if we had flushed
+//
+struct FFakeDrawBuffer
+{
+    std::vector<FFakeDrawCommand> Commands;
+    uint32_t Enqueued = 0;
+    uint32_t TotalInstances = 0;
+
+    bool AddTile()
+    {
+        Commands.push_back(FFakeDrawCommand{});
+        FFakeDrawCommand* Prev = Commands.size() - 1 > Enqueued ? &Commands[Commands.size() - 2] : nullptr;
+        if (AddGeneratedInstance(Prev, Commands.back(), TotalInstances++, TILE_VERTICES))
+        {
+            Commands.pop_back();
+            return false;
+        }
+        return true;
+    }
+
+    void Flush()
+    {
+        Enqueued = static_cast<uint32_t>(Commands.size());
+    }
+};
+
+/*-----------------------------------------------------------------------------
+    Instance records
+-----------------------------------------------------------------------------*/
+TEST(TilePacking, PacksRectsAndDepth)
+{
+    FFakeTileInstance Out;
+    const float Color[4] = { 0.25f, 0.5f, 1.f, 0.75f };
+    PackTileInstance(Out, 10.f, 20.f, 64.f, 32.f, 0.5f, 16.f, 8.f, 64.f, 32.f, 1.f / 128.f, 1.f / 64.f, Color);
+
+    CHECK_EQ(Out.Rect[0], 10.f);
+    CHECK_EQ(Out.Rect[1], 20.f);
+    CHECK_EQ(Out.Rect[2], 64.f);
+    CHECK_EQ(Out.Rect[3], 32.f);
+    CHECK_EQ(Out.UVRect[0], 0.125f);
+    CHECK_EQ(Out.UVRect[1], 0.125f);
+    CHECK_EQ(Out.UVRect[2], 0.5f);
+    CHECK_EQ(Out.UVRect[3], 0.5f);
+    CHECK_EQ(Out.Z, 0.5f);
+    CHECK_EQ(Out.DrawColor.Bits[0], FloatToHalf(0.25f));
+    CHECK_EQ(Out.DrawColor.Bits[1], FloatToHalf(0.5f));
+    CHECK_EQ(Out.DrawColor.Bits[2], FloatToHalf(1.f));
+    CHECK_EQ(Out.DrawColor.Bits[3], FloatToHalf(0.75f));
+}
+
+TEST(TilePacking, RecordIsSmallerThanUnbatchedTile)
+{
+    CHECK_EQ(sizeof(FFakeTileInstance), static_cast<size_t>(48));
+    CHECK(sizeof(FFakeTileInstance) * 5 <= TILE_UNBATCHED_BYTES);
+}
+
+/*-----------------------------------------------------------------------------
+    Batching
+-----------------------------------------------------------------------------*/
+TEST(TilePacking, ConsecutiveTilesShareOneDraw)
+{
+    FFakeDrawBuffer Buffer;
+    CHECK(Buffer.AddTile());
+    for (int i = 1; i < 100; ++i)
+        CHECK(!Buffer.AddTile());
+
+    CHECK_EQ(Buffer.Commands.size(), static_cast<size_t>(1));
+    CHECK_EQ(Buffer.Commands[0].baseInstance, 0u);
+    CHECK_EQ(Buffer.Commands[0].instanceCount, 100u);
+    CHECK_EQ(Buffer.Commands[0].vertexCount, static_cast<uint32_t>(TILE_VERTICES));
+    CHECK_EQ(Buffer.Commands[0].vertexStart, 0u);
+    CHECK_EQ(Buffer.Commands[0].indexCount, 0u);
+}
+
+TEST(TilePacking, FlushStartsANewDraw)
+{
+    // A state change flushes, so the next tile must not extend a draw we
+    // already encoded with the previous state
+    FFakeDrawBuffer Buffer;
+    const int RunLengths[] = { 3, 1, 7, 2 };
+    for (int Run : RunLengths)
+    {
+        for (int i = 0; i < Run; ++i)
+            CHECK_EQ(Buffer.AddTile(), i == 0);
+        Buffer.Flush();
+    }
+
+    CHECK_EQ(Buffer.Commands.size(), static_cast<size_t>(4));
+    uint32_t Instance = 0;
+    for (size_t i = 0; i < Buffer.Commands.size(); ++i)
+    {
+        CHECK_EQ(Buffer.Commands[i].baseInstance, Instance);
+        CHECK_EQ(Buffer.Commands[i].instanceCount, static_cast<uint32_t>(RunLengths[i]));
+        Instance += RunLengths[i];
+    }
+}
+
+TEST(TilePacking, OnlyExtendsAdjacentGeneratedDraws)
+{
+    FFakeDrawCommand Prev = { TILE_VERTICES, 2, 0, 5, 0, 0 };
+    FFakeDrawCommand Next;
+
+    // Not adjacent to the previous draw's instances
+    CHECK(!AddGeneratedInstance(&Prev, Next, 8, TILE_VERTICES));
+    CHECK_EQ(Next.baseInstance, 8u);
+    CHECK_EQ(Next.instanceCount, 1u);
+
+    // Different primitive
+    CHECK(!AddGeneratedInstance(&Prev, Next, 7, 3));
+
+    // Indexed draws never take generated instances
+    FFakeDrawCommand Indexed = { TILE_VERTICES, 1, 0, 6, 12, 0 };
+    CHECK(!AddGeneratedInstance(&Indexed, Next, 7, TILE_VERTICES));
+    CHECK_EQ(Indexed.instanceCount, 1u);
+
+    CHECK(AddGeneratedInstance(&Prev, Next, 7, TILE_VERTICES));
+    CHECK_EQ(Prev.instanceCount, 3u);
+}
@@ -0,0 +1,83 @@
+/*=============================================================================
+    FruCoRe_TestVertexEmission.cpp: Tests for FruCoRe_VertexEmission.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_VertexEmission.h"
+#include "FruCoRe_VertexEmissionTypes.h"
+
+/*-----------------------------------------------------------------------------
+    Emission
+-----------------------------------------------------------------------------*/
+TEST(VertexEmission, StreamCopy)
+{
+    // Every combination of misalignment and length around the 16-byte blocks
+    uint8_t Src[96], Dst[96];
+    for (int i = 0; i < 96; ++i)
+        Src[i] = static_cast<uint8_t>(i * 7 + 1);
+
+    for (size_t Offset = 0; Offset < 16; ++Offset)
+    {
+        for (size_t Bytes = 0; Bytes <= 64; ++Bytes)
+        {
+            memset(Dst, 0, sizeof(Dst));
+            StreamCopy(Dst + Offset, Src + 3, Bytes);
+            CHECK(memcmp(Dst + Offset, Src + 3, Bytes) == 0);
+            CHECK(Dst[Offset + Bytes] == 0);
+            CHECK(Offset == 0 || Dst[Offset - 1] == 0);
+        }
+    }
+}
+
+TEST(VertexEmission, GouraudVertices)
+{
+    // Counts below, at, and above the batch size and streaming threshold
+    FTestRandom Random;
+    FFakeVertexPool Pool(Random, 200);
+    const uint32_t Counts[] = { 0, 1, 3, 9, VERTEX_EMIT_BATCH, VERTEX_EMIT_BATCH + 1, 200 };
+    for (uint32_t Count : Counts)
+    {
+        std::vector<FFakeGouraudVertex> Vertices(Count + 1);
+        std::vector<FFakeHalf4> Fog(Count + 1);
+        EmitGouraudVertices(Vertices.data(), Fog.data(), Count, 42, [&](uint32_t i) -> const FFakeSourceVertex& { return *Pool.Pointers[i]; });
+
+        for (uint32_t i = 0; i < Count; ++i)
+        {
+            const FFakeSourceVertex& P = *Pool.Pointers[i];
+            CHECK(Vertices[i].Point.X == P.Point.X && Vertices[i].Point.Y == P.Point.Y && Vertices[i].Point.Z == P.Point.Z);
+            CHECK(Vertices[i].UV[0] == P.U && Vertices[i].UV[1] == P.V);
+            CHECK_EQ(Vertices[i].Instance, 42);
+            CHECK_EQ(Vertices[i].LightColor.Bits[0], FloatToHalf(P.Light.X));
+            CHECK_EQ(Vertices[i].LightColor.Bits[3], FloatToHalf(P.Light.W));
+            CHECK_EQ(Fog[i].Bits[2], FloatToHalf(P.Fog.Z));
+        }
+
+        // Nothing past the end
+        CHECK_EQ(Vertices[Count].Instance, 0);
+    }
+
+    // The fog stream is optional
+    std::vector<FFakeGouraudVertex> Vertices(64);
+    EmitGouraudVertices(Vertices.data(), static_cast<FFakeHalf4*>(nullptr), 64, 1, [&](uint32_t i) -> const FFakeSourceVertex& { return *Pool.Pointers[i]; });
+    CHECK(Vertices[63].UV[0] == Pool.Pointers[63]->U);
+}
+
+TEST(VertexEmission, PositionVertices)
+{
+    FTestRandom Random;
+    FFakeVertexPool Pool(Random, 100);
+    std::vector<FFakePositionVertex> Vertices(100);
+    const float MinZ = EmitPositionVertices(Vertices.data(), 100, 7, [&](uint32_t i) -> const FFakeVector& { return Pool.Pointers[i]->Point; });
+
+    float ExpectedMinZ = 1e30f;
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        CHECK(Vertices[i].Point.Z == Pool.Pointers[i]->Point.Z);
+        CHECK_EQ(Vertices[i].Instance, 7);
+        ExpectedMinZ = std::min(ExpectedMinZ, Pool.Pointers[i]->Point.Z);
+    }
+    CHECK(MinZ == ExpectedMinZ);
+}
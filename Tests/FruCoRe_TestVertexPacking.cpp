@@ -0,0 +1,104 @@
+/*=============================================================================
+    FruCoRe_TestVertexPacking.cpp: Tests for FruCoRe_VertexPacking.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+#include "FruCoRe_VertexPacking.h"
+
+#include <math.h>
+
+static float BitsToFloat(uint32_t Bits)
+{
+    float Result;
+    memcpy(&Result, &Bits, sizeof(Result));
+    return Result;
+}
+
+static bool IsHalfNaN(uint16_t Half)
+{
+    return (Half & 0x7C00) == 0x7C00 && (Half & 0x3FF) != 0;
+}
+
+/*-----------------------------------------------------------------------------
+    Half conversions
+-----------------------------------------------------------------------------*/
+TEST(VertexPacking, KnownValues)
+{
+    CHECK_EQ(FloatToHalf(0.f), 0x0000);
+    CHECK_EQ(FloatToHalf(-0.f), 0x8000);
+    CHECK_EQ(FloatToHalf(1.f), 0x3C00);
+    CHECK_EQ(FloatToHalf(-2.f), 0xC000);
+    CHECK_EQ(FloatToHalf(0.5f), 0x3800);
+    CHECK_EQ(FloatToHalf(65504.f), 0x7BFF);
+
+    // Halfway between 65504 and the next (unrepresentable) step rounds to infinity
+    CHECK_EQ(FloatToHalf(65520.f), 0x7C00);
+    CHECK_EQ(FloatToHalf(65519.f), 0x7BFF);
+    CHECK_EQ(FloatToHalf(1e10f), 0x7C00);
+    CHECK_EQ(FloatToHalf(-INFINITY), 0xFC00);
+    CHECK(IsHalfNaN(FloatToHalf(NAN)));
+
+    // Subnormals, with ties going to even
+    CHECK_EQ(FloatToHalf(ldexpf(1.f, -24)), 0x0001);
+    CHECK_EQ(FloatToHalf(ldexpf(1.f, -25)), 0x0000);
+    CHECK_EQ(FloatToHalf(ldexpf(3.f, -25)), 0x0002);
+    CHECK_EQ(FloatToHalf(ldexpf(1.f, -14)), 0x0400);
+
+    // Ties between normal halves go to even too
+    CHECK_EQ(FloatToHalf(1.f + ldexpf(1.f, -11)), 0x3C00);
+    CHECK_EQ(FloatToHalf(1.f + ldexpf(3.f, -11)), 0x3C02);
+}
+
+TEST(VertexPacking, AllHalvesRoundTrip)
+{
+    for (uint32_t Half = 0; Half <= 0xFFFF; ++Half)
+    {
+        const float Value = HalfToFloat(static_cast<uint16_t>(Half));
+        if (IsHalfNaN(static_cast<uint16_t>(Half)))
+            CHECK(Value != Value);
+        else
+            CHECK_EQ(FloatToHalf(Value), Half);
+    }
+}
+
+TEST(VertexPacking, RoundsToNearest)
+{
+    // Every float in the half range must become one of the two halves that
+    // surround it, and the closer of the two
+    FTestRandom Random;
+    for (int i = 0; i < 200000; ++i)
+    {
+        const float Value = BitsToFloat(Random.Next() & 0xC7FFFFFF);
+        if (!(fabsf(Value) < 65504.f))
+            continue;
+
+        const uint16_t Half = FloatToHalf(Value);
+        const double Error = fabs(static_cast<double>(HalfToFloat(Half)) - Value);
+        const uint16_t Magnitude = Half & 0x7FFF;
+        const uint16_t Sign = Half & 0x8000;
+        if (Magnitude < 0x7BFF)
+            CHECK(Error <= fabs(static_cast<double>(HalfToFloat(static_cast<uint16_t>(Sign | (Magnitude + 1)))) - Value));
+        if (Magnitude > 0)
+            CHECK(Error <= fabs(static_cast<double>(HalfToFloat(static_cast<uint16_t>(Sign | (Magnitude - 1)))) - Value));
+    }
+}
+
+TEST(VertexPacking, PackHalf4MatchesScalar)
+{
+    FTestRandom Random;
+    for (int i = 0; i < 10000; ++i)
+    {
+        float In[4];
+        for (float& Value : In)
+            Value = (static_cast<float>(Random.Next()) / 4294967296.f - 0.5f) * 4096.f;
+
+        uint16_t Vector[4], Scalar[4];
+        PackHalf4(Vector, In);
+        PackHalf4(Scalar, In[0], In[1], In[2], In[3]);
+        CHECK(memcmp(Vector, Scalar, sizeof(Vector)) == 0);
+    }
+}
@@ -0,0 +1,73 @@
+/*=============================================================================
+    FruCoRe_Tests.cpp: Test runner for the Metal-free components.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#include "FruCoRe_Tests.h"
+
+#include <string.h>
+
+struct FTestCase
+{
+    const char* Suite;
+    const char* Name;
+    FTestFunc   Func;
+    FTestCase*  Next;
+};
+
+// Function-local so registrars in other translation units can't run first
+static FTestCase*& GetTestCases()
+{
+    static FTestCase* TestCases = nullptr;
+    return TestCases;
+}
+
+static int NumFailures = 0;
+
+FTestRegistrar::FTestRegistrar(const char* Suite, const char* Name, FTestFunc Func)
+{
+    // Append, so we run the cases in the order they appear in their file
+    FTestCase** Tail = &GetTestCases();
+    while (*Tail)
+        Tail = &(*Tail)->Next;
+    *Tail = new FTestCase{ Suite, Name, Func, nullptr };
+}
+
+void ReportFailure(const char* File, int Line, const char* Message)
+{
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", File, Line, Message);
+    NumFailures++;
+}
+
+int main(int argc, char** argv)
+{
+    const char* Suite = argc > 1 ? argv[1] : nullptr;
+    int NumRun = 0;
+    int NumFailed = 0;
+
+    for (FTestCase* Case = GetTestCases(); Case; Case = Case->Next)
+    {
+        if (Suite && strcmp(Suite, Case->Suite) != 0)
+            continue;
+
+        const int PrevFailures = NumFailures;
+        Case->Func();
+        NumRun++;
+
+        const bool bPassed = NumFailures == PrevFailures;
+        NumFailed += bPassed ? 0 : 1;
+        printf("[%s] %s.%s\n", bPassed ? "  OK  " : " FAIL ", Case->Suite, Case->Name);
+    }
+
+    if (NumRun == 0)
+    {
+        fprintf(stderr, "No test cases found for suite %s\n", Suite ? Suite : "(all)");
+        return 1;
+    }
+
+    printf("%d of %d test cases passed\n", NumRun - NumFailed, NumRun);
+    return NumFailed ? 1 : 0;
+}
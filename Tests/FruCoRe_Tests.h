@@ -0,0 +1,75 @@
+/*=============================================================================
+    FruCoRe_Tests.h: Minimal test harness for the Metal-free components.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//
+// Test cases register themselves at static initialization time. The test
+// runner runs either all of them, or all cases of the suite named on the
+// command line (see CMakeLists.txt).
+//
+typedef void (*FTestFunc)();
+
+struct FTestRegistrar
+{
+    FTestRegistrar(const char* Suite, const char* Name, FTestFunc Func);
+};
+
+#define TEST(Suite, Name) \
+    static void Test_##Suite##_##Name(); \
+    static FTestRegistrar Registrar_##Suite##_##Name(#Suite, #Name, &Test_##Suite##_##Name); \
+    static void Test_##Suite##_##Name()
+
+// Records a failure in the current test case. The test keeps running
+void ReportFailure(const char* File, int Line, const char* Message);
+
+#define CHECK(Expr) \
+    do { if (!(Expr)) ReportFailure(__FILE__, __LINE__, #Expr); } while (0)
+
+#define CHECK_EQ(A, B) \
+    do \
+    { \
+        const auto CheckA = (A); \
+        const auto CheckB = (B); \
+        if (!(CheckA == CheckB)) \
+        { \
+            char CheckMessage[256]; \
+            snprintf(CheckMessage, sizeof(CheckMessage), "%s == %s (%lld vs %lld)", #A, #B, static_cast<long long>(CheckA), static_cast<long long>(CheckB)); \
+            ReportFailure(__FILE__, __LINE__, CheckMessage); \
+        } \
+    } while (0)
+
+//
+// Deterministic xorshift generator, so failures are reproducible
+//
+class FTestRandom
+{
+public:
+    explicit FTestRandom(uint64_t Seed = 0x2545F4914F6CDD1Dull) : State(Seed ? Seed : 1) {}
+
+    uint32_t Next()
+    {
+        State ^= State << 13;
+        State ^= State >> 7;
+        State ^= State << 17;
+        return static_cast<uint32_t>(State >> 32);
+    }
+
+    // Uniformly distributed in [Min, Max]
+    uint32_t Range(uint32_t Min, uint32_t Max)
+    {
+        return Min + Next() % (Max - Min + 1);
+    }
+
+private:
+    uint64_t State;
+};
@@ -0,0 +1,79 @@
+/*=============================================================================
+    FruCoRe_VertexEmissionTypes.h: Stand-ins for the engine's vertex types
+    and our packed vertex layouts, for the FruCoRe_VertexEmission tests and
+    benchmarks.
+    Copyright 2023 OldUnreal. All Rights Reserved.
+
+    Revision history:
+    * Created by Stijn Volckaert
+=============================================================================*/
+
+#pragma once
+
+#include "FruCoRe_Tests.h"
+
+#include <algorithm>
+#include <vector>
+
+// Like FTransTexture
+struct FFakeVector { float X, Y, Z; };
+struct FFakePlane { float X, Y, Z, W; };
+struct FFakeSourceVertex
+{
+    FFakeVector Point;
+    float       U, V;
+    FFakePlane  Light;
+    FFakePlane  Fog;
+    uint8_t     Padding[64];    // The engine's vertices carry a lot more than we read
+};
+
+// Like GouraudVertex and its fog stream
+struct FFakeHalf4 { uint16_t Bits[4]; };
+struct FFakeFloat3 { float X, Y, Z; };
+struct FFakeGouraudVertex
+{
+    FFakeFloat3 Point;
+    uint32_t    Instance;
+    float       UV[2];
+    FFakeHalf4  LightColor;
+};
+
+// Like ComplexVertex
+struct FFakePositionVertex
+{
+    FFakeFloat3 Point;
+    uint32_t    Instance;
+};
+
+//
+// A pool of source vertices and a list of pointers into it in random order,
+// so the emission code has to chase scattered pointers like it does for the
+// engine's mesh and BSP vertices
+//
+struct FFakeVertexPool
+{
+    std::vector<FFakeSourceVertex>  Vertices;
+    std::vector<FFakeSourceVertex*> Pointers;
+
+    FFakeVertexPool(FTestRandom& Random, size_t Count)
+        : Vertices(Count), Pointers(Count)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            FFakeSourceVertex& Vertex = Vertices[i];
+            Vertex.Point = { RandomFloat(Random), RandomFloat(Random), RandomFloat(Random) };
+            Vertex.U = RandomFloat(Random);
+            Vertex.V = RandomFloat(Random);
+            Vertex.Light = { RandomFloat(Random), RandomFloat(Random), RandomFloat(Random), 1.f };
+            Vertex.Fog = { RandomFloat(Random), RandomFloat(Random), RandomFloat(Random), 0.5f };
+            Pointers[i] = &Vertex;
+        }
+        for (size_t i = Count - 1; i > 0; --i)
+            std::swap(Pointers[i], Pointers[Random.Range(0, static_cast<uint32_t>(i))]);
+    }
+
+    static float RandomFloat(FTestRandom& Random)
+    {
+        return static_cast<float>(Random.Next() % 20001) / 10000.f - 1.f;
+    }
+};